@@ -241,6 +241,16 @@ cmd.LppObj = Type.make()
 --- CppObj.Params that will be used to build an obj from the resulting cpp
 --- file.
 ---@field cpp cmd.CppObj.Params
+--- Optional directory lpp caches the results of imports in.
+---@field import_cache string?
+--- Optional directory lpp caches the bytecode of metaprograms in.
+---@field bytecode_cache string?
+--- Whether lpp should use lppclang to find the headers included by its
+--- output when generating a depfile rather than scanning for them itself.
+---@field clang_deps boolean?
+--- Whether lpp should write depfiles in its binary format, which lake reads
+--- without any parsing.
+---@field binary_deps boolean?
 
 ---@param params cmd.LppObj.Params
 ---@return cmd.LppObj
@@ -265,11 +275,25 @@ cmd.LppObj.new = function(params)
     cpaths:push(cpath)
   end
 
+  -- Used by lpp to find the headers included by its output when generating
+  -- depfiles.
+  local include_dirs = List{}
+  if params.cpp and params.cpp.include_dirs then
+    for include_dir in params.cpp.include_dirs:each() do
+      include_dirs:push("-I"..include_dir)
+    end
+  end
+
   o.partial = helpers.listBuilder(
     params.lpp,
     cargs,
     requires,
     cpaths,
+    include_dirs,
+    params.import_cache and "--import-cache="..params.import_cache,
+    params.bytecode_cache and "--bytecode-cache="..params.bytecode_cache,
+    params.clang_deps and "--clang-deps",
+    params.binary_deps and "--binary-deps",
     -- little bit of cheating, really need to fix this somehow
     "-R", "src")
 
@@ -10,6 +10,7 @@ local build =
   obj = require "build.object",
   cmds = require "build.commands",
   flair = require "build.flair",
+  objcache = require "build.objcache",
 }
 
 local driver = {}
@@ -169,6 +170,19 @@ local createBuildCmds = function(proj)
     params.lpp = sys.root.."/bin/lpp"
     params.cpp = cpp_params
 
+    if #sys.cfg.lpp.import_cache ~= 0 then
+      params.import_cache = sys.root.."/"..sys.cfg.lpp.import_cache
+      lake.mkdir(params.import_cache, {make_parents=true})
+    end
+
+    if #sys.cfg.lpp.bytecode_cache ~= 0 then
+      params.bytecode_cache = sys.root.."/"..sys.cfg.lpp.bytecode_cache
+      lake.mkdir(params.bytecode_cache, {make_parents=true})
+    end
+
+    params.clang_deps = sys.cfg.lpp.clang_deps
+    params.binary_deps = sys.cfg.lpp.binary_deps
+
     cmds[build.obj.LppObj] = build.cmds.LppObj.new(params)
   end
 
@@ -274,6 +288,13 @@ end
 driver.subcmds.build = function(args)
   loadEnabledProjects()
 
+  if #sys.cfg.obj_cache.dir ~= 0 then
+    build.objcache.init(
+      sys.root.."/"..sys.cfg.obj_cache.dir,
+      sys.cfg.obj_cache.max_size_mb * 1024 * 1024)
+    driver.finalCallbacks:push(build.objcache.finish)
+  end
+
   for proj in sys.projects.list:each() do
     lake.chdir(proj.root)
     local cmds = createBuildCmds(proj)
@@ -387,13 +408,9 @@ driver.subcmds.publish = function(args, no_write_ver)
             if not lake.pathExists(target) then
               return true
             end
-            
-            local target_modtime = lake.modtime(target)
-            for prereq in prereqs:each() do
-              if lake.modtime(prereq) > target_modtime then
-                return true
-              end
-            end
+
+
+            return lake.newestModtime(prereqs) > lake.modtime(target)
           end)
           :recipe(function()
             -- Remove any file that might already be there. This is done to 
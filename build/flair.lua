@@ -47,6 +47,15 @@ end
 
 -- * --------------------------------------------------------------------------
 
+flair.writeCachedInputToOutput = function(input, output)
+  io.write(
+    flair.green, rootRelativePath(input), flair.reset, 
+    " -> ", 
+    flair.blue, rootRelativePath(output), flair.reset, " (cached)\n")
+end
+
+-- * --------------------------------------------------------------------------
+
 flair.writeFailure = function(output)
   io.write(flair.red, "failed to build ", flair.blue, 
            rootRelativePath(output), flair.reset, "\n")
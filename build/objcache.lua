@@ -0,0 +1,270 @@
+---
+--- A cache of the outputs of commands that build objects, shared between
+--- builds, so that switching branches or rebuilding in a fresh build
+--- directory doesn't compile the same objects again.
+---
+--- Entries are found in two steps, like ccache's direct mode. First the
+--- command, the identity of the program it runs, and the content of its
+--- input are hashed into a key naming a 'manifest', which lists the files
+--- the input depended on (from the depfile written when the entry was
+--- stored). Then that key and the content of each of those files are
+--- hashed into the key of the entry itself, which is a directory holding
+--- a copy of each output. This way an entry is only used when every header
+--- (or lpp import) the input depended on is the same as well.
+---
+--- Entries and manifests are touched when used, and once the cache grows
+--- beyond its maximum size the least recently used are removed at the end
+--- of the build.
+---
+
+local List = require "List"
+local buffer = require "string.buffer"
+
+local objcache = {}
+
+--- Directory the cache is kept in, nil when the cache is disabled.
+---@type string?
+objcache.dir = nil
+
+--- Size in bytes the cache is trimmed down to at the end of a build.
+objcache.max_size = 0
+
+objcache.stats =
+{
+  hits = 0,
+  misses = 0,
+  stored = 0,
+}
+
+-- * --------------------------------------------------------------------------
+
+---@param dir string
+---@param max_size number
+objcache.init = function(dir, max_size)
+  objcache.dir = dir
+  objcache.max_size = max_size
+  lake.mkdir(dir, {make_parents = true})
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Resolved identities of programs, by the name they were invoked with.
+local identities = {}
+
+--- Gets a string that changes whenever the program 'name' does, being its
+--- path, modified time, and size.
+local getProgramIdentity = function(name)
+  local identity = identities[name]
+  if identity then
+    return identity
+  end
+
+  local path
+  if name:find "/" then
+    path = name
+  else
+    for dir in (lake.getEnvVar("PATH") or ""):gmatch "[^:]+" do
+      if lake.pathExists(dir.."/"..name) then
+        path = dir.."/"..name
+        break
+      end
+    end
+  end
+
+  if path then
+    identity =
+      path..":"..tostring(lake.modtime(path))..":"..lake.fileSize(path)
+  else
+    identity = name
+  end
+
+  identities[name] = identity
+  return identity
+end
+
+-- * --------------------------------------------------------------------------
+
+local getManifestKey = function(cmd, input)
+  local args = lake.flatten(cmd)
+  local key = buffer.new()
+  key:put(getProgramIdentity(tostring(args[1])), "\0")
+  for arg in args:each() do
+    key:put(tostring(arg), "\0")
+  end
+  return lake.hashKey(key:get(), {input})
+end
+
+-- * --------------------------------------------------------------------------
+
+local readLines = function(path)
+  local lines = List{}
+  local file = io.open(path, "r")
+  if file then
+    for line in file:lines() do
+      if line:find "%S" then
+        lines:push(line)
+      end
+    end
+    file:close()
+  end
+  return lines
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Tries to restore the outputs of 'cmd' from the cache.
+---
+--- 'outputs' is a table mapping a name for each output, eg. "obj", to the
+--- path it should be restored to. Returns true if every output was
+--- restored, in which case 'cmd' doesn't need to be run.
+---
+---@param cmd iro.List
+---@param input string
+---@param outputs table
+---@return boolean
+objcache.restore = function(cmd, input, outputs)
+  if not objcache.dir then
+    return false
+  end
+
+  local manifest_key = getManifestKey(cmd, input)
+  local manifest = objcache.dir.."/"..manifest_key..".manifest"
+
+  if not lake.pathExists(manifest) then
+    objcache.stats.misses = objcache.stats.misses + 1
+    return false
+  end
+
+  local entry =
+    objcache.dir.."/"..lake.hashKey(manifest_key, readLines(manifest))
+
+  for name in pairs(outputs) do
+    if not lake.pathExists(entry.."/"..name) then
+      objcache.stats.misses = objcache.stats.misses + 1
+      return false
+    end
+  end
+
+  for name,path in pairs(outputs) do
+    if not lake.copy(path, entry.."/"..name) then
+      objcache.stats.misses = objcache.stats.misses + 1
+      return false
+    end
+    lake.touch(entry.."/"..name)
+  end
+  lake.touch(manifest)
+
+  objcache.stats.hits = objcache.stats.hits + 1
+  return true
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Stores the outputs of 'cmd', which has just been successfully run, in
+--- the cache. 'depfile' is the depfile listing what 'input' depended on,
+--- in any format lake.readDepFile accepts. Nothing is stored if it, or any
+--- output, is missing, or if the depfile is older than the input or any
+--- file it lists, as it might not list everything the input depends on now.
+--- The depfile is written by a task of its own, which doesn't have to have
+--- run again when only a header changed.
+---
+---@param cmd iro.List
+---@param input string
+---@param depfile string
+---@param outputs table
+objcache.store = function(cmd, input, depfile, outputs)
+  if not objcache.dir or 
+     not lake.pathExists(depfile) or
+     lake.modtime(depfile) < lake.modtime(input)
+  then
+    return
+  end
+
+  for _,path in pairs(outputs) do
+    if not lake.pathExists(path) then
+      return
+    end
+  end
+
+  local deps = lake.readDepFile(depfile)
+  if lake.modtime(depfile) < lake.newestModtime(deps) then
+    return
+  end
+  local manifest_key = getManifestKey(cmd, input)
+  local entry = objcache.dir.."/"..lake.hashKey(manifest_key, deps)
+
+  lake.mkdir(entry, {make_parents = true})
+  for name,path in pairs(outputs) do
+    if not lake.copy(entry.."/"..name, path) then
+      return
+    end
+  end
+
+  local manifest =
+    io.open(objcache.dir.."/"..manifest_key..".manifest", "w")
+  if not manifest then
+    return
+  end
+  for dep in deps:each() do
+    manifest:write(dep, "\n")
+  end
+  manifest:close()
+  lake.invalidateStat(objcache.dir.."/"..manifest_key..".manifest")
+
+  objcache.stats.stored = objcache.stats.stored + 1
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Removes the least recently used entries until the cache fits in its
+--- maximum size, and reports statistics when lake is printing timers.
+--- Called at the end of a build.
+objcache.finish = function()
+  if not objcache.dir then
+    return
+  end
+
+  local items = List{}
+  local total_size = 0
+
+  for path in lake.find(objcache.dir.."/*"):each() do
+    local item = { path = path, size = 0, modtime = 0 }
+    if path:find "%.manifest$" then
+      item.size = lake.fileSize(path)
+      item.modtime = lake.modtime(path)
+    else
+      for file in lake.find(path.."/*"):each() do
+        item.size = item.size + lake.fileSize(file)
+        local modtime = lake.modtime(file)
+        if modtime > item.modtime then
+          item.modtime = modtime
+        end
+      end
+    end
+    total_size = total_size + item.size
+    items:push(item)
+  end
+
+  local evicted = 0
+  if total_size > objcache.max_size then
+    table.sort(items, function(a, b) return a.modtime < b.modtime end)
+    for item in items:each() do
+      if total_size <= objcache.max_size then
+        break
+      end
+      lake.rm(item.path, {recursive = true, force = true})
+      total_size = total_size - item.size
+      evicted = evicted + 1
+    end
+  end
+
+  if lake.isPrintingTimers() then
+    local stats = objcache.stats
+    io.write(
+      "obj cache: ", stats.hits, " hits, ", stats.misses, " misses, ",
+      stats.stored, " stored, ", evicted, " evicted, ",
+      string.format("%.1f", total_size / (1024 * 1024)), "mb in use\n")
+  end
+end
+
+return objcache
@@ -9,6 +9,7 @@ local List = require "List"
 local helpers = require "build.helpers"
 local buffer = require "string.buffer"
 local flair = require "build.flair"
+local objcache = require "build.objcache"
 
 local build =
 {
@@ -22,32 +23,39 @@ local build =
 ---
 --- * =========================================================================
 
-local tryLoadDepFile = function(dfile, obj_task)
-  local depfile = io.open(dfile, "r")
-  if depfile then
-    for file in depfile:lines() do
-	    if file:find "%S" then
-        obj_task:dependsOn(lake.task(file))
-      end
+local setFileExistanceAndModTimeCondition = function(task)
+  task:cond(function(prereqs)
+    if not lake.pathExists(task.name) then
+      return true
     end
-    depfile:close()
-  end
+
+    return lake.newestModtime(prereqs) > lake.modtime(task.name)
+  end)
 end
 
 -- * --------------------------------------------------------------------------
 
-local setFileExistanceAndModTimeCondition = function(task)
+--- Like setFileExistanceAndModTimeCondition, but decides based on the 
+--- content of the task's prerequisites and the command that builds it, 
+--- falling back to modified times when lake has no record of the task yet.
+local setContentCondition = function(task, cmd)
+  local key = buffer.new()
+  for arg in lake.flatten(cmd):each() do
+    key:put(tostring(arg), "\0")
+  end
+  task:trackContent(key:get())
+
   task:cond(function(prereqs)
     if not lake.pathExists(task.name) then
       return true
     end
 
-    local target_modtime = lake.modtime(task.name)
-    for prereq in prereqs:each() do
-      if lake.modtime(prereq) > target_modtime then
-        return true
-      end
+    local unchanged = lake.unchanged(task)
+    if unchanged ~= nil then
+      return not unchanged
     end
+
+    return lake.newestModtime(prereqs) > lake.modtime(task.name)
   end)
 end
 
@@ -94,6 +102,15 @@ local runAndReportResult = function(args, infile, outfile)
   end
 end
 
+-- * --------------------------------------------------------------------------
+
+--- Reports that 'outfile' was restored from the object cache.
+local reportCached = function(infile, outfile)
+  if sys.cfg.report_success then
+    flair.writeCachedInputToOutput(infile, outfile)
+  end
+end
+
 --- * =========================================================================
 ---
 ---   Module
@@ -237,14 +254,19 @@ CppObj.defineTask = function(self, cmd)
     :dependsOn(cpp_task, self.proj.tasks.wait_for_deps)
     :workingDirectory(self.proj.root)
 
-  tryLoadDepFile(dfile, obj_task)
+  lake.loadDepFile(obj_task, dfile)
 
-  setFileExistanceAndModTimeCondition(obj_task)
-  setFileExistanceAndModTimeCondition(dep_task)
+  setContentCondition(obj_task, cpp_cmd)
+  setContentCondition(dep_task, dep_cmd)
 
   obj_task
     :recipe(function()
+      if objcache.restore(cpp_cmd, cfile, { obj = ofile }) then
+        reportCached(cfile, ofile)
+        return
+      end
       runAndReportResult(cpp_cmd, cfile, ofile)
+      objcache.store(cpp_cmd, cfile, dfile, { obj = ofile })
     end)
 
   dep_task
@@ -398,17 +420,33 @@ LppObj.defineTask = function(self, cmd)
     :dependsOn(cpp_task)
     :workingDirectory(self.proj.root)
 
-  tryLoadDepFile(dfile, cpp_task)
+  lake.loadDepFile(cpp_task, dfile)
+  -- The headers the cpp file includes are inputs of the obj as well, 
+  -- otherwise a header changing without changing the cpp file lpp 
+  -- generates would be missed now that the cpp file is content tracked.
+  lake.loadDepFile(obj_task, dfile)
+
+  setContentCondition(cpp_task, lpp_cmd)
+  setContentCondition(obj_task, cpp_cmd)
 
-  setFileExistanceAndModTimeCondition(cpp_task)
-  setFileExistanceAndModTimeCondition(obj_task)
+  local lpp_outputs = { cpp = cfile, d = dfile, meta = mfile }
 
   cpp_task:recipe(function()
+    if objcache.restore(lpp_cmd, lfile, lpp_outputs) then
+      reportCached(lfile, cfile)
+      return
+    end
     runAndReportResult(lpp_cmd, lfile, cfile)
+    objcache.store(lpp_cmd, lfile, dfile, lpp_outputs)
   end)
 
   obj_task:recipe(function()
+    if objcache.restore(cpp_cmd, cfile, { obj = ofile }) then
+      reportCached(cfile, ofile)
+      return
+    end
     runAndReportResult(cpp_cmd, cfile, ofile)
+    objcache.store(cpp_cmd, cfile, dfile, { obj = ofile })
   end)
 end
 
@@ -118,6 +118,87 @@ Reflect.popImportedStack = function()
   imported = imported_stack:pop()
 end
 
+local ImportCache = require "ImportCache"
+
+-- Stack of the imports currently being evaluated, tracking the imports they
+-- expanded and skipped so that their results can be cached.
+local import_frames = List{}
+
+local isImported = function(full_path)
+  return imported[full_path] ~= nil
+end
+
+local noteImport = function(full_path, embedded, skipped)
+  local frame = import_frames:last()
+  if not frame then
+    return
+  end
+
+  frame.embedded[full_path] = true
+  for _,path in ipairs(embedded) do
+    frame.embedded[path] = true
+  end
+  for _,path in ipairs(skipped) do
+    if not frame.embedded[path] then
+      frame.skipped[path] = true
+    end
+  end
+end
+
+local setToList = function(set)
+  local list = List{}
+  for k in pairs(set) do
+    list:push(k)
+  end
+  return list
+end
+
+-- Either retrieves the result of importing 'full_path' from the import cache
+-- or processes it and stores the result in the cache.
+local processImport = function(full_path)
+  if not ImportCache.isEnabled() then
+    return lpp.processFile(full_path)
+  end
+
+  local key = ImportCache.getKey(full_path)
+  if key then
+    local entry = ImportCache.lookup(key, isImported)
+    if entry then
+      for _,path in ipairs(entry.embedded) do
+        imported[path] = true
+      end
+      lpp.addDependency(full_path)
+      for i=1,#entry.deps,2 do
+        lpp.addDependency(entry.deps[i])
+      end
+      noteImport(full_path, entry.embedded, entry.skipped)
+      return entry.result
+    end
+  end
+
+  local deps_start = #lpp.dependencies
+  local frame = { embedded = {}, skipped = {} }
+  import_frames:push(frame)
+
+  local result = lpp.processFile(full_path)
+
+  import_frames:pop()
+
+  local embedded = setToList(frame.embedded)
+  local skipped = setToList(frame.skipped)
+
+  if key then
+    local deps = List{}
+    for i=deps_start+1,#lpp.dependencies do
+      deps:push(lpp.dependencies[i])
+    end
+    ImportCache.store(key, result, deps, embedded, skipped)
+  end
+
+  noteImport(full_path, embedded, skipped)
+  return result
+end
+
 -- TODO(sushi) this needs to be a part of lpp itself.
 local import_list = List{}
 lpp.import = function(path)
@@ -141,13 +222,17 @@ lpp.import = function(path)
   end
 
   if imported[full_path] then
+    local frame = import_frames:last()
+    if frame and not frame.embedded[full_path] then
+      frame.skipped[full_path] = true
+    end
     return 
   end
 
   import_list:push(path)
 
   imported[full_path] = true
-  local result = lpp.processFile(full_path)
+  local result = processImport(full_path)
 
   import_list:pop()
 
@@ -185,7 +270,10 @@ lpp.stacktrace_func_filter[lpp.import] = true
 
 local tu_name = lpp.getCurrentInputSourceName()
 
-if lpp.generating_dep_file then
+-- lpp finds the headers included by the result itself unless asked to 
+-- leave it to clang, which is slower but exact, eg. when headers are 
+-- included conditionally.
+if lpp.generating_dep_file and lpp.clang_deps then
   lpp.registerFinal(function(result)
     if tu_name ~= lpp.getCurrentInputSourceName() then
       return
@@ -25,6 +25,7 @@
 #include "unistd.h"
 #include "dlfcn.h"
 #include "string.h"
+#include "stdlib.h"
 
 #include "elf.h"
 #include "link.h"
@@ -35,7 +36,6 @@
 #include "iro/containers/SmallArray.h"
 #include "iro/containers/AVL.h"
 #include "iro/Platform.h"
-#include "iro/memory/Bump.h"
 
 #include "gnu/lib-names.h"
 
@@ -46,17 +46,36 @@ static Logger logger =
   Logger::create("reloader"_str, Logger::Verbosity::Info);
 
 /* ============================================================================
- *  Helper for reading a loaded ELF file.
+ *  Helper for reading an ELF file, which is mapped read-only rather than
+ *  read in where we can, as we only ever look at its headers and symbol
+ *  tables.
+ *
+ *  Every header, section and string table the file describes is checked
+ *  against its size when it is loaded, so that a malformed or half written
+ *  file fails to load rather than being read past the end of.
  */
 struct ELF
 {
+  u8* data;
+  u64 size;
+
+  // Backs 'data' when the file was read rather than mapped.
   io::Memory buffer;
+  b8 mapped;
 
   /* --------------------------------------------------------------------------
+   *  Objects may be rewritten by a build while we look at them and an
+   *  access to a mapping of a file that was truncated underneath it faults,
+   *  so those are loaded with 'map' false to read them in instead.
    */
-  b8 init(String path, mem::Allocator* allocator)
+  b8 init(String path, b8 map = true)
   {
     DEBUG("initializing ELF from path '", path, "'\n");
+
+    data = nullptr;
+    size = 0;
+    buffer = {};
+    mapped = false;
     
     auto file = fs::File::from(path, fs::OpenFlag::Read);
     if (isnil(file))
@@ -64,14 +83,73 @@ struct ELF
     defer { file.close(); };
 
     u64 file_size = file.getInfo().byte_size;
+    if (file_size < sizeof(Elf64_Ehdr))
+      return ERROR("file is too small to be an ELF\n");
+
+    if (map)
+    {
+      void* mapping =
+        mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file.handle, 0);
+      if (mapping == MAP_FAILED)
+        return ERROR("failed to map file: ", strerror(errno), "\n");
+
+      data = (u8*)mapping;
+      size = file_size;
+      mapped = true;
+    }
+    else
+    {
+      if (!buffer.open(file_size))
+        return false;
+
+      buffer.consume(&file, file_size);
+      data = buffer.ptr;
+      size = buffer.len;
+    }
+
+    if (!validate())
+    {
+      deinit();
+      return false;
+    }
+
+    return true;
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  void deinit()
+  {
+    if (mapped)
+      munmap(data, size);
+    else
+      buffer.close();
+    data = nullptr;
+    size = 0;
+    mapped = false;
+  }
 
-    if (!buffer.open(file_size, allocator))
+  /* --------------------------------------------------------------------------
+   *  Whether the 'count' entries of 'entsize' bytes at 'offset' lie within
+   *  the file.
+   */
+  b8 fits(u64 offset, u64 count, u64 entsize) const
+  {
+    if (offset > size)
+      return false;
+    if (entsize != 0 && count > (size - offset) / entsize)
       return false;
+    return true;
+  }
 
-    if (file_size != buffer.consume(&file, file_size))
-      return ERROR("failed to completely read file\n");
+  /* --------------------------------------------------------------------------
+   */
+  b8 validate() const
+  {
+    if (size < sizeof(Elf64_Ehdr))
+      return ERROR("file is too small to be an ELF\n");
 
-    auto header = (Elf64_Ehdr*)buffer.ptr;
+    auto header = getHeader();
 
     if (header->e_ident[EI_MAG0] != 0x7f ||
         header->e_ident[EI_MAG1] != 'E'  ||
@@ -84,14 +162,48 @@ struct ELF
 
     // TODO(sushi) endianess or whatever ugh
 
-    return true;
-  }
+    if (header->e_phnum != 0 &&
+        (header->e_phentsize < sizeof(Elf64_Phdr) ||
+         !fits(header->e_phoff, header->e_phnum, header->e_phentsize)))
+      return ERROR("program headers lie outside of the file\n");
 
-  /* --------------------------------------------------------------------------
-   */
-  void deinit()
-  {
-    buffer.close();
+    if (header->e_shnum == 0)
+      return true;
+
+    if (header->e_shentsize < sizeof(Elf64_Shdr) ||
+        !fits(header->e_shoff, header->e_shnum, header->e_shentsize))
+      return ERROR("section headers lie outside of the file\n");
+
+    if (header->e_shstrndx >= header->e_shnum)
+      return ERROR("section name string table index is out of range\n");
+
+    for (u32 si = 0; si < header->e_shnum; ++si)
+    {
+      auto sec = getSectionHeader(si);
+      if (sec.isNobits())
+        continue;
+
+      if (!fits(sec->sh_offset, sec->sh_size, 1))
+        return ERROR("section ", si, " lies outside of the file\n");
+
+      if (sec.isStrtab())
+      {
+        // Strings are read up to their terminator, so the table has to end
+        // with one.
+        if (sec->sh_size != 0 && sec.getStart()[sec->sh_size - 1] != 0)
+          return ERROR("string table ", si, " is not terminated\n");
+      }
+      else if (sec.isSymtab() || sec.isDynamicSymbols())
+      {
+        if (sec->sh_entsize != 0 && sec->sh_entsize < sizeof(Elf64_Sym))
+          return ERROR("symbol table ", si, " has a bad entry size\n");
+
+        if (sec->sh_link >= header->e_shnum)
+          return ERROR("symbol table ", si, " links a bad section\n");
+      }
+    }
+
+    return true;
   }
 
   /* --------------------------------------------------------------------------
@@ -100,7 +212,7 @@ struct ELF
 
   /* --------------------------------------------------------------------------
    */
-  Elf64_Ehdr* getHeader() const { return (Elf64_Ehdr*)buffer.ptr; } 
+  Elf64_Ehdr* getHeader() const { return (Elf64_Ehdr*)data; }
   u16 getSectionHeaderCount() { return getHeader()->e_shnum; }
 
   /* ==========================================================================
@@ -126,7 +238,7 @@ struct ELF
   {
     assert(idx < getHeader()->e_phnum);
     return ProgramHeaderEntry{
-      (Elf64_Phdr*)(buffer.ptr + getHeader()->e_phoff) + idx};
+      (Elf64_Phdr*)(data + getHeader()->e_phoff) + idx};
   }
 
   struct SectionHeaderEntry;
@@ -326,12 +438,14 @@ struct ELF
     u8* getStart() 
     { 
       assert(!isNobits());
-      return elf->buffer.ptr + header->sh_offset; 
+      return elf->data + header->sh_offset;
     }
 
+    // Returns nil if 'idx' is not an offset into this string table.
     String getString(u32 idx)
     {
-      assert(isStrtab() && idx && idx < header->sh_size);
+      if (!isStrtab() || idx == 0 || idx >= header->sh_size)
+        return nil;
       return String::fromCStr((char*)(getStart() + idx));
     }
 
@@ -342,7 +456,7 @@ struct ELF
         elf,
         idx,
         (Elf64_Sym*)(
-          elf->buffer.ptr + header->sh_offset + entidx * header->sh_entsize));
+          elf->data + header->sh_offset + entidx * header->sh_entsize));
     }
   };
 
@@ -354,7 +468,7 @@ struct ELF
     return SectionHeaderEntry
     {
       this,
-      (Elf64_Shdr*)(buffer.ptr + getHeader()->e_shoff + 
+      (Elf64_Shdr*)(data + getHeader()->e_shoff +
           idx * getHeader()->e_shentsize),
       idx
     };
@@ -392,6 +506,556 @@ struct ELF
   }
 };
 
+/* ============================================================================
+ *  Index of the symbols that may be patched, which are those named by the
+ *  objects the .hrf file lists that aren't also named by libc or by the
+ *  objects and libraries it lists to be filtered.
+ *
+ *  Reading every listed object again on each reload made reloading large
+ *  executables take seconds, so the index is kept between reloads and only
+ *  the objects whose size or modification time changed are read again.
+ *  Each symbol counts how many objects name it, so that one an object no
+ *  longer names stays for as long as another still does.
+ */
+struct SymbolIndex
+{
+  /* ==========================================================================
+   */
+  struct Symbol
+  {
+    // Hash of this symbol's name.
+    u64 hash;
+
+    // The symbol's name, which is owned by the index.
+    String name;
+
+    // How many of the objects to patch name this symbol, and how many of
+    // those to filter do.
+    u32 patchable_count;
+    u32 filtered_count;
+
+    // The last object that was read and named this symbol, so that
+    // symbols an object names more than once are only counted once.
+    u64 last_read;
+
+    b8 isPatchable() const
+    {
+      return patchable_count != 0 && filtered_count == 0;
+    }
+  };
+
+  typedef AVL<Symbol, [](const Symbol* sym) { return sym->hash; }> SymbolMap;
+
+  typedef Pool<Symbol> SymbolPool;
+
+  /* ==========================================================================
+   */
+  struct Object
+  {
+    // The object's path, which is owned by the index.
+    String path;
+    u64 path_hash;
+
+    TimePoint modtime;
+    u64 size;
+
+    // If this object's symbols are filtered rather than patched.
+    b8 filter;
+
+    // If this object was listed the last time the index was updated.
+    b8 listed;
+
+    // Every symbol this object names.
+    Array<Symbol*> symbols;
+  };
+
+  SymbolMap  symbol_map;
+  SymbolPool symbol_pool;
+
+  Array<Object> objects;
+
+  u64 read_count;
+
+  // How many objects were read by the last update.
+  u32 objects_read;
+
+  /* --------------------------------------------------------------------------
+   */
+  b8 init()
+  {
+    if (!symbol_map.init())
+      return false;
+    if (!symbol_pool.init())
+      return false;
+    if (!objects.init())
+      return false;
+    read_count = 0;
+    objects_read = 0;
+    return true;
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  void deinit()
+  {
+    for (Object& object : objects)
+    {
+      object.symbols.destroy();
+      mem::stl_allocator.free(object.path.ptr);
+    }
+    objects.destroy();
+    for (Symbol& sym : symbol_map)
+      mem::stl_allocator.free(sym.name.ptr);
+    symbol_map.deinit();
+    symbol_pool.deinit();
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  b8 isPatchable(String name) const
+  {
+    if (isnil(name))
+      return false;
+    Symbol* sym = symbol_map.find(name.hash());
+    return sym != nullptr && sym->isPatchable();
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Uncounts 'symbols' and destroys the array. Symbols no object names
+   *  anymore are kept until the index is deinitialized, as they're likely
+   *  to be named again by the next build of the object.
+   */
+  void releaseSymbols(Array<Symbol*>& symbols, b8 filter)
+  {
+    for (Symbol* sym : symbols)
+    {
+      if (filter)
+        sym->filtered_count -= 1;
+      else
+        sym->patchable_count -= 1;
+    }
+    symbols.destroy();
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  void releaseObject(Object& object)
+  {
+    releaseSymbols(object.symbols, object.filter);
+    mem::stl_allocator.free(object.path.ptr);
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Counts every named symbol in the ELF at 'path' towards 'object'.
+   */
+  b8 readObject(Object& object, String path)
+  {
+    ELF elf;
+    if (!elf.init(path, false))
+      return ERROR("failed to initialize ELF for '", path, "'\n");
+    defer { elf.deinit(); };
+
+    read_count += 1;
+    objects_read += 1;
+
+    for (u32 secidx = 0; secidx < elf->e_shnum; ++secidx)
+    {
+      auto sec = elf.getSectionHeader(secidx);
+      if (!sec.isSymtab() && !sec.isDynamicSymbols())
+        continue;
+
+      for (u32 i = 0; i < sec.entCount(); ++i)
+      {
+        String name = sec.getEntry(i).getName();
+        if (isnil(name))
+          continue;
+
+        u64 hash = name.hash();
+        Symbol* sym = symbol_map.find(hash);
+        if (sym == nullptr)
+        {
+          sym = symbol_pool.add();
+          sym->hash = hash;
+          sym->name = name.allocateCopy();
+          sym->patchable_count = 0;
+          sym->filtered_count = 0;
+          sym->last_read = 0;
+          symbol_map.insert(sym);
+        }
+        else if (sym->last_read == read_count)
+        {
+          continue;
+        }
+
+        sym->last_read = read_count;
+        if (object.filter)
+          sym->filtered_count += 1;
+        else
+          sym->patchable_count += 1;
+        object.symbols.push(sym);
+      }
+    }
+
+    return true;
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Marks the object at 'path' as listed, reading it if it is new or has
+   *  changed since it was last read.
+   */
+  b8 updateObject(String path, b8 filter)
+  {
+    fs::FileInfo info = fs::FileInfo::of(path);
+    if (isnil(info))
+      return ERROR("failed to stat '", path, "'\n");
+
+    TimePoint modtime = info.last_modified_time;
+    u64 path_hash = path.hash();
+
+    Object* object = nullptr;
+    for (Object& existing : objects)
+    {
+      if (existing.path_hash == path_hash && existing.filter == filter)
+      {
+        object = &existing;
+        break;
+      }
+    }
+
+    if (object != nullptr)
+    {
+      object->listed = true;
+      if (object->modtime == modtime && object->size == info.byte_size)
+        return true;
+
+      // Counting the new symbols before releasing the old ones keeps those
+      // that are still named from being freed and added again.
+      Array<Symbol*> old_symbols = object->symbols;
+      object->symbols = Array<Symbol*>::create(old_symbols.len());
+      if (!readObject(*object, path))
+      {
+        // Likely still being written, so keep what it named before and
+        // leave its modtime alone so that it's read again next time.
+        releaseSymbols(object->symbols, filter);
+        object->symbols = old_symbols;
+        return false;
+      }
+      releaseSymbols(old_symbols, filter);
+    }
+    else
+    {
+      object = objects.push();
+      object->path = path.allocateCopy();
+      object->path_hash = path_hash;
+      object->filter = filter;
+      object->listed = true;
+      object->symbols = Array<Symbol*>::create();
+      if (!readObject(*object, path))
+      {
+        releaseObject(*object);
+        objects.remove(objects.len() - 1);
+        return false;
+      }
+    }
+
+    object->modtime = modtime;
+    object->size = info.byte_size;
+    return true;
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Returns the path of the library named 'name' by asking the dynamic
+   *  linker to open it.
+   */
+  String findLibrary(const char* name)
+  {
+    void* handle = dlopen(name, RTLD_LAZY);
+    if (handle == nullptr)
+      return nil;
+
+    struct link_map* lm;
+    dlinfo(handle, RTLD_DI_LINKMAP, &lm);
+
+    if (lm->l_name == nullptr || lm->l_name[0] == '\0')
+      return nil;
+
+    return String::fromCStr(lm->l_name);
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Brings the index up to date with the .hrf file at 'hrfpath', which is
+   *  a newline delimited list of
+   *
+   *    +o<path>  an object whose symbols should be patched
+   *    -o<path>  an object whose symbols should be filtered
+   *    -l<lib>   a library whose symbols should be filtered, either by
+   *              name or by absolute path
+   *
+   *  libc's symbols are always filtered.
+   */
+  b8 update(String hrfpath)
+  {
+    objects_read = 0;
+
+    for (Object& object : objects)
+      object.listed = false;
+
+    // Find the correct path to libc via a gcc thing. This is probably
+    // NOT portable!
+    String libc = findLibrary(LIBC_SO);
+    if (isnil(libc) || !updateObject(libc, true))
+      return ERROR("failed to collect filtered symbols from libc\n");
+
+    auto hrf_file = fs::File::from(hrfpath, fs::OpenFlag::Read);
+    if (isnil(hrf_file))
+      return ERROR("failed to open hrfs at path '", hrfpath, "'\n");
+    defer { hrf_file.close(); };
+
+    u64 hrfs_size = hrf_file.getInfo().byte_size;
+
+    io::Memory hrfs;
+    if (!hrfs.open(hrfs_size))
+      return ERROR("failed to open buffer for reading hrfs\n");
+    defer { hrfs.close(); };
+
+    if (hrfs_size != hrfs.consume(&hrf_file, hrfs_size))
+      return ERROR("failed to read entire hrfs file\n");
+
+    String scan = hrfs.asStr();
+    for (;;)
+    {
+      u8* nl_or_eof = scan.ptr;
+      while (!matchAny(*nl_or_eof, '\n', 0))
+        nl_or_eof += 1;
+
+      // Paths are null-terminated in place for the calls taking them.
+      u8 terminator = *nl_or_eof;
+      *nl_or_eof = 0;
+
+      String filter = String::from(scan.ptr, nl_or_eof);
+      if (filter.startsWith("+o"_str))
+      {
+        String path = filter.sub(2);
+        if (!updateObject(path, false))
+          return ERROR("failed to collect symbols for file '", path, "'\n");
+      }
+      else if (filter.startsWith("-o"_str))
+      {
+        String path = filter.sub(2);
+        if (!updateObject(path, true))
+          return ERROR("failed to collect filtered symbols from file '",
+                       path, "'\n");
+      }
+      else if (filter.startsWith("-l"_str))
+      {
+        String lib = filter.sub(2);
+        if (lib.startsWith('/'))
+        {
+          // Must be an absolute path.
+          if (!updateObject(lib, false))
+            return ERROR("failed to collect symbols for file '", lib, "\n");
+        }
+        else
+        {
+          // Must be the name of the library.
+          io::StaticBuffer<512> libname;
+          io::formatv(&libname, "lib", lib, ".so");
+
+          String path = findLibrary((char*)libname.asStr().ptr);
+          if (isnil(path))
+            return ERROR("failed to get path to library '", lib, "'\n");
+
+          if (!updateObject(path, true))
+            return ERROR("failed to collect symbols for file '", lib, "'\n");
+        }
+      }
+
+      if (terminator == 0)
+        break;
+      scan = String::from(nl_or_eof + 1, scan.end());
+    }
+
+    // Forget objects that are no longer listed.
+    for (s32 i = objects.len() - 1; i >= 0; --i)
+    {
+      if (!objects[i].listed)
+      {
+        releaseObject(objects[i]);
+        objects.remove(i);
+      }
+    }
+
+    return true;
+  }
+};
+
+/* ============================================================================
+ *  Jumps to write over the start of functions, which are collected first
+ *  and then written together.
+ *
+ *  Making a page writable is a syscall, and writing each jump on its own
+ *  meant one per function, so instead the jumps are sorted by address and
+ *  the pages they touch are coalesced into contiguous ranges, each of which
+ *  is made writable, written, and made read-only and executable again with
+ *  one mprotect either side. The pages stay executable while they're
+ *  written, as other threads, or this code if it's linked into the
+ *  executable being patched, may be running in them.
+ */
+struct CodeWriter
+{
+  struct Jump
+  {
+    u8* from;
+    u8* to;
+  };
+
+  // mov r11, imm64; jmp r11
+  static constexpr u64 jump_size = 13;
+
+  Array<Jump> jumps;
+
+  // How many mprotect calls the last write made.
+  u64 mprotect_calls;
+
+  /* --------------------------------------------------------------------------
+   */
+  b8 init()
+  {
+    mprotect_calls = 0;
+    return jumps.init();
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  void deinit()
+  {
+    jumps.destroy();
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  void addJump(void* from, void* to)
+  {
+    Jump* jump = jumps.push();
+    jump->from = (u8*)from;
+    jump->to = (u8*)to;
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  static int compareJumps(const void* a, const void* b)
+  {
+    u8* x = ((Jump*)a)->from;
+    u8* y = ((Jump*)b)->from;
+    return x < y? -1 : x > y? 1 : 0;
+  }
+
+  /* --------------------------------------------------------------------------
+   */
+  static void writeJump(const Jump& jump)
+  {
+    u8* bytes = jump.from;
+    u64 offset = 0;
+    auto writeByte = [&](u8 b)
+    {
+      bytes[offset] = b;
+      offset += 1;
+    };
+
+    // mov r11, <to>
+    writeByte(0x40 | (1 << 3) | (1 << 0)); // REX.WB prefix
+    writeByte(0xbb); // opcode
+    // imm64 of <to>
+    writeByte((u64(jump.to) >>  0) & 0xff);
+    writeByte((u64(jump.to) >>  8) & 0xff);
+    writeByte((u64(jump.to) >> 16) & 0xff);
+    writeByte((u64(jump.to) >> 24) & 0xff);
+    writeByte((u64(jump.to) >> 32) & 0xff);
+    writeByte((u64(jump.to) >> 40) & 0xff);
+    writeByte((u64(jump.to) >> 48) & 0xff);
+    writeByte((u64(jump.to) >> 56) & 0xff);
+
+    // jmp r11
+    writeByte(0x40 | (1 << 0)); // REX.B prefix
+    writeByte(0xff); // opcode?
+    writeByte(0xe3); // idk.
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Writes the jumps to the pages in [first, last) and makes them read-only
+   *  and executable again.
+   */
+  b8 writeRange(u8* start, u8* end, Jump* first, Jump* last)
+  {
+    if (mprotect(start, end - start, PROT_EXEC | PROT_READ | PROT_WRITE))
+      return ERROR("failed to make ", (void*)start, " to ", (void*)end,
+                   " writable: ", strerror(errno), "\n");
+    mprotect_calls += 1;
+
+    for (Jump* jump = first; jump != last; ++jump)
+      writeJump(*jump);
+
+    if (mprotect(start, end - start, PROT_EXEC | PROT_READ))
+      return ERROR("failed to restore protection of ", (void*)start, " to ",
+                   (void*)end, ": ", strerror(errno), "\n");
+    mprotect_calls += 1;
+
+    // Nothing to do on x86, but other architectures don't keep the
+    // instruction cache coherent with writes to code.
+    __builtin___clear_cache(
+      (char*)first->from,
+      (char*)(last - 1)->from + jump_size);
+
+    return true;
+  }
+
+  /* --------------------------------------------------------------------------
+   *  Writes every jump that was added and forgets them.
+   */
+  b8 write()
+  {
+    mprotect_calls = 0;
+    defer { jumps.clear(); };
+
+    if (jumps.isEmpty())
+      return true;
+
+    qsort(jumps.arr, jumps.len(), sizeof(Jump), compareJumps);
+
+    u64 page_size = getpagesize();
+    auto pageOf = [page_size](u8* addr)
+    {
+      return (u8*)((u64)addr & -page_size);
+    };
+
+    Jump* first = jumps.arr;
+    u8* start = pageOf(first->from);
+    u8* end = pageOf(first->from + jump_size - 1) + page_size;
+
+    for (Jump* jump = first + 1; jump != jumps.arr + jumps.len(); ++jump)
+    {
+      u8* jump_start = pageOf(jump->from);
+      u8* jump_end = pageOf(jump->from + jump_size - 1) + page_size;
+
+      if (jump_start <= end)
+      {
+        if (jump_end > end)
+          end = jump_end;
+        continue;
+      }
+
+      if (!writeRange(start, end, first, jump))
+        return false;
+
+      first = jump;
+      start = jump_start;
+      end = jump_end;
+    }
+
+    return writeRange(start, end, first, jumps.arr + jumps.len());
+  }
+};
+
 /* ============================================================================
  */
 struct Reloader
@@ -404,8 +1068,9 @@ struct Reloader
 
   Array<void*> reloaded_funcs;
 
-  // Cleared at the end of a reload.
-  mem::LenientBump talloc;
+  SymbolIndex symbol_index;
+
+  CodeWriter code_writer;
 
   /* ==========================================================================
    */
@@ -432,6 +1097,11 @@ struct Reloader
       
       // The address of this symbol in memory.
       Elf64_Addr addr;
+
+      // The next function defined by the same name, as functions with
+      // internal linkage in different translation units may share one.
+      // These are kept in the order the ELF lists them.
+      FunctionSymbol* next;
     };
 
     typedef 
@@ -443,6 +1113,31 @@ struct Reloader
     FunctionSymbolMap function_map;
     FunctionSymbolPool function_pool;
 
+    /* ========================================================================
+     */
+    struct ObjectSymbol
+    {
+      // Hash of this object symbol's name.
+      u64 hash;
+
+      // The symbol's name.
+      String name;
+
+      // The address of this symbol in memory and its size.
+      Elf64_Addr addr;
+      u64 size;
+    };
+
+    typedef
+      AVL<ObjectSymbol, [](const ObjectSymbol* sym) { return sym->hash; }>
+      ObjectSymbolMap;
+
+    typedef Pool<ObjectSymbol> ObjectSymbolPool;
+
+    // Only the objects whose state may be copied between patches.
+    ObjectSymbolMap object_map;
+    ObjectSymbolPool object_pool;
+
     /* ------------------------------------------------------------------------
      */
     b8 isValid() const 
@@ -453,10 +1148,10 @@ struct Reloader
 
     /* ------------------------------------------------------------------------
      */
-    b8 init(mem::Allocator* allocator, String path)
+    b8 init(String path)
     {
       DEBUG("initializing patch for '", path, "'\n");
-      if (!elf.init(path, allocator))
+      if (!elf.init(path))
         return ERROR("failed to initialize patch ELF\n");
 
       dlerror();
@@ -473,14 +1168,14 @@ struct Reloader
 
       assert(isValid());
     
-      collectFunctionSymbols();
+      collectSymbols();
      
       return true;
     }
 
     /* ------------------------------------------------------------------------
      */
-    b8 initBase(mem::Allocator* allocator, void* dhandle, String exepath)
+    b8 initBase(void* dhandle, String exepath)
     {
       DEBUG("initializing patch for dl handle '", dhandle, "'\n");
 
@@ -491,56 +1186,121 @@ struct Reloader
 
       start_addr = (void*)lm->l_addr;
 
-      if (!elf.init(exepath, allocator))
+      if (!elf.init(exepath))
         return ERROR("failed to initialize patch ELF\n");
 
-      collectFunctionSymbols();
+      collectSymbols();
 
       return true;
     }
 
     /* ------------------------------------------------------------------------
+     *  Maps the names of the functions this patch defines and of the objects
+     *  whose state may be copied to where they are in the ELF.
      */
-    void collectFunctionSymbols()
+    void collectSymbols()
     {
       function_map.init();
       function_pool.init();
+      object_map.init();
+      object_pool.init();
 
       for (s32 i = 0; i < elf.getSectionHeaderCount(); ++i)
       {
         auto sec = elf.getSectionHeader(i);
-        if (!sec.isSymtab())
+        if (!sec.isSymtab() && !sec.isDynamicSymbols())
           continue;
 
         for (s32 sym_idx = 0; sym_idx < sec.entCount(); ++sym_idx)
         {
           auto ent = sec.getEntry(sym_idx);
-          if (!ent.isFunc() || !ent.isDefined())
+          if (!ent.isDefined())
             continue;
 
-          void* addr = (u8*)start_addr + ent->st_value;
-
           String name = ent.getName();
-        
-          if (name.startsWith("_GLOBAL__sub_I_"_str) ||
-              name.startsWith("__cxx_global_var_init"_str) ||
-              name.endsWith(".ro"_str))
+          if (isnil(name))
             continue;
 
+          u64 hash = name.hash();
 
-          if (notnil(name))
+          if (ent.isFunc() && sec.isSymtab())
           {
+            if (name.startsWith("_GLOBAL__sub_I_"_str) ||
+                name.startsWith("__cxx_global_var_init"_str) ||
+                name.endsWith(".ro"_str))
+              continue;
+
             FunctionSymbol* fsym = function_pool.add();
             fsym->name = name;
-            fsym->hash = name.hash();
+            fsym->hash = hash;
             fsym->addr = ent->st_value;
+            fsym->next = nullptr;
+
+            FunctionSymbol* first = function_map.find(hash);
+            if (first == nullptr)
+            {
+              function_map.insert(fsym);
+            }
+            else
+            {
+              FunctionSymbol* last = first;
+              while (last->next != nullptr)
+                last = last->next;
+              last->next = fsym;
+            }
+          }
+          else if (ent.isObject())
+          {
+            if (!isCopyableObject(ent) || object_map.find(hash) != nullptr)
+              continue;
 
-            function_map.insert(fsym);
+            ObjectSymbol* osym = object_pool.add();
+            osym->name = name;
+            osym->hash = hash;
+            osym->addr = ent->st_value;
+            osym->size = ent->st_size;
+
+            object_map.insert(osym);
           }
         }
       }
     }
 
+    /* ------------------------------------------------------------------------
+     *  Whether the object 'ent' is somewhere we can copy state to and from.
+     */
+    b8 isCopyableObject(ELF::Symbol ent)
+    {
+      if (ent.isAbsolute())
+      {
+        TRACE("cannot patch because this entry is absolute\n");
+        return false;
+      }
+
+      String name = ent.getName();
+      if (name.startsWith(".L"_str))
+      {
+        TRACE("cannot patch because this is a string literal\n");
+        return false;
+      }
+
+      if (ent->st_shndx >= elf->e_shnum)
+      {
+        TRACE("cannot patch because this is not in a known section\n");
+        return false;
+      }
+
+      // Make sure this isn't in a readonly section.
+      String sec_name = elf.getSectionHeader(ent->st_shndx).getName();
+      if (sec_name == ".rodata"_str || sec_name.endsWith(".ro"_str))
+      {
+        TRACE("cannot patch because this is in a read-only section\n");
+        return false;
+      }
+
+      return true;
+    }
+
     /* ------------------------------------------------------------------------
      */
     void deinit()
@@ -549,6 +1309,8 @@ struct Reloader
       dlclose(dhandle);
       function_map.deinit();
       function_pool.deinit();
+      object_map.deinit();
+      object_pool.deinit();
       start_addr = dhandle = nullptr;
     }
 
@@ -561,128 +1323,77 @@ struct Reloader
       rhs->start_addr = start_addr;
       function_map.move(rhs->function_map);
       function_pool.move(rhs->function_pool);
+      object_map.move(rhs->object_map);
+      object_pool.move(rhs->object_pool);
       elf = {};
       start_addr = dhandle = nullptr;
     }
 
     /* ------------------------------------------------------------------------
-     *  Iterate the symbols in this patch's ELF and redirect any functions 
-     *  with a matching function in 'to's ELF if they are specified to be 
-     *  reloaded and if they aren't filtered.
-     *
-     *  TODO(sushi) can just filter out the symbols from reloaded symbols to 
-     *              avoid using two maps here.
+     *  Iterate the patchable symbols in 'index' and add jumps to 'writer'
+     *  redirecting the functions this patch defines by those names to the
+     *  matching functions in 'to'.
      */
     b8 redirectFunctionsTo(
-        const Patch& to, 
-        const StringSet& patchable_symbols,
+        const Patch& to,
+        SymbolIndex& index,
+        CodeWriter& writer,
         Array<void*>& explicit_funcs)
     {
       assert(isValid() && to.isValid());
 
-      u64 remappings_written = 0;
-
-      for (u32 seci = 0; seci < elf.getSectionHeaderCount(); ++seci)
+      for (SymbolIndex::Symbol& sym : index.symbol_map)
       {
-        auto sec = elf.getSectionHeader(seci);
-        if (!sec.isSymtab())
+        if (!sym.isPatchable())
           continue;
 
-        for (u32 i = 0; i < sec.entCount(); ++i)
-        {
-          auto from_ent = sec.getEntry(i);
-          if (!from_ent.isFunc() || !from_ent.isDefined())
-            continue;
+        FunctionSymbol* from_func = function_map.find(sym.hash);
+        if (from_func == nullptr)
+          continue;
 
-          void* from_addr = (u8*)start_addr + from_ent->st_value;
-
-          // b8 found = false;
-          // for (void*& explicit_func : explicit_funcs)
-          // {
-          //   if (from_addr == explicit_func)
-          //   {
-          //     found = true;
-          //     break;
-          //   }
-          // }
-          //
-          // if (!found)
-          //   continue;
-
-          String from_name = from_ent.getName();
-          if (isnil(from_name))
-            // Can't match to any other symbol nor filter.
-            continue;
+        FunctionSymbol* to_func = to.function_map.find(sym.hash);
+        if (to_func == nullptr)
+          continue;
 
-          // Filter out global initializer functions.
-          if (from_name.startsWith("_GLOBAL__sub_I_"_str) || // static globals
-              from_name.startsWith("__cxx_global_var_init"_str))
-            continue;
+        u32 from_count = 0;
+        for (FunctionSymbol* f = from_func; f != nullptr; f = f->next)
+          from_count += 1;
 
-          if (from_name.endsWith(".ro"_str))
-            continue;
+        u32 to_count = 0;
+        for (FunctionSymbol* f = to_func; f != nullptr; f = f->next)
+          to_count += 1;
 
-          if (!patchable_symbols.has(from_name))
-            continue;
+        // Functions sharing a name are matched up by the order they appear
+        // in, which follows the order their objects were linked in. If
+        // either side has a different number of them we can't tell which
+        // is which.
+        if (from_count != to_count)
+        {
+          WARN("not patching ", sym.name, " as it names ", from_count,
+               " functions here but ", to_count, " in the patch\n");
+          continue;
+        }
 
-          // Lookup the symbol in the patch we are redirecting functions to.
-          // TODO(sushi) generating this function map has cut down the time 
-          //             it takes to look up symbols a LOT but we could prob
-          //             do even better if we set up the generation of this 
-          //             map to only store the symbols we are interested in
-          //             redirecting from as well so that we can eliminate
-          //             searching the ELF like we do here as well. I really 
-          //             need to clean up a lot more of hreload so I'm going to
-          //             save that for a later time.
-          FunctionSymbol* to_func = to.function_map.find(from_name.hash());
-          if (to_func == nullptr)
-            continue;
+        for (; from_func != nullptr;
+             from_func = from_func->next, to_func = to_func->next)
+        {
+          String from_name = from_func->name;
 
+          void* from_addr = (u8*)start_addr + from_func->addr;
           void* to_addr = (u8*)to.start_addr + to_func->addr;
 
           DEBUG("patching ", from_name, ": \n",
                "  ", from_addr, " => ", to_addr, "\n");
-          // from_ent.print();
-          // to_ent.print();
-
-          void* check = dlsym(to.dhandle, (char*)from_name.ptr);
-          if (check && check != to_addr)
-            platform::debugBreak();
-
-          void* aligned = (void*)((u64)from_addr & -getpagesize());
-          if (mprotect(
-                aligned, 
-                getpagesize(), 
-                PROT_EXEC | PROT_READ | PROT_WRITE))
-            return ERROR("failed to mprotect ", aligned, " when patching "
-                         "function '", from_name, "': ", 
-                         strerror(errno), "\n");
-
-          u8* bytes = (u8*)from_addr;
-          u64 offset = 0;
-          auto writeByte = [&](u8 b)
+
+          // dlsym only finds one of them when the name is shared.
+          if (from_count == 1)
           {
-            bytes[offset] = b;
-            offset += 1;
-          };
-
-          // mov r11, <from_addr>
-          writeByte(0x40 | (1 << 3) | (1 << 0)); // REX.WB prefix
-          writeByte(0xbb); // opcode
-          // imm64 of <from_addr>
-          writeByte((u64(to_addr) >>  0) & 0xff);
-          writeByte((u64(to_addr) >>  8) & 0xff);
-          writeByte((u64(to_addr) >> 16) & 0xff);
-          writeByte((u64(to_addr) >> 24) & 0xff);
-          writeByte((u64(to_addr) >> 32) & 0xff);
-          writeByte((u64(to_addr) >> 40) & 0xff);
-          writeByte((u64(to_addr) >> 48) & 0xff);
-          writeByte((u64(to_addr) >> 56) & 0xff);
-
-          // jmp r11
-          writeByte(0x40 | (1 << 0)); // REX.B prefix
-          writeByte(0xff); // opcode?
-          writeByte(0xe3); // idk.
+            void* check = dlsym(to.dhandle, (char*)from_name.ptr);
+            if (check && check != to_addr)
+              platform::debugBreak();
+          }
+
+          writer.addJump(from_addr, to_addr);
         }
       }
 
@@ -690,103 +1401,49 @@ struct Reloader
     }
 
     /* ------------------------------------------------------------------------
-     *  Iterate the symbols in this patch and copy the state of globals 
-     *  to the new patch's globals. I really don't think is a proper way to 
-     *  handle this and will likely break!
+     *  Iterate the patchable symbols in 'index' and copy the state of the
+     *  globals this patch defines to 'to's globals. I really don't think is
+     *  a proper way to handle this and will likely break!
      */
-    b8 copyGlobalState(const Patch& to, const StringSet& patchable_symbols)
+    b8 copyGlobalState(const Patch& to, SymbolIndex& index)
     {
       assert(isValid() && to.isValid());
 
-      u64 remappings_written = 0;
-
-      for (u32 seci = 0; seci < elf.getSectionHeaderCount(); ++seci)
+      for (SymbolIndex::Symbol& sym : index.symbol_map)
       {
-        auto sec = elf.getSectionHeader(seci);
-        if (!sec.isSymtab() && !sec.isDynamicSymbols())
+        if (!sym.isPatchable())
           continue;
 
-        for (u32 i = 0; i < sec.entCount(); ++i)
-        {
-          auto from_ent = sec.getEntry(i);
-          TRACE("ent: ", from_ent.getName(), "\n");
-          if (!from_ent.isObject())
-          {
-            TRACE("cannot patch because this entry is not an object\n");
-            continue;
-          }
-
-          if (from_ent.isAbsolute())
-          {
-            TRACE("cannot patch because this entry is absolute\n");
-            continue;
-          }
-
-          // Make sure this isn't in a readonly section.
-          String ent_sec = elf.getSectionHeader(from_ent->st_shndx).getName();
-
-          if (ent_sec == ".rodata"_str)
-          {
-            TRACE(
-              "cannot patch because this entry is in a readonly section\n");
-            continue;
-          }
-
-          String from_name = from_ent.getName();
-          if (isnil(from_name))
-          {
-            TRACE("cannot patch because this entry does not have a name\n");
-            continue;
-          }
-
-          if (from_name.startsWith(".L"_str))
-          {
-            TRACE("cannot patch because this is a string literal\n");
-            continue;
-          }
-
-          String sec_name = elf.getSectionHeader(from_ent->st_shndx).getName();
-          if (sec_name.endsWith(".ro"_str))
-          {
-            TRACE("cannot patch because this is in a read-only section\n");
-            continue;
-          }
-
-          if (!patchable_symbols.has(from_name))
-          {
-            TRACE("cannot patch ", from_name, " because it was filtered\n");
-            continue;
-          }
+        ObjectSymbol* from_obj = object_map.find(sym.hash);
+        if (from_obj == nullptr)
+          continue;
 
-          auto to_ent = to.elf.findSymbol(from_name);
-          if (!to_ent.isValid())
-          {
-            TRACE("cannot patch ", from_name, " because it could not be "
-                  "found in target patch\n");
-            continue;
-          }
+        ObjectSymbol* to_obj = to.object_map.find(sym.hash);
+        if (to_obj == nullptr)
+        {
+          TRACE("cannot patch ", sym.name, " because it could not be "
+                "found in target patch\n");
+          continue;
+        }
 
-          void* from_addr = (u8*)start_addr + from_ent->st_value;
-          void* to_addr = (u8*)to.start_addr + to_ent->st_value;
+        void* from_addr = (u8*)start_addr + from_obj->addr;
+        void* to_addr = (u8*)to.start_addr + to_obj->addr;
 
-          DEBUG("copyGlobalState: ", from_addr, " -> ", to_addr, " ", 
-               from_name, "\n",
-               "  sec: ", 
-                elf.getSectionHeader(from_ent->st_shndx).getName(), "\n");
+        DEBUG("copyGlobalState: ", from_addr, " -> ", to_addr, " ",
+             sym.name, "\n");
 
-          void* aligned = (void*)((u64)to_addr & -getpagesize());
-          u64 size = ((u8*)to_addr - (u8*)aligned) + to_ent->st_size;
+        void* aligned = (void*)((u64)to_addr & -getpagesize());
+        u64 size = ((u8*)to_addr - (u8*)aligned) + to_obj->size;
 
-          if (mprotect(
-                aligned, 
-                size, 
-                PROT_EXEC | PROT_READ | PROT_WRITE))
-            return ERROR("failed to mprotect ", aligned, " while patching '",
-                         from_name, "': ",
-                         strerror(errno), "\n");
+        if (mprotect(
+              aligned,
+              size,
+              PROT_EXEC | PROT_READ | PROT_WRITE))
+          return ERROR("failed to mprotect ", aligned, " while patching '",
+                       sym.name, "': ",
+                       strerror(errno), "\n");
 
-          mem::copy(to_addr, from_addr, from_ent->st_size);
-        }
+        mem::copy(to_addr, from_addr, from_obj->size);
       }
 
       return true;
@@ -812,6 +1469,12 @@ struct Reloader
     for (void* x : explicit_funcs)
       reloaded_funcs.push(x);
 
+    if (!symbol_index.init())
+      return ERROR("failed to initialize symbol index\n");
+
+    if (!code_writer.init())
+      return ERROR("failed to initialize code writer\n");
+
     return true;
   }
 
@@ -819,192 +1482,13 @@ struct Reloader
    */
   void deinit()
   {
-    talloc.deinit();
+    symbol_index.deinit();
+    code_writer.deinit();
     patch.base.deinit();
     patch.prev.deinit();
     patch.curr.deinit();
   }
 
-  /* --------------------------------------------------------------------------
-   */
-  b8 collectSyms(
-      const ELF& elf, 
-      StringSet* set,
-      const StringSet* filtered)
-  {
-    for (u32 secidx = 0; secidx < elf->e_shnum; ++secidx)
-    {
-      auto sec = elf.getSectionHeader(secidx);
-      switch (sec.getType())
-      {
-      using SHType = ELF::SectionHeaderEntry::Type;
-      case SHType::DynamicSymbols:
-      case SHType::Symtab:
-        for (u32 i = 0; i < sec.entCount(); ++i)
-        {
-          auto ent = sec.getEntry(i);
-          String name = ent.getName();
-          if (notnil(name) && (!filtered || !filtered->has(name)))
-            set->add(name);
-        }
-        break;
-      }
-    }
-
-    return true;
-  }
-
-  /* --------------------------------------------------------------------------
-   *  It is expected that the ELF allocated here is cleaned up elsewhere. We
-   *  don't clean it up here because that would invalidate the string data
-   *  we need to read later, eg. in the case of collecting symbols for 
-   *  filtering.
-   */
-  b8 collectSyms(
-      mem::Allocator* allocator, 
-      StringSet* set, 
-      const StringSet* filtered,
-      String path)
-  {
-    ELF elf;
-    if (!elf.init(path, allocator))
-      return ERROR("failed to initialize ELF for '", path, "'\n");
-
-    return collectSyms(elf, set, filtered);
-  }
-
-  /* --------------------------------------------------------------------------
-   *  Collect symbols we know we never want to filter, eg. libc and such.
-   */
-  b8 collectDefaultFilteredSymbols(
-      mem::Allocator* allocator, 
-      StringSet* filtered)
-  {
-    // libc
-    {
-      // Find the correct path to libc via a gcc thing. This is probably 
-      // NOT portable!
-      void* libc = dlopen(LIBC_SO, RTLD_LAZY);
-
-      struct link_map* lm;
-      dlinfo(libc, RTLD_DI_LINKMAP, &lm);
-
-      if (!collectSyms(
-            allocator, 
-            filtered, 
-            nullptr,
-            String::fromCStr(lm->l_name)))
-        return ERROR("failed to collect filtered symbols from libc\n");
-    }
-
-    return true;
-  }
-
-  /* --------------------------------------------------------------------------
-   *  Collect symbols from 'path' to filter, unless if they already exist in 
-   *  the patchable symbols set.
-   */
-  b8 collectFilteredSymbols(
-      mem::Allocator* allocator, 
-      String path,
-      const StringSet& patchable,
-      StringSet* filtered)
-  {
-    return 
-      collectSyms(
-        allocator,
-        filtered,
-        &patchable,
-        path);
-  }
-
-  /* --------------------------------------------------------------------------
-   */
-  b8 collectPatchableSymbols(
-      mem::Allocator* allocator,
-      StringSet* patchable,
-      StringSet* filtered,
-      String hrfpath)
-  {
-    auto hrf_file = fs::File::from(hrfpath, fs::OpenFlag::Read);
-    if (isnil(hrf_file))
-      return ERROR("failed to open hrfs at path '", hrfpath, "'\n");
-    defer { hrf_file.close(); };
-
-    u64 hrfs_size = hrf_file.getInfo().byte_size;
-
-    io::Memory hrfs;
-    if (!hrfs.open(hrfs_size))
-      return ERROR("failed to open buffer for reading hrfs\n");
-    defer { hrfs.close(); };
-
-    if (hrfs_size != hrfs.consume(&hrf_file, hrfs_size))
-      return ERROR("failed to read entire hrfs file\n");
-
-    String scan = hrfs.asStr();
-    for (;;)
-    {
-      u8* nl_or_eof = scan.ptr;
-      while (!matchAny(*nl_or_eof, '\n', 0))
-        nl_or_eof += 1;
-      String filter = String::from(scan.ptr, nl_or_eof);
-      if (!filter.isEmpty())
-      {
-        if (filter.startsWith("+o"_str))
-        {
-          String path = filter.sub(2);
-          if (!collectSyms(allocator, patchable, filtered, path))
-            return ERROR("failed to collect symbols for file '", path, "'\n");
-        }
-        else if (filter.startsWith("-o"_str))
-        {
-          String path = filter.sub(2);
-          if (!collectFilteredSymbols(allocator, path, *patchable, filtered))
-            return ERROR("failed to collect filtered symbols from file '", 
-                         path, "'\n");
-        }
-        else if (filter.startsWith("-l"_str))
-        {
-          String lib = filter.sub(2);
-          if (lib.startsWith('/'))
-          {
-            // Must be an absolute path.
-            if (!collectSyms(allocator, patchable, filtered, lib))
-              return ERROR("failed to collect symbols for file '", lib, "\n");
-          }
-          else
-          {
-            // Must be the name of the library, so try to find it by asking 
-            // the dynamic linker to open it and give us its path.
-
-            io::StaticBuffer<512> libname;
-            io::formatv(&libname, "lib", lib, ".so");
-
-            void* lib_handle = dlopen((char*)libname.asStr().ptr, RTLD_LAZY);
-
-            struct link_map* lm;
-            dlinfo(lib_handle, RTLD_DI_LINKMAP, &lm);
-
-            if (lm->l_name == nullptr || lm->l_name[0] == '\0')
-              return ERROR("failed to get path to library '", lib, "'\n");
-
-            if (!collectFilteredSymbols(
-                  allocator,
-                  String::fromCStr(lm->l_name),
-                  *patchable,
-                  filtered)) 
-              return ERROR("failed to collect symbols for file '", lib, "'\n");
-          }
-        }
-      }
-      if (*nl_or_eof == 0)
-        break;
-      scan = String::from(nl_or_eof + 1, scan.end());
-    }
-
-    return true;
-  }
-
   /* --------------------------------------------------------------------------
    */
   b8 reloadSymbolsFromObjFile(
@@ -1018,19 +1502,11 @@ struct Reloader
 
     INFO("reloading ", exepath, " using ", hrfpath, "\n");
 
-    if (!talloc.init())
-      return ERROR("failed to init temp allocator\n");
-
-    defer { talloc.deinit(); };
-
     // Handle swapping prev and curr patch.
 
     // TODO(sushi) do in init
     if (!patch.base.isValid())
-      if (!patch.base.initBase(
-            &mem::stl_allocator,
-            context.reloadee_handle, 
-            exepath))
+      if (!patch.base.initBase(context.reloadee_handle, exepath))
         return ERROR("failed to initialize base patch\n");
 
     if (patch.prev.isValid())
@@ -1056,37 +1532,18 @@ struct Reloader
 
     INFO("loading current patch from ", patch_path_buf.asStr(), "\n");
 
-    if (!patch.curr.init(
-          &mem::stl_allocator,
-          patch_path_buf.asStr()))
+    if (!patch.curr.init(patch_path_buf.asStr()))
       return ERROR("failed to create Patch for '", patch_path_buf.asStr(), 
                    "'\n");
 
-    // Form a list of filtered symbols.
-    StringSet filtered_symbols;
-    if (!filtered_symbols.init())
-      return ERROR("failed to init filtered symbols string set\n");
-    defer { filtered_symbols.deinit(); };
-
-    if (!collectDefaultFilteredSymbols(&talloc, &filtered_symbols))
-      return ERROR("failed to collect filtered symbols\n");
+    TimePoint loaded_time = TimePoint::monotonic();
 
-    // Form a list of symbols we want to patch.
-    StringSet patchable_symbols;
-    if (!patchable_symbols.init())
-      return ERROR("failed to init patchable symbols string set\n");
-    defer { patchable_symbols.deinit(); };
+    INFO("updating patchable symbols\n");
 
-    INFO("collecting patchable symbols\n");
-
-    if (!collectPatchableSymbols(
-          &talloc, 
-          &patchable_symbols, 
-          &filtered_symbols,
-          hrfpath))
+    if (!symbol_index.update(hrfpath))
       return ERROR("failed to collect patchable symbols\n");
 
-    u64 remappings_written = 0;
+    TimePoint indexed_time = TimePoint::monotonic();
 
     Patch* prev_patch = nullptr;
     if (patch.prev.isValid())
@@ -1096,22 +1553,46 @@ struct Reloader
 
     INFO("copying global state\n");
 
-    if (!prev_patch->copyGlobalState(patch.curr, patchable_symbols))
+    if (!prev_patch->copyGlobalState(patch.curr, symbol_index))
         return ERROR("failed to copy global state from prev to curr patch\n");
 
+    TimePoint copied_time = TimePoint::monotonic();
+
     INFO("redirecting functions\n");
 
     if (!patch.base.redirectFunctionsTo(
-          patch.curr, 
-          patchable_symbols,
+          patch.curr,
+          symbol_index,
+          code_writer,
           reloaded_funcs))
       return ERROR("failed to redirect function from base to curr patch\n");
 
-    result->remappings_written = remappings_written;
+    TimePoint redirected_time = TimePoint::monotonic();
+
+    u64 jump_count = code_writer.jumps.len();
+
+    if (!code_writer.write())
+      return ERROR("failed to write redirections to base\n");
+
+    TimePoint end_time = TimePoint::monotonic();
 
-    auto time_taken = TimePoint::monotonic() - start_time;
+    result->remappings_written = jump_count;
+    result->mprotect_calls = code_writer.mprotect_calls;
+    result->patch_time = end_time - redirected_time;
 
-    INFO("done! (finished in ", WithUnits(time_taken), ")\n");
+    INFO("done! (finished in ", WithUnits(end_time - start_time), ")\n");
+    INFO("  loading patch:       ", WithUnits(loaded_time - start_time),
+         "\n");
+    INFO("  indexing symbols:    ", WithUnits(indexed_time - loaded_time),
+         " (read ", symbol_index.objects_read, " of ",
+         symbol_index.objects.len(), " objects)\n");
+    INFO("  copying globals:     ", WithUnits(copied_time - indexed_time),
+         "\n");
+    INFO("  redirecting funcs:   ", WithUnits(redirected_time - copied_time),
+         "\n");
+    INFO("  writing redirects:   ", WithUnits(result->patch_time), " (",
+         jump_count, " functions, ", result->mprotect_calls,
+         " mprotect calls)\n");
 
     return true;
   }
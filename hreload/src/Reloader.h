@@ -13,6 +13,7 @@
 #include "iro/Common.h"
 #include "iro/Unicode.h"
 #include "iro/containers/Slice.h"
+#include "iro/time/Time.h"
 
 using namespace iro;
 
@@ -82,8 +83,15 @@ struct ReloadContext
 
 struct ReloadResult
 {
+  // How many functions were redirected.
   u64 remappings_written;
 
+  // How long writing the redirections took and how many mprotect calls
+  // it made, which is one to make each contiguous range of patched pages
+  // writable and one to make it executable again.
+  TimeSpan patch_time;
+  u64 mprotect_calls;
+
   void* this_patch;
   void* prev_patch;
 };
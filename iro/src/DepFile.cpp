@@ -0,0 +1,229 @@
+#include "DepFile.h"
+
+#include "memory/Memory.h"
+
+namespace iro::depfile
+{
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 isSpace(u8 c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* ----------------------------------------------------------------------------
+ *  Make rules are told apart from a list of paths by the first line having
+ *  a ':' followed by whitespace, which rules out Windows drive letters.
+ */
+Format detect(Bytes content)
+{
+  if (content.len >= sizeof(BinaryHeader) &&
+      mem::equal(content.ptr, (void*)binary_magic, sizeof(binary_magic)))
+    return Format::Binary;
+
+  for (u64 i = 0; i < content.len; ++i)
+  {
+    u8 c = content.ptr[i];
+    if (c == '\n')
+      break;
+
+    if (c == ':' && (i + 1 == content.len || isSpace(content.ptr[i + 1])))
+      return Format::Make;
+  }
+
+  return Format::Lines;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 parseBinary(Bytes content, Array<String>* paths)
+{
+  BinaryHeader header;
+  mem::copy(&header, content.ptr, sizeof(header));
+  if (header.version != binary_version)
+    return false;
+
+  u64 offset = sizeof(header);
+  for (u32 i = 0; i < header.path_count; ++i)
+  {
+    u32 len;
+    if (offset + sizeof(len) > content.len)
+      return false;
+    mem::copy(&len, content.ptr + offset, sizeof(len));
+    offset += sizeof(len);
+
+    if (offset + len > content.len)
+      return false;
+    paths->push({content.ptr + offset, len});
+    offset += len;
+  }
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 parseLines(Bytes content, Array<String>* paths)
+{
+  u64 offset = 0;
+  while (offset < content.len)
+  {
+    u64 start = offset;
+    while (offset < content.len && content.ptr[offset] != '\n')
+      offset += 1;
+    u64 end = offset;
+    offset += 1;
+
+    while (start < end && isSpace(content.ptr[start]))
+      start += 1;
+    while (end > start && isSpace(content.ptr[end - 1]))
+      end -= 1;
+
+    if (start != end)
+      paths->push({content.ptr + start, end - start});
+  }
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Each path is unescaped into the space it was read from, which it can
+ *  only shrink within.
+ */
+static b8 parseMake(Bytes content, Array<String>* paths)
+{
+  u8* s = content.ptr;
+  u64 len = content.len;
+  u64 offset = 0;
+
+  // Whether we are past the ':' of the current rule.
+  b8 in_prereqs = false;
+
+  while (offset < len)
+  {
+    u8 c = s[offset];
+
+    // Continuations are just whitespace.
+    if (c == '\\' && offset + 1 < len && s[offset + 1] == '\n')
+    {
+      offset += 2;
+      continue;
+    }
+    if (c == '\\' &&
+        offset + 2 < len &&
+        s[offset + 1] == '\r' &&
+        s[offset + 2] == '\n')
+    {
+      offset += 3;
+      continue;
+    }
+
+    if (c == '\n')
+    {
+      in_prereqs = false;
+      offset += 1;
+      continue;
+    }
+
+    if (isSpace(c))
+    {
+      offset += 1;
+      continue;
+    }
+
+    // Read a path, ending at unescaped whitespace.
+    u8* path = s + offset;
+    u64 path_len = 0;
+    while (offset < len)
+    {
+      c = s[offset];
+      if (isSpace(c))
+        break;
+
+      if (c == '\\' && offset + 1 < len &&
+          (s[offset + 1] == ' ' || s[offset + 1] == '#'))
+      {
+        path[path_len++] = s[offset + 1];
+        offset += 2;
+        continue;
+      }
+
+      // Only a line continuation ends the path. A lone '\r' after the
+      // backslash is just part of it.
+      if (c == '\\' && offset + 1 < len &&
+          (s[offset + 1] == '\n' ||
+           (s[offset + 1] == '\r' &&
+            offset + 2 < len &&
+            s[offset + 2] == '\n')))
+        break;
+
+      if (c == '$' && offset + 1 < len && s[offset + 1] == '$')
+      {
+        path[path_len++] = '$';
+        offset += 2;
+        continue;
+      }
+
+      path[path_len++] = c;
+      offset += 1;
+    }
+
+    if (path_len == 0)
+    {
+      offset += 1;
+      continue;
+    }
+
+    if (!in_prereqs)
+    {
+      // Targets run up to a ':' that either ends a path or stands alone.
+      if (path[path_len - 1] == ':')
+        in_prereqs = true;
+      continue;
+    }
+
+    paths->push({path, path_len});
+  }
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 parse(Bytes content, Array<String>* paths)
+{
+  switch (detect(content))
+  {
+  case Format::Binary: return parseBinary(content, paths);
+  case Format::Make:   return parseMake(content, paths);
+  case Format::Lines:  return parseLines(content, paths);
+  }
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 writeBinary(io::IO* out, Slice<String> paths)
+{
+  BinaryHeader header;
+  mem::copy(header.magic, (void*)binary_magic, sizeof(binary_magic));
+  header.version = binary_version;
+  header.path_count = paths.len;
+
+  if (out->write({(u8*)&header, sizeof(header)}) != sizeof(header))
+    return false;
+
+  for (String path : paths)
+  {
+    u32 len = path.len;
+    if (out->write({(u8*)&len, sizeof(len)}) != sizeof(len))
+      return false;
+    if (out->write({path.ptr, path.len}) != path.len)
+      return false;
+  }
+
+  return true;
+}
+
+}
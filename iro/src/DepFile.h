@@ -0,0 +1,63 @@
+/*
+ *  Reading and writing dep files, which list the files something was built
+ *  from so that it may be rebuilt when any of them change.
+ *
+ *  Three formats are understood:
+ *
+ *    Make rules, as written by compilers given -MD or -MMD. Everything up
+ *    to the ':' of each rule names its targets and is skipped. Paths are
+ *    separated by whitespace, '\ ' escapes a space, '\#' a '#', and '$$' a
+ *    '$'. A backslash at the end of a line continues the rule onto the
+ *    next one.
+ *
+ *    One path per line, as lpp writes by default and the dep tasks of the
+ *    build system do.
+ *
+ *    A binary format, being a BinaryHeader followed by each path as its
+ *    u32 length and then its bytes, which needs no parsing and can hold
+ *    any path. Lpp writes this when given --binary-deps.
+ */
+
+#ifndef _iro_DepFile_h
+#define _iro_DepFile_h
+
+#include "Common.h"
+#include "Unicode.h"
+#include "containers/Array.h"
+#include "containers/Slice.h"
+#include "io/IO.h"
+
+namespace iro::depfile
+{
+
+enum class Format
+{
+  Make,
+  Lines,
+  Binary,
+};
+
+/* ============================================================================
+ */
+struct BinaryHeader
+{
+  u8  magic[4];
+  u32 version;
+  u32 path_count;
+};
+
+static const u8  binary_magic[4] = { 'l', 'k', 'd', 'p' };
+static const u32 binary_version = 1;
+
+Format detect(Bytes content);
+
+// Parses the paths listed in 'content', pushing each onto 'paths'. The
+// paths are views into 'content', which is modified in place as escapes
+// are removed. Returns false if 'content' is malformed.
+b8 parse(Bytes content, Array<String>* paths);
+
+b8 writeBinary(io::IO* out, Slice<String> paths);
+
+}
+
+#endif // _iro_DepFile_h
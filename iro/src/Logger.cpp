@@ -7,6 +7,8 @@ namespace iro
 
   Log log;
 
+  thread_local u64 Log::indentation = 0;
+
   /* --------------------------------------------------------------------------
    */
   b8 Log::init()
@@ -15,6 +17,9 @@ namespace iro
     if (notnil(destinations))
       return true;
 
+    if (!mutex.init())
+      return false;
+
     destinations = Array<Dest>::create(4);
     return true;
   }
@@ -24,6 +29,7 @@ namespace iro
   void Log::deinit()
   {
     destinations.destroy();
+    mutex.deinit();
   }
 
   /* --------------------------------------------------------------------------
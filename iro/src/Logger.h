@@ -17,6 +17,7 @@
 #define _iro_logger_h
 
 #include "Common.h"
+#include "Mutex.h"
 #include "Unicode.h"
 #include "containers/Array.h"
 #include "io/IO.h"
@@ -89,11 +90,17 @@ struct Log
     io::IO* io;
   };
 
-  u64 indentation;
+  // Kept per thread so that threads indenting their own output don't
+  // indent each other's.
+  static thread_local u64 indentation;
   u64 max_name_len;
 
   Array<Dest> destinations;
 
+  // Held while a message is written so that messages logged from different
+  // threads don't interleave.
+  Mutex mutex;
+
   b8   init();
   void deinit();
 
@@ -304,6 +311,8 @@ struct Logger
     if (isnil(iro::log.destinations))
       return;
 
+    ScopedMutexLock lock(iro::log.mutex);
+
     if (nofmt)
     {
       for (Log::Dest& destination : iro::log.destinations)
@@ -3,6 +3,7 @@
 #include "Common.h"
 #include "Logger.h"
 #include "Mutex.h"
+#include "memory/Allocator.h"
 
 #include <cstring>
 #include "errno.h"
@@ -19,9 +20,15 @@ static iro::Logger logger =
  */
 b8 Mutex::init()
 {
-  int err = pthread_mutex_init((pthread_mutex_t*)&this->handle, nullptr);
+  // A pthread_mutex_t doesn't fit in 'handle', so it lives on the heap.
+  auto* mutex = mem::stl_allocator.allocateType<pthread_mutex_t>();
+  int err = pthread_mutex_init(mutex, nullptr);
   if (err != 0)
+  {
+    mem::stl_allocator.free(mutex);
     return ERROR("Failed to initialize mutex: ", strerror(err), "\n");
+  }
+  this->handle = mutex;
   return true;
 }
 
@@ -31,7 +38,8 @@ void Mutex::deinit()
 {
   if (nullptr != this->handle)
   {
-    pthread_mutex_destroy((pthread_mutex_t*)&this->handle);
+    pthread_mutex_destroy((pthread_mutex_t*)this->handle);
+    mem::stl_allocator.free(this->handle);
     this->handle = nullptr;
   }
 }
@@ -40,7 +48,7 @@ void Mutex::deinit()
  */
 void Mutex::lock()
 {
-  if (0 != pthread_mutex_lock((pthread_mutex_t*)&this->handle))
+  if (0 != pthread_mutex_lock((pthread_mutex_t*)this->handle))
     ERROR("Failed to lock mutex: ", strerror(errno), "\n");
 }
 
@@ -55,16 +63,16 @@ b8 Mutex::tryLock(u32 timeout_ms)
     ts.tv_nsec += timeout_ms * 1000000;
     ts.tv_sec += ts.tv_nsec / 1000000000;
     ts.tv_nsec %= 1000000000;
-    return 0 == pthread_mutex_timedlock((pthread_mutex_t*)&this->handle, &ts);
+    return 0 == pthread_mutex_timedlock((pthread_mutex_t*)this->handle, &ts);
   }
-  return 0 == pthread_mutex_trylock((pthread_mutex_t*)&this->handle);
+  return 0 == pthread_mutex_trylock((pthread_mutex_t*)this->handle);
 }
 
 /* ----------------------------------------------------------------------------
  */
 void Mutex::unlock()
 {
-  if (0 != pthread_mutex_unlock((pthread_mutex_t*)&this->handle))
+  if (0 != pthread_mutex_unlock((pthread_mutex_t*)this->handle))
     ERROR("Failed to unlock mutex: ", strerror(errno), "\n");
 }
 
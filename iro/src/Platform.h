@@ -17,6 +17,7 @@
 #include "containers/Slice.h"
 
 #include "fs/FileSystem.h"
+#include "fs/Watcher.h"
 #include "Process.h"
 
 namespace iro::platform
@@ -92,6 +93,18 @@ b8 isatty(fs::File::Handle handle);
  */
 b8 setNonBlocking(fs::File::Handle handle);
 
+/* ----------------------------------------------------------------------------
+ *  Makes 'handle' refer to whatever 'to' refers to, and returns a new handle
+ *  to what 'handle' referred to before in 'out_original', which is not
+ *  inherited by processes spawned afterwards. Used to keep whatever else
+ *  writes to a standard stream, eg. lua's print, out of output that a
+ *  client parses.
+ */
+b8 redirectHandle(
+    fs::File::Handle handle,
+    fs::File::Handle to,
+    fs::File::Handle* out_original);
+
 /* ============================================================================
  *  Data returned by clock functions.
  */
@@ -136,6 +149,17 @@ b8 closedir(fs::Dir::Handle handle);
  */
 s64 readdir(fs::Dir::Handle handle, Bytes buffer);
 
+/* ----------------------------------------------------------------------------
+ *  Reads every entry of the directory at 'path' other than '.' and '..', in
+ *  as few calls into the system as possible, and calls 'callback' with the
+ *  name and kind of each. The kind is FileKind::Unknown when the system 
+ *  can't tell without a stat, and 'name' is only valid during the call.
+ *
+ *  'path' must be null terminated.
+ */
+typedef void (*ListDirCallback)(void* data, String name, fs::FileKind kind);
+b8 listDir(String path, ListDirCallback callback, void* data);
+
 /* ----------------------------------------------------------------------------
  *  Returns if the stdin pipe has data ready to read.
  */
@@ -229,6 +253,13 @@ u64 processWrite(Process::Handle h_process, Bytes buffer);
  */
 b8 processHasExited(Process::Handle h_process, s32* out_exit_code);
 
+/* ----------------------------------------------------------------------------
+ *  Returns the most memory, in bytes, a Process had resident at once, which 
+ *  is only known once processHasExited has seen it exit. Returns 0 if it 
+ *  isn't known.
+ */
+u64 processPeakMemory(Process::Handle h_process);
+
 /* ----------------------------------------------------------------------------
  *  Cleans up handles held by a process. After this call, the given handle is
  *  no longer valid. If the process given is still running when this is called
@@ -236,6 +267,69 @@ b8 processHasExited(Process::Handle h_process, s32* out_exit_code);
  */
 b8 processClose(Process::Handle h_process);
 
+/* ----------------------------------------------------------------------------
+ *  Creates a ProcessWaiter, returning false if this is not supported. 
+ *  See Process.h.
+ */
+b8 processWaiterCreate(ProcessWaiter::Handle* out_handle);
+
+/* ----------------------------------------------------------------------------
+ *  Destroys a ProcessWaiter. Processes still in it are not affected.
+ */
+void processWaiterDestroy(ProcessWaiter::Handle h_waiter);
+
+/* ----------------------------------------------------------------------------
+ *  Adds a process to a ProcessWaiter, which reports 'userdata' when the 
+ *  process has output or exits.
+ */
+b8 processWaiterAdd(
+    ProcessWaiter::Handle h_waiter, 
+    Process::Handle       h_process,
+    void*                 userdata);
+
+/* ----------------------------------------------------------------------------
+ *  Removes a process from a ProcessWaiter. This must be done before the 
+ *  process is closed.
+ */
+void processWaiterRemove(
+    ProcessWaiter::Handle h_waiter, 
+    Process::Handle       h_process);
+
+/* ----------------------------------------------------------------------------
+ *  Blocks until a process in the ProcessWaiter is ready or 'timeout' passes.
+ *  See ProcessWaiter::wait.
+ */
+s32 processWaiterWait(
+    ProcessWaiter::Handle h_waiter, 
+    Slice<void*>          out_ready,
+    TimeSpan              timeout);
+
+/* ----------------------------------------------------------------------------
+ *  Creates a Watcher, returning false if this is not supported. 
+ *  See fs/Watcher.h.
+ */
+b8 watcherCreate(fs::Watcher::Handle* out_handle);
+
+/* ----------------------------------------------------------------------------
+ *  Destroys a Watcher.
+ */
+void watcherDestroy(fs::Watcher::Handle h_watcher);
+
+/* ----------------------------------------------------------------------------
+ *  Watches the directory at 'path', which must be null-terminated, 
+ *  reporting 'userdata' with changes to the files in it.
+ */
+b8 watcherAdd(fs::Watcher::Handle h_watcher, String path, void* userdata);
+
+/* ----------------------------------------------------------------------------
+ *  Blocks until something watched by a Watcher changes or 'timeout' passes.
+ *  See Watcher::wait.
+ */
+s32 watcherWait(
+    fs::Watcher::Handle      h_watcher,
+    Slice<fs::Watcher::Event> out_events,
+    TimeSpan                 timeout);
+
 /* ----------------------------------------------------------------------------
  *  Converts the given path, that must exist, to a canonical path, that is with
  *  segments /./ and /../ evaluated and links followed.
@@ -335,6 +429,35 @@ void debugBreak();
  */
 u64 getPid();
 
+/* ----------------------------------------------------------------------------
+ *  Retrieves information about the executable file the running process was
+ *  started from.
+ */
+b8 getExecutableInfo(fs::FileInfo* out_info);
+
+/* ----------------------------------------------------------------------------
+ *  Returns the number of processors currently available to this process.
+ */
+u32 getProcessorCount();
+
+/* ----------------------------------------------------------------------------
+ *  Gets the total memory of the system and how much of it could be given to
+ *  new processes without swapping, in bytes.
+ */
+b8 getMemoryInfo(u64* out_total, u64* out_available);
+
+/* ----------------------------------------------------------------------------
+ *  Gets the average number of processes running or waiting to run over the
+ *  last minute.
+ */
+b8 getLoadAverage(f64* out_load);
+
+/* ----------------------------------------------------------------------------
+ *  Gets the percentage of the last 10 seconds in which some process was 
+ *  stalled waiting on memory. Fails when the system doesn't track this.
+ */
+b8 getMemoryPressure(f32* out_percent);
+
 /* ----------------------------------------------------------------------------
  *  TODO(sushi) put these somewhere better later.
  */
@@ -374,6 +497,17 @@ void decommitMemory(void* ptr, u64 size);
  */
 void releaseMemory(void* ptr, u64 size);
 
+/* ----------------------------------------------------------------------------
+ *  Maps the first 'size' bytes of the given file into memory read-only. The
+ *  mapping remains valid after the file is closed. Returns nullptr on 
+ *  failure.
+ */
+void* mapFile(fs::File::Handle handle, u64 size);
+
+/* ----------------------------------------------------------------------------
+ */
+void unmapFile(void* ptr, u64 size);
+
 } // namespace iro::platform
 
 #endif
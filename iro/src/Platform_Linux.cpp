@@ -6,6 +6,7 @@
 #include "Unicode.h"
 #include "containers/StackArray.h"
 #include "containers/Pool.h"
+#include "containers/Array.h"
 
 #include "pty.h"
 #include "utmp.h"
@@ -21,14 +22,17 @@
 #include "sys/uio.h"
 #include "sys/stat.h"
 #include "sys/wait.h"
+#include "sys/resource.h"
 #include "sys/ptrace.h"
 #include "sys/sendfile.h"
 #include "sys/mman.h"
+#include "sys/epoll.h"
+#include "sys/inotify.h"
+#include "sys/syscall.h"
+#include "spawn.h"
 
 #include "stdio.h"
 
-#include "valgrind/callgrind.h"
-
 #include "ctime"
 
 namespace iro::platform
@@ -200,6 +204,28 @@ b8 setNonBlocking(fs::File::Handle handle)
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+b8 redirectHandle(
+    fs::File::Handle handle,
+    fs::File::Handle to,
+    fs::File::Handle* out_original)
+{
+  int original = fcntl((s64)handle, F_DUPFD_CLOEXEC, 0);
+  if (original == -1)
+    return reportErrno("failed to duplicate file with handle ", handle);
+
+  if (-1 == dup2((s64)to, (s64)handle))
+  {
+    ::close(original);
+    return reportErrno(
+        "failed to redirect file with handle ", handle, " to ", to);
+  }
+
+  *out_original = original;
+  return true;
+}
+
 /* ----------------------------------------------------------------------------
  */
 Timespec clock_realtime()
@@ -291,6 +317,68 @@ s64 readdir(fs::Dir::Handle handle, Bytes buffer)
   return len;
 }
 
+/* ----------------------------------------------------------------------------
+ *  What getdents64 fills its buffer with, which glibc only declares for
+ *  _GNU_SOURCE on newer versions.
+ */
+struct LinuxDirent64
+{
+  u64 d_ino;
+  s64 d_off;
+  u16 d_reclen;
+  u8  d_type;
+  char d_name[];
+};
+
+/* ----------------------------------------------------------------------------
+ */
+b8 listDir(String path, ListDirCallback callback, void* data)
+{
+  assert(path.ptr && callback);
+
+  int fd = ::open((char*)path.ptr, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return reportErrno("failed to open dir at path '", path, "'");
+  defer { ::close(fd); };
+
+  // Big enough for most directories to be read in a single call.
+  alignas(LinuxDirent64) u8 buffer[32768];
+
+  for (;;)
+  {
+    s64 len = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+    if (len == -1)
+      return reportErrno("failed to read dir at path '", path, "'");
+    if (len == 0)
+      return true;
+
+    for (s64 offset = 0; offset < len;)
+    {
+      auto* de = (LinuxDirent64*)(buffer + offset);
+      offset += de->d_reclen;
+
+      String name = String::fromCStr(de->d_name);
+      if (name == "."_str || name == ".."_str)
+        continue;
+
+      fs::FileKind kind;
+      switch (de->d_type)
+      {
+      case DT_REG: kind = fs::FileKind::Regular; break;
+      case DT_DIR: kind = fs::FileKind::Directory; break;
+      case DT_LNK: kind = fs::FileKind::SymLink; break;
+      case DT_BLK: kind = fs::FileKind::Block; break;
+      case DT_CHR: kind = fs::FileKind::Character; break;
+      case DT_FIFO: kind = fs::FileKind::FIFO; break;
+      case DT_SOCK: kind = fs::FileKind::Socket; break;
+      default: kind = fs::FileKind::Unknown; break;
+      }
+
+      callback(data, name, kind);
+    }
+  }
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 stdinHasData()
@@ -509,6 +597,16 @@ struct ProcessLinux
   int stdin;
   int stdout;
   int stderr;
+
+  // Opened when the process is added to a ProcessWaiter, -1 otherwise.
+  int pidfd;
+
+  // What the ProcessWaiter this process is in reports when it's ready.
+  void* waiter_userdata;
+
+  // The peak resident set size of the process in bytes, taken when it's 
+  // reaped.
+  u64 peak_memory;
 };
 
 using ProcessPool = StaticPool<ProcessLinux>;
@@ -516,6 +614,25 @@ static ProcessPool g_process_pool;
 
 /* ----------------------------------------------------------------------------
  */
+static b8 setNonBlockingFd(int fd)
+{
+  int oldflags = fcntl(fd, F_GETFL, 0);
+  return -1 != fcntl(fd, F_SETFL, oldflags | O_NONBLOCK);
+}
+
+/* ----------------------------------------------------------------------------
+ *  Processes are spawned through posix_spawn rather than fork, as glibc 
+ *  implements it with clone(CLONE_VM | CLONE_VFORK) which, unlike fork,
+ *  doesn't copy our page tables. That copy gets slower the more memory we
+ *  have mapped, which adds up when lake is holding a large task graph and 
+ *  spawning thousands of jobs.
+ *
+ *  Every pipe is opened with O_CLOEXEC so that the ends we keep aren't
+ *  inherited by other children, which would hold the pipes open after the
+ *  process they belong to exits. The ends given to the child lose the flag
+ *  when they're dup'd onto its standard streams. Only our ends are made 
+ *  non-blocking, as the flag would be shared with the child's.
+ */
 b8 processSpawn(
     Process::Handle* out_handle,
     String file,
@@ -526,10 +643,6 @@ b8 processSpawn(
 {
   assert(out_handle);
 
-  ProcessLinux* p_proc = g_process_pool.add();
-  if (p_proc == nullptr)
-    return ERROR("failed to allocate a ProcessLinux\n");
-
   // TODO(sushi) replace this with some container thats a stack buffer
   //             up to a point then dynamically allocates
   Array<char*> argsc = Array<char*>::create(args.len);
@@ -542,91 +655,107 @@ b8 processSpawn(
 
   defer { argsc.destroy(); };
 
-  int stdin_pipes[2];
-  int stdout_pipes[2];
-  int stderr_pipes[2];
+  int stdin_pipes[2] = { -1, -1 };
+  int stdout_pipes[2] = { -1, -1 };
+  int stderr_pipes[2] = { -1, -1 };
 
-  if (-1 == pipe(stdout_pipes))
-    return reportErrno("failed to open pipes for process ", file);
+  // Our ends are only kept once the process has been spawned.
+  b8 spawned = false;
+  defer
+  {
+    int child_ends[] = { stdin_pipes[0], stdout_pipes[1], stderr_pipes[1] };
+    for (int fd : child_ends)
+    {
+      if (fd != -1)
+        ::close(fd);
+    }
 
-  if (-1 == pipe(stdin_pipes))
+    if (!spawned)
+    {
+      int our_ends[] = { stdin_pipes[1], stdout_pipes[0], stderr_pipes[0] };
+      for (int fd : our_ends)
+      {
+        if (fd != -1)
+          ::close(fd);
+      }
+    }
+  };
+
+  if (-1 == pipe2(stdout_pipes, O_CLOEXEC) ||
+      -1 == pipe2(stdin_pipes, O_CLOEXEC) ||
+      (!redirect_err_to_out && -1 == pipe2(stderr_pipes, O_CLOEXEC)))
     return reportErrno("failed to open pipes for process ", file);
 
-  if (!redirect_err_to_out)
+  posix_spawn_file_actions_t actions;
+  if (int err = posix_spawn_file_actions_init(&actions))
   {
-    if (-1 == pipe(stderr_pipes))
-      return reportErrno("failed to open pipes for process ", file);
+    errno = err;
+    return reportErrno("failed to spawn process ", file);
   }
+  defer { posix_spawn_file_actions_destroy(&actions); };
 
-  if (pid_t pid = fork())
+  // this miiight cause problems if the string were given is destroyed
+  // before we reach this point somehow but hopefully that is very
+  // unlikely
+  if (notnil(cwd))
   {
-    // parent branch
-
-    if (pid == -1)
-      return reportErrno("failed to fork process");
-
-    ::close(stdout_pipes[1]);
-    if (!redirect_err_to_out)
-      ::close(stderr_pipes[1]);
-    ::close(stdin_pipes[0]);
-
-    if (non_blocking)
+    if (int err =
+          posix_spawn_file_actions_addchdir_np(&actions, (char*)cwd.ptr))
     {
-      int oldflags = fcntl(stdout_pipes[0], F_GETFL, 0);
-      if (-1 == fcntl(
-            stdout_pipes[0],
-            F_SETFL,
-            oldflags | O_NONBLOCK))
-        return reportErrno("failed to set child pipe as non-blocking");
-
-      oldflags = fcntl(stdin_pipes[1], F_GETFL, 0);
-      if (-1 == fcntl(
-            stdin_pipes[1],
-            F_SETFL,
-            oldflags | O_NONBLOCK))
-        return reportErrno("failed to set child pipe as non-blocking");
+      errno = err;
+      return reportErrno("failed to set working directory '", cwd,
+                         "' for process ", file);
     }
-
-    p_proc->pid = pid;
-    p_proc->stderr = redirect_err_to_out? stdout_pipes[0] : stderr_pipes[0];
-    p_proc->stdout = stdout_pipes[0];
-    p_proc->stdin = stdin_pipes[1];
-    *out_handle = p_proc;
   }
-  else
-  {
-    // child branch
 
-    CALLGRIND_ZERO_STATS;
+  int stderr_fd = redirect_err_to_out? stdout_pipes[1] : stderr_pipes[1];
+  int err = posix_spawn_file_actions_adddup2(&actions, stdin_pipes[0], 0);
+  if (!err)
+    err = posix_spawn_file_actions_adddup2(&actions, stdout_pipes[1], 1);
+  if (!err)
+    err = posix_spawn_file_actions_adddup2(&actions, stderr_fd, 2);
+  if (err)
+  {
+    errno = err;
+    return reportErrno("failed to redirect pipes for process ", file);
+  }
 
-    if (notnil(cwd))
-    {
-      // this miiight cause problems if the string were given is destroyed
-      // before we reach this point somehow but hopefully that is very
-      // unlikely
-      chdir(cwd);
-    }
+  pid_t pid;
+  if ((err = posix_spawnp(
+        &pid, argsc.arr[0], &actions, nullptr, argsc.arr, environ)))
+  {
+    errno = err;
+    return reportErrno("failed to spawn process ", file);
+  }
 
-    ::close(stdout_pipes[0]);
-    dup2(stdout_pipes[1], 1);
+  // The process is running now, so we take ownership of our ends even if
+  // something below fails.
+  spawned = true;
 
-    if (!redirect_err_to_out)
-    {
-      ::close(stderr_pipes[0]);
-      dup2(stderr_pipes[1], 2);
-    }
-    else
-      dup2(stdout_pipes[1], 2);
+  ProcessLinux* p_proc = g_process_pool.add();
+  if (p_proc == nullptr)
+  {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    spawned = false;
+    return ERROR("failed to allocate a ProcessLinux\n");
+  }
 
-    ::close(stdin_pipes[1]);
-    dup2(stdin_pipes[0], 0);
+  p_proc->pid = pid;
+  p_proc->pidfd = -1;
+  p_proc->waiter_userdata = nullptr;
+  p_proc->peak_memory = 0;
+  p_proc->stderr = redirect_err_to_out? stdout_pipes[0] : stderr_pipes[0];
+  p_proc->stdout = stdout_pipes[0];
+  p_proc->stdin = stdin_pipes[1];
+  *out_handle = p_proc;
 
-    if (-1 == execvp(argsc.arr[0], argsc.arr))
-    {
-      reportErrno(
-        "execvp failed to replace child process with file '", file, "'");
-      exit(1);
-    }
+  if (non_blocking)
+  {
+    if (!setNonBlockingFd(stdout_pipes[0]) ||
+        !setNonBlockingFd(stdin_pipes[1]) ||
+        (!redirect_err_to_out && !setNonBlockingFd(stderr_pipes[0])))
+      return reportErrno("failed to set child pipe as non-blocking");
   }
 
   return true;
@@ -748,7 +877,8 @@ b8 processHasExited(Process::Handle h_process, s32* out_exit_code)
     return ERROR("processHasExited passed a null process handle\n");
 
   int status = 0;
-  int r = waitpid(p_proc->pid, &status, WNOHANG);
+  struct rusage usage;
+  int r = wait4(p_proc->pid, &status, WNOHANG, &usage);
   if (-1 == r)
   {
     if (errno == ECHILD)
@@ -764,6 +894,8 @@ b8 processHasExited(Process::Handle h_process, s32* out_exit_code)
 
   if (r)
   {
+    p_proc->peak_memory = u64(usage.ru_maxrss) * 1024;
+
     if (WIFEXITED(status))
     {
       if (out_exit_code)
@@ -775,6 +907,17 @@ b8 processHasExited(Process::Handle h_process, s32* out_exit_code)
   return false;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+u64 processPeakMemory(Process::Handle h_process)
+{
+  auto* p_proc = (ProcessLinux*)h_process;
+  if (p_proc == nullptr)
+    return ERROR("processPeakMemory passed a null process handle\n");
+
+  return p_proc->peak_memory;
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 processClose(Process::Handle h_process)
@@ -787,13 +930,401 @@ b8 processClose(Process::Handle h_process)
   {
     if (-1 == kill(p_proc->pid, SIGKILL))
       return reportErrno("failed to close process ", h_process);
+    // Reap it so it doesn't linger as a zombie.
+    waitpid(p_proc->pid, nullptr, 0);
   }
 
+  ::close(p_proc->stdin);
+  ::close(p_proc->stdout);
+  if (p_proc->stderr != p_proc->stdout)
+    ::close(p_proc->stderr);
+
   g_process_pool.remove(p_proc);
 
   return true;
 }
 
+/* ============================================================================
+ *  Processes are waited on through epoll. Their output is watched through 
+ *  their stdout (and stderr, when it is separate) pipe and their exit 
+ *  through a pidfd, which becomes readable once the process exits. On 
+ *  kernels without pidfds (before 5.3) we rely on the hangup of the stdout
+ *  pipe instead, which happens when the process exits unless it passed the
+ *  pipe on to a child of its own.
+ *
+ *  A pipe hangs up as soon as the exiting process closes its files, which
+ *  is a little before it can be reaped. The hangup is reported for as long
+ *  as the pipe is in the epoll set, so when we have a pidfd to tell us
+ *  about the exit, a pipe that hung up with nothing left to read is taken
+ *  out of the set rather than waking the waiter over and over in the
+ *  meantime.
+ *
+ *  Each event carries the ProcessLinux it belongs to with which of its fds
+ *  it is for in the low bits of the pointer.
+ */
+struct ProcessWaiterLinux
+{
+  int epfd;
+};
+
+enum class WaiterFd : u64
+{
+  Stdout,
+  Stderr,
+  Pid,
+};
+
+/* ----------------------------------------------------------------------------
+ */
+static int getWaiterFd(ProcessLinux* p_proc, WaiterFd kind)
+{
+  switch (kind)
+  {
+  case WaiterFd::Stdout: return p_proc->stdout;
+  case WaiterFd::Stderr: return p_proc->stderr;
+  case WaiterFd::Pid:    return p_proc->pidfd;
+  }
+  return -1;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 processWaiterCreate(ProcessWaiter::Handle* out_handle)
+{
+  assert(out_handle);
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd == -1)
+    return reportErrno("failed to create epoll instance");
+
+  auto* waiter = mem::stl_allocator.allocateType<ProcessWaiterLinux>();
+  waiter->epfd = epfd;
+  *out_handle = waiter;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void processWaiterDestroy(ProcessWaiter::Handle h_waiter)
+{
+  auto* waiter = (ProcessWaiterLinux*)h_waiter;
+  if (waiter == nullptr)
+    return;
+
+  ::close(waiter->epfd);
+  mem::stl_allocator.free(waiter);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 epollAdd(int epfd, ProcessLinux* p_proc, WaiterFd kind)
+{
+  static_assert(alignof(ProcessLinux) >= 4);
+
+  int fd = getWaiterFd(p_proc, kind);
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = u64(p_proc) | u64(kind);
+  if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event))
+    return reportErrno("failed to add fd ", fd, " to epoll instance");
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 processWaiterAdd(
+    ProcessWaiter::Handle h_waiter, 
+    Process::Handle       h_process,
+    void*                 userdata)
+{
+  auto* waiter = (ProcessWaiterLinux*)h_waiter;
+  auto* p_proc = (ProcessLinux*)h_process;
+  if (waiter == nullptr || p_proc == nullptr)
+    return ERROR("processWaiterAdd passed a null handle\n");
+
+  p_proc->waiter_userdata = userdata;
+
+  if (!epollAdd(waiter->epfd, p_proc, WaiterFd::Stdout))
+    return false;
+
+  if (p_proc->stderr != p_proc->stdout)
+  {
+    if (!epollAdd(waiter->epfd, p_proc, WaiterFd::Stderr))
+      return false;
+  }
+
+#ifdef SYS_pidfd_open
+  p_proc->pidfd = syscall(SYS_pidfd_open, p_proc->pid, 0);
+  if (p_proc->pidfd == -1)
+  {
+    // Not supported, we'll see the pipe hang up instead.
+    errno = 0;
+  }
+  else if (!epollAdd(waiter->epfd, p_proc, WaiterFd::Pid))
+  {
+    ::close(p_proc->pidfd);
+    p_proc->pidfd = -1;
+    return false;
+  }
+#endif
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void processWaiterRemove(
+    ProcessWaiter::Handle h_waiter, 
+    Process::Handle       h_process)
+{
+  auto* waiter = (ProcessWaiterLinux*)h_waiter;
+  auto* p_proc = (ProcessLinux*)h_process;
+  if (waiter == nullptr || p_proc == nullptr)
+    return;
+
+  // Pipes that hung up may have been removed already, which is fine.
+  epoll_ctl(waiter->epfd, EPOLL_CTL_DEL, p_proc->stdout, nullptr);
+
+  if (p_proc->stderr != p_proc->stdout)
+    epoll_ctl(waiter->epfd, EPOLL_CTL_DEL, p_proc->stderr, nullptr);
+
+  if (p_proc->pidfd != -1)
+  {
+    // Closing the pidfd removes it from the epoll instance.
+    ::close(p_proc->pidfd);
+    p_proc->pidfd = -1;
+  }
+
+  p_proc->waiter_userdata = nullptr;
+
+  errno = 0;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 processWaiterWait(
+    ProcessWaiter::Handle h_waiter, 
+    Slice<void*>          out_ready,
+    TimeSpan              timeout)
+{
+  auto* waiter = (ProcessWaiterLinux*)h_waiter;
+  if (waiter == nullptr)
+  {
+    ERROR("processWaiterWait passed a null handle\n");
+    return -1;
+  }
+
+  const s32 max_events = 64;
+  struct epoll_event events[max_events];
+
+  s32 event_count = out_ready.len < max_events? out_ready.len : max_events;
+  int timeout_ms = timeout.ns < 0? -1 : timeout.ns / 1000000;
+
+  int r = epoll_wait(waiter->epfd, events, event_count, timeout_ms);
+  if (r == -1)
+  {
+    if (errno == EINTR)
+    {
+      errno = 0;
+      return 0;
+    }
+    reportErrno("failed to wait on epoll instance");
+    return -1;
+  }
+
+  for (s32 i = 0; i < r; ++i)
+  {
+    u64 data = events[i].data.u64;
+    auto* p_proc = (ProcessLinux*)(data & ~u64(3));
+    auto kind = WaiterFd(data & 3);
+
+    if (kind != WaiterFd::Pid &&
+        p_proc->pidfd != -1 &&
+        (events[i].events & EPOLLHUP) &&
+        !(events[i].events & EPOLLIN))
+    {
+      int fd = getWaiterFd(p_proc, kind);
+      epoll_ctl(waiter->epfd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    out_ready.ptr[i] = p_proc->waiter_userdata;
+  }
+
+  return r;
+}
+
+/* ============================================================================
+ *  Watchers are inotify instances watching each directory added to them.
+ *  Events are read into 'buffer' and handed out from it, so that the names
+ *  they carry can point straight into it. Those that don't fit into the 
+ *  caller's slice are kept for the next call to wait.
+ */
+struct WatcherLinux
+{
+  int fd;
+
+  // The user data of each directory by its watch descriptor, which the 
+  // kernel hands out counting up from 1.
+  Array<void*> userdata;
+
+  alignas(struct inotify_event) u8 buffer[16 * 1024];
+  u32 buffer_len;
+  u32 buffer_pos;
+};
+
+/* ----------------------------------------------------------------------------
+ */
+b8 watcherCreate(fs::Watcher::Handle* out_handle)
+{
+  assert(out_handle);
+
+  int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (fd == -1)
+    return reportErrno("failed to create inotify instance");
+
+  auto* watcher = mem::stl_allocator.allocateType<WatcherLinux>();
+  watcher->fd = fd;
+  watcher->userdata.init();
+  watcher->buffer_len = 0;
+  watcher->buffer_pos = 0;
+  *out_handle = watcher;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void watcherDestroy(fs::Watcher::Handle h_watcher)
+{
+  auto* watcher = (WatcherLinux*)h_watcher;
+  if (watcher == nullptr)
+    return;
+
+  ::close(watcher->fd);
+  watcher->userdata.destroy();
+  mem::stl_allocator.free(watcher);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 watcherAdd(fs::Watcher::Handle h_watcher, String path, void* userdata)
+{
+  auto* watcher = (WatcherLinux*)h_watcher;
+  if (watcher == nullptr)
+    return ERROR("watcherAdd passed a null handle\n");
+
+  const u32 mask = 
+    IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | 
+    IN_ONLYDIR;
+
+  int wd = inotify_add_watch(watcher->fd, (char*)path.ptr, mask);
+  if (wd == -1)
+    return reportErrno("failed to watch directory '", path, "'");
+
+  while (watcher->userdata.len() <= wd)
+    watcher->userdata.push(nullptr);
+  watcher->userdata[wd] = userdata;
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 watcherWait(
+    fs::Watcher::Handle      h_watcher,
+    Slice<fs::Watcher::Event> out_events,
+    TimeSpan                 timeout)
+{
+  using Kind = fs::Watcher::Event::Kind;
+
+  auto* watcher = (WatcherLinux*)h_watcher;
+  if (watcher == nullptr)
+  {
+    ERROR("watcherWait passed a null handle\n");
+    return -1;
+  }
+
+  if (watcher->buffer_pos == watcher->buffer_len)
+  {
+    struct pollfd pfd = {};
+    pfd.fd = watcher->fd;
+    pfd.events = POLLIN;
+
+    int timeout_ms = timeout.ns < 0? -1 : timeout.ns / 1000000;
+
+    int r = ::poll(&pfd, 1, timeout_ms);
+    if (r == -1)
+    {
+      if (errno == EINTR)
+      {
+        errno = 0;
+        return 0;
+      }
+      reportErrno("failed to poll inotify instance");
+      return -1;
+    }
+
+    if (r == 0)
+      return 0;
+
+    ssize_t bytes_read = 
+      ::read(watcher->fd, watcher->buffer, sizeof(watcher->buffer));
+    if (bytes_read == -1)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+      {
+        errno = 0;
+        return 0;
+      }
+      reportErrno("failed to read inotify instance");
+      return -1;
+    }
+
+    watcher->buffer_len = bytes_read;
+    watcher->buffer_pos = 0;
+  }
+
+  s32 count = 0;
+  while (count < out_events.len && 
+         watcher->buffer_pos < watcher->buffer_len)
+  {
+    auto* event = 
+      (struct inotify_event*)(watcher->buffer + watcher->buffer_pos);
+    watcher->buffer_pos += sizeof(struct inotify_event) + event->len;
+
+    fs::Watcher::Event* out = out_events.ptr + count;
+    
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+      out->kind = Kind::Overflowed;
+      out->userdata = nullptr;
+      out->name = nil;
+      count += 1;
+      continue;
+    }
+
+    // Sent when a watch goes away, eg. because its directory was removed,
+    // which its parent will have reported if it's being watched.
+    if (event->mask & IN_IGNORED)
+      continue;
+
+    if (event->mask & IN_CLOSE_WRITE)
+      out->kind = Kind::Modified;
+    else if (event->mask & (IN_CREATE | IN_MOVED_TO))
+      out->kind = Kind::Created;
+    else 
+      out->kind = Kind::Removed;
+
+    out->userdata = 
+      event->wd < watcher->userdata.len()? 
+        watcher->userdata[event->wd] : nullptr;
+    out->name = event->len? String::fromCStr(event->name) : nil;
+    count += 1;
+  }
+
+  return count;
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 realpath(fs::Path* path)
@@ -987,6 +1518,95 @@ u64 getPid()
   return getpid();
 }
 
+/* ----------------------------------------------------------------------------
+ */
+b8 getExecutableInfo(fs::FileInfo* out_info)
+{
+  return stat(out_info, "/proc/self/exe"_str);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u32 getProcessorCount()
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0? (u32)count : 1;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Reads the small, generated file at 'path', eg. under /proc, into 
+ *  'buffer' and null-terminates it.
+ */
+static b8 readSystemFile(const char* path, char* buffer, s64 size)
+{
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+
+  s64 len = ::read(fd, buffer, size - 1);
+  ::close(fd);
+  if (len < 0)
+    return false;
+
+  buffer[len] = 0;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 getMemoryInfo(u64* out_total, u64* out_available)
+{
+  assert(out_total && out_available);
+
+  char buffer[4096];
+  if (!readSystemFile("/proc/meminfo", buffer, sizeof(buffer)))
+    return false;
+
+  // Values are given in kB.
+  char* total = strstr(buffer, "MemTotal:");
+  char* available = strstr(buffer, "MemAvailable:");
+  if (total == nullptr || available == nullptr)
+    return false;
+
+  *out_total = strtoull(total + strlen("MemTotal:"), nullptr, 10) * 1024;
+  *out_available = 
+    strtoull(available + strlen("MemAvailable:"), nullptr, 10) * 1024;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 getLoadAverage(f64* out_load)
+{
+  assert(out_load);
+
+  char buffer[256];
+  if (!readSystemFile("/proc/loadavg", buffer, sizeof(buffer)))
+    return false;
+
+  *out_load = strtod(buffer, nullptr);
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 getMemoryPressure(f32* out_percent)
+{
+  assert(out_percent);
+
+  char buffer[256];
+  if (!readSystemFile("/proc/pressure/memory", buffer, sizeof(buffer)))
+    return false;
+
+  // The first line is 'some avg10=... avg60=... avg300=... total=...'.
+  char* avg10 = strstr(buffer, "avg10=");
+  if (avg10 == nullptr)
+    return false;
+
+  *out_percent = strtof(avg10 + strlen("avg10="), nullptr);
+  return true;
+}
+
 /* ----------------------------------------------------------------------------
  */
 u16 byteSwap(u16 x)
@@ -1074,6 +1694,27 @@ void releaseMemory(void* ptr, u64 size)
     reportErrno("failed to release memory");
 }
 
+/* ----------------------------------------------------------------------------
+ */
+void* mapFile(fs::File::Handle handle, u64 size)
+{
+  void* result = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, (int)handle, 0);
+  if (result == MAP_FAILED)
+  {
+    reportErrno("failed to map file");
+    return nullptr;
+  }
+  return result;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void unmapFile(void* ptr, u64 size)
+{
+  if (-1 == munmap(ptr, size))
+    reportErrno("failed to unmap file");
+}
+
 }
 
 #endif // #if IRO_LINUX
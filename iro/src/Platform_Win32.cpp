@@ -549,6 +549,17 @@ b8 setNonBlocking(fs::File::Handle handle)
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ *  Not supported yet, so callers keep sharing the handle.
+ */
+b8 redirectHandle(
+    fs::File::Handle handle,
+    fs::File::Handle to,
+    fs::File::Handle* out_original)
+{
+  return false;
+}
+
 /* ----------------------------------------------------------------------------
  */
 Timespec clock_realtime()
@@ -722,6 +733,30 @@ s64 readdir(fs::Dir::Handle handle, Bytes buffer)
   return utf8_len-1; // maybe safe idk
 }
 
+/* ----------------------------------------------------------------------------
+ *  FindNextFileW already returns entries in bulk, but the kind it gives
+ *  doesn't follow symlinks, so it is left for the caller to stat.
+ */
+b8 listDir(String path, ListDirCallback callback, void* data)
+{
+  fs::Dir::Handle handle;
+  if (!opendir(&handle, path))
+    return false;
+  defer { closedir(handle); };
+
+  u8 buffer[MAX_PATH * 4];
+  for (;;)
+  {
+    s64 len = readdir(handle, {buffer, sizeof(buffer)});
+    if (len == -1)
+      return false;
+    if (len == 0)
+      return true;
+
+    callback(data, String::from(buffer, len), fs::FileKind::Unknown);
+  }
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 stdinHasData()
@@ -1565,6 +1600,14 @@ b8 processHasExited(Process::Handle h_process, s32* out_exit_code)
   return false;
 }
 
+/* ----------------------------------------------------------------------------
+ *  Not yet supported on Windows, where this would need GetProcessMemoryInfo.
+ */
+u64 processPeakMemory(Process::Handle h_process)
+{
+  return 0;
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 processClose(Process::Handle h_process)
@@ -1587,6 +1630,73 @@ b8 processClose(Process::Handle h_process)
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ *  Not yet supported on Windows, where this would need WaitForMultipleObjects
+ *  along with overlapped reads on the pipes. Callers fall back to polling.
+ */
+b8 processWaiterCreate(ProcessWaiter::Handle* out_handle)
+{
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void processWaiterDestroy(ProcessWaiter::Handle h_waiter) {}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 processWaiterAdd(
+    ProcessWaiter::Handle h_waiter, 
+    Process::Handle       h_process,
+    void*                 userdata)
+{
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void processWaiterRemove(
+    ProcessWaiter::Handle h_waiter, 
+    Process::Handle       h_process) {}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 processWaiterWait(
+    ProcessWaiter::Handle h_waiter, 
+    Slice<void*>          out_ready,
+    TimeSpan              timeout)
+{
+  return -1;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 watcherCreate(fs::Watcher::Handle* out_handle)
+{
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void watcherDestroy(fs::Watcher::Handle h_watcher) {}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 watcherAdd(fs::Watcher::Handle h_watcher, String path, void* userdata)
+{
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 watcherWait(
+    fs::Watcher::Handle      h_watcher,
+    Slice<fs::Watcher::Event> out_events,
+    TimeSpan                 timeout)
+{
+  return -1;
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 realpath(fs::Path* path)
@@ -1885,6 +1995,55 @@ u64 getPid()
   return (u64)GetCurrentProcessId();
 }
 
+/* ----------------------------------------------------------------------------
+ *  Not supported yet.
+ */
+b8 getExecutableInfo(fs::FileInfo* out_info)
+{
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u32 getProcessorCount()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 getMemoryInfo(u64* out_total, u64* out_available)
+{
+  assert(out_total && out_available);
+
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return false;
+
+  *out_total = status.ullTotalPhys;
+  *out_available = status.ullAvailPhys;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Windows has no equivalent.
+ */
+b8 getLoadAverage(f64* out_load)
+{
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Windows has no equivalent.
+ */
+b8 getMemoryPressure(f32* out_percent)
+{
+  return false;
+}
+
 /* ----------------------------------------------------------------------------
  */
 u16 byteSwap(u16 x)
@@ -1980,6 +2139,47 @@ void releaseMemory(void* ptr, u64 size)
   VirtualFree(ptr, 0, MEM_RELEASE);
 }
 
+/* ----------------------------------------------------------------------------
+ */
+void* mapFile(fs::File::Handle handle, u64 size)
+{
+  HANDLE mapping = 
+    CreateFileMappingA(
+      (HANDLE)handle, 
+      nullptr, 
+      PAGE_READONLY, 
+      (DWORD)(size >> 32), 
+      (DWORD)size, 
+      nullptr);
+  if (mapping == nullptr)
+  {
+    ERROR("failed to map file: ",
+      makeWin32ErrorMsg(GetLastError()), "\n");
+    cleanupWin32ErrorMsg();
+    return nullptr;
+  }
+
+  // The view keeps the mapping alive.
+  defer { CloseHandle(mapping); };
+
+  void* result = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+  if (result == nullptr)
+  {
+    ERROR("failed to map view of file: ",
+      makeWin32ErrorMsg(GetLastError()), "\n");
+    cleanupWin32ErrorMsg();
+  }
+  return result;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void unmapFile(void* ptr, u64 size)
+{
+  // The whole view is always unmapped on win32.
+  UnmapViewOfFile(ptr);
+}
+
 }
 
 #endif // #if IRO_WIN32
@@ -80,6 +80,14 @@ void Process::check()
   }
 }
 
+/* ----------------------------------------------------------------------------
+ */
+u64 Process::peakMemory() const
+{
+  assert(handle);
+  return platform::processPeakMemory(handle);
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 Process::close()
@@ -98,5 +106,47 @@ b8 Process::close()
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+ProcessWaiter ProcessWaiter::create()
+{
+  ProcessWaiter out = {};
+  if (!platform::processWaiterCreate(&out.handle))
+    return nil;
+  return out;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void ProcessWaiter::destroy()
+{
+  if (handle)
+    platform::processWaiterDestroy(handle);
+  handle = nullptr;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 ProcessWaiter::add(Process* proc, void* userdata)
+{
+  assert(handle && proc->handle);
+  return platform::processWaiterAdd(handle, proc->handle, userdata);
 }
 
+/* ----------------------------------------------------------------------------
+ */
+void ProcessWaiter::remove(Process* proc)
+{
+  assert(handle && proc->handle);
+  platform::processWaiterRemove(handle, proc->handle);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 ProcessWaiter::wait(Slice<void*> out_ready, TimeSpan timeout)
+{
+  assert(handle);
+  return platform::processWaiterWait(handle, out_ready, timeout);
+}
+
+}
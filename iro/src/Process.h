@@ -13,6 +13,7 @@
 #include "traits/Nil.h"
 
 #include "fs/FileSystem.h"
+#include "time/Time.h"
 
 namespace iro
 {
@@ -53,6 +54,10 @@ struct Process
   // Checks the status of this Process and updates status/exit_code
   // if it has exited.
   void check();
+
+  // The most memory, in bytes, this Process had resident at once, which is
+  // known once check() has seen it exit. 0 if it isn't known.
+  u64 peakMemory() const;
   
   // Closes this process, terminating it early if it is still running,
   // and cleans up its internal resources.
@@ -62,6 +67,39 @@ struct Process
   DefineMoveTrait(Process, { to.handle = from.handle; });
 };
 
+/* ============================================================================
+ *  A set of processes that can be waited on together, for when many 
+ *  processes are running at once and we only want to do work once some of 
+ *  them produce output or exit.
+ *
+ *  Each process is added along with some user data, which is what wait() 
+ *  reports back when the process is ready. A process may be reported more
+ *  than once by a single wait(), eg. if it both wrote output and exited.
+ *
+ *  Not every platform supports this, in which case create() returns nil and
+ *  callers should fall back to polling each process.
+ */
+struct ProcessWaiter
+{
+  typedef void* Handle;
+
+  Handle handle;
+
+  static ProcessWaiter create();
+  void destroy();
+
+  b8   add(Process* proc, void* userdata);
+  void remove(Process* proc);
+
+  // Blocks until at least one process is ready or 'timeout' passes, writing
+  // the user data of those ready into 'out_ready'. Returns how many were 
+  // written, which is 0 on timeout, or -1 on error. A negative 'timeout' 
+  // waits indefinitely.
+  s32 wait(Slice<void*> out_ready, TimeSpan timeout);
+
+  DefineNilTrait(ProcessWaiter, {nullptr}, x.handle == nullptr);
+};
+
 /* ============================================================================
  */
 struct ProcessIO : io::IO
@@ -0,0 +1,578 @@
+#include "DirCache.h"
+#include "File.h"
+
+#include "../Logger.h"
+#include "../Platform.h"
+#include "../containers/SmallArray.h"
+
+#include "stdlib.h"
+#include "string.h"
+
+namespace iro::fs
+{
+
+static Logger logger =
+  Logger::create("iro.dircache"_str, Logger::Verbosity::Notice);
+
+// Bump whenever the layout of saved caches changes.
+static const u32 cache_version = 2;
+
+// How long after a directory was last modified it must have been read for
+// its listing to be trusted. Generous, as filesystems only update times
+// every so often.
+static const u64 racy_ns = 1000000000;
+
+/* ============================================================================
+ *  Saved caches are this header followed by the listings, the entries, and
+ *  then the names, which start with the paths of the listings.
+ */
+struct CacheHeader
+{
+  u8  magic[4];
+  u32 version;
+  u32 listing_count;
+  u32 entry_count;
+  u32 names_len;
+};
+
+static const u8 cache_magic[4] = { 'i', 'r', 'd', 'c' };
+
+/* ----------------------------------------------------------------------------
+ */
+b8 DirCache::init()
+{
+  if (!names.open())
+    return false;
+  if (!normalized.open())
+    return false;
+  if (!entries.init())
+    return false;
+  if (!listings.init())
+    return false;
+  if (!index.init(64))
+    return false;
+  index.resize(64);
+  mem::zero(index.arr, index.len() * sizeof(u32));
+  cwd = nil;
+  cwd_valid = false;
+  dirty = false;
+  hits = misses = 0;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void DirCache::deinit()
+{
+  if (notnil(cwd))
+    cwd.destroy();
+  names.close();
+  normalized.close();
+  entries.destroy();
+  listings.destroy();
+  index.destroy();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 isSeparator(u8 c)
+{
+#if IRO_WIN32
+  return c == '/' || c == '\\';
+#else
+  return c == '/';
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ *  Writes 'path' made absolute, with '.' and '..' resolved lexically, to
+ *  the cache's 'normalized' buffer and returns its hash.
+ */
+static u64 normalizePath(DirCache& cache, String path)
+{
+  SmallArray<String, 32> components;
+  defer { components.deinit(); };
+
+  auto addComponents = [&](String s)
+  {
+    u8* scan = s.ptr;
+    u8* end = s.ptr + s.len;
+    while (scan < end)
+    {
+      u8* start = scan;
+      while (scan < end && !isSeparator(*scan))
+        scan += 1;
+
+      String component = String::from(start, scan);
+      if (component == ".."_str)
+      {
+        if (!components.isEmpty())
+          components.pop();
+      }
+      else if (!component.isEmpty() && component != "."_str)
+      {
+        components.push(component);
+      }
+
+      scan += 1;
+    }
+  };
+
+  if (!Path::isRooted(path))
+  {
+    if (!cache.cwd_valid)
+    {
+      if (notnil(cache.cwd))
+        cache.cwd.destroy();
+      cache.cwd = Path::cwd();
+      cache.cwd_valid = true;
+    }
+    addComponents(cache.cwd.asStr());
+  }
+
+  addComponents(path);
+
+  cache.normalized.clear();
+  for (String component : components)
+  {
+    cache.normalized.write("/"_str);
+    cache.normalized.write(component);
+  }
+  if (components.isEmpty())
+    cache.normalized.write("/"_str);
+
+  u64 hash = 14695981039346656037ull;
+  for (u8 c : cache.normalized.asStr())
+    hash = (hash ^ c) * 1099511628211;
+  return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Returns the slot in the index the listing of the directory at the
+ *  normalized 'path' is in, or the empty one it would go in. Paths are
+ *  compared as well as hashes so that a collision can't hand out another
+ *  directory's entries.
+ */
+static u32* findSlot(DirCache& cache, u64 hash, String path)
+{
+  u32 mask = cache.index.len() - 1;
+  for (u32 i = u32(hash) & mask;; i = (i + 1) & mask)
+  {
+    u32* slot = &cache.index[i];
+    if (*slot == 0)
+      return slot;
+
+    DirCache::Listing& listing = cache.listings[*slot - 1];
+    if (listing.hash == hash && cache.getPath(listing) == path)
+      return slot;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void addToIndex(DirCache& cache, u32 listing)
+{
+  // Keep the table at most half full.
+  if (u32(cache.listings.len()) * 2 > u32(cache.index.len()))
+  {
+    u32 new_len = cache.index.len() * 2;
+    cache.index.resize(new_len);
+    mem::zero(cache.index.arr, new_len * sizeof(u32));
+    for (u32 i = 0; i < u32(cache.listings.len()); ++i)
+    {
+      if (i != listing)
+      {
+        DirCache::Listing& other = cache.listings[i];
+        *findSlot(cache, other.hash, cache.getPath(other)) = i + 1;
+      }
+    }
+  }
+
+  DirCache::Listing& added = cache.listings[listing];
+  *findSlot(cache, added.hash, cache.getPath(added)) = listing + 1;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 toNanoseconds(TimePoint t)
+{
+  return t.s * 1000000000 + t.ns;
+}
+
+/* ============================================================================
+ *  An entry as it is read, before being sorted.
+ */
+struct ReadEntry
+{
+  u32 name;
+  u16 name_len;
+  FileKind kind;
+};
+
+struct ReadState
+{
+  DirCache* cache;
+  Array<ReadEntry> read;
+};
+
+/* ----------------------------------------------------------------------------
+ */
+static void onEntry(void* data, String name, FileKind kind)
+{
+  auto* state = (ReadState*)data;
+  io::Memory& names = state->cache->names;
+
+  ReadEntry* entry = state->read.push();
+  entry->name = names.len;
+  entry->name_len = name.len;
+  entry->kind = kind;
+
+  names.write({name.ptr, name.len});
+  names.write({(u8*)"", 1});
+}
+
+/* ----------------------------------------------------------------------------
+ *  Entries are sorted with their names resolved, as 'names' can't move
+ *  while sorting.
+ */
+struct SortEntry
+{
+  String name;
+  u32 offset;
+  b8 is_dir;
+};
+
+static int compareEntries(const void* a, const void* b)
+{
+  String x = ((SortEntry*)a)->name;
+  String y = ((SortEntry*)b)->name;
+  s32 n = x.len < y.len? x.len : y.len;
+  int c = memcmp(x.ptr, y.ptr, n);
+  if (c != 0)
+    return c;
+  return s32(x.len) - s32(y.len);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 readDir(DirCache& cache, String path, DirCache::Listing* listing)
+{
+  u32 names_start = cache.names.len;
+
+  // Taken before reading so that anything changed while we do is caught.
+  u64 read_at = toNanoseconds(TimePoint::now());
+
+  ReadState state;
+  state.cache = &cache;
+  state.read = Array<ReadEntry>::create(64);
+  defer { state.read.destroy(); };
+
+  if (!platform::listDir(path, onEntry, &state))
+  {
+    cache.names.len = names_start;
+    return false;
+  }
+
+  auto sorted = Array<SortEntry>::create(state.read.len());
+  defer { sorted.destroy(); };
+
+  // Anything the system didn't tell us the kind of is stat'd, which also
+  // follows symlinks to see if they lead to a directory.
+  auto full = Path::from(path);
+  defer { full.destroy(); };
+  full.ensureDir();
+  auto rollback = full.makeRollback();
+
+  for (ReadEntry& read : state.read)
+  {
+    SortEntry* entry = sorted.push();
+    entry->name = String::from(cache.names.ptr + read.name, read.name_len);
+    entry->offset = read.name;
+
+    if (read.kind == FileKind::Unknown || read.kind == FileKind::SymLink)
+    {
+      full.append(entry->name);
+      entry->is_dir = full.isDirectory();
+      full.commitRollback(rollback);
+    }
+    else
+    {
+      entry->is_dir = read.kind == FileKind::Directory;
+    }
+  }
+
+  qsort(sorted.arr, sorted.len(), sizeof(SortEntry), compareEntries);
+
+  listing->first = cache.entries.len();
+  listing->count = sorted.len();
+  listing->read_at = read_at;
+
+  for (SortEntry& sort : sorted)
+  {
+    DirCache::Entry* entry = cache.entries.push();
+    entry->name = sort.offset;
+    entry->name_len = sort.name.len;
+    entry->is_dir = sort.is_dir;
+  }
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 DirCache::list(String path, Listing* out)
+{
+  FileInfo info = FileInfo::of(path);
+  if (isnil(info) || info.kind != FileKind::Directory)
+    return false;
+
+  u64 modtime = toNanoseconds(info.last_modified_time);
+  u64 hash = normalizePath(*this, path);
+
+  u32* slot = findSlot(*this, hash, normalized.asStr());
+  if (*slot != 0)
+  {
+    Listing& listing = listings[*slot - 1];
+    if (listing.modtime == modtime && listing.modtime + racy_ns <
+                                      listing.read_at)
+    {
+      hits += 1;
+      *out = listing;
+      return true;
+    }
+  }
+
+  misses += 1;
+  dirty = true;
+
+  // Directories that changed get their entries appended again, leaving the
+  // old ones unused until the cache is saved.
+  Listing listing;
+  listing.hash = hash;
+  listing.modtime = modtime;
+  if (*slot != 0)
+  {
+    Listing& old = listings[*slot - 1];
+    listing.path = old.path;
+    listing.path_len = old.path_len;
+  }
+  else
+  {
+    listing.path = names.len;
+    listing.path_len = normalized.len;
+    names.write(normalized.asBytes());
+    names.write({(u8*)"", 1});
+  }
+
+  if (!readDir(*this, path, &listing))
+    return false;
+
+  TRACE("read ", listing.count, " entries of ", path, "\n");
+
+  if (*slot != 0)
+  {
+    listings[*slot - 1] = listing;
+  }
+  else
+  {
+    *listings.push() = listing;
+    addToIndex(*this, listings.len() - 1);
+  }
+
+  *out = listing;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 DirCache::save(String path)
+{
+  // Only the entries and names still in use are written, so that the file
+  // doesn't grow with each directory that changed.
+  u32 entry_count = 0;
+  u32 names_len = 0;
+  for (Listing& listing : listings)
+  {
+    entry_count += listing.count;
+    names_len += listing.path_len + 1;
+    for (u32 i = 0; i < listing.count; ++i)
+      names_len += entries[listing.first + i].name_len + 1;
+  }
+
+  CacheHeader header;
+  mem::copy(header.magic, (void*)cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.listing_count = listings.len();
+  header.entry_count = entry_count;
+  header.names_len = names_len;
+
+  io::Memory data;
+  data.open(sizeof(CacheHeader) +
+            listings.len() * sizeof(Listing) +
+            entry_count * sizeof(Entry) +
+            names_len);
+  defer { data.close(); };
+
+  data.write({(u8*)&header, sizeof(header)});
+
+  u32 first = 0;
+  u32 name = 0;
+  for (Listing listing : listings)
+  {
+    listing.first = first;
+    first += listing.count;
+    listing.path = name;
+    name += listing.path_len + 1;
+    data.write({(u8*)&listing, sizeof(listing)});
+  }
+
+  for (Listing& listing : listings)
+  {
+    for (u32 i = 0; i < listing.count; ++i)
+    {
+      Entry entry = entries[listing.first + i];
+      entry.name = name;
+      name += entry.name_len + 1;
+      data.write({(u8*)&entry, sizeof(entry)});
+    }
+  }
+
+  for (Listing& listing : listings)
+    data.write({names.ptr + listing.path, u64(listing.path_len) + 1});
+
+  for (Listing& listing : listings)
+  {
+    for (u32 i = 0; i < listing.count; ++i)
+    {
+      Entry& entry = entries[listing.first + i];
+      data.write({names.ptr + entry.name, u64(entry.name_len) + 1});
+    }
+  }
+
+  io::Memory tmp_path;
+  tmp_path.open();
+  defer { tmp_path.close(); };
+  io::formatv(&tmp_path, path, '.', platform::getPid());
+
+  {
+    auto file =
+      File::from(
+        tmp_path.asStr(),
+          OpenFlag::Create
+        | OpenFlag::Write
+        | OpenFlag::Truncate);
+    if (isnil(file))
+      return ERROR("failed to open dir cache ", tmp_path.asStr(),
+                   " for writing\n");
+    defer { file.close(); };
+
+    if (file.write(data.asBytes()) != data.len)
+      return ERROR("failed to write dir cache ", tmp_path.asStr(), "\n");
+  }
+
+  if (!File::rename(path, tmp_path.asStr()))
+  {
+    File::unlink(tmp_path.asStr());
+    return ERROR("failed to move dir cache into place at ", path, "\n");
+  }
+
+  DEBUG("saved ", header.listing_count, " directories to ", path, "\n");
+
+  dirty = false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 DirCache::load(String path)
+{
+  assert(listings.isEmpty());
+
+  auto file = File::from(path, OpenFlag::Read);
+  if (isnil(file))
+  {
+    DEBUG("no dir cache at ", path, "\n");
+    return true;
+  }
+  defer { file.close(); };
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+  data.consume(&file, 1 << 16);
+
+  if (data.len < sizeof(CacheHeader))
+  {
+    WARN("ignoring truncated dir cache ", path, "\n");
+    return true;
+  }
+
+  auto* header = (CacheHeader*)data.ptr;
+  if (!mem::equal(header->magic, (void*)cache_magic, sizeof(cache_magic)) ||
+      header->version != cache_version)
+  {
+    DEBUG("ignoring outdated dir cache ", path, "\n");
+    return true;
+  }
+
+  u64 listings_size = u64(header->listing_count) * sizeof(Listing);
+  u64 entries_size = u64(header->entry_count) * sizeof(Entry);
+
+  if (data.len != sizeof(CacheHeader) + listings_size + entries_size +
+                  header->names_len)
+  {
+    WARN("ignoring corrupt dir cache ", path, "\n");
+    return true;
+  }
+
+  auto* saved_listings = (Listing*)(data.ptr + sizeof(CacheHeader));
+  auto* saved_entries = (Entry*)((u8*)saved_listings + listings_size);
+  u8* saved_names = (u8*)saved_entries + entries_size;
+
+  for (u32 i = 0; i < header->listing_count; ++i)
+  {
+    Listing& listing = saved_listings[i];
+    if (u64(listing.first) + listing.count > header->entry_count ||
+        u64(listing.path) + listing.path_len >= header->names_len)
+    {
+      WARN("ignoring corrupt dir cache ", path, "\n");
+      return true;
+    }
+  }
+
+  for (u32 i = 0; i < header->entry_count; ++i)
+  {
+    Entry& entry = saved_entries[i];
+    if (u64(entry.name) + entry.name_len >= header->names_len)
+    {
+      WARN("ignoring corrupt dir cache ", path, "\n");
+      return true;
+    }
+  }
+
+  u32 names_start = names.len;
+  u32 entries_start = entries.len();
+
+  names.write({saved_names, header->names_len});
+  for (u32 i = 0; i < header->entry_count; ++i)
+  {
+    Entry* entry = entries.push();
+    *entry = saved_entries[i];
+    entry->name += names_start;
+  }
+
+  for (u32 i = 0; i < header->listing_count; ++i)
+  {
+    Listing* listing = listings.push();
+    *listing = saved_listings[i];
+    listing->first += entries_start;
+    listing->path += names_start;
+    addToIndex(*this, listings.len() - 1);
+  }
+
+  DEBUG("loaded ", header->listing_count, " directories from ", path, "\n");
+
+  return true;
+}
+
+}
@@ -0,0 +1,118 @@
+/*
+ *  Remembering what directories contain, so that globbing the same trees
+ *  over and over doesn't read them over and over.
+ */
+
+#ifndef _iro_DirCache_h
+#define _iro_DirCache_h
+
+#include "../Common.h"
+#include "../Unicode.h"
+#include "../containers/Array.h"
+#include "../io/IO.h"
+
+#include "Path.h"
+
+namespace iro::fs
+{
+
+/* ============================================================================
+ *  The entries of every directory read through it, each read at most once
+ *  for as long as the directory doesn't change.
+ *
+ *  Directories are keyed by their absolute path, with '.' and '..' resolved
+ *  lexically, and each has its entries sorted by name along with whether
+ *  they are directories, which the system usually tells us while reading
+ *  the directory, so that walking a tree needs no stat per entry. Together
+ *  they form a trie of the tree from the root down to wherever was read.
+ *
+ *  Every lookup stats the directory and reads it again if its modification
+ *  time changed, which it does whenever an entry is added, removed, or
+ *  renamed. As the time is only so precise, a directory that was modified
+ *  shortly before it was read is read again on each lookup until that's no
+ *  longer the case, so a change in the same instant can't go unnoticed.
+ *
+ *  The cache may be saved to a file and loaded by another process, as
+ *  lake does so that the lpp processes it spawns can glob the same trees
+ *  its lakefile already did. Loaded directories are checked like any other.
+ */
+struct DirCache
+{
+  struct Entry
+  {
+    // Offset of the name in 'names', which is followed by a null
+    // terminator.
+    u32 name;
+    u16 name_len;
+    b8  is_dir;
+  };
+
+  // A directory's entries are entries[first] up to entries[first + count].
+  // Its normalized path is kept in 'names' too, as listings are found by its
+  // hash.
+  struct Listing
+  {
+    u64 hash;
+    u32 path;
+    u32 path_len;
+    u64 modtime;
+    u64 read_at;
+    u32 first;
+    u32 count;
+  };
+
+  io::Memory     names;
+  Array<Entry>   entries;
+  Array<Listing> listings;
+
+  // Open addressed table of 1 + the index of each Listing by its hash, 0
+  // being empty. Its length is always a power of 2.
+  Array<u32> index;
+
+  // Where the normalized path of the directory being looked up is built.
+  io::Memory normalized;
+
+  // The current directory relative paths are resolved against, fetched
+  // lazily after it changes.
+  Path cwd;
+  b8   cwd_valid;
+
+  // If anything was read since the cache was loaded.
+  b8 dirty;
+
+  u64 hits;
+  u64 misses;
+
+  b8   init();
+  void deinit();
+
+  // Returns the listing of the directory at 'path', which must be
+  // null-terminated, reading it if it isn't cached or changed since it was.
+  // Returns false if it isn't a directory or can't be read.
+  b8 list(String path, Listing* out);
+
+  String getName(const Entry& entry) const
+  {
+    return String::from(names.ptr + entry.name, entry.name_len);
+  }
+
+  String getPath(const Listing& listing) const
+  {
+    return String::from(names.ptr + listing.path, listing.path_len);
+  }
+
+  // Must be called whenever the current directory changes.
+  void noteChdir() { cwd_valid = false; }
+
+  // Saves every listing to 'path', which is written to a temporary file
+  // first so that a process loading it never sees half of it.
+  b8 save(String path);
+
+  // Adds the listings saved at 'path' to this cache, which must be empty. A
+  // missing or outdated file is not an error.
+  b8 load(String path);
+};
+
+}
+
+#endif // _iro_DirCache_h
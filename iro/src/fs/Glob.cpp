@@ -1,4 +1,5 @@
 #include "Glob.h"
+#include "../Platform.h"
 
 namespace iro::fs
 {
@@ -150,6 +151,66 @@ Globber::Part* Globber::pushPart(Part::Kind kind, String raw)
   return p;
 }
 
+/* ------------------------------------------------------------------------------------------------
+ */
+b8 Globber::Lister::open(DirCache* cache, Path path)
+{
+  this->cache = cache;
+  next_entry = 0;
+  is_dir = false;
+  dir = nil;
+
+  String str =
+    notnil(path) && !path.asStr().isEmpty()? path.asStr() : "."_str;
+
+  if (cache != nullptr)
+    return cache->list(str, &listing);
+
+  dir = Dir::open(str);
+  return notnil(dir);
+}
+
+/* ------------------------------------------------------------------------------------------------
+ */
+void Globber::Lister::close()
+{
+  if (notnil(dir))
+    dir.close();
+  dir = nil;
+}
+
+/* ------------------------------------------------------------------------------------------------
+ */
+s64 Globber::Lister::next(String* out_name)
+{
+  if (cache != nullptr)
+  {
+    if (next_entry == listing.count)
+      return 0;
+
+    DirCache::Entry& entry = cache->entries[listing.first + next_entry];
+    next_entry += 1;
+
+    *out_name = cache->getName(entry);
+    is_dir = entry.is_dir;
+    return out_name->len;
+  }
+
+  buffer.len = dir.next({buffer.arr, u64(buffer.capacity())});
+  if (buffer.len > 0)
+    *out_name = String::from(buffer.asSlice());
+  return buffer.len;
+}
+
+/* ------------------------------------------------------------------------------------------------
+ */
+b8 Globber::Lister::isDirectory(Path& full)
+{
+  if (cache != nullptr)
+    return is_dir;
+  return full.isDirectory();
+}
+
 }
 
 extern "C"
@@ -164,6 +225,53 @@ struct GlobResult
   s32 path_count;
 };
 
+/* ------------------------------------------------------------------------------------------------
+ *  Globs from lua on the same thread share a DirCache, which starts out
+ *  with the one saved at IRO_DIR_CACHE when that's set, as lake does for
+ *  the processes it runs.
+ *
+ *  Each thread gets its own, as lpp --batch runs metaprograms that glob on
+ *  several at once, and a DirCache hands out names pointing into storage
+ *  that grows as it reads.
+ */
+struct ThreadDirCache
+{
+  DirCache cache;
+  b8 initialized = false;
+
+  ~ThreadDirCache()
+  {
+    if (initialized)
+      cache.deinit();
+  }
+};
+
+static thread_local ThreadDirCache thread_dir_cache;
+
+static DirCache* getDirCache()
+{
+  DirCache& cache = thread_dir_cache.cache;
+  if (thread_dir_cache.initialized)
+    return &cache;
+  thread_dir_cache.initialized = true;
+
+  cache.init();
+
+  String var = "IRO_DIR_CACHE"_str;
+  s32 len = platform::getEnvVar(var, nil);
+  if (len > 0)
+  {
+    auto buffer = Bytes::from((u8*)mem::stl_allocator.allocate(len + 1),
+                              len + 1);
+    defer { mem::stl_allocator.free(buffer.ptr); };
+
+    platform::getEnvVar(var, buffer);
+    cache.load(String::from(buffer.ptr, len));
+  }
+
+  return &cache;
+}
+
 EXPORT_DYNAMIC
 GlobResult iro_glob(String pattern)
 {
@@ -175,7 +283,8 @@ GlobResult iro_glob(String pattern)
       String match = p.buffer.asStr();
       *matches.push() = match.allocateCopy();
       return true;
-    });
+    },
+    getDirCache());
   glob.destroy();
 
   return {matches.arr, matches.len()};
@@ -17,6 +17,7 @@
 #include "../io/IO.h"
 #include "../fs/Path.h"
 #include "../fs/FileSystem.h"
+#include "../fs/DirCache.h"
 
 #include "../memory/Bump.h"
 
@@ -83,7 +84,9 @@ struct Globber
   
   void destroy();
 
-  void run(GlobberCallback auto f);
+  // Calls 'f' with each path matching the pattern until it returns false.
+  // Directories are read through 'cache' when one is given.
+  void run(GlobberCallback auto f, DirCache* cache = nullptr);
 
 private:
 
@@ -91,6 +94,31 @@ private:
   
   void compilePattern();
 
+  /* ==========================================================================
+   *  Iterates the entries of a directory, through a DirCache when given one.
+   */
+  struct Lister
+  {
+    DirCache* cache;
+    DirCache::Listing listing;
+    u32 next_entry;
+    b8 is_dir;
+
+    Dir dir;
+    StackArray<u8, 255> buffer;
+
+    b8 open(DirCache* cache, Path path);
+    void close();
+
+    // Sets 'out_name' to the name of the next entry, which is valid until
+    // the next call or until the cache is used again. Returns its length,
+    // 0 when there are none left, or -1 if we fail to read the directory.
+    s64 next(String* out_name);
+
+    // Returns if the last entry, whose full path is 'full', is a directory.
+    b8 isDirectory(Path& full);
+  };
+
   Part* pushPart(Part::Kind kind, String raw);
   
 };
@@ -111,7 +139,7 @@ private:
  *              but im not too worried about it because zsh uses more memory 
  *              with the same globs so whatever.
  */
-void Globber::run(GlobberCallback auto callback)
+void Globber::run(GlobberCallback auto callback, DirCache* cache)
 {
   using enum Part::Kind;
 
@@ -136,6 +164,9 @@ void Globber::run(GlobberCallback auto callback)
 
   DLinkedPool<Entry> entry_stack = DLinkedPool<Entry>::create(&bump);
 
+  if (cache != nullptr)
+    cache->noteChdir();
+
   entry_stack.pushTail({curn, nil});
 
   while (!entry_stack.isEmpty())
@@ -216,25 +247,23 @@ void Globber::run(GlobberCallback auto callback)
         INFO("MatchEntry: opening ", path, "\n");
         SCOPED_INDENT;
 
-        StackArray<u8, 255> buffer;
-        Dir dir = Dir::open(path);
-        if (isnil(dir))
+        Lister lister;
+        if (!lister.open(cache, path))
           goto err;
-        defer { dir.close(); };
+        defer { lister.close(); };
         
         Path full = path.copy().ensureDir();
         auto rollback = full.makeRollback();
 
         for (;;)
         {
-          buffer.len = dir.next({buffer.arr, u64(buffer.capacity())});
-          if (buffer.len == -1)
+          String entstr;
+          s64 len = lister.next(&entstr);
+          if (len == -1)
             goto err;
-          if (buffer.len == 0)
+          if (len == 0)
             break;
 
-          String entstr = String::from(buffer.asSlice());
-
           if (entstr == "."_str || entstr == ".."_str)
             continue;
 
@@ -248,7 +277,7 @@ void Globber::run(GlobberCallback auto callback)
               if (!callback(full))
                 goto done;
             }
-            else if (full.isDirectory())
+            else if (lister.isDirectory(full))
             {
               INFO("match is a directory\n");
               entry_stack.pushTail({node->next, full.copy()});
@@ -266,26 +295,23 @@ void Globber::run(GlobberCallback auto callback)
         INFO("MatchDirectory: opening ", path, "\n");
         SCOPED_INDENT;
 
-        StackArray<u8, 255> buffer;
-        Dir dir = Dir::open(path);
-        if (isnil(dir))
+        Lister lister;
+        if (!lister.open(cache, path))
           goto err;
-        defer { dir.close(); };
+        defer { lister.close(); };
 
         Path full = path.copy().ensureDir();
         auto rollback = full.makeRollback();
 
         for (;;)
         {
-          buffer.len = dir.next({buffer.arr, u64(buffer.capacity())});
-
-          if (buffer.len == -1)
+          String entstr;
+          s64 len = lister.next(&entstr);
+          if (len == -1)
             goto err;
-          if (buffer.len == 0)
+          if (len == 0)
             break;
 
-          String entstr = String::from(buffer.asSlice());
-
           if (entstr == "."_str || entstr == ".."_str)
             continue;
 
@@ -293,7 +319,7 @@ void Globber::run(GlobberCallback auto callback)
           {
             full.append(entstr);
             INFO("path ", full, " matches ", part->raw, "\n");
-            if (full.isDirectory())
+            if (lister.isDirectory(full))
             {
               INFO("path exists and is a directory\n");
               entry_stack.pushTail({node->next, full.copy()});
@@ -311,18 +337,18 @@ void Globber::run(GlobberCallback auto callback)
         // recursively iterate over all files from the current path
         // and attempt to match the next part against them
 
-        DLinkedPool<Dir> dir_stack = DLinkedPool<Dir>::create(&bump);
+        DLinkedPool<Lister> dir_stack = DLinkedPool<Lister>::create(&bump);
         DLinkedPool<Path> dir_path_stack = DLinkedPool<Path>::create(&bump);
 
-        dir_path_stack.pushTail(path);
-
         INFO("DoubleStar: opening ", path, "\n");
         SCOPED_INDENT;
-        dir_stack.pushHead(
-          Dir::open(
-            notnil(path)? 
-            path.copy() : 
-            Path::from("."_str, &bump)));
+        {
+          Lister lister;
+          if (!lister.open(cache, path))
+            break;
+          dir_path_stack.pushTail(path);
+          dir_stack.pushHead(lister);
+        }
 
         assert(node->next); // IDK if this will ever happen??
         Part* next_part = node->next->data;
@@ -341,27 +367,28 @@ void Globber::run(GlobberCallback auto callback)
           if (recurse)
           {
             INFO("recursing into ", dir_path_stack.head(), "\n");
-            Dir d = Dir::open(dir_path_stack.head());
-            if (isnil(d))
+            recurse = false;
+
+            Lister lister;
+            if (!lister.open(cache, dir_path_stack.head()))
             {
+              // Skip directories we can't read rather than iterating the
+              // one we were in as if it were this one.
               dir_path_stack.popHead();
-              if (dir_path_stack.isEmpty())
-                break;
+              continue;
             }
-            dir_stack.pushHead(d);
-            recurse = false;
+            dir_stack.pushHead(lister);
           }
 
-          Dir* dir = &dir_stack.head();
+          Lister* dir = &dir_stack.head();
           INFO("iterating path ", dir_path_stack.head(), "\n");
 
-          StackArray<u8, 255> dirent;
-
-          dirent.len = dir->next({dirent.arr, u64(dirent.capacity())});
-          if (dirent.len == -1)
+          String s;
+          s64 len = dir->next(&s);
+          if (len == -1)
             goto err;
 
-          if (dirent.len == 0)
+          if (len == 0)
           {
             dir->close(); 
 
@@ -377,8 +404,6 @@ void Globber::run(GlobberCallback auto callback)
 
             continue;
           }
-          
-          String s = String::from(dirent.asSlice());
 
           if (s == "."_str || s == ".."_str)
           {
@@ -424,7 +449,7 @@ void Globber::run(GlobberCallback auto callback)
             break;
           }
 
-          if (full.isDirectory())
+          if (dir->isDirectory(full))
           {
             INFO("pushing dir ", full, "\n");
             entry_stack.pushTail({node->next, full.copy()});
@@ -0,0 +1,42 @@
+#include "Watcher.h"
+#include "../Platform.h"
+
+namespace iro::fs
+{
+
+/* ----------------------------------------------------------------------------
+ */
+Watcher Watcher::create()
+{
+  Watcher out = {};
+  if (!platform::watcherCreate(&out.handle))
+    return nil;
+  return out;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Watcher::destroy()
+{
+  if (handle)
+    platform::watcherDestroy(handle);
+  handle = nullptr;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Watcher::add(String path, void* userdata)
+{
+  assert(handle);
+  return platform::watcherAdd(handle, path, userdata);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 Watcher::wait(Slice<Event> out_events, TimeSpan timeout)
+{
+  assert(handle);
+  return platform::watcherWait(handle, out_events, timeout);
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+ *  Watching directories for changes to the files in them.
+ */
+
+#ifndef _iro_Watcher_h
+#define _iro_Watcher_h
+
+#include "../Common.h"
+#include "../Unicode.h"
+#include "../containers/Slice.h"
+#include "../time/Time.h"
+
+namespace iro::fs
+{
+
+/* ============================================================================
+ *  A set of directories whose files are watched for being written, created,
+ *  or removed, for when we want to react to files changing without
+ *  repeatedly stat'ing them.
+ *
+ *  Directories are watched rather than individual files as many editors
+ *  save by writing a new file and renaming it over the old one, which would
+ *  leave a watch on the old file with nothing to see. Subdirectories are not
+ *  watched along with their parent.
+ *
+ *  Not every platform supports this, in which case create() returns nil.
+ */
+struct Watcher
+{
+  typedef void* Handle;
+
+  Handle handle;
+
+  struct Event
+  {
+    enum class Kind
+    {
+      // A file was written to.
+      Modified,
+      // A file was created or moved into the directory.
+      Created,
+      // A file was removed or moved out of the directory.
+      Removed,
+      // Too many events happened before we could read them and some were
+      // lost, so anything may have changed. 'userdata' and 'name' are not
+      // set.
+      Overflowed,
+    };
+
+    Kind kind;
+
+    // The user data given when the directory was added.
+    void* userdata;
+
+    // The name of the file within the directory, which is only valid until
+    // the next call to wait().
+    String name;
+  };
+
+  static Watcher create();
+  void destroy();
+
+  // Watches the directory at 'path', which must be null-terminated,
+  // reporting 'userdata' with each change to it. Adding a directory that
+  // is already watched replaces its user data.
+  b8 add(String path, void* userdata);
+
+  // Blocks until something changes or 'timeout' passes, writing what
+  // changed into 'out_events'. Returns how many were written, which is 0
+  // on timeout, or -1 on error. A negative 'timeout' waits indefinitely.
+  s32 wait(Slice<Event> out_events, TimeSpan timeout);
+
+  DefineNilTrait(Watcher, {nullptr}, x.handle == nullptr);
+};
+
+}
+
+#endif // _iro_Watcher_h
@@ -1,12 +1,18 @@
 local sys = require "build.sys"
+local List = require "List"
 local bobj = require "build.object"
 
 local proj = sys.getLoadingProject()
 
 proj:dependsOn "iro"
 
+local mainobj
 for cfile in lake.find "src/**/*.cpp" :each() do
-  proj.report.CppObj(cfile)
+  if not cfile:find "main%.cpp" then
+    proj.report.CppObj(cfile)
+  else
+    mainobj = proj.report.CppObj(cfile)
+  end
 end
 
 for lfile in lake.find "src/*.lua" :each() do
@@ -18,3 +24,19 @@ local exe =
     proj:gatherBuildObjects{bobj.CppObj, bobj.LuaObj})
 
 proj.report.published(exe)
+
+-- Benchmarks. Each is built as its own exe linking against everything lake 
+-- does, except for main.
+for cfile in lake.find "tests/bench/*.cpp" :each() do
+  local benchobjs = List{ proj.report.CppObj(cfile) }
+  for obj in proj:gatherBuildObjects{bobj.CppObj, bobj.LuaObj}:each() do
+    if obj ~= mainobj and 
+       not (obj.proj == proj and obj.src:find "^tests/") 
+    then
+      benchobjs:push(obj)
+    end
+  end
+
+  local name = cfile:match "tests/bench/(.*)%.cpp"
+  proj.report.Exe("lake-"..name:lower(), benchobjs)
+end
@@ -0,0 +1,240 @@
+#include "BuildDB.h"
+
+#include "iro/Logger.h"
+#include "iro/Platform.h"
+#include "iro/fs/File.h"
+#include "iro/io/IO.h"
+
+static Logger logger =
+  Logger::create("lake.builddb"_str, Logger::Verbosity::Notice);
+
+// Bump whenever the layout of the database or the way anything in it is
+// hashed changes.
+static const u32 db_version = 3;
+
+/* ============================================================================
+ *  The database is laid out as this header followed by the file records and
+ *  then the task records.
+ */
+struct DBHeader
+{
+  u8  magic[4];
+  u32 version;
+  u64 file_count;
+  u64 task_count;
+};
+
+static const u8 db_magic[4] = { 'l', 'k', 'd', 'b' };
+
+/* ----------------------------------------------------------------------------
+ */
+b8 BuildDB::init()
+{
+  if (!file_pool.init())
+    return false;
+  if (!file_map.init())
+    return false;
+  if (!task_pool.init())
+    return false;
+  if (!task_map.init())
+    return false;
+  dirty = false;
+  files_hashed = 0;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void BuildDB::deinit()
+{
+  task_map.deinit();
+  task_pool.deinit();
+  file_map.deinit();
+  file_pool.deinit();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void BuildDB::load(String path)
+{
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+  {
+    DEBUG("no build database at ", path, "\n");
+    return;
+  }
+  defer { file.close(); };
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+  data.consume(&file, 1 << 16);
+
+  if (data.len < sizeof(DBHeader))
+  {
+    WARN("ignoring truncated build database ", path, "\n");
+    return;
+  }
+
+  auto* header = (DBHeader*)data.ptr;
+  if (!mem::equal(header->magic, (void*)db_magic, sizeof(db_magic)) ||
+      header->version != db_version)
+  {
+    DEBUG("ignoring outdated build database ", path, "\n");
+    return;
+  }
+
+  u64 files_size = header->file_count * sizeof(FileRecord);
+  u64 tasks_size = header->task_count * sizeof(TaskRecord);
+
+  if (data.len != sizeof(DBHeader) + files_size + tasks_size)
+  {
+    WARN("ignoring corrupt build database ", path, "\n");
+    return;
+  }
+
+  auto* files = (FileRecord*)(data.ptr + sizeof(DBHeader));
+  for (u64 i = 0; i < header->file_count; ++i)
+  {
+    FileRecord* record = file_pool.add();
+    *record = files[i];
+    file_map.insert(record);
+  }
+
+  auto* tasks = (TaskRecord*)(data.ptr + sizeof(DBHeader) + files_size);
+  for (u64 i = 0; i < header->task_count; ++i)
+  {
+    TaskRecord* record = task_pool.add();
+    *record = tasks[i];
+    task_map.insert(record);
+  }
+
+  DEBUG("loaded ", header->file_count, " file records and ",
+        header->task_count, " task records from ", path, "\n");
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 BuildDB::save(String path)
+{
+  DBHeader header;
+  mem::copy(header.magic, (void*)db_magic, sizeof(db_magic));
+  header.version = db_version;
+  header.file_count = 0;
+  header.task_count = 0;
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+
+  data.write({(u8*)&header, sizeof(header)});
+
+  for (FileRecord& record : file_map)
+  {
+    data.write({(u8*)&record, sizeof(FileRecord)});
+    header.file_count += 1;
+  }
+
+  for (TaskRecord& record : task_map)
+  {
+    data.write({(u8*)&record, sizeof(TaskRecord)});
+    header.task_count += 1;
+  }
+
+  mem::copy(data.ptr, &header, sizeof(header));
+
+  // Write to a temp file and move it into place so that an interrupted
+  // save doesn't leave a corrupt database behind.
+  io::Memory tmp_path;
+  tmp_path.open();
+  defer { tmp_path.close(); };
+  io::formatv(&tmp_path, path, '.', platform::getPid());
+
+  {
+    auto file =
+      fs::File::from(
+        tmp_path.asStr(),
+          fs::OpenFlag::Create
+        | fs::OpenFlag::Write
+        | fs::OpenFlag::Truncate);
+    if (isnil(file))
+      return ERROR("failed to open build database ", tmp_path.asStr(),
+                   " for writing\n");
+    defer { file.close(); };
+
+    if (file.write(data.asBytes()) != data.len)
+      return ERROR("failed to write build database ", tmp_path.asStr(),
+                   "\n");
+  }
+
+  if (!fs::File::rename(path, tmp_path.asStr()))
+  {
+    fs::File::unlink(tmp_path.asStr());
+    return ERROR("failed to move build database into place at ", path, "\n");
+  }
+
+  dirty = false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u64 BuildDB::hashFile(
+    String path,
+    u64 path_hash,
+    const StatCache::Entry& stat)
+{
+  FileRecord* record = file_map.find(path_hash);
+  if (record != nullptr &&
+      record->modtime == stat.modtime &&
+      record->size == stat.size)
+    return record->content_hash;
+
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+    return 0;
+  defer { file.close(); };
+
+  files_hashed += 1;
+
+  u64 hash = 14695981039346656037ull;
+  u8 buffer[1 << 16];
+  for (;;)
+  {
+    s64 bytes_read = file.read({buffer, sizeof(buffer)});
+    if (bytes_read <= 0)
+      break;
+
+    for (s64 i = 0; i < bytes_read; ++i)
+      hash = (hash ^ buffer[i]) * 1099511628211;
+  }
+
+  if (record == nullptr)
+  {
+    record = file_pool.add();
+    record->path_hash = path_hash;
+    file_map.insert(record);
+  }
+
+  record->modtime = stat.modtime;
+  record->size = stat.size;
+  record->content_hash = hash;
+  dirty = true;
+
+  return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+BuildDB::TaskRecord* BuildDB::addTask(u64 uid)
+{
+  TaskRecord* record = task_pool.add();
+  record->uid = uid;
+  record->input_hash = 0;
+  record->output_hash = 0;
+  record->duration_us = 0;
+  record->peak_memory = 0;
+  task_map.insert(record);
+  dirty = true;
+  return record;
+}
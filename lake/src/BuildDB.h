@@ -0,0 +1,99 @@
+/*
+ *  What lake remembers about a build between runs.
+ *
+ *  For tasks that opt into it (Task:trackContent), lake records a hash of
+ *  their inputs, being the contents of their prerequisites plus a key given
+ *  by the user (usually the command line used to build the task), and a
+ *  hash of the file the task outputs. This lets conditions ask if anything
+ *  actually changed (lake.unchanged) rather than relying on modified times,
+ *  which change on a 'git checkout' or when a file is regenerated with the
+ *  same content. It also lets lake skip rebuilding the dependents of a task
+ *  whose recipe wrote exactly what was already there.
+ *
+ *  The time each task's recipe took is recorded as well, so that lake can
+ *  start the tasks with the longest chain of work after them first, along 
+ *  with the most memory any process it ran used, so that lake can avoid 
+ *  running more recipes at once than fit in memory.
+ *
+ *  So that files are not read on every run, their hashes are stored along
+ *  with the modified time and size they were taken at, and are only
+ *  recomputed when either changes.
+ */
+
+#ifndef _lake_BuildDB_h
+#define _lake_BuildDB_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/AVL.h"
+#include "iro/containers/Pool.h"
+
+#include "StatCache.h"
+
+using namespace iro;
+
+/* ============================================================================
+ */
+struct BuildDB
+{
+  struct FileRecord
+  {
+    // Hash of the file's absolute path, see StatCache::hashPath.
+    u64 path_hash;
+
+    u64 modtime;
+    u64 size;
+    u64 content_hash;
+  };
+
+  struct TaskRecord
+  {
+    u64 uid;
+    u64 input_hash;
+    u64 output_hash; // 0 if the Task's content has not been recorded.
+
+    // How long the Task's recipe took the last time it ran, used to 
+    // estimate how long it will take next time. 0 if it hasn't run.
+    u64 duration_us;
+
+    // The peak memory, in bytes, of the processes the Task's recipe ran the
+    // last time it ran. 0 if it hasn't run or ran none.
+    u64 peak_memory;
+  };
+
+  typedef AVL<FileRecord, [](const FileRecord* r) { return r->path_hash; }>
+    FileMap;
+  typedef AVL<TaskRecord, [](const TaskRecord* r) { return r->uid; }>
+    TaskMap;
+
+  Pool<FileRecord> file_pool;
+  FileMap          file_map;
+
+  Pool<TaskRecord> task_pool;
+  TaskMap          task_map;
+
+  // Set when a record changes, so we know if the database needs saving.
+  b8 dirty;
+
+  // How many files had to be read to get their hashes this run.
+  u64 files_hashed;
+
+  b8   init();
+  void deinit();
+
+  // Loads the records saved at 'path' by a previous run. A missing or
+  // outdated database is not an error, we just start with nothing.
+  void load(String path);
+
+  b8 save(String path);
+
+  // Returns a hash of the content of the file at 'path', which 'stat'
+  // describes. The file is only read if it has changed since the last time
+  // it was hashed.
+  u64 hashFile(String path, u64 path_hash, const StatCache::Entry& stat);
+
+  TaskRecord* findTask(u64 uid) { return task_map.find(uid); }
+  TaskRecord* addTask(u64 uid);
+};
+
+#endif // _lake_BuildDB_h
@@ -0,0 +1,436 @@
+#include "GraphCache.h"
+
+#include "Lake.h"
+
+#include "iro/Logger.h"
+#include "iro/Platform.h"
+#include "iro/fs/File.h"
+#include "iro/fs/Glob.h"
+
+static Logger logger =
+  Logger::create("lake.graphcache"_str, Logger::Verbosity::Notice);
+
+// Bump whenever the layout of the cache or the way anything in it is hashed
+// changes.
+static const u32 cache_version = 1;
+
+/* ============================================================================
+ *  The cache is laid out as this header followed by the file, environment
+ *  variable, and glob records and then the strings they refer to.
+ */
+struct CacheHeader
+{
+  u8  magic[4];
+  u32 version;
+  u64 args_hash;
+  u32 file_count;
+  u32 env_var_count;
+  u32 glob_count;
+  u32 strings_len;
+};
+
+static const u8 cache_magic[4] = { 'l', 'k', 'g', 'c' };
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 hashString(u64 hash, String s)
+{
+  for (u8 c : s)
+    hash = (hash ^ c) * 1099511628211;
+  return (hash ^ '\n') * 1099511628211;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Matches are hashed such that the order the globber finds them in doesn't
+ *  matter.
+ */
+static u64 hashGlobMatch(u64 hash, String match)
+{
+  return hash + hashString(14695981039346656037ull, match);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 hashArgs(Lake& lake)
+{
+  u64 hash = 14695981039346656037ull;
+  for (int i = 1; i < lake.argc; ++i)
+    hash = hashString(hash, String::fromCStr(lake.argv[i]));
+  return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ *  'name' must be null-terminated.
+ */
+static u64 hashEnvVar(String name)
+{
+  s32 len = platform::getEnvVar(name, nil);
+  if (len == -1)
+    return 0;
+
+  auto buffer = Bytes::from((u8*)mem::stl_allocator.allocate(len + 1),
+                            len + 1);
+  defer { mem::stl_allocator.free(buffer.ptr); };
+
+  platform::getEnvVar(name, buffer);
+  return hashString(14695981039346656037ull, String::from(buffer.ptr, len));
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static GraphCache::StrRef addString(io::Memory& strings, String s)
+{
+  GraphCache::StrRef ref;
+  ref.offset = strings.len;
+  strings.write({s.ptr, s.len});
+  ref.len = strings.len - ref.offset;
+  strings.write({(u8*)"", 1});
+  return ref;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Adds the absolute form of 'path' to 'strings'. A relative 'path' is
+ *  taken to be relative to 'dir', or the current directory if it is nil.
+ */
+static GraphCache::StrRef addPath(
+    io::Memory& strings,
+    String path,
+    String dir = nil)
+{
+  if (fs::Path::isRooted(path))
+    return addString(strings, path);
+
+  GraphCache::StrRef ref;
+  ref.offset = strings.len;
+
+  if (isnil(dir))
+  {
+    auto cwd = fs::Path::cwd();
+    defer { cwd.destroy(); };
+    io::formatv(&strings, cwd, '/', path);
+  }
+  else
+  {
+    io::formatv(&strings, dir, '/', path);
+  }
+
+  ref.len = strings.len - ref.offset;
+  strings.write({(u8*)"", 1});
+  return ref;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static String getString(io::Memory& strings, GraphCache::StrRef ref)
+{
+  return String::from(strings.ptr + ref.offset, ref.len);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void addFile(GraphCache& cache, Lake& lake, String path,
+                    String dir = nil)
+{
+  GraphCache::FileRecord* record = cache.files.push();
+  *record = {};
+  record->path = addPath(cache.strings, path, dir);
+
+  StatCache::Entry* entry =
+    lake.stat_cache.get(getString(cache.strings, record->path));
+  record->exists = entry->exists;
+  if (entry->exists)
+  {
+    record->modtime = entry->modtime;
+    record->size = entry->size;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 GraphCache::init()
+{
+  if (!strings.open())
+    return false;
+  if (!files.init())
+    return false;
+  if (!env_vars.init())
+    return false;
+  if (!globs.init())
+    return false;
+  if (!env_var_names.init())
+    return false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void GraphCache::deinit()
+{
+  strings.close();
+  files.destroy();
+  env_vars.destroy();
+  globs.destroy();
+  env_var_names.destroy();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void GraphCache::recordFile(Lake& lake, String path)
+{
+  addFile(*this, lake, path);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void GraphCache::recordEnvVar(String name, b8 set)
+{
+  u64 name_hash = name.hash();
+  for (u64 seen : env_var_names)
+  {
+    if (seen == name_hash)
+      return;
+  }
+  env_var_names.push(name_hash);
+
+  // A variable the lakefile set before getting it has whatever value the
+  // lakefile gave it, which tells us nothing.
+  if (set)
+    return;
+
+  EnvVarRecord* record = env_vars.push();
+  record->name = addString(strings, name);
+  record->value_hash = hashEnvVar(getString(strings, record->name));
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u32 GraphCache::recordGlob(String pattern)
+{
+  auto cwd = fs::Path::cwd();
+  defer { cwd.destroy(); };
+
+  GlobRecord* record = globs.push();
+  record->dir = addString(strings, cwd.asStr());
+  record->pattern = addString(strings, pattern);
+  record->result_hash = 0;
+  return globs.len() - 1;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void GraphCache::recordGlobMatch(u32 glob, String match)
+{
+  globs[glob].result_hash = hashGlobMatch(globs[glob].result_hash, match);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 GraphCache::save(String path, Lake& lake)
+{
+  LuaState& lua = lake.lua;
+
+  addFile(*this, lake, lake.initpath);
+
+  lua.getfield(lake.I.lake, "lua_files");
+  for (s32 i = 1; i <= lua.objlen(); ++i)
+  {
+    lua.rawgeti(-1, i);
+    addFile(*this, lake, lua.tostring());
+    lua.pop();
+  }
+  lua.pop();
+
+#if IRO_LINUX
+  // So that a new build of lake, which may do things differently, runs
+  // the lakefile again.
+  addFile(*this, lake, "/proc/self/exe"_str);
+#endif
+
+  for (Task* task : lake.graph.tasks)
+    addFile(*this, lake, task->name, task->wdir.asStr());
+
+  CacheHeader header;
+  mem::copy(header.magic, (void*)cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.args_hash = hashArgs(lake);
+  header.file_count = files.len();
+  header.env_var_count = env_vars.len();
+  header.glob_count = globs.len();
+  header.strings_len = strings.len;
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+
+  data.write({(u8*)&header, sizeof(header)});
+  data.write({(u8*)files.arr, files.len() * sizeof(FileRecord)});
+  data.write({(u8*)env_vars.arr, env_vars.len() * sizeof(EnvVarRecord)});
+  data.write({(u8*)globs.arr, globs.len() * sizeof(GlobRecord)});
+  data.write(strings.asBytes());
+
+  // Write to a temp file and move it into place so that an interrupted
+  // save doesn't leave a corrupt cache behind.
+  io::Memory tmp_path;
+  tmp_path.open();
+  defer { tmp_path.close(); };
+  io::formatv(&tmp_path, path, '.', platform::getPid());
+
+  {
+    auto file =
+      fs::File::from(
+        tmp_path.asStr(),
+          fs::OpenFlag::Create
+        | fs::OpenFlag::Write
+        | fs::OpenFlag::Truncate);
+    if (isnil(file))
+      return ERROR("failed to open graph cache ", tmp_path.asStr(),
+                   " for writing\n");
+    defer { file.close(); };
+
+    if (file.write(data.asBytes()) != data.len)
+      return ERROR("failed to write graph cache ", tmp_path.asStr(), "\n");
+  }
+
+  if (!fs::File::rename(path, tmp_path.asStr()))
+  {
+    fs::File::unlink(tmp_path.asStr());
+    return ERROR("failed to move graph cache into place at ", path, "\n");
+  }
+
+  DEBUG("saved ", header.file_count, " files, ", header.env_var_count,
+        " environment variables, and ", header.glob_count, " globs to ",
+        path, "\n");
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Checks are made from cheapest to most expensive, stopping at the first
+ *  thing that changed.
+ */
+b8 GraphCache::isUpToDate(String path, Lake& lake)
+{
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+  {
+    DEBUG("no graph cache at ", path, "\n");
+    return false;
+  }
+  defer { file.close(); };
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+  data.consume(&file, 1 << 16);
+
+  if (data.len < sizeof(CacheHeader))
+  {
+    WARN("ignoring truncated graph cache ", path, "\n");
+    return false;
+  }
+
+  auto* header = (CacheHeader*)data.ptr;
+  if (!mem::equal(header->magic, (void*)cache_magic, sizeof(cache_magic)) ||
+      header->version != cache_version)
+  {
+    DEBUG("ignoring outdated graph cache ", path, "\n");
+    return false;
+  }
+
+  u64 files_size = header->file_count * sizeof(FileRecord);
+  u64 env_vars_size = header->env_var_count * sizeof(EnvVarRecord);
+  u64 globs_size = header->glob_count * sizeof(GlobRecord);
+
+  if (data.len != sizeof(CacheHeader) + files_size + env_vars_size +
+                  globs_size + header->strings_len)
+  {
+    WARN("ignoring corrupt graph cache ", path, "\n");
+    return false;
+  }
+
+  auto* files = (FileRecord*)(data.ptr + sizeof(CacheHeader));
+  auto* env_vars = (EnvVarRecord*)((u8*)files + files_size);
+  auto* globs = (GlobRecord*)((u8*)env_vars + env_vars_size);
+  u8* strings = (u8*)globs + globs_size;
+
+  auto getString = [strings, header](StrRef ref)
+  {
+    if (u64(ref.offset) + ref.len >= header->strings_len)
+      return String(nil);
+    return String::from(strings + ref.offset, ref.len);
+  };
+
+  if (header->args_hash != hashArgs(lake))
+  {
+    DEBUG("arguments changed since the graph was cached\n");
+    return false;
+  }
+
+  for (u32 i = 0; i < header->env_var_count; ++i)
+  {
+    String name = getString(env_vars[i].name);
+    if (isnil(name))
+      return false;
+
+    if (hashEnvVar(name) != env_vars[i].value_hash)
+    {
+      DEBUG("environment variable ", name, " changed since the graph was "
+            "cached\n");
+      return false;
+    }
+  }
+
+  for (u32 i = 0; i < header->file_count; ++i)
+  {
+    FileRecord& record = files[i];
+
+    String file_path = getString(record.path);
+    if (isnil(file_path))
+      return false;
+
+    StatCache::Entry* entry = lake.stat_cache.get(file_path);
+    if (entry->exists != b8(record.exists) ||
+        (entry->exists && (entry->modtime != record.modtime ||
+                           entry->size != record.size)))
+    {
+      DEBUG(file_path, " changed since the graph was cached\n");
+      return false;
+    }
+  }
+
+  defer
+  {
+    lake.root_dir.chdir();
+    lake.stat_cache.noteChdir();
+  };
+
+  for (u32 i = 0; i < header->glob_count; ++i)
+  {
+    GlobRecord& record = globs[i];
+
+    String dir = getString(record.dir);
+    String pattern = getString(record.pattern);
+    if (isnil(dir) || isnil(pattern) || !fs::Path::chdir(dir))
+      return false;
+
+    u64 hash = 0;
+    auto globber = fs::Globber::create(pattern);
+    globber.run(
+      [&hash](fs::Path& p)
+      {
+        hash = hashGlobMatch(hash, p.buffer.asStr());
+        return true;
+      },
+      &lake.dir_cache);
+    globber.destroy();
+
+    if (hash != record.result_hash)
+    {
+      DEBUG("the files matching '", pattern, "' in ", dir, " changed since "
+            "the graph was cached\n");
+      return false;
+    }
+  }
+
+  return true;
+}
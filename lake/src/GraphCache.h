@@ -0,0 +1,123 @@
+/*
+ *  Skipping the lakefile entirely when a build would have nothing to do.
+ *
+ *  Running the lakefile, and whatever it requires, globs, and reads, can
+ *  take a noticeable amount of time before any Task is even checked, which
+ *  is most of the time a build takes when nothing changed. So, after a
+ *  build that ran no recipes, we save what the lakefile depended on along
+ *  with the state of the file named by every Task in the graph it built:
+ *
+ *    The arguments lake was given and lake itself.
+ *
+ *    Every lua file run by the lakefile and every dep file it loaded.
+ *
+ *    Every other file it read through io.open or looked at through
+ *    lake.pathExists, lake.modtime, lake.newestModtime, lake.fileSize, or
+ *    lake.hashKey.
+ *
+ *    The value of every environment variable it got through
+ *    lake.getEnvVar, unless it set that variable first.
+ *
+ *    What each of its globs matched.
+ *
+ *  The next run checks these before running the lakefile and, if none of
+ *  them changed, there is nothing to do, as the lakefile would build the
+ *  same graph and every condition would see the same files it did when it
+ *  said its Task was up to date.
+ *
+ *  Conditions and recipes are lua functions which can't be saved, so the
+ *  graph itself is not loaded back; a build that has anything to do always
+ *  runs the lakefile. This relies on conditions only looking at the files
+ *  of Tasks, and the lakefile only depending on the things above. A
+ *  lakefile that depends on anything else, such as the output of a process
+ *  it runs or a file it reads without io.open, must be run with
+ *  --no-graph-cache.
+ */
+
+#ifndef _lake_GraphCache_h
+#define _lake_GraphCache_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/Array.h"
+#include "iro/io/IO.h"
+
+using namespace iro;
+
+struct Lake;
+
+/* ============================================================================
+ */
+struct GraphCache
+{
+  // A string in 'strings'.
+  struct StrRef
+  {
+    u32 offset;
+    u32 len;
+  };
+
+  // The state of a file when it was recorded, by its absolute path.
+  struct FileRecord
+  {
+    StrRef path;
+    u64    modtime;
+    u64    size;
+    u64    exists;
+  };
+
+  // An environment variable and a hash of its value, which is 0 if it
+  // wasn't set.
+  struct EnvVarRecord
+  {
+    StrRef name;
+    u64    value_hash;
+  };
+
+  // A glob run from 'dir' and a hash of what it matched.
+  struct GlobRecord
+  {
+    StrRef dir;
+    StrRef pattern;
+    u64    result_hash;
+  };
+
+  // What the lakefile has depended on so far, each string being followed
+  // by a null terminator.
+  io::Memory          strings;
+  Array<FileRecord>   files;
+  Array<EnvVarRecord> env_vars;
+  Array<GlobRecord>   globs;
+
+  // Hashes of the names of environment variables either recorded or set by
+  // the lakefile, as only their first value matters.
+  Array<u64> env_var_names;
+
+  b8   init();
+  void deinit();
+
+  // Notes that the lakefile depends on the file at 'path', relative to the
+  // current directory.
+  void recordFile(Lake& lake, String path);
+
+  // Notes that the lakefile got the value of the environment variable
+  // 'name', or set it when 'set' is true.
+  void recordEnvVar(String name, b8 set = false);
+
+  // Notes a glob the lakefile is about to run from the current directory,
+  // returning its index, which each match should be passed to
+  // recordGlobMatch with.
+  u32  recordGlob(String pattern);
+  void recordGlobMatch(u32 glob, String match);
+
+  // Saves what the lakefile depended on and the state of every Task's file
+  // to 'path'. Should only be called after a build that ran no recipes.
+  b8 save(String path, Lake& lake);
+
+  // Returns true if the graph saved at 'path' says the build has nothing to
+  // do, in which case the lakefile doesn't need to be run. A missing or
+  // outdated cache is not an error.
+  b8 isUpToDate(String path, Lake& lake);
+};
+
+#endif // _lake_GraphCache_h
@@ -0,0 +1,126 @@
+#include "JobLimiter.h"
+
+#include "Task.h"
+
+#include "iro/Logger.h"
+#include "iro/Platform.h"
+
+static Logger logger =
+  Logger::create("lake.jobs"_str, Logger::Verbosity::Notice);
+
+// How often we look at the system again while deciding on recipes.
+static const s64 sample_interval_ms = 250;
+
+// The share of recent time in which something stalled on memory that we
+// stop starting recipes at.
+static const f32 max_pressure = 10.f;
+
+/* ----------------------------------------------------------------------------
+ */
+static void sample(JobLimiter& limiter)
+{
+  TimePoint now = TimePoint::monotonic();
+  if (notnil(limiter.sampled_at) &&
+      (now - limiter.sampled_at).toMilliseconds() < sample_interval_ms)
+    return;
+  limiter.sampled_at = now;
+
+  u64 total;
+  limiter.have_memory = platform::getMemoryInfo(&total, &limiter.available);
+  limiter.have_load = platform::getLoadAverage(&limiter.load);
+  limiter.have_pressure = platform::getMemoryPressure(&limiter.pressure);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 JobLimiter::init()
+{
+  enabled = true;
+  processor_count = platform::getProcessorCount();
+
+  u64 total = 0;
+  u64 unused;
+  if (platform::getMemoryInfo(&total, &unused))
+    reserve = total / 16;
+  else
+    reserve = 0;
+
+  budget = committed = 0;
+  sampled_at = nil;
+  have_memory = have_load = have_pressure = false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void JobLimiter::beginBuild()
+{
+  committed = 0;
+  if (!enabled)
+    return;
+
+  sampled_at = nil;
+  sample(*this);
+
+  budget = have_memory && available > reserve? available - reserve : 0;
+
+  DEBUG("recipes may use ", budget / (1024 * 1024), "MiB, ",
+        processor_count, " processors\n");
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 JobLimiter::admit(Task* task, u32 active_count, u64 reserved)
+{
+  if (!enabled || active_count == 0)
+    return true;
+
+  sample(*this);
+
+  if (have_memory && available < reserve)
+  {
+    DEBUG("holding back '", task->name, "', only ",
+          available / (1024 * 1024), "MiB of memory is available\n");
+    return false;
+  }
+
+  if (have_pressure && pressure >= max_pressure)
+  {
+    DEBUG("holding back '", task->name, "', the system is stalling on "
+          "memory ", pressure, "% of the time\n");
+    return false;
+  }
+
+  // The load average counts our own recipes, which are assumed to keep a
+  // processor busy each.
+  if (have_load && load - active_count >= processor_count)
+  {
+    DEBUG("holding back '", task->name, "', the load average is ", load,
+          "\n");
+    return false;
+  }
+
+  if (budget != 0 &&
+      committed + task->estimate_memory + reserved > budget)
+  {
+    DEBUG("holding back '", task->name, "', which is expected to need ",
+          task->estimate_memory / (1024 * 1024), "MiB\n");
+    return false;
+  }
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void JobLimiter::onStart(Task* task)
+{
+  committed += task->estimate_memory;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void JobLimiter::onEnd(Task* task)
+{
+  committed -= task->estimate_memory;
+}
@@ -0,0 +1,76 @@
+/*
+ *  Deciding whether the machine can take another recipe, on top of the
+ *  hard cap of max_jobs.
+ *
+ *  Recipes differ wildly in how much memory they need. A small C++ object
+ *  takes a hundred megabytes or so, while one run through lppclang's
+ *  reflection can take over a gigabyte, so any fixed job count either runs
+ *  out of memory on the big ones or leaves cores idle on the small ones.
+ *
+ *  The build database records the peak memory of the processes each recipe
+ *  ran, and a recipe is only started if what we expect every running
+ *  recipe to need, plus what it needs, fits in the memory that was
+ *  available when the build started. Recipes that have never run are
+ *  expected to need the average of those that have.
+ *
+ *  As estimates can be wrong and other programs use memory too, we also
+ *  hold off while the system is low on memory right now, is stalling on
+ *  memory (when the kernel tracks pressure stalls), or is already loaded
+ *  with more work than it has processors without counting our own.
+ *
+ *  One recipe is always allowed to run so that the build makes progress.
+ *  Disabled by --no-adaptive-jobs.
+ */
+
+#ifndef _lake_JobLimiter_h
+#define _lake_JobLimiter_h
+
+#include "iro/Common.h"
+#include "iro/time/Time.h"
+
+using namespace iro;
+
+struct Task;
+
+/* ============================================================================
+ */
+struct JobLimiter
+{
+  b8 enabled;
+
+  u32 processor_count;
+
+  // Memory kept free for everything but recipes.
+  u64 reserve;
+
+  // Memory the running recipes are expected to stay within, taken from
+  // what was available when the build started, and the sum of the
+  // estimates of those running.
+  u64 budget;
+  u64 committed;
+
+  // The last look at the system, which is refreshed at most every so
+  // often. Each is only used when the platform is able to provide it.
+  TimePoint sampled_at;
+  b8  have_memory;
+  u64 available;
+  b8  have_load;
+  f64 load;
+  b8  have_pressure;
+  f32 pressure;
+
+  b8 init();
+
+  // Takes the budget from the memory available now.
+  void beginBuild();
+
+  // Returns if 'task's recipe may start while 'active_count' others are
+  // running, leaving 'reserved' bytes of the budget for a recipe held back
+  // before it.
+  b8 admit(Task* task, u32 active_count, u64 reserved);
+
+  void onStart(Task* task);
+  void onEnd(Task* task);
+};
+
+#endif // _lake_JobLimiter_h
@@ -15,6 +15,8 @@
 #include "iro/time/Time.h"
 
 #include "iro/Process.h"
+#include "iro/DepFile.h"
+#include "iro/fs/File.h"
 #include "iro/fs/Glob.h"
 #include "iro/fs/Path.h"
 
@@ -22,6 +24,10 @@
 
 #include "iro/ArgIter.h"
 
+#if IRO_LINUX
+#include "sys/resource.h"
+#endif
+
 using namespace iro;
 
 extern "C"
@@ -35,6 +41,8 @@ int lua__canonicalizePath(lua_State* L);
 EXPORT_DYNAMIC
 int lua__glob(lua_State* L);
 EXPORT_DYNAMIC
+int lua__readDepFile(lua_State* L);
+EXPORT_DYNAMIC
 int lua__getEnvVar(lua_State* L);
 EXPORT_DYNAMIC
 int lua__setEnvVar(lua_State* L);
@@ -53,6 +61,9 @@ b8 Lake::init(const char** argv, int argc, mem::Allocator* allocator)
 {
   assert(argv && allocator);
 
+  this->argv = argv;
+  this->argc = argc;
+
   INFO("initializing Lake.\n");
   SCOPED_INDENT;
 
@@ -72,6 +83,7 @@ b8 Lake::init(const char** argv, int argc, mem::Allocator* allocator)
   addGlobalCFunc(lua__cwd);
   addGlobalCFunc(lua__canonicalizePath);
   addGlobalCFunc(lua__glob);
+  addGlobalCFunc(lua__readDepFile);
   addGlobalCFunc(lua__getEnvVar);
   addGlobalCFunc(lua__setEnvVar);
 
@@ -115,6 +127,13 @@ b8 Lake::init(const char** argv, int argc, mem::Allocator* allocator)
 
   max_jobs = 1;
 
+  if (!job_limiter.init())
+    return ERROR("failed to initialize job limiter\n");
+
+  build_db_path = ".lakedb"_str;
+  graph_cache_path = ".lakegraph"_str;
+  dir_cache_path = ".lakedircache"_str;
+
   // TODO(sushi) also search for lakefile with no extension
   initpath = nil;
   max_jobs_set_on_cli = false;
@@ -151,15 +170,37 @@ b8 Lake::init(const char** argv, int argc, mem::Allocator* allocator)
   //             files to begin with.
   active_process_pool = Pool<Process>::create(allocator);
 
+  process_waiter = ProcessWaiter::create();
+  if (isnil(process_waiter))
+    DEBUG("process waiting is not supported, recipes will be polled\n");
+
+  active_task = nullptr;
+
+  if (!stat_cache.init())
+    return ERROR("failed to initialize stat cache\n");
+
+  if (!build_db.init())
+    return ERROR("failed to initialize build database\n");
+
+  if (!graph_cache.init())
+    return ERROR("failed to initialize graph cache\n");
+
+  if (!dir_cache.init())
+    return ERROR("failed to initialize dir cache\n");
+  early_cutoff_count = 0;
+
   if (!active_recipes.init(allocator))
     return false;
   active_recipe_count = 0;
 
-  if (!tasks.init(allocator))
-    return ERROR("failed to initialize tasks list\n");
+  if (!graph.init(allocator))
+    return ERROR("failed to initialize task graph\n");
+
+  if (!job_slots.init(16, allocator))
+    return ERROR("failed to initialize job slots\n");
 
-  if (!leaves.init(allocator))
-    return ERROR("failed to initialize leaves list\n");
+  if (!held_recipes.init(16, allocator))
+    return ERROR("failed to initialize held recipes\n");
 
   root_dir = fs::Dir::open("."_str);
   if (isnil(root_dir))
@@ -175,12 +216,28 @@ void Lake::deinit()
   lua.deinit();
   active_recipes.deinit();
 
-  for (auto* task : tasks.eachPtr())
-    task->deinit();
+  graph.deinit();
+  job_slots.destroy();
+  held_recipes.destroy();
+
+  if (tracer != nullptr)
+  {
+    tracer->deinit();
+    mem::stl_allocator.free(tracer);
+  }
 
-  tasks.deinit();
+  if (watch_mode != nullptr)
+  {
+    watch_mode->deinit();
+    mem::stl_allocator.free(watch_mode);
+  }
 
   active_process_pool.deinit();
+  process_waiter.destroy();
+  build_db.deinit();
+  graph_cache.deinit();
+  dir_cache.deinit();
+  stat_cache.deinit();
 }
 
 /* ----------------------------------------------------------------------------
@@ -274,6 +331,85 @@ static b8 processArgDoubleDash(
     lake->print_timers = true;
     break;
 
+  case "explain-schedule"_hashed:
+    lake->explain_schedule = true;
+    break;
+
+  case "trace"_hashed:
+    iter->next();
+    if (isnil(iter->current))
+    {
+      FATAL("expected a path after '--trace'\n");
+      return false;
+    }
+    lake->trace_path = iter->current;
+    if (lake->tracer == nullptr)
+    {
+      lake->tracer = mem::stl_allocator.allocateType<Tracer>();
+      new (lake->tracer) Tracer;
+      if (!lake->tracer->init())
+      {
+        FATAL("failed to initialize tracer\n");
+        return false;
+      }
+    }
+    break;
+
+  case "watch"_hashed:
+    if (lake->watch_mode == nullptr)
+    {
+      lake->watch_mode = mem::stl_allocator.allocateType<WatchMode>();
+      new (lake->watch_mode) WatchMode;
+      if (!lake->watch_mode->init())
+      {
+        FATAL("failed to initialize watch mode\n");
+        return false;
+      }
+    }
+    break;
+
+  case "build-db"_hashed:
+    iter->next();
+    if (isnil(iter->current))
+    {
+      FATAL("expected a path after '--build-db'\n");
+      return false;
+    }
+    lake->build_db_path = iter->current;
+    break;
+
+  case "graph-cache"_hashed:
+    iter->next();
+    if (isnil(iter->current))
+    {
+      FATAL("expected a path after '--graph-cache'\n");
+      return false;
+    }
+    lake->graph_cache_path = iter->current;
+    break;
+
+  case "no-graph-cache"_hashed:
+    lake->graph_cache_path = nil;
+    break;
+
+  case "dir-cache"_hashed:
+    iter->next();
+    if (isnil(iter->current))
+    {
+      FATAL("expected a path after '--dir-cache'\n");
+      return false;
+    }
+    lake->dir_cache_path = iter->current;
+    break;
+
+  case "no-dir-cache"_hashed:
+    lake->dir_cache_path = nil;
+    break;
+
+  case "no-adaptive-jobs"_hashed:
+    lake->job_limiter.enabled = false;
+    break;
+
   default:;
   }
 
@@ -345,10 +481,55 @@ b8 Lake::processArgv(const char** argv, int argc, String* initfile)
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ *  Saves what the lakefile globbed and points processes we spawn at it, as
+ *  lpp's globs tend to walk the same trees.
+ */
+static void shareDirCache(Lake& lake)
+{
+  // Failing to save only costs the next run some reading.
+  if (lake.dir_cache.dirty && !lake.dir_cache.save(lake.dir_cache_path))
+    return;
+
+  auto path = fs::Path::from(lake.dir_cache_path);
+  defer { path.destroy(); };
+
+  if (path.makeAbsolute())
+    platform::setEnvVar("IRO_DIR_CACHE"_str, path.asStr());
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 Lake::run()
 {
+  if (notnil(dir_cache_path))
+    dir_cache.load(dir_cache_path);
+
+  // Watching needs the graph the lakefile builds, so it's always run then.
+  if (notnil(graph_cache_path) && watch_mode == nullptr)
+  {
+    auto check_start = TimePoint::monotonic();
+    b8 up_to_date = graph_cache.isUpToDate(graph_cache_path, *this);
+
+    if (print_timers)
+      NOTICE("checking the graph cache took ",
+             WithUnits(TimePoint::monotonic() - check_start), "\n");
+
+    if (tracer)
+      tracer->record(Tracer::Kind::Phase, "graph cache"_str, 0, check_start);
+
+    if (up_to_date)
+    {
+      if (notnil(dir_cache_path) && dir_cache.dirty)
+        dir_cache.save(dir_cache_path);
+
+      NOTICE("nothing to do, as nothing changed since the last build\n");
+      if (tracer && tracer->write(trace_path))
+        NOTICE("wrote trace to ", trace_path, "\n");
+      return true;
+    }
+  }
+
   auto lakefile_start = TimePoint::monotonic();
 
   lua.require("Errh"_str);
@@ -364,6 +545,12 @@ b8 Lake::run()
     NOTICE("lakefile took ",
            WithUnits(TimePoint::monotonic() - lakefile_start), "\n");
 
+  if (tracer)
+    tracer->record(Tracer::Kind::Phase, "lakefile"_str, 0, lakefile_start);
+
+  if (notnil(dir_cache_path))
+    shareDirCache(*this);
+
   if (lua.isboolean())
   {
     // If the lakefile returns false, dont move onto building.
@@ -379,83 +566,220 @@ b8 Lake::run()
 
   INFO("beginning build loop.\n");
 
-  // for (Task& task : tasks)
+  // for (Task* task : graph.tasks)
   // {
-  //   INFO("task ", task.name, ":\n");
+  //   INFO("task ", task->name, ":\n");
   //
   //   INFO("  prereqs:\n");
-  //   for (Task& prereq : task.prerequisites)
+  //   for (Task* prereq : task->prerequisites)
   //   {
-  //     INFO("    ", prereq.name, "\n");
+  //     INFO("    ", prereq->name, "\n");
   //   }
   // }
 
-  TaskList build_queue;
-  if (!build_queue.init())
-    return ERROR("failed to initialize build queue\n");
-  defer { build_queue.deinit(); };
-
   auto sort_start = TimePoint::monotonic();
 
-  if (Task::TopSortResult::Cycle == Task::topSortTasks(tasks, &build_queue))
+  if (!graph.build())
+    return ERROR("failed to build task graph\n");
+
+  auto build_queue = Array<Task*>::create(graph.tasks.len());
+  defer { build_queue.destroy(); };
+
+  if (!graph.sort(&build_queue))
     return ERROR("cycle detected\n");
 
   if (print_timers)
-    NOTICE("top sort took ", WithUnits(TimePoint::monotonic() - sort_start),
-         "\n");
+    NOTICE("building and sorting the task graph took ", 
+           WithUnits(TimePoint::monotonic() - sort_start), "\n");
+
+  if (tracer)
+    tracer->record(Tracer::Kind::Phase, "task graph"_str, 0, sort_start);
+
+  build_db.load(build_db_path);
+
+  computePriorities(build_queue.asSlice());
 
-  for (Task& task : build_queue)
+  for (Task* task : build_queue)
   {
-    if (task.isLeaf())
-      addLeaf(&task);
+    if (graph.pending[task->index] == 0)
+      graph.addLeaf(task);
   }
 
+  auto build_start = TimePoint::monotonic();
+
+  b8 success = build();
+
+  if (success && notnil(graph_cache_path))
+  {
+    b8 did_nothing = true;
+    for (Task* task : graph.tasks)
+    {
+      if (notnil(task->start_time))
+      {
+        did_nothing = false;
+        break;
+      }
+    }
+
+    // Failing to save only costs the next run the lakefile.
+    if (did_nothing)
+      graph_cache.save(graph_cache_path, *this);
+  }
+
+  if (explain_schedule)
+    explainSchedule(build_queue.asSlice(), 
+                    TimePoint::monotonic() - build_start);
+
+  if (tracer)
+  {
+    tracer->record(Tracer::Kind::Phase, "build"_str, 0, build_start);
+    if (tracer->write(trace_path))
+      NOTICE("wrote trace to ", trace_path, "\n");
+  }
+
+  if (print_timers)
+  {
+    NOTICE("build took ", WithUnits(TimePoint::monotonic() - build_start),
+           "\n");
+
+    NOTICE("stat cache: ", stat_cache.hits, " hits, ", stat_cache.misses, 
+           " misses\n");
+
+    NOTICE("dir cache: ", dir_cache.hits, " hits, ", dir_cache.misses,
+           " misses\n");
+
+    NOTICE("build db: ", build_db.files_hashed, " files hashed, ", 
+           early_cutoff_count, " rebuilt tasks with unchanged output\n");
+
+#if IRO_LINUX
+    // Time lake itself spent on the cpu, not counting the processes it ran,
+    // which should stay small however long the build takes.
+    struct rusage usage;
+    if (0 == getrusage(RUSAGE_SELF, &usage))
+    {
+      s64 user_us = usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec;
+      s64 sys_us = usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+      NOTICE("lake cpu time: ", 
+             WithUnits(TimeSpan::fromMicroseconds(user_us)), " user, ",
+             WithUnits(TimeSpan::fromMicroseconds(sys_us)), " sys\n");
+    }
+#endif
+  }
+
+  if (!callFinalCallback(success))
+    return false;
+
+  if (watch_mode != nullptr)
+    return watch_mode->run(*this);
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lake::build()
+{
+  job_limiter.beginBuild();
+
   b8 success = true;
   for (u64 build_pass = 0, recipe_pass = 0;;)
   {
-    if (leaves.isEmpty() && active_recipes.isEmpty())
+    if (graph.leaves.isEmpty() &&
+        active_recipes.isEmpty() &&
+        held_recipes.isEmpty())
     {
       DEBUG("no leaves, we must be done\n");
       break;
     }
 
-    while (!leaves.isEmpty() && max_jobs > active_recipe_count)
+    // Recipes held back earlier go first, in the order they were held.
+    // Later ones may only use what would be left over once the first has
+    // started, so that a recipe needing a lot of memory isn't held back
+    // forever by smaller ones.
+    for (s32 i = 0;
+         i < held_recipes.len() && max_jobs > active_recipe_count;)
+    {
+      Task* task = held_recipes[i];
+      u64 reserved = i == 0? 0 : held_recipes[0]->estimate_memory;
+      if (job_limiter.admit(task, active_recipe_count, reserved))
+      {
+        DEBUG("task '", task->name, "' is no longer held back\n");
+        held_recipes.remove(i);
+        startRecipe(task);
+      }
+      else
+      {
+        i += 1;
+      }
+    }
+
+    while (!graph.leaves.isEmpty() && max_jobs > active_recipe_count)
     {
-      Task* task = leaves.front();
+      Task* task = graph.takeLeaf();
 
       DEBUG("checking '", task->name, "'\n");
 
-      if (task->needRunRecipe(*this))
+      TimePoint cond_start = TimePoint::monotonic();
+      b8 need_run_recipe = task->needRunRecipe(*this);
+      if (tracer && task->flags.test(Task::Flag::HasCond))
+        tracer->record(Tracer::Kind::Cond, task->name, 0, cond_start);
+
+      if (need_run_recipe)
       {
         DEBUG("task '", task->name, "' needs to run its recipe\n");
-        active_recipes.pushHead(task);
-        active_recipe_count += 1;
-        leaves.remove(leaves.head);
+
+        u64 reserved =
+          held_recipes.isEmpty()? 0 : held_recipes[0]->estimate_memory;
+        if (job_limiter.admit(task, active_recipe_count, reserved))
+          startRecipe(task);
+        else
+          *held_recipes.push() = task;
       }
       else
       {
         DEBUG("task '", task->name, "' is complete\n");
         task->onComplete(*this, false);
-        leaves.remove(leaves.head);
       }
     }
 
-    while (max_jobs <= active_recipe_count ||
-          (active_recipe_count && leaves.isEmpty()))
+    // Time spent with leaves ready to go but every job slot taken, or with
+    // recipes held back until others finish.
+    TimePoint blocked_start = nil;
+    if (tracer && 
+        ((!graph.leaves.isEmpty() && max_jobs <= active_recipe_count) ||
+         !held_recipes.isEmpty()))
+      blocked_start = TimePoint::monotonic();
+
+    while (active_recipe_count != 0 &&
+           (max_jobs <= active_recipe_count ||
+            graph.leaves.isEmpty() ||
+            !held_recipes.isEmpty()))
     {
+      u32 resumed_count = 0;
+      u32 ended_count = 0;
+
       TaskList::Node* task_node = active_recipes.head;
       for (;task_node;)
       {
         Task* task = task_node->data;
         TaskList::Node* next = task_node->next;
+
+        if (task->isWaitingOnProcesses())
+        {
+          task_node = next;
+          continue;
+        }
+
+        resumed_count += 1;
+
         switch (task->resumeRecipe(*this))
         {
         case Task::RecipeResult::Finished:
           {
             DEBUG("task '", task->name, "' completed\n");
-            active_recipes.remove(task_node);
-            active_recipe_count -= 1;
-            task->onComplete(*this, true);;
+            endRecipe(task, task_node);
+            task->onComplete(*this, true);
+            ended_count += 1;
           }
           break;
 
@@ -463,9 +787,9 @@ b8 Lake::run()
         case Task::RecipeResult::Error:
           {
             task->flags.set(Task::Flag::Errored);
-            active_recipes.remove(task_node);
-            active_recipe_count -= 1;
+            endRecipe(task, task_node);
             success = false;
+            ended_count += 1;
           }
           break;
 
@@ -474,9 +798,37 @@ b8 Lake::run()
         }
         task_node = next;
       }
+
+      // A held recipe may fit now.
+      if (ended_count != 0 && !held_recipes.isEmpty())
+        break;
+
+      // Every recipe is waiting on some process, so sleep until one of 
+      // them has something for us.
+      if (resumed_count == 0)
+        waitForProcesses();
+    }
+
+    if (notnil(blocked_start))
+    {
+      String reason =
+        held_recipes.isEmpty()? "max jobs"_str : "held back"_str;
+      tracer->record(Tracer::Kind::Blocked, reason, 0, blocked_start);
     }
   }
 
+  // Failing to save only costs the next run some rebuilding, so it doesn't
+  // fail this one.
+  if (build_db.dirty)
+    build_db.save(build_db_path);
+
+  return success;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lake::callFinalCallback(b8 success)
+{
   lua.pushvalue(I.lake);
   lua.pushstring("finalCallback"_str);
   lua.gettable(-2);
@@ -493,10 +845,259 @@ b8 Lake::run()
 
 /* ----------------------------------------------------------------------------
  */
-void Lake::addLeaf(Task* task)
+void Lake::resetRecipe(Task* task)
+{
+  lua.getfield(I.lake, "resetRecipe");
+  lua.pushstring(task->name);
+  if (!lua.pcall(1, 0))
+  {
+    ERROR("failed to reset recipe of '", task->name, "': ", lua.tostring(),
+          "\n");
+    lua.pop();
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Lake::startRecipe(Task* task)
+{
+  active_recipes.pushHead(task);
+  active_recipe_count += 1;
+  job_limiter.onStart(task);
+
+  task->job_slot = 0;
+  for (s32 i = 0; i < job_slots.len(); ++i)
+  {
+    if (job_slots[i] == nullptr)
+    {
+      job_slots[i] = task;
+      task->job_slot = i + 1;
+      break;
+    }
+  }
+
+  if (task->job_slot == 0)
+  {
+    job_slots.push(task);
+    task->job_slot = job_slots.len();
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Lake::endRecipe(Task* task, TaskList::Node* node)
+{
+  active_recipes.remove(node);
+  active_recipe_count -= 1;
+  job_limiter.onEnd(task);
+
+  job_slots[task->job_slot - 1] = nullptr;
+
+  if (tracer && notnil(task->start_time))
+    tracer->record(Tracer::Kind::Recipe, task->name, task->job_slot, 
+                   task->start_time);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Lake::computePriorities(Slice<Task*> sorted)
+{
+  // Tasks that have never run are assumed to take as long, and need as
+  // much memory, as the average of those that have.
+  u64 known_total = 0;
+  u64 known_count = 0;
+  u64 known_memory_total = 0;
+  u64 known_memory_count = 0;
+  for (Task* task : sorted)
+  {
+    if (!task->flags.test(Task::Flag::HasRecipe))
+      continue;
+
+    BuildDB::TaskRecord* record = build_db.findTask(task->uid);
+    if (record != nullptr && record->duration_us != 0)
+    {
+      task->estimate_us = record->duration_us;
+      known_total += record->duration_us;
+      known_count += 1;
+    }
+
+    if (record != nullptr && record->peak_memory != 0)
+    {
+      task->estimate_memory = record->peak_memory;
+      known_memory_total += record->peak_memory;
+      known_memory_count += 1;
+    }
+  }
+
+  u64 default_memory =
+    known_memory_count? known_memory_total / known_memory_count : 0;
+
+  u64 default_estimate = known_count? known_total / known_count : 0;
+
+  // Dependents come after their prerequisites in 'sorted', so walking it 
+  // backwards visits every dependent of a Task before the Task itself.
+  for (s64 i = s64(sorted.len) - 1; i >= 0; --i)
+  {
+    Task* task = sorted[i];
+
+    if (task->flags.test(Task::Flag::HasRecipe) && task->estimate_us == 0)
+      task->estimate_us = default_estimate;
+
+    if (task->flags.test(Task::Flag::HasRecipe) &&
+        task->estimate_memory == 0)
+      task->estimate_memory = default_memory;
+
+    u64 longest_after = 0;
+    for (Task* dependent : task->dependents)
+    {
+      if (dependent->priority_us > longest_after)
+        longest_after = dependent->priority_us;
+    }
+
+    task->priority_us = task->estimate_us + longest_after;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 ranRecipe(Task* task)
 {
-  DEBUG("new leaf: ", task->name, "\n");
-  leaves.pushTail(task);
+  return notnil(task->start_time) && notnil(task->end_time);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 finishedAfter(Task* a, Task* b)
+{
+  return (a->end_time - b->end_time).ns > 0;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Finds the recipe among 'task's prerequisites, looking through those that 
+ *  didn't run one, that finished last.
+ */
+static Task* lastFinishedPrereq(Task* task)
+{
+  Task* last = nullptr;
+  for (Task* prereq : task->prerequisites)
+  {
+    Task* candidate = 
+      ranRecipe(prereq)? prereq : lastFinishedPrereq(prereq);
+    if (candidate != nullptr && 
+        (last == nullptr || finishedAfter(candidate, last)))
+      last = candidate;
+  }
+  return last;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Lake::explainSchedule(Slice<Task*> sorted, TimeSpan build_time)
+{
+  // The predicted critical path starts at the Task with the highest 
+  // priority and follows the dependent with the highest priority.
+  Task* predicted = nullptr;
+  for (Task* task : sorted)
+  {
+    if (predicted == nullptr || task->priority_us > predicted->priority_us)
+      predicted = task;
+  }
+
+  if (predicted == nullptr)
+    return;
+
+  NOTICE("predicted critical path (", 
+         WithUnits(TimeSpan::fromMicroseconds(predicted->priority_us)), 
+         "):\n");
+  while (predicted != nullptr)
+  {
+    if (predicted->estimate_us != 0)
+      NOTICE("  ", predicted->name, " ", 
+             WithUnits(TimeSpan::fromMicroseconds(predicted->estimate_us)), 
+             "\n");
+
+    Task* next = nullptr;
+    for (Task* dependent : predicted->dependents)
+    {
+      if (next == nullptr || dependent->priority_us > next->priority_us)
+        next = dependent;
+    }
+    predicted = next;
+  }
+
+  // The actual critical path ends at the recipe that finished last, and 
+  // each step back is whichever recipe among its prerequisites finished
+  // last, as that is the one it was waiting on.
+  Task* actual = nullptr;
+  for (Task* task : sorted)
+  {
+    if (ranRecipe(task) && 
+        (actual == nullptr || finishedAfter(task, actual)))
+      actual = task;
+  }
+
+  NOTICE("actual critical path (build took ", WithUnits(build_time), 
+         "):\n");
+
+  auto path = Array<Task*>::create();
+  defer { path.destroy(); };
+  for (; actual != nullptr; actual = lastFinishedPrereq(actual))
+    path.push(actual);
+
+  for (s32 i = path.len() - 1; i >= 0; --i)
+  {
+    Task* task = path[i];
+    NOTICE("  ", task->name, " ", 
+           WithUnits(task->end_time - task->start_time), 
+           " (estimated ", 
+           WithUnits(TimeSpan::fromMicroseconds(task->estimate_us)), ")\n");
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u64 Lake::hashFile(String path, String dir)
+{
+  StatCache::Entry* stat = stat_cache.get(path, dir);
+  if (!stat->regular)
+    return 0;
+
+  u64 path_hash = stat_cache.hashPath(path, dir);
+
+  if (isnil(dir) || fs::Path::isRooted(path))
+    return build_db.hashFile(path, path_hash, *stat);
+
+  auto full = fs::Path::from(dir);
+  defer { full.destroy(); };
+  full.ensureDir().append(path);
+  return build_db.hashFile(full.asStr(), path_hash, *stat);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Lake::waitForProcesses()
+{
+  // Wake up every so often regardless, so that a process whose exit we 
+  // can't observe (see ProcessWaiterLinux) doesn't stall the build.
+  const TimeSpan timeout = TimeSpan::fromMilliseconds(100);
+
+  TimePoint wait_start = TimePoint::monotonic();
+
+  void* ready[64];
+  s32 ready_count = process_waiter.wait({ready, 64}, timeout);
+
+  if (tracer)
+    tracer->record(Tracer::Kind::Wait, "wait"_str, 0, wait_start);
+
+  if (ready_count <= 0)
+  {
+    for (Task& task : active_recipes)
+      task.flags.set(Task::Flag::ProcessReady);
+    return;
+  }
+
+  for (s32 i = 0; i < ready_count; ++i)
+    ((Task*)ready[i])->flags.set(Task::Flag::ProcessReady);
 }
 
 /* ============================================================================
@@ -510,26 +1111,97 @@ extern "C"
 EXPORT_DYNAMIC
 Task* lua__createTask(Lake* lake, String name)
 {
-  auto* task = lake->allocateTask<Task>();
-  if (!task->init(name))
-  {
+  // The Task may have already been created by a dep file naming it.
+  Task* task = lake->graph.internTask(name);
+  if (task == nullptr)
     ERROR("failed to initialize lua task ", name, "\n");
-    mem::stl_allocator.free(task);
-    return nullptr;
-  }
-  lake->tasks.pushTail(task);
   return task;
 }
 
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-void lua__makeDep(Task* task, Task* prereq)
+void lua__makeDep(Lake* lake, Task* task, Task* prereq)
 {
   INFO("Making '", prereq->name, "' a prerequisite of task '",
        task->name, "'.\n");
-  task->prerequisites.insert(prereq);
-  prereq->dependents.insert(task);
+  lake->graph.addPrerequisite(task, prereq);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lake::readDepFile(String path, io::Memory* data, Array<String>* paths)
+{
+  // Dep files don't exist until their first build, which isn't an error.
+  if (!fs::File::exists(path))
+    return false;
+
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+    return false;
+  defer { file.close(); };
+
+  data->consume(&file, 1 << 12);
+
+  if (!depfile::parse({data->ptr, data->len}, paths))
+    return ERROR("malformed dep file ", path, "\n");
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Makes every file listed in the dep file at 'path' a prerequisite of 
+ *  'task', creating Tasks for them as needed. This avoids creating a lua 
+ *  Task for every header of every object, which is where most of the 
+ *  Tasks in a large project come from. Returns the number of files listed, 
+ *  or -1 if the dep file could not be read.
+ */
+EXPORT_DYNAMIC
+s32 lua__loadDepFile(Lake* lake, Task* task, String path)
+{
+  if (lake->graph.built)
+  {
+    ERROR("cannot load dep file ", path, " for '", task->name, 
+          "' as the task graph has already been built\n");
+    return -1;
+  }
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+
+  auto paths = Array<String>::create();
+  defer { paths.destroy(); };
+
+  // Recorded whether it exists or not, as it appearing would change the
+  // graph.
+  if (notnil(lake->graph_cache_path))
+    lake->graph_cache.recordFile(*lake, path);
+
+  b8 read = Lake::readDepFile(path, &data, &paths);
+
+  // Also recorded when it doesn't exist yet, which is the case until the
+  // first build, as it then appearing means the graph is missing the files
+  // it lists.
+  if (lake->watch_mode != nullptr)
+    lake->watch_mode->recordDepFile(
+      task, path, read? paths.asSlice() : Slice<String>{});
+
+  if (!read)
+    return -1;
+
+  for (String file : paths)
+  {
+    Task* prereq = lake->graph.internTask(file);
+    if (prereq == nullptr)
+      return -1;
+    lake->graph.addPrerequisite(task, prereq);
+  }
+
+  DEBUG("loaded ", paths.len(), " prerequisites of '", task->name, 
+        "' from ", path, "\n");
+
+  return paths.len();
 }
 
 /* ----------------------------------------------------------------------------
@@ -558,6 +1230,29 @@ void lua__setTaskRecipeWorkingDir(Task* task, String wdir)
   task->wdir = fs::Path::from(wdir);
 }
 
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+void lua__setTaskContentKey(Task* task, String key)
+{
+  task->content_key = key.hash();
+  task->flags.set(Task::Flag::ContentTracked);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+s32 lua__taskUnchanged(Lake* lake, Task* task)
+{
+  if (!task->flags.test(Task::Flag::ContentTracked))
+  {
+    ERROR("lake.unchanged called on task '", task->name, "', which does not "
+          "track its content\n");
+    return 0;
+  }
+  return task->isUnchanged(*lake);
+}
+
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
@@ -570,15 +1265,20 @@ u64 lua__getMonotonicClock()
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__makeDir(String path, b8 make_parents)
+b8 lua__makeDir(Lake* lake, String path, b8 make_parents)
 {
+  lake->stat_cache.invalidate(path);
   return fs::Dir::make(path, make_parents);
 }
 
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-Process* lua__processSpawn(Lake* lake, String* args, u32 args_count)
+Process* lua__processSpawn(
+    Lake* lake, 
+    String* args, 
+    u32 args_count,
+    b8 merge_stderr)
 {
   assert(args && args_count);
 
@@ -598,13 +1298,35 @@ Process* lua__processSpawn(Lake* lake, String* args, u32 args_count)
     cwd.destroy();
   }
 
+  TimePoint spawn_start = TimePoint::monotonic();
+
   Process* proc = lake->active_process_pool.add();
   *proc =
-    Process::spawn(args[0], {.ptr=args+1, .len=args_count-1}, nil);
+    Process::spawn(
+      args[0], 
+      {.ptr=args+1, .len=args_count-1}, 
+      nil, 
+      true, 
+      merge_stderr);
   if (isnil(*proc))
   {
+    // Left to lake.cmd to fail the recipe.
     ERROR("failed to spawn process using file '", args[0], "'\n");
-    exit(1);
+    lake->active_process_pool.remove(proc);
+    return nullptr;
+  }
+
+  Task* task = lake->active_task;
+
+  if (lake->tracer)
+    lake->tracer->record(Tracer::Kind::Spawn, args[0], 
+                         task? task->job_slot : 0, spawn_start, true);
+  if (task && notnil(lake->process_waiter))
+  {
+    if (lake->process_waiter.add(proc, task))
+      task->waiting_process_count += 1;
+    else
+      lake->process_waiter.remove(proc);
   }
 
   return proc;
@@ -631,6 +1353,26 @@ b8 lua__processCanRead(Process* proc)
   return proc->hasOutput();
 }
 
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+void lua__processReadErr(
+    Process* proc,
+    void* ptr, u64 len, u64* out_bytes_read)
+{
+  assert(proc && ptr && len && out_bytes_read);
+  *out_bytes_read = proc->readstderr({(u8*)ptr, len});
+}
+
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+b8 lua__processCanReadErr(Process* proc)
+{
+  assert(proc);
+  return proc->hasErrOutput();
+}
+
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
@@ -663,6 +1405,17 @@ void lua__processClose(Lake* lake, Process* proc)
   assert(proc);
   TRACE("closing proc ", (void*)proc, "\n");
 
+  // Processes are closed by the same recipe that spawned them.
+  Task* task = lake->active_task;
+  if (task && task->waiting_process_count != 0)
+  {
+    lake->process_waiter.remove(proc);
+    task->waiting_process_count -= 1;
+  }
+
+  if (task && proc->peakMemory() > task->peak_memory)
+    task->peak_memory = proc->peakMemory();
+
   proc->close();
 
   lake->active_process_pool.remove(proc);
@@ -674,26 +1427,74 @@ int lua__glob(lua_State* L)
 {
   auto lua = LuaState::fromExistingState(L);
 
-  String pattern = lua.tostring(1);
+  auto* lake = lua.tolightuserdata<Lake>(1);
+  String pattern = lua.tostring(2);
 
   lua.newtable();
   const s32 I_result = lua.gettop();
 
+  // When watching, what the lakefile's globs matched is kept so that we 
+  // know to run it again if that changes.
+  WatchMode::Glob* watched = nullptr;
+  if (lake->watch_mode != nullptr && !lake->graph.built)
+    watched = lake->watch_mode->recordGlob(pattern);
+
+  // Likewise for the graph cache.
+  s64 cached = -1;
+  if (notnil(lake->graph_cache_path) && !lake->graph.built)
+    cached = lake->graph_cache.recordGlob(pattern);
+
   auto glob = fs::Globber::create(pattern);
   u64 count = 0;
   glob.run(
-    [&lua, &count, I_result](fs::Path& p)
+    [&lua, &count, I_result, lake, watched, cached](fs::Path& p)
     {
+      if (watched != nullptr)
+        lake->watch_mode->recordGlobMatch(watched, p.buffer.asStr());
+      if (cached != -1)
+        lake->graph_cache.recordGlobMatch(cached, p.buffer.asStr());
       count += 1;
       lua.pushinteger(count);
       lua.pushstring(p.buffer.asStr());
       lua.settable(I_result);
       return true;
-    });
+    },
+    &lake->dir_cache);
   glob.destroy();
   return 1;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+int lua__readDepFile(lua_State* L)
+{
+  auto lua = LuaState::fromExistingState(L);
+
+  String path = lua.tostring(1);
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+
+  auto paths = Array<String>::create();
+  defer { paths.destroy(); };
+
+  lua.newtable();
+  const s32 I_result = lua.gettop();
+
+  if (!Lake::readDepFile(path, &data, &paths))
+    return 1;
+
+  for (s32 i = 0; i < paths.len(); ++i)
+  {
+    lua.pushinteger(i + 1);
+    lua.pushstring(paths[i]);
+    lua.settable(I_result);
+  }
+
+  return 1;
+}
+
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
@@ -735,8 +1536,9 @@ int lua__cwd(lua_State* L)
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__chdir(String path)
+b8 lua__chdir(Lake* lake, String path)
 {
+  lake->stat_cache.noteChdir();
   return fs::Path::chdir(path);
 }
 
@@ -766,24 +1568,31 @@ int lua__canonicalizePath(lua_State* L)
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__copyFile(String dst, String src)
+b8 lua__copyFile(Lake* lake, String dst, String src)
 {
+  lake->stat_cache.invalidate(dst);
   return fs::File::copy(dst, src);
 }
 
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__moveFile(String dst, String src)
+b8 lua__moveFile(Lake* lake, String dst, String src)
 {
+  lake->stat_cache.invalidate(dst);
+  lake->stat_cache.invalidate(src);
   return fs::File::rename(dst, src);
 }
 
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__rm(String path, b8 recursive, b8 force)
+b8 lua__rm(Lake* lake, String path, b8 recursive, b8 force)
 {
+  // Only the given path is forgotten, anything cached beneath a removed
+  // directory must be invalidated by the user.
+  lake->stat_cache.invalidate(path);
+
   // TODO(sushi) move to iro
   using namespace fs;
 
@@ -910,12 +1719,33 @@ b8 lua__rm(String path, b8 recursive, b8 force)
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ *  Notes that the lakefile looked at the file at 'path', as what it found
+ *  there may have changed the graph it built. Files looked at once the
+ *  graph is built, by conditions and recipes, don't need to be.
+ */
+static void recordLakefileInput(Lake* lake, String path)
+{
+  if (notnil(lake->graph_cache_path) && !lake->graph.built)
+    lake->graph_cache.recordFile(*lake, path);
+}
+
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__pathExists(String path)
+b8 lua__pathExists(Lake* lake, String path)
 {
-  return platform::fileExists(path);
+  recordLakefileInput(lake, path);
+  return lake->stat_cache.get(path)->exists;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Called by the io.open wrapper in Lake.lua for files opened for reading.
+ */
+EXPORT_DYNAMIC
+void lua__recordFileRead(Lake* lake, String path)
+{
+  recordLakefileInput(lake, path);
 }
 
 /* ----------------------------------------------------------------------------
@@ -929,18 +1759,86 @@ b8 lua__inRecipe(Lake* lake)
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-b8 lua__touch(String path)
+b8 lua__touch(Lake* lake, String path)
 {
+  lake->stat_cache.invalidate(path);
   return platform::touchFile(path);
 }
 
 /* ----------------------------------------------------------------------------
  */
 EXPORT_DYNAMIC
-u64 lua__modtime(String path)
+u64 lua__modtime(Lake* lake, String path)
+{
+  recordLakefileInput(lake, path);
+  return lake->stat_cache.get(path)->modtime;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Gets the modtimes of many paths at once so that conditions checking a 
+ *  large list of prerequisites don't have to cross into C for each one.
+ */
+EXPORT_DYNAMIC
+void lua__modtimes(Lake* lake, String* paths, u32 count, u64* out_modtimes)
+{
+  for (u32 i = 0; i < count; ++i)
+  {
+    recordLakefileInput(lake, paths[i]);
+    out_modtimes[i] = lake->stat_cache.get(paths[i])->modtime;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+u64 lua__fileSize(Lake* lake, String path)
 {
-  TimePoint modtime = fs::Path::modtime(path);
-  return ((modtime - TimePoint{}).toMilliseconds());
+  recordLakefileInput(lake, path);
+  return lake->stat_cache.get(path)->size;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Hashes 'key' along with the paths and contents of 'files' into 16 hex 
+ *  digits written to 'out_hex'. Files that don't exist contribute only 
+ *  their path.
+ */
+EXPORT_DYNAMIC
+void lua__hashKey(
+    Lake* lake, 
+    String key, 
+    String* files, 
+    u32 file_count, 
+    u8* out_hex)
+{
+  u64 hash = (14695981039346656037ull ^ key.hash()) * 1099511628211;
+  for (u32 i = 0; i < file_count; ++i)
+  {
+    recordLakefileInput(lake, files[i]);
+    hash = (hash ^ files[i].hash()) * 1099511628211;
+    hash = (hash ^ lake->hashFile(files[i])) * 1099511628211;
+  }
+
+  for (s32 i = 15; i >= 0; --i)
+  {
+    out_hex[i] = "0123456789abcdef"[hash & 0xf];
+    hash >>= 4;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+b8 lua__isPrintingTimers(Lake* lake)
+{
+  return lake->print_timers;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+EXPORT_DYNAMIC
+void lua__invalidateStat(Lake* lake, String path)
+{
+  lake->stat_cache.invalidate(path);
 }
 
 /* ----------------------------------------------------------------------------
@@ -948,12 +1846,16 @@ u64 lua__modtime(String path)
 int lua__getEnvVar(lua_State* L)
 {
 	auto lua = LuaState::fromExistingState(L);
-	if (!lua.isstring(1))
-		return ERROR("lua__getEnvVar expects a string as first argument\n");
+  auto* lake = lua.tolightuserdata<Lake>(1);
+	if (!lua.isstring(2))
+		return ERROR("lua__getEnvVar expects a string as second argument\n");
 
-	String var = lua.tostring(1);
+	String var = lua.tostring(2);
 	TRACE("lua__getEnvVar(\"", var, "\")\n");
 
+  if (notnil(lake->graph_cache_path) && !lake->graph.built)
+    lake->graph_cache.recordEnvVar(var);
+
 	s32 bytes_needed = platform::getEnvVar(var, nil);
 	if (bytes_needed == -1)
 	{
@@ -982,8 +1884,12 @@ int lua__getEnvVar(lua_State* L)
 int lua__setEnvVar(lua_State* L)
 {
 	auto lua = LuaState::fromExistingState(L);
-	String name = lua.tostring(1);
-	String val = lua.tostring(2);
+  auto* lake = lua.tolightuserdata<Lake>(1);
+	String name = lua.tostring(2);
+	String val = lua.tostring(3);
+
+  if (notnil(lake->graph_cache_path) && !lake->graph.built)
+    lake->graph_cache.recordEnvVar(name, true);
 
   if (!platform::setEnvVar(name, val))
 	  return 0;
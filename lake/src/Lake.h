@@ -4,11 +4,20 @@
 #include "iro/Common.h"
 #include "iro/containers/List.h"
 #include "iro/containers/AVL.h"
+#include "iro/containers/Array.h"
 #include "iro/Logger.h"
 #include "iro/LuaState.h"
 #include "iro/Process.h"
+#include "iro/fs/DirCache.h"
 
 #include "Task.h"
+#include "TaskGraph.h"
+#include "StatCache.h"
+#include "BuildDB.h"
+#include "Tracer.h"
+#include "WatchMode.h"
+#include "GraphCache.h"
+#include "JobLimiter.h"
 
 struct Lexer;
 struct Parser;
@@ -19,12 +28,12 @@ struct Lake
 {
   LuaState lua;
 
-  TaskList tasks;
+  // Every Task and the dependencies between them, along with the leaves
+  // waiting to be checked.
+  TaskGraph graph;
 
   TaskList explicit_requests;
 
-  TaskList leaves;
-
   // If we are currently giving control to some callback of a task, eg. 
   // its condition or recipe function, this will point to it. Important 
   // for cases like a recipe changing its current directory as we need to
@@ -36,15 +45,72 @@ struct Lake
 
   Pool<Process> active_process_pool;
 
+  // Processes spawned by recipes are added to this so that, when no recipe
+  // can make progress, we can sleep until one of their processes produces
+  // output or exits rather than resuming every recipe over and over. Nil 
+  // when the platform doesn't support it, in which case recipes are polled.
+  ProcessWaiter process_waiter;
+
+  // What we know about the files tasks ask about, so that each is only
+  // stat'd once per run unless something changes it.
+  StatCache stat_cache;
+
+  // Hashes of files and tasks kept between runs, see BuildDB.h.
+  BuildDB build_db;
+  String  build_db_path; // --build-db <path>
+
+  // What the lakefile depended on, saved after a build with nothing to do
+  // so that the next may skip running it, see GraphCache.h. The path is nil
+  // when given --no-graph-cache.
+  GraphCache graph_cache;
+  String     graph_cache_path; // --graph-cache <path>
+
+  // What the directories globbed so far contain, see iro/fs/DirCache.h.
+  // It's saved to the path, which is nil when given --no-dir-cache, after
+  // the lakefile runs so that the next run and the processes recipes spawn
+  // can use it.
+  fs::DirCache dir_cache;
+  String       dir_cache_path; // --dir-cache <path>
+
+  // How many tasks were rebuilt without their output changing, sparing 
+  // their dependents from being rebuilt.
+  u32 early_cutoff_count;
+
   String initpath = nil;
 
   u32 max_jobs; // --max-jobs <n> or -j <n>
   b8 max_jobs_set_on_cli;
 
+  // Decides whether there's room for another recipe below max_jobs, see
+  // JobLimiter.h.
+  JobLimiter job_limiter;
+
+  // Tasks whose recipes need to run but that the job limiter held back, in
+  // the order they were taken from the leaves.
+  Array<Task*> held_recipes;
+
   b8 print_transformed; // --print-transformed
 
   b8 print_timers = false; // --print-timers
 
+  b8 explain_schedule = false; // --explain-schedule
+
+  // Set when given --trace <path>, in which case a trace of the build is 
+  // written to 'trace_path' once it's done.
+  Tracer* tracer = nullptr;
+  String  trace_path = nil;
+
+  // Set when given --watch, in which case lake keeps rebuilding whatever
+  // changes affect after the first build, see WatchMode.h.
+  WatchMode* watch_mode = nullptr;
+
+  // The arguments lake was started with, so that it may restart itself.
+  const char** argv;
+  int argc;
+
+  // The Task running in each job slot, nullptr when the slot is free.
+  Array<Task*> job_slots;
+
   b8 in_recipe = false;
 
   // Handle to the root directory for quickly swapping back when a recipe 
@@ -57,17 +123,44 @@ struct Lake
   b8 processArgv(const char** argv, int argc, String* initfile);
   b8 run();
 
-  void addLeaf(Task* task);
+  // Checks the leaves of the task graph and runs the recipes of those that
+  // need it, until nothing is left. Returns false if any recipe failed.
+  b8 build();
 
-  // Central allocation function in case we ever want to change how tasks 
-  // are stored.
-  template<typename T>
-  Task* allocateTask()
-  {
-    auto* task = (Task*)mem::stl_allocator.allocateType<T>();
-    new (task) T;
-    return task;
-  }
+  // Calls lake.finalCallback, if the lakefile set one, with whether the 
+  // build succeeded.
+  b8 callFinalCallback(b8 success);
+
+  // Recreates the coroutine of 'task's recipe so that it may run again.
+  void resetRecipe(Task* task);
+
+  // Adds 'task' to the active recipes in the first free job slot, and 
+  // removes it again once its recipe has ended.
+  void startRecipe(Task* task);
+  void endRecipe(Task* task, TaskList::Node* node);
+
+  // Estimates how long each Task in 'sorted', which is in topological 
+  // order, will take from the durations recorded in the build database and
+  // gives each a priority from the longest chain of estimates starting at
+  // it. The memory each will need is estimated the same way.
+  void computePriorities(Slice<Task*> sorted);
+
+  // Prints the chain of Tasks we expected to take the longest, using the 
+  // estimates computePriorities made, against the chain that actually did.
+  void explainSchedule(Slice<Task*> sorted, TimeSpan build_time);
+
+  // Returns a hash of the content of the file at 'path', relative to 'dir' 
+  // if given, or 0 if it's not a regular file.
+  u64 hashFile(String path, String dir = nil);
+
+  // Blocks until the process of some active recipe is ready, marking the 
+  // recipes that own them as such.
+  void waitForProcesses();
+
+  // Reads the dep file at 'path' into 'data' and parses the files it lists
+  // into 'paths', which view 'data'. Returns false if the file doesn't 
+  // exist or is malformed.
+  static b8 readDepFile(String path, io::Memory* data, Array<String>* paths);
 
   // Indexes on lua's stack where important things have been loaded.
   // This doesn't have to be tracked at runtime, but makes it easier 
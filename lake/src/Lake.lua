@@ -51,31 +51,52 @@ ffi.cdef
   typedef u8       b8; // booean type
 
   void* lua__createTask(void* lake, String name);
-  void  lua__makeDep(void* task, void* prereq);
+  void  lua__makeDep(void* lake, void* task, void* prereq);
+  s32   lua__loadDepFile(void* lake, void* task, String path);
   void  lua__setTaskHasRecipe(void* task);
   void  lua__setTaskRecipeWorkingDir(void* task, String wdir);
   u64   lua__getMonotonicClock();
-  b8    lua__makeDir(String path, b8 make_parents);
-  b8    lua__pathExists(String path);
+  b8    lua__makeDir(void* lake, String path, b8 make_parents);
+  b8    lua__pathExists(void* lake, String path);
+  void  lua__recordFileRead(void* lake, String path);
   b8    lua__inRecipe(void* lake);
 
-  void* lua__processSpawn(void* lake, String* args, u32 args_count);
+  void* lua__processSpawn(
+    void* lake, 
+    String* args, 
+    u32 args_count, 
+    b8 merge_stderr);
   void lua__processRead(
     void* proc, 
     void* ptr, u64 len, u64* out_bytes_read);
   b8 lua__processCanRead(void* proc);
+  void lua__processReadErr(
+    void* proc, 
+    void* ptr, u64 len, u64* out_bytes_read);
+  b8 lua__processCanReadErr(void* proc);
   b8 lua__processCheck(void* proc, s32* out_exit_code);
   void lua__processClose(void* lake, void* proc);
 
   void lua__setMaxJobs(void* lake, s32 n);
   s32  lua__getMaxJobs(void* lake);
 
-  b8 lua__copyFile(String dst, String src);
-  b8 lua__moveFile(String dst, String src);
-  b8 lua__chdir(String path);
-  b8 lua__rm(String path, b8, b8);
-  b8 lua__touch(String path);
-  u64 lua__modtime(String path);
+  b8 lua__copyFile(void* lake, String dst, String src);
+  b8 lua__moveFile(void* lake, String dst, String src);
+  b8 lua__chdir(void* lake, String path);
+  b8 lua__rm(void* lake, String path, b8, b8);
+  b8 lua__touch(void* lake, String path);
+  u64 lua__modtime(void* lake, String path);
+  void lua__modtimes(void* lake, String* paths, u32 count, u64* out_modtimes);
+  void lua__invalidateStat(void* lake, String path);
+  s32 lua__taskUnchanged(void* lake, void* task);
+  u64 lua__fileSize(void* lake, String path);
+  void lua__hashKey(
+    void* lake, 
+    String key, 
+    String* files, 
+    u32 file_count, 
+    u8* out_hex);
+  b8 lua__isPrintingTimers(void* lake);
 ]]
 local C = ffi.C
 local strtype = ffi.typeof("String")
@@ -106,6 +127,50 @@ end
 --- processed by the user.
 lake.cliargs = List{}
 
+--- The lua files run by the lakefile, which lake watches when given 
+--- --watch. This doesn't include the lakefile itself.
+lake.lua_files = List{}
+
+do
+  local loadfile_ = loadfile
+  loadfile = function(path, ...)
+    if path then
+      lake.lua_files:push(path)
+    end
+    return loadfile_(path, ...)
+  end
+
+  local dofile_ = dofile
+  dofile = function(path)
+    if path then
+      lake.lua_files:push(path)
+    end
+    return dofile_(path)
+  end
+
+  -- Files the lakefile reads may change the graph it builds just like the
+  -- lua files it runs, so the graph cache is told about them.
+  local open_ = io.open
+  io.open = function(path, mode)
+    if lake.handle and type(path) == "string" and
+       (mode == nil or mode:find "r")
+    then
+      C.lua__recordFileRead(lake.handle, makeStr(path))
+    end
+    return open_(path, mode)
+  end
+
+  -- The loader require uses to find modules on package.path.
+  local loadModule = package.loaders[2]
+  package.loaders[2] = function(name)
+    local path = package.searchpath(name, package.path)
+    if path then
+      lake.lua_files:push(path)
+    end
+    return loadModule(name)
+  end
+end
+
 local Task = require "Task"
 
 
@@ -186,7 +251,7 @@ end
 ---
 ---@param path string
 lake.touch = function(path)
-  C.lua__touch(makeStr(path))
+  C.lua__touch(lake.handle, makeStr(path))
 end
 
 -- * --------------------------------------------------------------------------
@@ -255,7 +320,7 @@ end
 ---@param path string
 ---@return boolean
 lake.chdir = function(path)
-  if 0 == C.lua__chdir(makeStr(path)) then
+  if 0 == C.lua__chdir(lake.handle, makeStr(path)) then
     print(debug.traceback())
   end
 end
@@ -287,7 +352,7 @@ end
 ---@param path string
 ---@return boolean
 lake.pathExists = function(path)
-  return 0 ~= C.lua__pathExists(makeStr(path))
+  return 0 ~= C.lua__pathExists(lake.handle, makeStr(path))
 end
 
 -- * --------------------------------------------------------------------------
@@ -298,7 +363,117 @@ end
 ---@param path string 
 ---@return number
 lake.modtime = function(path)
-  return C.lua__modtime(makeStr(path))
+  return C.lua__modtime(lake.handle, makeStr(path))
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Get the newest modified time of the files at each of the given paths, 
+--- or 0 if none of them exist. This asks lake about every path at once, 
+--- which is much cheaper than calling lake.modtime on each of a long list 
+--- of prerequisites.
+---
+---@param paths table | iro.List
+---@return number
+lake.newestModtime = function(paths)
+  local count = #paths
+  if count == 0 then
+    return 0
+  end
+
+  local pathsarr = ffi.new("String["..count.."]")
+  for i,path in ipairs(paths) do
+    pathsarr[i-1] = makeStr(path)
+  end
+
+  local modtimes = ffi.new("u64["..count.."]")
+  C.lua__modtimes(lake.handle, pathsarr, count, modtimes)
+
+  local newest = modtimes[0]
+  for i=1,count-1 do
+    if modtimes[i] > newest then
+      newest = modtimes[i]
+    end
+  end
+  return newest
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Get the size in bytes of the file at the given path, or 0 if the path 
+--- does not exist.
+---
+---@param path string
+---@return number
+lake.fileSize = function(path)
+  return tonumber(C.lua__fileSize(lake.handle, makeStr(path)))
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Hashes 'key' along with the paths and contents of the files in 'files', 
+--- returning the hash as a string of 16 hex digits. File contents are 
+--- hashed through the same cache lake uses for Task:trackContent, so files
+--- are only read again once they change.
+---
+---@param key string
+---@param files table | iro.List | nil
+---@return string
+lake.hashKey = function(key, files)
+  files = files or {}
+  local count = #files
+
+  local filesarr = ffi.new("String["..math.max(count, 1).."]")
+  for i,file in ipairs(files) do
+    filesarr[i-1] = makeStr(file)
+  end
+
+  local out = ffi.new("u8[16]")
+  C.lua__hashKey(lake.handle, makeStr(key), filesarr, count, out)
+  return ffi.string(out, 16)
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Returns true if lake was asked to print timing information with 
+--- --print-timers, so that lakefiles can report their own.
+---
+---@return boolean
+lake.isPrintingTimers = function()
+  return 0 ~= C.lua__isPrintingTimers(lake.handle)
+end
+
+-- * --------------------------------------------------------------------------
+
+--- For use in the cond of a Task that has called Task:trackContent. Returns
+--- true if the content of the Task's prerequisites, its key, and its output
+--- are all the same as when the Task was last completed, false if any of 
+--- them changed, or nil if lake has no record of the Task, in which case 
+--- the cond should fall back to some other check, eg. comparing modified 
+--- times.
+---
+---@param task Task
+---@return boolean?
+lake.unchanged = function(task)
+  local result = C.lua__taskUnchanged(lake.handle, task.handle)
+  if result == -1 then
+    return nil
+  end
+  return result == 1
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Lake remembers whether files exist and when they were modified for the 
+--- rest of the run once it has been asked about them. This is kept up to 
+--- date for files written by its own functions (eg. lake.copy) and those 
+--- named by tasks whose recipes have run, but a recipe that writes any 
+--- other file that a condition later checks must tell lake about it with 
+--- this.
+---
+---@param path string
+lake.invalidateStat = function(path)
+  C.lua__invalidateStat(lake.handle, makeStr(path))
 end
 
 -- * --------------------------------------------------------------------------
@@ -320,6 +495,7 @@ lake.rm = function(path, options)
   options = options or {recursive = false, force = false}
   return 0 ~=
     C.lua__rm(
+      lake.handle,
       makeStr(path),
       options.recursive or false,
       options.force or false)
@@ -347,7 +523,7 @@ lake.mkdir = function(path, options)
     end
   end
 
-  if C.lua__makeDir(strtype(path, #path), make_parents) == 0 then
+  if C.lua__makeDir(lake.handle, strtype(path, #path), make_parents) == 0 then
     return false
   end
 
@@ -362,7 +538,7 @@ end
 ---@param dst string
 ---@return boolean
 lake.copy = function(dst, src)
-  return C.lua__copyFile(makeStr(dst), makeStr(src))
+  return 0 ~= C.lua__copyFile(lake.handle, makeStr(dst), makeStr(src))
 end
 
 -- * --------------------------------------------------------------------------
@@ -373,7 +549,7 @@ end
 ---@param dst string
 ---@return boolean
 lake.move = function(dst, src)
-  return C.lua__moveFile(makeStr(dst), makeStr(src))
+  return 0 ~= C.lua__moveFile(lake.handle, makeStr(dst), makeStr(src))
 end
 
 -- * --------------------------------------------------------------------------
@@ -394,7 +570,7 @@ lake.find = function(pattern)
     error("pattern given to lake.find must be a string!", 2)
   end
 
-  return (List(lua__glob(pattern)))
+  return (List(lua__glob(lake.handle, pattern)))
 end
 
 -- * --------------------------------------------------------------------------
@@ -403,7 +579,7 @@ lake.getEnvVar = function(name)
   if not name or type(name) ~= "string" then
     error("getEnvVar expects a string")
   end
-  return lua__getEnvVar(name)
+  return lua__getEnvVar(lake.handle, name)
 end
 
 -- * --------------------------------------------------------------------------
@@ -415,7 +591,7 @@ lake.setEnvVar = function(name, value)
   if value and type(value) ~= "string" then
     error("setEnvVar expects a string for its second argument")
   end
-  return lua__setEnvVar(name, value)
+  return lua__setEnvVar(lake.handle, name, value)
 end
 
 -- * --------------------------------------------------------------------------
@@ -423,9 +599,13 @@ end
 --- Executes the program referred to by the first parameter
 --- and passes any following arguments as cli args.
 ---
--- TODO(sushi) add a way to pass callbacks for reading stdout/stderr while the 
---             process is running and maybe even passing a stdin if it ever 
---             seems useful/necessary.
+--- Options:
+---   onRead: called with each chunk of what the process writes to stdout, 
+---           along with stderr unless onReadErr is given.
+---   onReadErr: called with each chunk of what the process writes to 
+---              stderr, which is then kept separate from stdout.
+---
+-- TODO(sushi) maybe add passing a stdin if it ever seems useful/necessary.
 ---
 ---@param args string[] | Twine
 ---@param options table?
@@ -448,6 +628,7 @@ lake.cmd = function(args, options)
   options = options or {}
 
   local onRead = options.onRead
+  local onReadErr = options.onReadErr
 
   local argsarr = ffi.new("String["..(args:len()+1).."]")
 
@@ -469,7 +650,8 @@ lake.cmd = function(args, options)
     end
   end
 
-  local handle = C.lua__processSpawn(lake.handle, argsarr, args:len()+1)
+  local handle = 
+    C.lua__processSpawn(lake.handle, argsarr, args:len()+1, not onReadErr)
 
   if not handle then
     local argsstr = ""
@@ -482,15 +664,17 @@ lake.cmd = function(args, options)
   local buffer = require "string.buffer"
 
   local out_buf = buffer.new()
+  local err_buf = onReadErr and buffer.new()
 
   local space_wanted = 1024
 
   local exit_code = ffi.new("s32[1]")
   local out_read = ffi.new("u64[1]")
 
+  -- Output is read even when nothing wants it so that the process never 
+  -- blocks on a full pipe and lake isn't woken up over output it will never
+  -- consume.
   local tryRead = function()
-    if not onRead then return 0 end
-
     if 0 == C.lua__processCanRead(handle) then
       return 0
     end
@@ -499,16 +683,30 @@ lake.cmd = function(args, options)
 
     C.lua__processRead(handle, ptr, len, out_read)
 
-    out_buf:commit(out_read[0])
+    if out_read[0] ~= 0 and onRead then
+      onRead(ffi.string(ptr, out_read[0]))
+    end
+    return out_read[0]
+  end
+
+  local tryReadErr = function()
+    if not onReadErr or 0 == C.lua__processCanReadErr(handle) then
+      return 0
+    end
+
+    local ptr, len = err_buf:reserve(space_wanted)
+
+    C.lua__processReadErr(handle, ptr, len, out_read)
 
     if out_read[0] ~= 0 then
-      onRead(ffi.string(ptr, out_read[0]))
+      onReadErr(ffi.string(ptr, out_read[0]))
     end
     return out_read[0]
   end
 
   while true do
     tryRead()
+    tryReadErr()
 
     local ret = C.lua__processCheck(handle, exit_code)
 
@@ -517,6 +715,7 @@ lake.cmd = function(args, options)
       -- report that its terminated before all of its buffered output is 
       -- consumed
       while tryRead() ~= 0 do end
+      while tryReadErr() ~= 0 do end
 
       C.lua__processClose(lake.handle, handle)
 
@@ -589,6 +788,41 @@ lake.task = function(name)
   return Task.new(lake, name)
 end
 
+--- Makes every file listed in the dep file at 'path' a prerequisite of 
+--- 'task'. The dep file may be a make rule, as written by compilers given 
+--- -MD, a list of files one per line, or lpp's binary format. The files are
+--- tracked by lake without creating a lua Task for each one, though 
+--- lake.task may still be used to get one later.
+---
+--- Returns false if the dep file could not be read, eg. because it hasn't
+--- been written yet.
+---
+---@param task Task
+---@param path string
+---@return boolean
+lake.loadDepFile = function(task, path)
+  return -1 ~= C.lua__loadDepFile(lake.handle, task.handle, makeStr(path))
+end
+
+--- Returns a List of the files listed in the dep file at 'path', which may 
+--- be in any format lake.loadDepFile accepts. The List is empty if the dep 
+--- file could not be read.
+---
+---@param path string
+---@return List
+lake.readDepFile = function(path)
+  return (List(lua__readDepFile(path)))
+end
+
+--- Called by lake to allow the recipe of the Task named 'name' to run 
+--- again, as when watching for changes.
+---
+---@param name string
+lake.resetRecipe = function(name)
+  local task = lake.tasks.by_name[name]
+  task.cb.recipe = co.create(task.cb.recipe_fn)
+end
+
 --- Indicates that an error has occured in a recipe that prevents the task
 --- from being completed. Calling this function from within a task's recipe 
 --- will mark that task as having errored which will prevent any dependent
@@ -651,7 +885,7 @@ end
 Target.dependsOn = function(self, x)
   local x_type = type(x)
   if "string" == x_type then
-    C.lua__makeDep(self.handle, lake.target(x).handle)
+    C.lua__makeDep(lake.handle, self.handle, lake.target(x).handle)
   elseif "table" == x_type then
     for v,i in lake.flatten(x):eachWithIndex() do
       local v_type = type(v)
@@ -661,7 +895,7 @@ Target.dependsOn = function(self, x)
           "not a string, rather a "..v_type.." whose value is "..
           tostring(v)..".", 2)
       end
-      C.lua__makeDep(self.handle, lake.target(v).handle)
+      C.lua__makeDep(lake.handle, self.handle, lake.target(v).handle)
     end
   else
     error(
@@ -761,14 +995,14 @@ end
 TargetGroup.dependsOn = function(self, x)
   local x_type = type(x)
   if "string" == x_type then
-    C.lua__makeDep(self.handle, lake.target(x).handle)
+    C.lua__makeDep(lake.handle, self.handle, lake.target(x).handle)
   elseif "table" == x_type then
     for i,v in ipairs(lake.flatten(x)) do
       local v_type = type(v)
       if "string" ~= v_type then
         error("Element "..i.." of flattened table given to TargetGroup.depends_on is not a string, rather a "..v_type.." whose value is "..tostring(v)..".", 2)
       end
-      C.lua__makeDep(self.handle, lake.target(v).handle)
+      C.lua__makeDep(lake.handle, self.handle, lake.target(v).handle)
     end
   else
     error("TargetGroup.depends_on can take either a string or a table of strings, got: "..x_type..".", 2)
@@ -0,0 +1,159 @@
+#include "StatCache.h"
+
+#include "iro/Logger.h"
+#include "iro/fs/File.h"
+#include "iro/containers/SmallArray.h"
+
+static Logger logger =
+  Logger::create("lake.statcache"_str, Logger::Verbosity::Notice);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 StatCache::init()
+{
+  if (!entry_pool.init())
+    return false;
+  if (!entry_map.init())
+    return false;
+  cwd = nil;
+  cwd_valid = false;
+  hits = misses = 0;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void StatCache::deinit()
+{
+  if (notnil(cwd))
+    cwd.destroy();
+  entry_map.deinit();
+  entry_pool.deinit();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 isSeparator(u8 c)
+{
+#if IRO_WIN32
+  return c == '/' || c == '\\';
+#else
+  return c == '/';
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u64 StatCache::hashPath(String path, String dir)
+{
+  SmallArray<String, 32> components;
+  defer { components.deinit(); };
+
+  auto addComponents = [&](String s)
+  {
+    u8* scan = s.ptr;
+    u8* end = s.ptr + s.len;
+    while (scan < end)
+    {
+      u8* start = scan;
+      while (scan < end && !isSeparator(*scan))
+        scan += 1;
+
+      String component = String::from(start, scan);
+      if (component == ".."_str)
+      {
+        if (!components.isEmpty())
+          components.pop();
+      }
+      else if (!component.isEmpty() && component != "."_str)
+      {
+        components.push(component);
+      }
+
+      scan += 1;
+    }
+  };
+
+  if (!fs::Path::isRooted(path))
+  {
+    // A relative 'dir' is itself relative to the current directory.
+    if (isnil(dir) || !fs::Path::isRooted(dir))
+    {
+      if (!cwd_valid)
+      {
+        if (notnil(cwd))
+          cwd.destroy();
+        cwd = fs::Path::cwd();
+        cwd_valid = true;
+      }
+      addComponents(cwd.asStr());
+    }
+
+    if (notnil(dir))
+      addComponents(dir);
+  }
+
+  addComponents(path);
+
+  u64 hash = 14695981039346656037ull;
+  for (String component : components)
+  {
+    hash = (hash ^ '/') * 1099511628211;
+    for (u8 c : component)
+      hash = (hash ^ c) * 1099511628211;
+  }
+  return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+StatCache::Entry* StatCache::get(String path, String dir)
+{
+  u64 hash = hashPath(path, dir);
+
+  if (Entry* entry = entry_map.find(hash))
+  {
+    hits += 1;
+    return entry;
+  }
+
+  misses += 1;
+
+  Entry* entry = entry_pool.add();
+  entry->hash = hash;
+
+  fs::FileInfo info;
+  if (notnil(dir) && !fs::Path::isRooted(path))
+  {
+    auto full = fs::Path::from(dir);
+    defer { full.destroy(); };
+    full.ensureDir().append(path);
+    info = fs::FileInfo::of(full.asStr());
+  }
+  else
+  {
+    info = fs::FileInfo::of(path);
+  }
+
+  entry->exists = notnil(info);
+  entry->regular = info.kind == fs::FileKind::Regular;
+  entry->modtime = (info.last_modified_time - TimePoint{}).toMilliseconds();
+  entry->size = info.byte_size;
+
+  entry_map.insert(entry);
+  return entry;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void StatCache::invalidate(String path, String dir)
+{
+  u64 hash = hashPath(path, dir);
+
+  if (Entry* entry = entry_map.find(hash))
+  {
+    TRACE("invalidating ", path, "\n");
+    entry_map.remove(entry);
+    entry_pool.remove(entry);
+  }
+}
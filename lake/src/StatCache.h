@@ -0,0 +1,78 @@
+/*
+ *  Remembers whether paths exist and when they were last modified for the
+ *  duration of a single run of lake.
+ *
+ *  Task conditions tend to ask about the same files over and over, eg. a
+ *  header shared by hundreds of objects is checked once per object, so
+ *  rather than stat'ing them every time we stat each path once and keep the
+ *  result until something lake knows about changes it. This includes tasks
+ *  finishing their recipes (which are assumed to have written the file
+ *  named by the task) and lake's own file operations. Anything else a
+ *  recipe writes should be invalidated through lake.invalidateStat.
+ *
+ *  Entries are keyed by absolute path with '.' and '..' resolved lexically,
+ *  so that the same file reached relative to different directories shares
+ *  an entry.
+ */
+
+#ifndef _lake_StatCache_h
+#define _lake_StatCache_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/AVL.h"
+#include "iro/containers/Array.h"
+#include "iro/containers/Pool.h"
+#include "iro/fs/Path.h"
+
+using namespace iro;
+
+/* ============================================================================
+ */
+struct StatCache
+{
+  struct Entry
+  {
+    u64 hash;
+
+    b8  exists;
+    b8  regular; // If this is a regular file rather than a directory, etc.
+    u64 modtime; // In milliseconds, as given to lua.
+    u64 size;
+  };
+
+  typedef AVL<Entry, [](const Entry* e) { return e->hash; }> EntryMap;
+
+  Pool<Entry> entry_pool;
+  EntryMap    entry_map;
+
+  // The current directory relative paths are resolved against, fetched
+  // lazily after it changes.
+  fs::Path cwd;
+  b8       cwd_valid;
+
+  u64 hits;
+  u64 misses;
+
+  b8   init();
+  void deinit();
+
+  // Returns the entry for 'path', stat'ing it if it is not yet cached. If 
+  // 'dir' is given, a relative 'path' is taken to be relative to it rather 
+  // than the current directory.
+  Entry* get(String path, String dir = nil);
+
+  // Forgets what is known about 'path' so that it is stat'd again next
+  // time it is asked about. If 'dir' is given, a relative 'path' is taken
+  // to be relative to it rather than the current directory.
+  void invalidate(String path, String dir = nil);
+
+  // Must be called whenever lake changes its current directory.
+  void noteChdir() { cwd_valid = false; }
+
+  // Hashes the absolute form of 'path', which is what entries are keyed 
+  // by. This is stable between runs for paths that name the same file.
+  u64 hashPath(String path, String dir = nil);
+};
+
+#endif // _lake_StatCache_h
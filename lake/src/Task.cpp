@@ -3,14 +3,11 @@
 #include "Lake.h"
 
 #include "iro/Logger.h"
+#include "iro/containers/SmallArray.h"
 
 static Logger logger = 
   Logger::create("lake.task"_str, Logger::Verbosity::Trace);
 
-/* ----------------------------------------------------------------------------
- */
-u64 hashTask(const Task* task) { return task->uid; }
-
 /* ----------------------------------------------------------------------------
  */
 b8 Task::init(String name)
@@ -18,13 +15,6 @@ b8 Task::init(String name)
   this->name = name.allocateCopy();
   uid = name.hash();
 
-  if (!prerequisites.init())
-    return ERROR(
-        "failed to initialize prerequisites list for task ", name, "\n");
-
-  if (!dependents.init())
-    return ERROR("failed to initialize dependents list for task", name, "\n");
-
   wdir = fs::Path::cwd();
 
   return true;
@@ -37,21 +27,24 @@ void Task::deinit()
   mem::stl_allocator.free(name.ptr);
   name = {};
   uid = 0;
-
-  prerequisites.deinit();
-  dependents.deinit();
 }
 
 /* ----------------------------------------------------------------------------
  */
-b8 Task::isLeaf()
+void Task::reset()
 {
-  for (Task& task : prerequisites)
-  {
-    if (!task.flags.test(Flag::Complete) || task.flags.test(Flag::Errored))
-      return false;
-  }
-  return true;
+  flags.unset(Flag::PrereqJustBuilt);
+  flags.unset(Flag::Errored);
+  flags.unset(Flag::StartedRecipe);
+  flags.unset(Flag::Complete);
+  flags.unset(Flag::ProcessReady);
+  flags.unset(Flag::InputHashed);
+
+  waiting_process_count = 0;
+  start_time = nil;
+  end_time = nil;
+  job_slot = 0;
+  peak_memory = 0;
 }
 
 /* ----------------------------------------------------------------------------
@@ -66,6 +59,7 @@ b8 Task::needRunRecipe(Lake& lake)
   LuaState& lua = lake.lua;
 
   wdir.chdir();
+  lake.stat_cache.noteChdir();
   defer 
   { 
     // Always save whatever the current directory is as the user may have 
@@ -84,6 +78,7 @@ b8 Task::needRunRecipe(Lake& lake)
     wdir.destroy();
     wdir = fs::Path::cwd();
     lake.root_dir.chdir(); 
+    lake.stat_cache.noteChdir();
   };
 
   s32 top = lua.gettop();
@@ -97,11 +92,11 @@ b8 Task::needRunRecipe(Lake& lake)
   lua.pushvalue(lake.I.list);
   lua.newtable();
   u32 prereq_count = 0;
-  for (Task& prereq : prerequisites)
+  for (Task* prereq : prerequisites)
   {
     prereq_count += 1;
     lua.pushinteger(prereq_count);
-    lua.pushstring(prereq.name);
+    lua.pushstring(prereq->name);
     lua.settable(-3);
   }
 
@@ -128,70 +123,104 @@ b8 Task::needRunRecipe(Lake& lake)
 void Task::onComplete(Lake& lake, b8 just_built)
 {
   flags.set(Flag::Complete);
-  for (Task& dependent : dependents)
-  {
-    // TODO(sushi) this kinda sucks. We used to do this better by 
-    //             tracking a count of unsatisfied prereqs on Targets
-    //             but for some reason I'm hesitant to do that here.
-    //             Probably return to doing that, or even just use
-    //             an extrinsic graph structure that we can trim 
-    //             nodes from to detect this kinda stuff.
-    if (dependent.isLeaf())
-      lake.addLeaf(&dependent);
-    if (just_built)
-      dependent.flags.set(Flag::PrereqJustBuilt);
-  }
-}
 
-/* ----------------------------------------------------------------------------
- */
-static Task::TopSortResult topSortVisit(Task* task, TaskList* sorted)
-{
-  if (task->flags.test(Task::Flag::VisitedPerm))
-    return Task::TopSortResult::Ok;
+  // Assume the recipe wrote the file this task is named after.
+  if (just_built)
+    lake.stat_cache.invalidate(name, wdir.asStr());
 
-  if (task->flags.test(Task::Flag::VisitedTemp))
+  if (just_built && notnil(start_time) && notnil(end_time))
   {
-    ERROR(task->name, " <- \n");
-    return Task::TopSortResult::Cycle;
+    BuildDB::TaskRecord* record = lake.build_db.findTask(uid);
+    if (record == nullptr)
+      record = lake.build_db.addTask(uid);
+    record->duration_us = (end_time - start_time).toMicroseconds();
+    if (peak_memory != 0)
+      record->peak_memory = peak_memory;
+    lake.build_db.dirty = true;
   }
 
-  task->flags.set(Task::Flag::VisitedTemp);
-
-  for (Task& prereq : task->prerequisites)
+  b8 output_changed = just_built;
+  if (flags.test(Flag::ContentTracked))
   {
-    Task::TopSortResult result = topSortVisit(&prereq, sorted);
-    if (result == Task::TopSortResult::Cycle)
+    u64 input_hash = getInputHash(lake, wdir.asStr());
+    u64 output_hash = lake.hashFile(name, wdir.asStr());
+
+    BuildDB::TaskRecord* record = lake.build_db.findTask(uid);
+    if (record == nullptr)
     {
-      ERROR(task->name, " <- \n");
-      return result;
+      record = lake.build_db.addTask(uid);
     }
-    else if (result != Task::TopSortResult::Ok)
+    else if (just_built && 
+             output_hash != 0 && 
+             output_hash == record->output_hash)
     {
-      return result;
+      // The recipe wrote exactly what was already there, so there's no
+      // need to rebuild anything that depends on it.
+      DEBUG("output of '", name, "' did not change\n");
+      output_changed = false;
+      lake.early_cutoff_count += 1;
+    }
+
+    if (record->input_hash != input_hash || 
+        record->output_hash != output_hash)
+    {
+      record->input_hash = input_hash;
+      record->output_hash = output_hash;
+      lake.build_db.dirty = true;
     }
   }
 
-  task->flags.set(Task::Flag::VisitedPerm);
-  sorted->pushTail(task);
+  if (output_changed)
+  {
+    for (Task* dependent : dependents)
+      dependent->flags.set(Flag::PrereqJustBuilt);
+  }
 
-  return Task::TopSortResult::Ok;
+  lake.graph.releaseDependents(this);
 }
 
 /* ----------------------------------------------------------------------------
  */
-Task::TopSortResult Task::topSortTasks(const TaskList& tasks, TaskList* sorted)
+u64 Task::getInputHash(Lake& lake, String dir)
 {
-  for (Task& task : tasks)
+  if (flags.test(Flag::InputHashed))
+    return input_hash;
+
+  // Prerequisites are visited in order of their uid so that the hash 
+  // doesn't depend on the order they were added in. They're sorted in a
+  // copy as the graph's slice may be being iterated elsewhere.
+  SmallArray<Task*, 16> sorted;
+  for (Task* prereq : prerequisites)
+    sorted.push(prereq);
+  TaskGraph::sortByUid(Slice<Task*>::from(sorted.arr, sorted.len));
+
+  input_hash = (14695981039346656037ull ^ content_key) * 1099511628211;
+  for (s32 i = 0; i < sorted.len; ++i)
   {
-    if (!task.flags.test(Flag::VisitedPerm))
-    {
-      TopSortResult result = topSortVisit(&task, sorted);
-      if (result != TopSortResult::Ok)
-        return result;
-    }
+    Task* prereq = sorted.arr[i];
+    input_hash = (input_hash ^ prereq->uid) * 1099511628211;
+    input_hash = 
+      (input_hash ^ lake.hashFile(prereq->name, dir)) * 
+      1099511628211;
   }
-  return TopSortResult::Ok;
+
+  flags.set(Flag::InputHashed);
+  return input_hash;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s32 Task::isUnchanged(Lake& lake)
+{
+  BuildDB::TaskRecord* record = lake.build_db.findTask(uid);
+  if (record == nullptr || record->output_hash == 0)
+    return -1;
+
+  if (record->input_hash != getInputHash(lake))
+    return 0;
+
+  u64 output_hash = lake.hashFile(name);
+  return output_hash != 0 && output_hash == record->output_hash;
 }
 
 /* ----------------------------------------------------------------------------
@@ -212,14 +241,22 @@ Task::RecipeResult Task::resumeRecipe(Lake& lake)
     ERROR("failed to chdir into Task's working directory: '",wdir,"'\n");
     return Task::RecipeResult::Error;
   }
+  lake.stat_cache.noteChdir();
 
   defer
   {
     wdir.destroy();
     wdir = fs::Path::cwd();
     lake.root_dir.chdir();
+    lake.stat_cache.noteChdir();
   };
 
+  // The recipe is running, so it will check on whatever it was waiting on.
+  flags.unset(Flag::ProcessReady);
+
+  lake.active_task = this;
+  defer { lake.active_task = nullptr; };
+
   LuaState& lua = lake.lua;
     
   lua.pushstring(name);
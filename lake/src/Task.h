@@ -9,7 +9,7 @@
 #include "iro/Common.h"
 #include "iro/Unicode.h"
 #include "iro/containers/List.h"
-#include "iro/containers/AVL.h"
+#include "iro/containers/Slice.h"
 #include "iro/fs/Path.h"
 #include "iro/fs/Dir.h"
 
@@ -18,11 +18,8 @@ using namespace iro;
 struct Lake;
 struct Task;
 
-u64 hashTask(const Task* t);
-
 typedef DList<Task> TaskList;
 typedef TaskList::Node TaskNode;
-typedef AVL<Task, hashTask> TaskSet;
 
 /* ============================================================================
  */
@@ -34,26 +31,60 @@ struct Task
   // A unique name for this Task. Note that this String is owned by this Task.
   String name = {};
 
-  // Lists of Tasks this Task either depends on or is a prerequisite of.
-  // This forms the dependency graph.
-  TaskSet prerequisites = {};
-  TaskSet dependents = {};
+  // Index of this Task in its TaskGraph.
+  u32 index = 0;
+
+  // Tasks this Task either depends on or is a prerequisite of, which form
+  // the dependency graph. These are only valid once the TaskGraph has been
+  // built, see TaskGraph.h.
+  Slice<Task*> prerequisites = {};
+  Slice<Task*> dependents = {};
 
   // The working directory of this Task, eg. the directory we will chdir into
   // anytime we hand over control to one of its callbacks, currently only 
   // the cond and recipe callbacks.
   fs::Path wdir;
 
+  // How many processes spawned by the recipe are in the Lake's 
+  // process_waiter. While this is non-zero the recipe is only resumed once
+  // one of them is ready.
+  u32 waiting_process_count = 0;
+
   // The times at which the recipe started and ended.
   TimePoint start_time = nil;
   TimePoint end_time = nil;
 
+  // The job slot, starting from 1, the recipe occupies while it runs. 
+  // Used to lay out recipes when tracing.
+  u32 job_slot = 0;
+
+  // When the Task is ContentTracked, a hash of the key given by the user
+  // which is mixed into the hash of its inputs.
+  u64 content_key = 0;
+
+  // Hash of the content of this Task's prerequisites and its content_key,
+  // valid once InputHashed is set.
+  u64 input_hash = 0;
+
+  // How long we expect this Task's recipe to take, and how long we expect
+  // it and the longest chain of Tasks depending on it to take, which is 
+  // the priority it is given when deciding which leaf to run next. See 
+  // Lake::computePriorities.
+  u64 estimate_us = 0;
+  u64 priority_us = 0;
+
+  // How much memory we expect the processes this Task's recipe runs to
+  // need, from what they peaked at last time, and what they've peaked at
+  // this time, in bytes. See JobLimiter.h.
+  u64 estimate_memory = 0;
+  u64 peak_memory = 0;
+
   b8   init(String name);
   void deinit();
 
-  // Returns true if all of this Task's prerequisites are marked as completed
-  // and none of its prerequisites are marked as Errored.
-  b8 isLeaf();
+  // Forgets how this Task went the last time it was checked so that it may
+  // be checked again, eg. when lake is watching for changes.
+  void reset();
 
   // Returns if this Task's recipe should run after all of its prerequisites 
   // have been built.
@@ -61,6 +92,17 @@ struct Task
 
   void onComplete(Lake& lake, b8 just_built);
 
+  // Gets the hash of this ContentTracked Task's inputs, computing it if 
+  // it hasn't been yet. Paths are relative to 'dir', or the current 
+  // directory if it is nil.
+  u64 getInputHash(Lake& lake, String dir = nil);
+
+  // Returns 1 if the build database says this ContentTracked Task's inputs
+  // and output are the same as the last time it was recorded, 0 if not, and 
+  // -1 if the Task has not been recorded. This is meant to be called from
+  // the Task's cond, while we are in its working directory.
+  s32 isUnchanged(Lake& lake);
+
   // Starts or resumes this task's recipe.
   enum class RecipeResult
   {
@@ -80,6 +122,13 @@ struct Task
 
   RecipeResult resumeRecipe(Lake& lake);
 
+  // Returns true if the recipe is blocked on its processes, in which case 
+  // resuming it would accomplish nothing.
+  b8 isWaitingOnProcesses() const
+  {
+    return waiting_process_count != 0 && !flags.test(Flag::ProcessReady);
+  }
+
   enum class Flag
   {
     PrereqJustBuilt,
@@ -91,7 +140,15 @@ struct Task
     StartedRecipe,
     Complete,
 
-    VisitedPerm,
+    // Set when a process the recipe is waiting on has output or exited.
+    ProcessReady,
+
+    // The hashes of this Task's inputs and output are kept in the build 
+    // database, see BuildDB.h.
+    ContentTracked,
+    InputHashed,
+
+    // Used when looking for a cycle in the graph.
     VisitedTemp,
 
     COUNT,
@@ -99,14 +156,6 @@ struct Task
   typedef Flags<Flag> Flags;
 
   Flags flags = {};
-
-  enum class TopSortResult
-  {
-    Ok,
-    Cycle,
-  };
-
-  static TopSortResult topSortTasks(const TaskList& tasks, TaskList* sorted);
 };
 
 #endif
@@ -17,6 +17,7 @@ Task* lua__createLuaTask(Lake* lake, String name);
 
 void lua__setTaskHasCond(Task* task);
 void lua__setTaskHasRecipe(Task* task);
+void lua__setTaskContentKey(Task* task, String key);
 ]]
 
 local strtype = ffi.typeof("String")
@@ -65,7 +66,7 @@ Task.dependsOn = function(self, ...)
   for task in List{...}:each() do
     if "table" == type(task) then
       if Task:isTypeOf(task) then
-        C.lua__makeDep(self.handle, task.handle)
+        C.lua__makeDep(lake.handle, self.handle, task.handle)
       else 
         -- Treat the table as if its an array of tasks.
         if not List:isTypeOf(task) then
@@ -108,11 +109,28 @@ Task.recipe = function(self, f)
   
   C.lua__setTaskHasRecipe(self.handle)
 
+  self.cb.recipe_fn = f
   self.cb.recipe = co.create(f)
 
   return self
 end
 
+--- Has lake keep hashes of this Task's inputs and output in its build 
+--- database, so that its cond may use lake.unchanged to see if anything 
+--- actually changed since it was last built, and so that if its recipe 
+--- writes the same output as was already there, tasks depending on it are
+--- not rebuilt because of it.
+---
+--- 'key' is anything else the output depends on, usually the command line
+--- used to build it, such that changing it causes lake.unchanged to return
+--- false.
+---@param key string
+---@return self
+Task.trackContent = function(self, key)
+  C.lua__setTaskContentKey(self.handle, makeStr(key))
+  return self
+end
+
 --- Sets the working directory this task's recipe should start in.
 ---@param path string
 ---@return self
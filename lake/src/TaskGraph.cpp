@@ -0,0 +1,485 @@
+#include "TaskGraph.h"
+
+#include "iro/Logger.h"
+
+#include "stdlib.h"
+
+static Logger logger =
+  Logger::create("lake.graph"_str, Logger::Verbosity::Notice);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 TaskGraph::init(mem::Allocator* allocator)
+{
+  if (!pool.init(allocator))
+    return false;
+  if (!tasks.init(256, allocator))
+    return false;
+  if (!task_map.init(allocator))
+    return false;
+  if (!edges.init(256, allocator))
+    return false;
+  if (!prerequisites.init(8, allocator))
+    return false;
+  if (!dependents.init(8, allocator))
+    return false;
+  if (!dependent_offsets.init(8, allocator))
+    return false;
+  if (!dependent_indexes.init(8, allocator))
+    return false;
+  if (!pending.init(8, allocator))
+    return false;
+  if (!leaves.init(64, allocator))
+    return false;
+  built = false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TaskGraph::deinit()
+{
+  for (Task* task : tasks)
+    task->deinit();
+
+  pool.deinit();
+  tasks.destroy();
+  task_map.deinit();
+  edges.destroy();
+  prerequisites.destroy();
+  dependents.destroy();
+  dependent_offsets.destroy();
+  dependent_indexes.destroy();
+  pending.destroy();
+  leaves.destroy();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+Task* TaskGraph::createTask(String name)
+{
+  Task* task = pool.add();
+  if (!task->init(name))
+  {
+    pool.remove(task);
+    return nullptr;
+  }
+
+  task->index = tasks.len();
+  tasks.push(task);
+  task_map.insert(task);
+  return task;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+Task* TaskGraph::findTask(String name)
+{
+  return task_map.find(name.hash());
+}
+
+/* ----------------------------------------------------------------------------
+ */
+Task* TaskGraph::internTask(String name)
+{
+  Task* task = findTask(name);
+  if (task != nullptr)
+    return task;
+  return createTask(name);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 TaskGraph::addPrerequisite(Task* task, Task* prereq)
+{
+  if (built)
+    return ERROR("cannot make '", prereq->name, "' a prerequisite of '",
+                 task->name, "' as the task graph has already been built\n");
+
+  edges.push({task->index, prereq->index});
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static int compareUids(const void* a, const void* b)
+{
+  u64 x = (*(Task**)a)->uid;
+  u64 y = (*(Task**)b)->uid;
+  return x < y? -1 : x > y? 1 : 0;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TaskGraph::sortByUid(Slice<Task*> range)
+{
+  qsort(range.ptr, range.len, sizeof(Task*), compareUids);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static int compareIndexes(const void* a, const void* b)
+{
+  u32 x = *(u32*)a;
+  u32 y = *(u32*)b;
+  return x < y? -1 : x > y? 1 : 0;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Most Tasks have only a handful of prerequisites, which are quicker to 
+ *  insertion sort than to hand to qsort.
+ */
+static void sortIndexes(u32* indexes, u32 count)
+{
+  if (count > 32)
+  {
+    qsort(indexes, count, sizeof(u32), compareIndexes);
+    return;
+  }
+
+  for (u32 i = 1; i < count; ++i)
+  {
+    u32 index = indexes[i];
+    u32 j = i;
+    for (; j > 0 && indexes[j - 1] > index; --j)
+      indexes[j] = indexes[j - 1];
+    indexes[j] = index;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ *  Turns the count of each Task at offsets[index + 1] into the offset its
+ *  range starts at.
+ */
+static void accumulateOffsets(Array<u32>& offsets)
+{
+  for (s32 i = 1; i < offsets.len(); ++i)
+    offsets[i] += offsets[i - 1];
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 TaskGraph::build()
+{
+  s32 task_count = tasks.len();
+
+  // The graph is laid out using only the indexes of Tasks, so that we 
+  // don't have to touch the Tasks themselves for every edge.
+  auto offsets = Array<u32>::create(task_count + 1);
+  defer { offsets.destroy(); };
+  offsets.resize(task_count + 1);
+
+  auto cursors = Array<u32>::create(task_count);
+  defer { cursors.destroy(); };
+  cursors.resize(task_count);
+
+  auto indexes = Array<u32>::create(edges.len());
+  defer { indexes.destroy(); };
+  indexes.resize(edges.len());
+
+  // Gather the prerequisites of each Task into its own range.
+  for (u32& offset : offsets)
+    offset = 0;
+  for (Edge& edge : edges)
+    offsets[edge.task + 1] += 1;
+  accumulateOffsets(offsets);
+
+  for (s32 i = 0; i < task_count; ++i)
+    cursors[i] = offsets[i];
+  for (Edge& edge : edges)
+  {
+    indexes[cursors[edge.task]] = edge.prereq;
+    cursors[edge.task] += 1;
+  }
+
+  // Sort each range so that duplicates sit next to each other, and pack
+  // them down with the duplicates removed. A range never moves past where
+  // it started, so its offset can be overwritten as we go.
+  u32 packed = 0;
+  for (s32 i = 0; i < task_count; ++i)
+  {
+    u32 start = offsets[i];
+    u32 count = offsets[i + 1] - start;
+    sortIndexes(indexes.arr + start, count);
+
+    offsets[i] = packed;
+    for (u32 j = 0; j < count; ++j)
+    {
+      u32 prereq = indexes[start + j];
+      if (packed != offsets[i] && indexes[packed - 1] == prereq)
+        continue;
+      indexes[packed] = prereq;
+      packed += 1;
+    }
+  }
+  offsets[task_count] = packed;
+
+  // Then the dependents, which are just the prerequisites flipped around.
+  // Tasks are visited in order, so each Task's dependents end up in order 
+  // of their index.
+  dependent_offsets.resize(task_count + 1);
+
+  for (u32& offset : dependent_offsets)
+    offset = 0;
+  for (u32 i = 0; i < packed; ++i)
+    dependent_offsets[indexes[i] + 1] += 1;
+  accumulateOffsets(dependent_offsets);
+
+  for (s32 i = 0; i < task_count; ++i)
+    cursors[i] = dependent_offsets[i];
+
+  dependent_indexes.resize(packed);
+  for (s32 i = 0; i < task_count; ++i)
+  {
+    for (u32 j = offsets[i]; j < offsets[i + 1]; ++j)
+    {
+      u32 prereq = indexes[j];
+      dependent_indexes[cursors[prereq]] = i;
+      cursors[prereq] += 1;
+    }
+  }
+
+  pending.resize(task_count);
+  for (s32 i = 0; i < task_count; ++i)
+    pending[i] = offsets[i + 1] - offsets[i];
+
+  // Finally the Tasks themselves are given views of their neighbours.
+  prerequisites.resize(packed);
+  for (u32 i = 0; i < packed; ++i)
+    prerequisites[i] = tasks[indexes[i]];
+
+  dependents.resize(packed);
+  for (u32 i = 0; i < packed; ++i)
+    dependents[i] = tasks[dependent_indexes[i]];
+
+  for (s32 i = 0; i < task_count; ++i)
+  {
+    Task* task = tasks[i];
+
+    task->prerequisites = 
+      {prerequisites.arr + offsets[i], offsets[i + 1] - offsets[i]};
+
+    task->dependents = 
+      { dependents.arr + dependent_offsets[i], 
+        dependent_offsets[i + 1] - dependent_offsets[i] };
+  }
+
+  DEBUG("built task graph of ", task_count, " tasks with ", packed, 
+        " edges (", edges.len() - packed, " duplicates)\n");
+
+  edges.destroy();
+  built = true;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Called when sorting could not place every Task. Each Task left with
+ *  'remaining' prerequisites has one that also does, so following those
+ *  must eventually come back around to some Task we've seen.
+ */
+static void reportCycle(TaskGraph& graph, Array<u32>& remaining)
+{
+  Task* task = nullptr;
+  for (Task* candidate : graph.tasks)
+  {
+    if (remaining[candidate->index] != 0)
+    {
+      task = candidate;
+      break;
+    }
+  }
+
+  auto path = Array<Task*>::create();
+  defer { path.destroy(); };
+
+  while (!task->flags.test(Task::Flag::VisitedTemp))
+  {
+    task->flags.set(Task::Flag::VisitedTemp);
+    path.push(task);
+
+    for (Task* prereq : task->prerequisites)
+    {
+      if (remaining[prereq->index] != 0)
+      {
+        task = prereq;
+        break;
+      }
+    }
+  }
+
+  s32 start = 0;
+  while (path[start] != task)
+    start += 1;
+
+  for (s32 i = start; i < path.len(); ++i)
+    ERROR(path[i]->name, " <- \n");
+  ERROR(task->name, "\n");
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 TaskGraph::sort(Array<Task*>* sorted)
+{
+  assert(built);
+
+  // How many prerequisites of each Task have yet to be placed.
+  auto remaining = Array<u32>::create(tasks.len());
+  defer { remaining.destroy(); };
+  remaining.resize(tasks.len());
+
+  for (s32 i = 0; i < tasks.len(); ++i)
+  {
+    remaining[i] = pending[i];
+    if (remaining[i] == 0)
+      sorted->push(tasks[i]);
+  }
+
+  // 'sorted' doubles as the queue of Tasks whose dependents we have yet to
+  // visit.
+  for (s32 i = 0; i < sorted->len(); ++i)
+  {
+    u32 index = (*sorted)[i]->index;
+    for (u32 j = dependent_offsets[index]; 
+         j < dependent_offsets[index + 1]; 
+         ++j)
+    {
+      u32 dependent = dependent_indexes[j];
+      remaining[dependent] -= 1;
+      if (remaining[dependent] == 0)
+        sorted->push(tasks[dependent]);
+    }
+  }
+
+  if (sorted->len() == tasks.len())
+    return true;
+
+  reportCycle(*this, remaining);
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TaskGraph::addLeaf(Task* task)
+{
+  DEBUG("new leaf: ", task->name, "\n");
+
+  leaves.push(task);
+
+  s32 i = leaves.len() - 1;
+  while (i > 0)
+  {
+    s32 parent = (i - 1) / 2;
+    if (leaves[parent]->priority_us >= leaves[i]->priority_us)
+      break;
+    Task* swap = leaves[parent];
+    leaves[parent] = leaves[i];
+    leaves[i] = swap;
+    i = parent;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+Task* TaskGraph::takeLeaf()
+{
+  Task* top = leaves[0];
+
+  leaves[0] = *leaves.last();
+  leaves.pop();
+
+  s32 i = 0;
+  s32 len = leaves.len();
+  for (;;)
+  {
+    s32 largest = i;
+    s32 left = 2 * i + 1;
+    s32 right = 2 * i + 2;
+    if (left < len &&
+        leaves[left]->priority_us > leaves[largest]->priority_us)
+      largest = left;
+    if (right < len &&
+        leaves[right]->priority_us > leaves[largest]->priority_us)
+      largest = right;
+    if (largest == i)
+      break;
+    Task* swap = leaves[largest];
+    leaves[largest] = leaves[i];
+    leaves[i] = swap;
+    i = largest;
+  }
+
+  return top;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TaskGraph::reschedule(Slice<Task*> changed, Array<Task*>* affected)
+{
+  assert(built && affected->isEmpty());
+
+  auto marked = Array<b8>::create(tasks.len());
+  defer { marked.destroy(); };
+  marked.resize(tasks.len());
+  for (b8& mark : marked)
+    mark = false;
+
+  for (Task* task : changed)
+  {
+    if (!marked[task->index])
+    {
+      marked[task->index] = true;
+      affected->push(task);
+    }
+  }
+
+  // 'affected' doubles as the queue of Tasks whose dependents we have yet 
+  // to visit.
+  for (s32 i = 0; i < affected->len(); ++i)
+  {
+    u32 index = (*affected)[i]->index;
+    for (u32 j = dependent_offsets[index]; 
+         j < dependent_offsets[index + 1]; 
+         ++j)
+    {
+      u32 dependent = dependent_indexes[j];
+      if (!marked[dependent])
+      {
+        marked[dependent] = true;
+        affected->push(tasks[dependent]);
+      }
+    }
+  }
+
+  // Prerequisites that weren't affected are still complete, so only those
+  // that were are waited on.
+  for (Task* task : *affected)
+  {
+    u32 count = 0;
+    for (Task* prereq : task->prerequisites)
+    {
+      if (marked[prereq->index])
+        count += 1;
+    }
+    pending[task->index] = count;
+  }
+
+  for (Task* task : *affected)
+  {
+    if (pending[task->index] == 0)
+      addLeaf(task);
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TaskGraph::releaseDependents(Task* task)
+{
+  u32 index = task->index;
+  for (u32 j = dependent_offsets[index]; j < dependent_offsets[index + 1]; ++j)
+  {
+    u32 dependent = dependent_indexes[j];
+    pending[dependent] -= 1;
+    if (pending[dependent] == 0)
+      addLeaf(tasks[dependent]);
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ *  Storage for every Task and the dependency graph between them.
+ *
+ *  Tasks are allocated out of chunks rather than one at a time, and the
+ *  prerequisites declared while the lakefile runs are gathered into a flat
+ *  list of edges. Once the lakefile is done, build() turns those into two
+ *  contiguous arrays holding the prerequisites and dependents of every Task
+ *  back to back, with each Task getting a Slice of each, so walking the
+ *  graph touches as little memory as possible. This matters as large
+ *  projects easily reach tens of thousands of Tasks, most of them being
+ *  headers found in dep files.
+ *
+ *  Rather than checking every prerequisite of a dependent whenever one of
+ *  them completes, we count how many prerequisites of each Task have yet
+ *  to complete, and the Task becomes a leaf when its count reaches 0.
+ */
+
+#ifndef _lake_TaskGraph_h
+#define _lake_TaskGraph_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/Array.h"
+#include "iro/containers/Pool.h"
+#include "iro/containers/AVL.h"
+
+#include "Task.h"
+
+using namespace iro;
+
+/* ============================================================================
+ */
+struct TaskGraph
+{
+  Pool<Task, 256> pool;
+
+  // Every Task, in the order they were created. A Task's index in this is
+  // Task::index.
+  Array<Task*> tasks;
+
+  // Every Task by its uid, so that Tasks named in dep files can be found
+  // without going through lua.
+  typedef AVL<Task, [](const Task* t) { return t->uid; }> TaskMap;
+  TaskMap task_map;
+
+  // Prerequisites declared through addPrerequisite, by the index of each 
+  // Task, consumed by build().
+  struct Edge
+  {
+    u32 task;
+    u32 prereq;
+  };
+  Array<Edge> edges;
+
+  // Backing storage of Task::prerequisites and Task::dependents.
+  Array<Task*> prerequisites;
+  Array<Task*> dependents;
+
+  // The dependents of each Task by index, the range of those of Task i 
+  // being [dependent_offsets[i], dependent_offsets[i + 1]). Sorting and 
+  // scheduling walk these so that they only touch a Task once it's ready.
+  Array<u32> dependent_offsets;
+  Array<u32> dependent_indexes;
+
+  // How many prerequisites of each Task have yet to complete. The Task 
+  // becomes a leaf when this reaches 0.
+  Array<u32> pending;
+
+  // Set once build() has been called, after which no more prerequisites
+  // can be added.
+  b8 built;
+
+  // Tasks whose prerequisites are all complete, kept as a max heap on
+  // Task::priority_us so that the Task with the most work depending on it
+  // is started first.
+  Array<Task*> leaves;
+
+  b8   init(mem::Allocator* allocator = &mem::stl_allocator);
+  void deinit();
+
+  // Returns nullptr if the Task fails to initialize.
+  Task* createTask(String name);
+
+  Task* findTask(String name);
+
+  // Returns the Task with the given name, creating it if it doesn't exist.
+  Task* internTask(String name);
+
+  // Returns false if the graph has already been built.
+  b8 addPrerequisite(Task* task, Task* prereq);
+
+  // Lays out the prerequisites and dependents of every Task, dropping
+  // duplicates.
+  b8 build();
+
+  // Fills 'sorted' with every Task such that each comes after all of its
+  // prerequisites. Returns false, after printing it, if there is a cycle.
+  b8 sort(Array<Task*>* sorted);
+
+  void addLeaf(Task* task);
+
+  // Removes and returns the leaf with the highest priority.
+  Task* takeLeaf();
+
+  // Notes that 'task' is complete, adding any dependents that were only
+  // waiting on it to the leaves.
+  void releaseDependents(Task* task);
+
+  // Fills the empty 'affected' with the Tasks in 'changed' and every Task 
+  // depending on them, and schedules them again as if they were all that 
+  // was in the graph, adding those that aren't waiting on each other to 
+  // the leaves. The Tasks themselves are left for the caller to reset.
+  void reschedule(Slice<Task*> changed, Array<Task*>* affected);
+
+  // Sorts 'tasks' by their uid, for when their order must not depend on 
+  // the order the Tasks were created in.
+  static void sortByUid(Slice<Task*> tasks);
+};
+
+#endif // _lake_TaskGraph_h
@@ -0,0 +1,163 @@
+#include "Tracer.h"
+
+#include "iro/Logger.h"
+#include "iro/fs/File.h"
+
+#include "stdio.h"
+
+static Logger logger =
+  Logger::create("lake.tracer"_str, Logger::Verbosity::Notice);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Tracer::init()
+{
+  if (!events.init(256))
+    return false;
+  if (!names.init())
+    return false;
+  start = TimePoint::monotonic();
+  slot_count = 0;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Tracer::deinit()
+{
+  names.deinit();
+  events.destroy();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Tracer::record(
+    Kind kind,
+    String name,
+    u32 track,
+    TimePoint event_start,
+    b8 copy_name)
+{
+  if (copy_name)
+    name = name.allocateCopy(&names);
+
+  record(kind, name, track, event_start, TimePoint::monotonic());
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Tracer::record(
+    Kind kind,
+    String name,
+    u32 track,
+    TimePoint event_start,
+    TimePoint event_end)
+{
+  Event* event = events.push();
+  event->kind = kind;
+  event->name = name;
+  event->track = track;
+  event->start_ns = (event_start - start).ns;
+  event->duration_ns = (event_end - event_start).ns;
+
+  if (track > slot_count)
+    slot_count = track;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static String getKindName(Tracer::Kind kind)
+{
+  switch (kind)
+  {
+  case Tracer::Kind::Phase:   return "phase"_str;
+  case Tracer::Kind::Cond:    return "cond"_str;
+  case Tracer::Kind::Recipe:  return "recipe"_str;
+  case Tracer::Kind::Spawn:   return "spawn"_str;
+  case Tracer::Kind::Blocked: return "blocked"_str;
+  case Tracer::Kind::Wait:    return "wait"_str;
+  }
+  return "unknown"_str;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void writeJSONString(io::IO* out, String s)
+{
+  io::format(out, '"');
+  for (u64 i = 0; i < s.len; ++i)
+  {
+    u8 c = s.ptr[i];
+    if (c == '"' || c == '\\')
+    {
+      io::format(out, '\\');
+      io::format(out, (char)c);
+    }
+    else if (c < 0x20)
+    {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      io::format(out, (const char*)buf);
+    }
+    else
+    {
+      io::format(out, (char)c);
+    }
+  }
+  io::format(out, '"');
+}
+
+/* ----------------------------------------------------------------------------
+ *  Trace timestamps are in microseconds.
+ */
+static void writeMicroseconds(io::IO* out, s64 ns)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", f64(ns) / 1000.0);
+  io::format(out, (const char*)buf);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Tracer::write(String path)
+{
+  auto file =
+    fs::File::from(path,
+        fs::OpenFlag::Create
+      | fs::OpenFlag::Truncate
+      | fs::OpenFlag::Write);
+  if (isnil(file))
+    return ERROR("failed to open trace file '", path, "'\n");
+  defer { file.close(); };
+
+  io::format(&file, "{\"traceEvents\":[\n");
+
+  // Name the tracks so they read as lake and each job slot.
+  io::format(&file,
+    "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"thread_name\","
+    "\"args\":{\"name\":\"lake\"}}");
+  for (u32 slot = 1; slot <= slot_count; ++slot)
+  {
+    io::formatv(&file,
+      ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":", slot,
+      ",\"name\":\"thread_name\",\"args\":{\"name\":\"job ", slot, "\"}}");
+  }
+
+  for (Event& event : events)
+  {
+    io::formatv(&file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":", event.track,
+               ",\"name\":");
+    writeJSONString(&file, event.name);
+    io::format(&file, ",\"cat\":");
+    writeJSONString(&file, getKindName(event.kind));
+    io::format(&file, ",\"ts\":");
+    writeMicroseconds(&file, event.start_ns);
+    io::format(&file, ",\"dur\":");
+    writeMicroseconds(&file, event.duration_ns);
+    io::format(&file, "}");
+  }
+
+  io::format(&file, "\n]}\n");
+
+  return true;
+}
@@ -0,0 +1,85 @@
+/*
+ *  Records what lake spends its time on when given --trace <path>, and
+ *  writes it out as a Chrome trace (viewable in chrome://tracing or
+ *  perfetto).
+ *
+ *  Recipes are laid out on a track per job slot, so idle slots show up as
+ *  gaps. Lake's own work, being the phases before the build, evaluating
+ *  conds, and time spent with leaves ready but every slot taken, is put on
+ *  a track of its own. Spawning processes is recorded on the track of the
+ *  recipe that spawned them.
+ */
+
+#ifndef _lake_Tracer_h
+#define _lake_Tracer_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/time/Time.h"
+#include "iro/containers/Array.h"
+#include "iro/memory/Bump.h"
+
+using namespace iro;
+
+/* ============================================================================
+ */
+struct Tracer
+{
+  enum class Kind
+  {
+    Phase,
+    Cond,
+    Recipe,
+    Spawn,
+    Blocked,
+    Wait,
+  };
+
+  struct Event
+  {
+    Kind kind;
+    String name;
+
+    // The track the event is shown on, 0 being lake's and the rest job
+    // slots.
+    u32 track;
+
+    // Relative to 'start'.
+    s64 start_ns;
+    s64 duration_ns;
+  };
+
+  Array<Event> events;
+
+  TimePoint start;
+
+  // How many job slot tracks have been used.
+  u32 slot_count;
+
+  // Storage for copies of names that don't outlive the events.
+  mem::LenientBump names;
+
+  b8   init();
+  void deinit();
+
+  // Records an event that started at 'event_start' and ends now. 'name' must
+  // outlive the Tracer, unless 'copy_name' is set.
+  void record(
+    Kind kind,
+    String name,
+    u32 track,
+    TimePoint event_start,
+    b8 copy_name = false);
+
+  // Records an event with explicit bounds.
+  void record(
+    Kind kind,
+    String name,
+    u32 track,
+    TimePoint event_start,
+    TimePoint event_end);
+
+  b8 write(String path);
+};
+
+#endif // _lake_Tracer_h
@@ -0,0 +1,545 @@
+#include "WatchMode.h"
+
+#include "Lake.h"
+#include "Task.h"
+
+#include "iro/Logger.h"
+#include "iro/Platform.h"
+#include "iro/fs/Glob.h"
+
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+
+#if IRO_LINUX
+#include "unistd.h"
+#endif
+
+static Logger logger =
+  Logger::create("lake.watch"_str, Logger::Verbosity::Notice);
+
+// How long to wait after something changes for anything else to change
+// before rebuilding.
+static const s64 debounce_ms = 100;
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 hashString(u64 hash, String s)
+{
+  for (u8 c : s)
+    hash = (hash ^ c) * 1099511628211;
+  return (hash ^ '\n') * 1099511628211;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Matches are hashed such that the order the globber finds them in, which
+ *  may change as files come and go, doesn't matter.
+ */
+static u64 hashGlobMatch(u64 hash, String match)
+{
+  return hash + hashString(14695981039346656037ull, match);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 hashDepFile(Slice<String> paths)
+{
+  u64 hash = 14695981039346656037ull;
+  for (String path : paths)
+    hash = hashString(hash, path);
+  return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Writes the absolute form of 'path' into 'out'. A relative 'path' is
+ *  taken to be relative to 'dir', which is itself taken to be relative to
+ *  the current directory when it's relative or nil.
+ */
+static void makeAbsolute(fs::Path* out, String path, String dir = nil)
+{
+  out->clear();
+
+  if (path.len == 0 || !fs::Path::isRooted(path))
+  {
+    if (isnil(dir) || !fs::Path::isRooted(dir))
+    {
+      auto cwd = fs::Path::cwd();
+      defer { cwd.destroy(); };
+      out->append(cwd.asStr());
+    }
+
+    if (notnil(dir))
+      out->ensureDir().append(dir);
+
+    out->ensureDir();
+  }
+
+  out->append(path);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static int compareFiles(const void* a, const void* b)
+{
+  u64 x = ((WatchMode::File*)a)->path_hash;
+  u64 y = ((WatchMode::File*)b)->path_hash;
+  return x < y? -1 : x > y? 1 : 0;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static int compareHashes(const void* a, const void* b)
+{
+  u64 x = *(u64*)a;
+  u64 y = *(u64*)b;
+  return x < y? -1 : x > y? 1 : 0;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Returns the index of the first file whose hash is not less than 'hash'.
+ */
+static s32 findFile(Array<WatchMode::File>& files, u64 hash)
+{
+  s32 lo = 0;
+  s32 hi = files.len();
+  while (lo < hi)
+  {
+    s32 mid = lo + (hi - lo) / 2;
+    if (files[mid].path_hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 WatchMode::init()
+{
+  watcher = fs::Watcher::create();
+  if (isnil(watcher))
+    return ERROR("watching for changes is not supported on this platform\n");
+
+  if (!dirs.init())
+    return false;
+  if (!files.init())
+    return false;
+  if (!lua_files.init())
+    return false;
+  if (!globs.init())
+    return false;
+  if (!glob_dirs.init())
+    return false;
+  if (!dep_files.init())
+    return false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void WatchMode::deinit()
+{
+  watcher.destroy();
+
+  for (fs::Path& dir : dirs)
+    dir.destroy();
+  dirs.destroy();
+
+  files.destroy();
+  lua_files.destroy();
+
+  for (Glob& glob : globs)
+  {
+    glob.dir.destroy();
+    mem::stl_allocator.free(glob.pattern.ptr);
+  }
+  globs.destroy();
+
+  for (fs::Path& dir : glob_dirs)
+    dir.destroy();
+  glob_dirs.destroy();
+
+  for (DepFile& dep_file : dep_files)
+    dep_file.path.destroy();
+  dep_files.destroy();
+}
+
+/* ----------------------------------------------------------------------------
+ *  Directories that don't exist are skipped, as are those that were just
+ *  added, which is often the case as Tasks and glob matches in the same
+ *  directory tend to come one after another. Anything else added twice is
+ *  caught by the watcher.
+ */
+static void addGlobDir(WatchMode::Glob* glob, Array<fs::Path>& glob_dirs,
+                       String dir)
+{
+  fs::Path path = fs::Path::from();
+  makeAbsolute(&path, dir, glob->dir.asStr());
+
+  if (!glob_dirs.isEmpty() && glob_dirs.last()->asStr() == path.asStr())
+  {
+    path.destroy();
+    return;
+  }
+
+  glob_dirs.push(path);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+WatchMode::Glob* WatchMode::recordGlob(String pattern)
+{
+  Glob* glob = globs.push();
+  glob->dir = fs::Path::cwd();
+  glob->pattern = pattern.allocateCopy();
+  glob->result_hash = 0;
+
+  // Files may be created in the directory the pattern starts from even if
+  // nothing in it matches yet.
+  u64 prefix_len = 0;
+  for (u64 i = 0; i < pattern.len; ++i)
+  {
+    u8 c = pattern.ptr[i];
+    if (c == '*' || c == '?' || c == '[' || c == '{')
+      break;
+    if (c == '/')
+      prefix_len = i + 1;
+  }
+  addGlobDir(glob, glob_dirs, pattern.sub(0, prefix_len));
+
+  return glob;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void WatchMode::recordGlobMatch(Glob* glob, String match)
+{
+  glob->result_hash = hashGlobMatch(glob->result_hash, match);
+  addGlobDir(glob, glob_dirs, fs::Path::removeBasename(match));
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void WatchMode::recordDepFile(Task* task, String path, Slice<String> paths)
+{
+  DepFile* dep_file = dep_files.push();
+  dep_file->task = task->index;
+  dep_file->path.init();
+  makeAbsolute(&dep_file->path, path);
+  dep_file->hash = hashDepFile(paths);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void watchDir(WatchMode& watch, String dir)
+{
+  if (!watch.dirs.isEmpty() && watch.dirs.last()->asStr() == dir)
+    return;
+
+  if (!fs::Path::isDirectory(dir))
+    return;
+
+  watch.dirs.push(fs::Path::from(dir));
+  if (!watch.watcher.add(watch.dirs.last()->asStr(),
+                         (void*)u64(watch.dirs.len() - 1)))
+  {
+    watch.dirs.last()->destroy();
+    watch.dirs.pop();
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ *  Gathers everything we should react to changes to and starts watching
+ *  their directories.
+ */
+static void watchFiles(WatchMode& watch, Lake& lake)
+{
+  LuaState& lua = lake.lua;
+
+  auto path = fs::Path::from();
+  defer { path.destroy(); };
+
+  auto addLuaFile = [&](String file)
+  {
+    makeAbsolute(&path, file);
+    watch.lua_files.push(lake.stat_cache.hashPath(path.asStr()));
+    watchDir(watch, fs::Path::removeBasename(path.asStr()));
+  };
+
+  addLuaFile(lake.initpath);
+
+  lua.getfield(lake.I.lake, "lua_files");
+  for (s32 i = 1; i <= lua.objlen(); ++i)
+  {
+    lua.rawgeti(-1, i);
+    addLuaFile(lua.tostring());
+    lua.pop();
+  }
+  lua.pop();
+
+  for (Task* task : lake.graph.tasks)
+  {
+    // Files written by recipes are kept track of so that them being 
+    // written isn't mistaken for something new appearing in a globbed
+    // directory, but don't cause rebuilds themselves.
+    if (task->flags.test(Task::Flag::HasRecipe))
+    {
+      watch.files.push(
+        {lake.stat_cache.hashPath(task->name, task->wdir.asStr()),
+         task->index});
+      continue;
+    }
+
+    StatCache::Entry* entry =
+      lake.stat_cache.get(task->name, task->wdir.asStr());
+    if (!entry->exists || !entry->regular)
+      continue;
+
+    watch.files.push({entry->hash, task->index});
+
+    makeAbsolute(&path, task->name, task->wdir.asStr());
+    watchDir(watch, fs::Path::removeBasename(path.asStr()));
+  }
+
+  for (fs::Path& dir : watch.glob_dirs)
+    watchDir(watch, dir.asStr());
+
+  qsort(watch.files.arr, watch.files.len(), sizeof(WatchMode::File),
+        compareFiles);
+  qsort(watch.lua_files.arr, watch.lua_files.len(), sizeof(u64),
+        compareHashes);
+
+  NOTICE("watching ", watch.files.len(), " files in ", watch.dirs.len(),
+         " directories\n");
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 globChanged(WatchMode::Glob& glob)
+{
+  if (!glob.dir.chdir())
+    return true;
+
+  u64 hash = 0;
+  auto globber = fs::Globber::create(glob.pattern);
+  globber.run(
+    [&hash](fs::Path& p)
+    {
+      hash = hashGlobMatch(hash, p.buffer.asStr());
+      return true;
+    });
+  globber.destroy();
+
+  return hash != glob.result_hash;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Returns true if any dep file lists different files than it did when it
+ *  was loaded. Every one is checked, as a build may write the dep file of
+ *  a Task that was never rescheduled, eg. one whose dep file didn't exist
+ *  when the lakefile ran.
+ */
+static b8 depFilesChanged(WatchMode& watch, Lake& lake)
+{
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+
+  auto paths = Array<String>::create();
+  defer { paths.destroy(); };
+
+  for (WatchMode::DepFile& dep_file : watch.dep_files)
+  {
+    Task* task = lake.graph.tasks[dep_file.task];
+
+    data.clear();
+    paths.clear();
+    if (!Lake::readDepFile(dep_file.path.asStr(), &data, &paths))
+      paths.clear();
+
+    if (hashDepFile(paths.asSlice()) != dep_file.hash)
+    {
+      NOTICE("the prerequisites of '", task->name, "' listed in ",
+             dep_file.path, " changed\n");
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Runs lake again from the start with the same arguments, only returning
+ *  if that fails.
+ */
+static b8 restart(Lake& lake)
+{
+  NOTICE("restarting\n");
+
+#if IRO_LINUX
+  lake.root_dir.chdir();
+  execvp(lake.argv[0], (char* const*)lake.argv);
+  return ERROR("failed to restart lake: ", strerror(errno), "\n");
+#else
+  return ERROR("restarting lake is not supported on this platform\n");
+#endif
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 WatchMode::run(Lake& lake)
+{
+  // The initial build may have written dep files that didn't exist when
+  // the lakefile loaded them.
+  if (depFilesChanged(*this, lake))
+    return restart(lake);
+
+  watchFiles(*this, lake);
+
+  // Tasks named by a file that changed, marked VisitedTemp while they're in
+  // here so they're only added once.
+  auto changed = Array<Task*>::create();
+  defer { changed.destroy(); };
+
+  auto affected = Array<Task*>::create();
+  defer { affected.destroy(); };
+
+  auto path = fs::Path::from();
+  defer { path.destroy(); };
+
+  const s32 max_events = 64;
+  fs::Watcher::Event events[max_events];
+
+  for (;;)
+  {
+    NOTICE("watching for changes\n");
+
+    changed.clear();
+    b8 need_restart = false;
+    b8 recheck_globs = false;
+
+    auto noteEvent = [&](fs::Watcher::Event& event)
+    {
+      if (event.kind == fs::Watcher::Event::Kind::Overflowed)
+      {
+        NOTICE("too many files changed to keep track of\n");
+        need_restart = true;
+        return;
+      }
+
+      fs::Path& dir = dirs[(u64)event.userdata];
+      path.clear();
+      path.append(dir.asStr()).ensureDir().append(event.name);
+
+      u64 hash = lake.stat_cache.hashPath(path.asStr());
+      lake.stat_cache.invalidate(path.asStr());
+
+      if (bsearch(&hash, lua_files.arr, lua_files.len(), sizeof(u64),
+                  compareHashes))
+      {
+        NOTICE(path, " changed\n");
+        need_restart = true;
+        return;
+      }
+
+      s32 found = 0;
+      for (s32 i = findFile(files, hash);
+           i < files.len() && files[i].path_hash == hash;
+           ++i)
+      {
+        found += 1;
+
+        Task* task = lake.graph.tasks[files[i].task];
+        if (task->flags.test(Task::Flag::HasRecipe) ||
+            task->flags.test(Task::Flag::VisitedTemp))
+          continue;
+
+        task->flags.set(Task::Flag::VisitedTemp);
+        changed.push(task);
+      }
+
+      if (found == 0 && event.kind != fs::Watcher::Event::Kind::Modified)
+        recheck_globs = true;
+    };
+
+    // Wait as long as it takes for something to change, then until nothing
+    // else has for a moment.
+    TimeSpan timeout = TimeSpan::fromNanoseconds(-1);
+    for (;;)
+    {
+      s32 count = watcher.wait({events, max_events}, timeout);
+      if (count == -1)
+        return ERROR("failed to wait for changes\n");
+
+      if (count == 0)
+      {
+        if (timeout.ns < 0)
+          continue;
+        break;
+      }
+
+      for (s32 i = 0; i < count; ++i)
+        noteEvent(events[i]);
+
+      timeout = TimeSpan::fromMilliseconds(debounce_ms);
+    }
+
+    for (Task* task : changed)
+      task->flags.unset(Task::Flag::VisitedTemp);
+
+    if (!need_restart && recheck_globs)
+    {
+      for (Glob& glob : globs)
+      {
+        if (globChanged(glob))
+        {
+          NOTICE("the files matching '", glob.pattern, "' changed\n");
+          need_restart = true;
+          break;
+        }
+      }
+
+      lake.root_dir.chdir();
+      lake.stat_cache.noteChdir();
+    }
+
+    if (need_restart)
+      return restart(lake);
+
+    if (changed.isEmpty())
+      continue;
+
+    TimePoint rebuild_start = TimePoint::monotonic();
+
+    affected.clear();
+    lake.graph.reschedule(changed.asSlice(), &affected);
+
+    for (Task* task : affected)
+    {
+      task->reset();
+      if (task->flags.test(Task::Flag::HasRecipe))
+        lake.resetRecipe(task);
+    }
+
+    b8 success = lake.build();
+
+    u32 recipes_run = 0;
+    for (Task* task : affected)
+    {
+      if (notnil(task->start_time))
+        recipes_run += 1;
+    }
+
+    NOTICE(success? "rebuilt in " : "rebuild failed after ",
+           WithUnits(TimePoint::monotonic() - rebuild_start), ", ",
+           changed.len(), " files changed, ", affected.len(),
+           " tasks checked, ", recipes_run, " recipes run\n");
+
+    if (!lake.callFinalCallback(success))
+      return false;
+
+    if (depFilesChanged(*this, lake))
+      return restart(lake);
+  }
+}
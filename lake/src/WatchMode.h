@@ -0,0 +1,111 @@
+/*
+ *  Keeping lake running after a build to rebuild whatever is affected by
+ *  files changing, as enabled by --watch.
+ *
+ *  The task graph, stat cache, and build database are kept between builds,
+ *  so a rebuild only costs checking the Tasks that depend on the files that
+ *  changed, rather than running the lakefile, globbing, and stat'ing the
+ *  whole project again.
+ *
+ *  We watch the directory of every file named by a Task without a recipe,
+ *  those being the sources everything else is built from, and changes to
+ *  them are gathered until none have happened for a short while before
+ *  rebuilding, as editors and version control tend to touch several files
+ *  at once. Files written by recipes are ignored, as they're only ever
+ *  changed by the builds themselves.
+ *
+ *  Some changes can't be handled without running the lakefile again, in
+ *  which case lake restarts itself with the same arguments:
+ *
+ *    A lua file run by the lakefile changing.
+ *
+ *    A file being created in or removed from a directory the lakefile
+ *    globbed, such that the glob matches something different.
+ *
+ *    A dep file listing different files than it did when the lakefile
+ *    loaded it, including one that didn't exist then, as the
+ *    prerequisites of Tasks can't change once the graph is built. These are
+ *    checked after every build, the initial one included.
+ */
+
+#ifndef _lake_WatchMode_h
+#define _lake_WatchMode_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/Array.h"
+#include "iro/fs/Path.h"
+#include "iro/fs/Watcher.h"
+
+using namespace iro;
+
+struct Lake;
+struct Task;
+
+/* ============================================================================
+ */
+struct WatchMode
+{
+  fs::Watcher watcher;
+
+  // Every directory being watched, the user data given to the watcher for
+  // each being its index here.
+  Array<fs::Path> dirs;
+
+  // The file named by each Task, sorted by the hash of their absolute path
+  // (see StatCache::hashPath). Several Tasks may name the same file. Only
+  // changes to those without recipes cause a rebuild.
+  struct File
+  {
+    u64 path_hash;
+    u32 task;
+  };
+  Array<File> files;
+
+  // Hashes of the absolute path of each lua file run by the lakefile,
+  // sorted.
+  Array<u64> lua_files;
+
+  // A glob run by the lakefile, from 'dir', and a hash of what it matched.
+  struct Glob
+  {
+    fs::Path dir;
+    String   pattern;
+    u64      result_hash;
+  };
+  Array<Glob> globs;
+
+  // Directories the lakefile's globs looked in, which are watched along
+  // with those of the files.
+  Array<fs::Path> glob_dirs;
+
+  // A dep file loaded through lake.loadDepFile and a hash of the files it
+  // listed, which is that of no files if it didn't exist.
+  struct DepFile
+  {
+    u32      task;
+    fs::Path path;
+    u64      hash;
+  };
+  Array<DepFile> dep_files;
+
+  b8   init();
+  void deinit();
+
+  // Notes a glob the lakefile is about to run from the current directory,
+  // each match of which should be passed to recordGlobMatch. Globs run
+  // once the task graph is built, eg. by recipes, aren't recorded.
+  Glob* recordGlob(String pattern);
+  void  recordGlobMatch(Glob* glob, String match);
+
+  // Notes that 'task' was given the files in 'paths' as prerequisites by
+  // the dep file at 'path', relative to the current directory. 'paths' is
+  // empty if the dep file couldn't be read.
+  void recordDepFile(Task* task, String path, Slice<String> paths);
+
+  // Watches for changes and rebuilds what they affect until something goes
+  // wrong or lake is restarted. The initial build must have completed.
+  b8 run(Lake& lake);
+};
+
+#endif // _lake_WatchMode_h
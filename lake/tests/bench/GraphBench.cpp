@@ -0,0 +1,197 @@
+/*
+ *  Benchmark of lake's task graph on a synthetic project shaped like a
+ *  large C++ build.
+ *
+ *  Usage:
+ *    lake-graphbench [tasks] [iterations]
+ *
+ *  A quarter of the tasks (100000 by default) are headers, each depending
+ *  on a couple of the headers before it. The rest are split between
+ *  sources and the objects built from them, each object depending on its
+ *  source and a couple dozen headers, some of them more than once as dep
+ *  files often repeat headers, and a single executable depends on every
+ *  object.
+ *
+ *  Each iteration times creating the tasks and declaring their
+ *  prerequisites, building the graph, sorting it, and then scheduling it,
+ *  completing each leaf as soon as it is taken.
+ */
+
+#include "TaskGraph.h"
+
+#include "iro/Common.h"
+#include "iro/Logger.h"
+#include "iro/fs/File.h"
+#include "iro/containers/Array.h"
+#include "iro/time/Time.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+
+using namespace iro;
+
+static Logger logger =
+  Logger::create("lake.graphbench"_str, Logger::Verbosity::Info);
+
+// How many headers each object depends on.
+static const u32 headers_per_object = 24;
+
+struct Timings
+{
+  s64 construct_ns;
+  s64 build_ns;
+  s64 sort_ns;
+  s64 schedule_ns;
+};
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 nextRandom(u64* state)
+{
+  u64 x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static Task* createTask(TaskGraph& graph, const char* format, u32 n)
+{
+  char name[64];
+  snprintf(name, sizeof(name), format, n);
+  return graph.createTask(String::fromCStr(name));
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 runIteration(u32 task_count, Timings* timings)
+{
+  TaskGraph graph;
+  if (!graph.init())
+    return ERROR("failed to initialize task graph\n");
+  defer { graph.deinit(); };
+
+  u32 header_count = task_count / 4;
+  u32 object_count = (task_count - header_count - 1) / 2;
+
+  u64 rng = 0x9e3779b97f4a7c15;
+
+  auto headers = Array<Task*>::create(header_count);
+  defer { headers.destroy(); };
+
+  TimePoint start = TimePoint::monotonic();
+
+  for (u32 i = 0; i < header_count; ++i)
+  {
+    Task* header = createTask(graph, "h%u.h", i);
+    for (u32 j = 0; j < 2 && i != 0; ++j)
+      graph.addPrerequisite(header, headers[nextRandom(&rng) % i]);
+    headers.push(header);
+  }
+
+  Task* exe = graph.createTask("exe"_str);
+
+  for (u32 i = 0; i < object_count; ++i)
+  {
+    Task* source = createTask(graph, "s%u.cpp", i);
+    Task* object = createTask(graph, "s%u.o", i);
+
+    graph.addPrerequisite(object, source);
+    for (u32 j = 0; j < headers_per_object; ++j)
+    {
+      graph.addPrerequisite(object,
+        headers[nextRandom(&rng) % header_count]);
+    }
+
+    graph.addPrerequisite(exe, object);
+  }
+
+  timings->construct_ns += (TimePoint::monotonic() - start).ns;
+
+  start = TimePoint::monotonic();
+  if (!graph.build())
+    return ERROR("failed to build task graph\n");
+  timings->build_ns += (TimePoint::monotonic() - start).ns;
+
+  auto sorted = Array<Task*>::create(graph.tasks.len());
+  defer { sorted.destroy(); };
+
+  start = TimePoint::monotonic();
+  if (!graph.sort(&sorted))
+    return ERROR("synthetic graph has a cycle\n");
+  timings->sort_ns += (TimePoint::monotonic() - start).ns;
+
+  // Give the leaves something to be ordered by.
+  for (Task* task : sorted)
+    task->priority_us = nextRandom(&rng) % 1000;
+
+  start = TimePoint::monotonic();
+
+  for (Task* task : sorted)
+  {
+    if (graph.pending[task->index] == 0)
+      graph.addLeaf(task);
+  }
+
+  s32 completed = 0;
+  while (!graph.leaves.isEmpty())
+  {
+    Task* task = graph.takeLeaf();
+    task->flags.set(Task::Flag::Complete);
+    graph.releaseDependents(task);
+    completed += 1;
+  }
+
+  timings->schedule_ns += (TimePoint::monotonic() - start).ns;
+
+  if (completed != graph.tasks.len())
+    return ERROR("only scheduled ", completed, " of ", graph.tasks.len(),
+                 " tasks\n");
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+int main(int argc, const char** argv)
+{
+  iro::log.init();
+  defer { iro::log.deinit(); };
+
+  {
+    using enum Log::Dest::Flag;
+    Log::Dest::Flags flags = AllowColor | ShowVerbosity;
+    iro::log.newDestination("stdout"_str, &fs::stdout, flags);
+  }
+
+  u32 task_count = argc > 1? atoi(argv[1]) : 100000;
+  s32 iterations = argc > 2? atoi(argv[2]) : 5;
+
+  if (task_count < 16)
+    task_count = 16;
+  if (iterations < 1)
+    iterations = 1;
+
+  Timings timings = {};
+  for (s32 i = 0; i < iterations; ++i)
+  {
+    if (!runIteration(task_count, &timings))
+      return 1;
+  }
+
+  auto perIteration = [&](s64 total_ns)
+  {
+    return TimeSpan::fromNanoseconds(total_ns / iterations);
+  };
+
+  INFO("scheduled ", task_count, " tasks ", iterations, " times\n");
+  INFO("  construct: ", WithUnits(perIteration(timings.construct_ns)), "\n");
+  INFO("  build:     ", WithUnits(perIteration(timings.build_ns)), "\n");
+  INFO("  sort:      ", WithUnits(perIteration(timings.sort_ns)), "\n");
+  INFO("  schedule:  ", WithUnits(perIteration(timings.schedule_ns)), "\n");
+
+  return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ *  Benchmark of spawning processes the way recipes do, through
+ *  lua__processSpawn.
+ *
+ *  Usage:
+ *    lake-spawnbench [processes] [heap MiB]
+ *
+ *  Spawns 'processes' (10000 by default) instances of /bin/true one after
+ *  another, reading their output and waiting for each to exit before
+ *  closing it, as lake.cmd does. Before that, 'heap MiB' (0 by default) of
+ *  memory is touched to stand in for a large lua heap, which is what makes
+ *  spawning by fork() slow.
+ */
+
+#include "Lake.h"
+
+#include "iro/Common.h"
+#include "iro/Logger.h"
+#include "iro/fs/File.h"
+#include "iro/time/Time.h"
+
+#include "stdlib.h"
+
+using namespace iro;
+
+static Logger logger =
+  Logger::create("lake.spawnbench"_str, Logger::Verbosity::Info);
+
+extern "C"
+{
+Process* lua__processSpawn(
+    Lake* lake,
+    String* args,
+    u32 args_count,
+    b8 merge_stderr);
+void lua__processRead(
+    Process* proc,
+    void* ptr, u64 len, u64* out_bytes_read);
+b8 lua__processCanRead(Process* proc);
+b8 lua__processCheck(Process* proc, s32* out_exit_code);
+void lua__processClose(Lake* lake, Process* proc);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+int main(int argc, const char** argv)
+{
+  iro::log.init();
+  defer { iro::log.deinit(); };
+
+  {
+    using enum Log::Dest::Flag;
+    Log::Dest::Flags flags = AllowColor | ShowVerbosity;
+    iro::log.newDestination("stdout"_str, &fs::stdout, flags);
+  }
+
+  s32 process_count = argc > 1? atoi(argv[1]) : 10000;
+  s32 heap_mib = argc > 2? atoi(argv[2]) : 0;
+
+  if (process_count < 1)
+    process_count = 1;
+
+  u64 heap_size = u64(heap_mib) << 20;
+  u8* heap = nullptr;
+  if (heap_size != 0)
+  {
+    heap = (u8*)mem::stl_allocator.allocate(heap_size);
+    if (heap == nullptr)
+    {
+      ERROR("failed to allocate a ", heap_mib, "MiB heap\n");
+      return 1;
+    }
+    for (u64 i = 0; i < heap_size; i += 4096)
+      heap[i] = u8(i);
+  }
+  defer
+  {
+    if (heap != nullptr)
+      mem::stl_allocator.free(heap);
+  };
+
+  // Only what lua__processSpawn and lua__processClose touch is set up.
+  Lake lake;
+  lake.active_task = nullptr;
+  lake.active_process_pool = Pool<Process>::create();
+  lake.process_waiter = nil;
+  defer { lake.active_process_pool.deinit(); };
+
+  String args[] = { "/bin/true"_str };
+
+  u8 buffer[256];
+  u64 bytes_read;
+
+  s64 spawn_ns = 0;
+  s32 failed_count = 0;
+
+  TimePoint start = TimePoint::monotonic();
+
+  for (s32 i = 0; i < process_count; ++i)
+  {
+    TimePoint spawn_start = TimePoint::monotonic();
+    Process* proc = lua__processSpawn(&lake, args, 1, true);
+    spawn_ns += (TimePoint::monotonic() - spawn_start).ns;
+
+    if (proc == nullptr)
+      return 1;
+
+    s32 exit_code = 0;
+    for (;;)
+    {
+      if (lua__processCanRead(proc))
+        lua__processRead(proc, buffer, sizeof(buffer), &bytes_read);
+      if (lua__processCheck(proc, &exit_code))
+        break;
+    }
+
+    if (exit_code != 0)
+      failed_count += 1;
+
+    lua__processClose(&lake, proc);
+  }
+
+  TimeSpan total = TimePoint::monotonic() - start;
+
+  INFO("ran ", process_count, " processes with a ", heap_mib,
+       "MiB heap in ", WithUnits(total), "\n");
+  INFO("  per process: ",
+       WithUnits(TimeSpan::fromNanoseconds(total.ns / process_count)), "\n");
+  INFO("  spawning:    ",
+       WithUnits(TimeSpan::fromNanoseconds(spawn_ns / process_count)), "\n");
+
+  if (failed_count != 0)
+  {
+    ERROR(failed_count, " processes exited with a non-zero code\n");
+    return 1;
+  }
+
+  return 0;
+}
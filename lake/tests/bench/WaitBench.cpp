@@ -0,0 +1,210 @@
+/*
+ *  Benchmark of how much cpu lake's build loop spends waiting on the
+ *  processes recipes run.
+ *
+ *  Usage:
+ *    lake-waitbench [poll|wait] [jobs] [processes] [loop count]
+ *
+ *  Runs 'processes' (200 by default) shells that each count to 'loop count'
+ *  (20000 by default), which stands in for a compiler, keeping 'jobs'
+ *  (4 by default) of them running at once.
+ *
+ *  'poll' checks every running process over and over, the way lake resumed
+ *  every active recipe before it could sleep on a ProcessWaiter. This does
+ *  not go through lua, so it is a lower bound of what that cost. 'wait'
+ *  sleeps on a ProcessWaiter and only looks at the processes it reports,
+ *  as Lake::waitForProcesses does.
+ *
+ *  Reports the wall time along with the cpu time used by the benchmark
+ *  itself and by the processes it ran.
+ */
+
+#include "iro/Common.h"
+#include "iro/Logger.h"
+#include "iro/Process.h"
+#include "iro/fs/File.h"
+#include "iro/time/Time.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "sys/resource.h"
+
+using namespace iro;
+
+static Logger logger =
+  Logger::create("lake.waitbench"_str, Logger::Verbosity::Info);
+
+/* ----------------------------------------------------------------------------
+ */
+struct Job
+{
+  Process proc;
+  b8 running;
+  b8 ready;
+};
+
+/* ----------------------------------------------------------------------------
+ */
+static TimeSpan getCpuTime(int who, b8 sys)
+{
+  struct rusage usage;
+  if (getrusage(who, &usage))
+    return {};
+  struct timeval tv = sys? usage.ru_stime : usage.ru_utime;
+  return TimeSpan::fromMicroseconds(tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+int main(int argc, const char** argv)
+{
+  iro::log.init();
+  defer { iro::log.deinit(); };
+
+  {
+    using enum Log::Dest::Flag;
+    Log::Dest::Flags flags = AllowColor | ShowVerbosity;
+    iro::log.newDestination("stdout"_str, &fs::stdout, flags);
+  }
+
+  b8 use_waiter = argc > 1 && String::fromCStr(argv[1]) == "wait"_str;
+  s32 job_count = argc > 2? atoi(argv[2]) : 4;
+  s32 process_count = argc > 3? atoi(argv[3]) : 200;
+  s32 loop_count = argc > 4? atoi(argv[4]) : 20000;
+
+  if (job_count < 1)
+    job_count = 1;
+  if (job_count > 64)
+    job_count = 64;
+
+  ProcessWaiter waiter = nil;
+  if (use_waiter)
+  {
+    waiter = ProcessWaiter::create();
+    if (isnil(waiter))
+    {
+      ERROR("process waiting is not supported on this platform\n");
+      return 1;
+    }
+  }
+  defer
+  {
+    if (notnil(waiter))
+      waiter.destroy();
+  };
+
+  char script[128];
+  snprintf(script, sizeof(script),
+    "i=0; while [ $i -lt %d ]; do i=$((i+1)); done", loop_count);
+
+  String args[] = { "-c"_str, String::fromCStr(script) };
+
+  Job jobs[64] = {};
+
+  u8 buffer[256];
+
+  s32 spawned_count = 0;
+  s32 running_count = 0;
+  s32 failed_count = 0;
+  u64 check_count = 0;
+  u64 wake_count = 0;
+
+  TimePoint start = TimePoint::monotonic();
+
+  for (;;)
+  {
+    for (s32 i = 0; i < job_count; ++i)
+    {
+      Job& job = jobs[i];
+      if (job.running || spawned_count == process_count)
+        continue;
+
+      job.proc = Process::spawn("/bin/sh"_str, {args, 2}, nil);
+      if (isnil(job.proc))
+      {
+        ERROR("failed to spawn /bin/sh\n");
+        return 1;
+      }
+
+      if (use_waiter && !waiter.add(&job.proc, &job))
+      {
+        ERROR("failed to add a process to the waiter\n");
+        return 1;
+      }
+
+      job.running = true;
+      job.ready = false;
+      spawned_count += 1;
+      running_count += 1;
+    }
+
+    if (running_count == 0)
+      break;
+
+    if (use_waiter)
+    {
+      void* ready[64];
+      s32 ready_count =
+        waiter.wait({ready, 64}, TimeSpan::fromMilliseconds(100));
+      wake_count += 1;
+
+      if (ready_count <= 0)
+      {
+        for (s32 i = 0; i < job_count; ++i)
+          jobs[i].ready = true;
+      }
+      else
+      {
+        for (s32 i = 0; i < ready_count; ++i)
+          ((Job*)ready[i])->ready = true;
+      }
+    }
+
+    for (s32 i = 0; i < job_count; ++i)
+    {
+      Job& job = jobs[i];
+      if (!job.running || (use_waiter && !job.ready))
+        continue;
+
+      job.ready = false;
+      check_count += 1;
+
+      if (job.proc.hasOutput())
+        job.proc.read({buffer, sizeof(buffer)});
+
+      job.proc.check();
+      if (job.proc.status == Process::Status::Running)
+        continue;
+
+      if (job.proc.status != Process::Status::ExitedNormally ||
+          job.proc.exit_code != 0)
+        failed_count += 1;
+
+      if (use_waiter)
+        waiter.remove(&job.proc);
+      job.proc.close();
+      job.running = false;
+      running_count -= 1;
+    }
+  }
+
+  TimeSpan total = TimePoint::monotonic() - start;
+
+  INFO("ran ", process_count, " processes ", job_count, " at a time by ",
+       use_waiter? "waiting" : "polling", " in ", WithUnits(total), "\n");
+  INFO("  checks:         ", check_count, " (", wake_count, " wakeups)\n");
+  INFO("  own cpu:        ",
+       WithUnits(getCpuTime(RUSAGE_SELF, false)), " user, ",
+       WithUnits(getCpuTime(RUSAGE_SELF, true)), " sys\n");
+  INFO("  processes' cpu: ",
+       WithUnits(getCpuTime(RUSAGE_CHILDREN, false)), " user, ",
+       WithUnits(getCpuTime(RUSAGE_CHILDREN, true)), " sys\n");
+
+  if (failed_count != 0)
+  {
+    ERROR(failed_count, " processes failed\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,4 +1,5 @@
 local sys = require "build.sys"
+local List = require "List"
 local bobj = require "build.object"
 
 local lpp = sys.getLoadingProject()
@@ -12,11 +13,12 @@ lpp.report.dir.include
   glob = "*.h"
 } 
 
+local mainobj
 for cfile in lake.find("src/**/*.cpp"):each() do
   if not cfile:find "main%.cpp" then
     lpp.report.pub.CppObj(cfile)
   else
-    lpp.report.CppObj(cfile)
+    mainobj = lpp.report.CppObj(cfile)
   end
 end
 
@@ -32,4 +34,21 @@ local exe =
 
 lpp.report.published(exe)
 
+-- Benchmarks. Each is built as its own exe linking against everything lpp 
+-- does, except for main.
+for cfile in lake.find("tests/bench/*.cpp"):each() do
+  local benchobjs = List{ lpp.report.CppObj(cfile) }
+  for obj in lpp:gatherBuildObjects{bobj.CppObj, bobj.LuaObj}:each() do
+    if obj ~= mainobj and 
+       not (obj.proj == lpp and obj.src:find "^tests/") 
+    then
+      benchobjs:push(obj)
+    end
+  end
+
+  local name = cfile:match "tests/bench/(.*)%.cpp"
+  lpp.report.Exe("lpp-"..name:lower(), benchobjs)
+end
+
+
 
@@ -0,0 +1,132 @@
+#include "Batch.h"
+
+#include "iro/Logger.h"
+#include "iro/Platform.h"
+#include "iro/fs/File.h"
+#include "iro/time/Time.h"
+
+namespace lpp
+{
+
+static Logger logger = 
+  Logger::create("lpp.batch"_str, Logger::Verbosity::Info);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Batch::init(String path, Slice<String> base_args, u32 thread_count)
+{
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+    return ERROR("failed to open batch file '", path, "'\n");
+  defer { file.close(); };
+
+  jobs_file.open();
+  jobs_file.consume(&file, 4096);
+
+  jobs.init();
+
+  String scan = jobs_file.asStr();
+  while (!scan.isEmpty())
+  {
+    auto newline = scan.findFirst('\n');
+    String line = newline.found()? scan.sub(0, newline) : scan;
+    if (!line.isEmpty())
+      jobs.push(line);
+    scan = newline.found()? scan.sub(newline + 1) : String{};
+  }
+
+  this->base_args = base_args;
+  this->thread_count = 
+    thread_count == 0? platform::getProcessorCount() : thread_count;
+
+  if (this->thread_count > (u32)jobs.len())
+    this->thread_count = jobs.len();
+
+  mutex.init();
+  next_job = 0;
+  failed_jobs = 0;
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Batch::deinit()
+{
+  jobs.destroy();
+  jobs_file.close();
+  mutex.deinit();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Batch::run()
+{
+  if (jobs.isEmpty())
+    return true;
+
+  TimePoint start = TimePoint::monotonic();
+
+  Array<void*> threads = Array<void*>::create(thread_count);
+  defer { threads.destroy(); };
+
+  for (u32 i = 0; i < thread_count; ++i)
+  {
+    void* thread = thread::create(worker, this, 0);
+    if (thread == thread::INVALID_HANDLE)
+    {
+      // Let whatever threads we did manage to make run everything.
+      ERROR("failed to create worker thread ", i, "\n");
+      break;
+    }
+    threads.push(thread);
+  }
+
+  if (threads.isEmpty())
+    return false;
+
+  for (void* thread : threads)
+    thread::join(thread, 0);
+
+  INFO("ran ", jobs.len(), " jobs on ", threads.len(), " threads in ",
+       WithUnits(TimePoint::monotonic() - start), "\n");
+
+  if (failed_jobs != 0)
+    return ERROR(failed_jobs, " of ", jobs.len(), " jobs failed\n");
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void* Batch::worker(thread::Context* context)
+{
+  auto* batch = (Batch*)context->data;
+
+  JobRunner runner;
+  if (!runner.init(batch->base_args))
+    return nullptr;
+  defer { runner.deinit(); };
+
+  for (;;)
+  {
+    s32 job_idx;
+    {
+      ScopedMutexLock lock(batch->mutex);
+      if (batch->next_job >= batch->jobs.len())
+        break;
+      job_idx = batch->next_job;
+      batch->next_job += 1;
+    }
+
+    if (!runner.run(batch->jobs[job_idx]))
+    {
+      ScopedMutexLock lock(batch->mutex);
+      batch->failed_jobs += 1;
+    }
+  }
+
+  return nullptr;
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ *  Preprocesses many files concurrently. Jobs (see JobRunner.h) are read one
+ *  per line from a file and handed out to a set of worker threads, each of 
+ *  which owns its own JobRunner, and so its own lpp instance and lua state.
+ *
+ *  Workers share the list of jobs and the base arguments given to every job.
+ *  Imports may also be shared between them through the import cache. Beyond
+ *  that they share what the process does: the log, which serializes their
+ *  messages, and the working directory. Relative paths in jobs are resolved
+ *  against the directory lpp was started in, so nothing a job runs may
+ *  change it, as that would move every other job running at the time along
+ *  with it.
+ */
+
+#ifndef _lpp_Batch_h
+#define _lpp_Batch_h
+
+#include "JobRunner.h"
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/Mutex.h"
+#include "iro/Thread.h"
+#include "iro/io/IO.h"
+#include "iro/containers/Array.h"
+#include "iro/containers/Slice.h"
+
+using namespace iro;
+
+namespace lpp
+{
+
+/* ============================================================================
+ */
+struct Batch
+{
+  // Contents of the batch file that 'jobs' point into.
+  io::Memory jobs_file;
+
+  Array<String> jobs;
+
+  Slice<String> base_args;
+
+  u32 thread_count;
+
+  // Guards 'next_job' and 'failed_jobs'.
+  Mutex mutex;
+  s32 next_job;
+  s32 failed_jobs;
+
+  // 'base_args' are prepended to the arguments of every job. If 
+  // 'thread_count' is 0, a thread is used for each available processor.
+  b8   init(String path, Slice<String> base_args, u32 thread_count);
+  void deinit();
+
+  // Runs every job, returning false if any of them failed.
+  b8 run();
+
+private:
+
+  static void* worker(thread::Context* context);
+};
+
+}
+
+#endif
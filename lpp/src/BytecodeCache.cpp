@@ -0,0 +1,250 @@
+#include "BytecodeCache.h"
+#include "Metaprogram.h"
+#include "Lpp.h"
+
+#include "iro/Logger.h"
+#include "iro/Platform.h"
+#include "iro/fs/File.h"
+
+#include "stdio.h"
+
+namespace lpp
+{
+
+static Logger logger =
+  Logger::create("lpp.bccache"_str, Logger::Verbosity::Notice);
+
+// Bump whenever the layout of entries or the way metacode is generated
+// changes such that old entries can no longer be trusted.
+static const u32 entry_version = 1;
+
+/* ============================================================================
+ *  Entries are laid out as this header followed by the tokens, the line
+ *  map, and then the bytecode.
+ */
+struct EntryHeader
+{
+  u8  magic[4];
+  u32 version;
+  u64 key;
+  u64 token_count;
+  u64 line_map_count;
+  u64 bytecode_len;
+};
+
+static const u8 entry_magic[4] = { 'l', 'p', 'b', 'c' };
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 hashCombine(u64 seed, u64 hash)
+{
+  return (seed ^ hash) * 1099511628211;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void formEntryPath(io::Memory* out, String dir, u64 key)
+{
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)key);
+  io::formatv(out, dir, '/', String::from((u8*)buf, 16), ".lbc");
+}
+
+/* ----------------------------------------------------------------------------
+ *  Hash identifying the lpp binary itself. Entries depend on how that binary
+ *  generates metacode, which LPP_VERSION doesn't change with between builds,
+ *  so its size and modification time are covered as well.
+ */
+static u64 computeBinaryHash()
+{
+  u64 hash = staticStringHash(LPP_VERSION, sizeof(LPP_VERSION) - 1);
+
+  fs::FileInfo info;
+  if (!platform::getExecutableInfo(&info))
+  {
+    WARN("failed to get info about the lpp binary, the bytecode cache "
+         "will not notice it being rebuilt\n");
+    return hash;
+  }
+
+  hash = hashCombine(hash, info.byte_size);
+  hash = hashCombine(hash, info.last_modified_time.s);
+  hash = hashCombine(hash, info.last_modified_time.ns);
+  return hash;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 getBytecodeCacheKey(Source* input, io::IO* instream, u64* out_key)
+{
+  if (!input->complete)
+  {
+    for (;;)
+    {
+      s64 bytes_read = input->readStream(instream, 4096);
+      if (bytes_read == -1)
+        return ERROR("failed to read input '", input->name, "'\n");
+      if (bytes_read == 0)
+        break;
+    }
+  }
+
+  // Batch workers get here concurrently, which a local static handles.
+  static const u64 binary_hash = computeBinaryHash();
+
+  u64 key = binary_hash;
+  key = hashCombine(key, entry_version);
+  key = hashCombine(key, input->name.hash());
+  key = hashCombine(key, input->content.hash());
+
+  *out_key = key;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 loadCachedBytecode(Metaprogram* mp, String dir, u64 key)
+{
+  io::Memory path;
+  path.open();
+  defer { path.close(); };
+  formEntryPath(&path, dir, key);
+
+  auto file = fs::File::from(path.asStr(), fs::OpenFlag::Read);
+  if (isnil(file))
+    return false;
+  defer { file.close(); };
+
+  io::Memory data;
+  data.open();
+  defer { data.close(); };
+  data.consume(&file, 4096);
+
+  if (data.len < sizeof(EntryHeader))
+  {
+    WARN("discarding truncated bytecode cache entry ", path.asStr(), "\n");
+    return false;
+  }
+
+  auto* header = (EntryHeader*)data.ptr;
+  if (!mem::equal(header->magic, (void*)entry_magic, sizeof(entry_magic)) ||
+      header->version != entry_version ||
+      header->key != key)
+    return false;
+
+  u64 tokens_size = header->token_count * sizeof(Token);
+  u64 line_map_size =
+    header->line_map_count * sizeof(Metaprogram::InputLineMapping);
+
+  if (data.len !=
+      sizeof(EntryHeader) + tokens_size + line_map_size + header->bytecode_len)
+  {
+    WARN("discarding corrupt bytecode cache entry ", path.asStr(), "\n");
+    return false;
+  }
+
+  u8* cursor = data.ptr + sizeof(EntryHeader);
+
+  auto* tokens = (Token*)cursor;
+  cursor += tokens_size;
+
+  auto* line_map = (Metaprogram::InputLineMapping*)cursor;
+  cursor += line_map_size;
+
+  // This fails if the bytecode was dumped by a different version of luajit,
+  // in which case we just treat the entry as missing.
+  LuaState& lua = mp->lpp->lua;
+  if (!lua.loadbuffer({cursor, header->bytecode_len},
+                      (char*)mp->input->name.ptr))
+  {
+    DEBUG("failed to load cached bytecode: ", lua.tostring(), "\n");
+    lua.pop();
+    return false;
+  }
+
+  for (u64 i = 0; i < header->token_count; ++i)
+    mp->parser.tokens.push(tokens[i]);
+
+  for (u64 i = 0; i < header->line_map_count; ++i)
+    mp->line_map.push(line_map[i]);
+  mp->line_map_generated = true;
+
+  // Normally done by the parser, but sections still need to find lines in
+  // the input.
+  mp->input->cacheLineOffsets();
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void storeCachedBytecode(Metaprogram* mp, String dir, u64 key)
+{
+  LuaState& lua = mp->lpp->lua;
+
+  io::Memory bytecode;
+  bytecode.open();
+  defer { bytecode.close(); };
+
+  if (!lua.dump(&bytecode))
+  {
+    WARN("failed to dump bytecode of ", mp->input->name, "\n");
+    return;
+  }
+
+  if (!mp->line_map_generated)
+  {
+    mp->generateInputLineMap(&mp->line_map);
+    mp->line_map_generated = true;
+  }
+
+  EntryHeader header;
+  mem::copy(header.magic, (void*)entry_magic, sizeof(entry_magic));
+  header.version = entry_version;
+  header.key = key;
+  header.token_count = mp->parser.tokens.len();
+  header.line_map_count = mp->line_map.len();
+  header.bytecode_len = bytecode.len;
+
+  io::Memory path;
+  path.open();
+  defer { path.close(); };
+  formEntryPath(&path, dir, key);
+
+  // Write to a temp file and move it into place so that other lpp processes
+  // never see a partially written entry. The metaprogram's address keeps 
+  // the name unique between threads of the same process.
+  io::Memory tmp_path;
+  tmp_path.open();
+  defer { tmp_path.close(); };
+  io::formatv(&tmp_path, 
+    path.asStr(), '.', platform::getPid(), '.', (u64)mp);
+
+  {
+    auto file =
+      fs::File::from(
+        tmp_path.asStr(),
+          fs::OpenFlag::Create
+        | fs::OpenFlag::Write
+        | fs::OpenFlag::Truncate);
+    if (isnil(file))
+    {
+      WARN("failed to open bytecode cache entry ", tmp_path.asStr(), "\n");
+      return;
+    }
+    defer { file.close(); };
+
+    file.write({(u8*)&header, sizeof(header)});
+    file.write(
+      {(u8*)mp->parser.tokens.arr, header.token_count * sizeof(Token)});
+    file.write(
+      {(u8*)mp->line_map.arr,
+       header.line_map_count * sizeof(Metaprogram::InputLineMapping)});
+    file.write(bytecode.asBytes());
+  }
+
+  if (!fs::File::rename(path.asStr(), tmp_path.asStr()))
+    fs::File::unlink(tmp_path.asStr());
+}
+
+}
@@ -0,0 +1,47 @@
+/*
+ *  On-disk cache of the bytecode lua compiles a metaprogram's metacode into.
+ *
+ *  The metacode generated from an input depends only on the input itself,
+ *  so entries are keyed by the input's name and content along with the
+ *  lpp binary that generated them. Along with the bytecode, each entry
+ *  stores the tokens the metacode refers to and the mapping from lines in
+ *  the metacode back to lines in the input, which lets a metaprogram with
+ *  a valid entry skip parsing its input and having lua parse its metacode
+ *  entirely.
+ */
+
+#ifndef _lpp_BytecodeCache_h
+#define _lpp_BytecodeCache_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/io/IO.h"
+
+using namespace iro;
+
+struct Source;
+
+namespace lpp
+{
+
+struct Metaprogram;
+
+// Forms the key of the entry for 'input'. The key covers all of the input,
+// so if it is not yet complete the rest of it is read from 'instream'.
+// Returns false if that fails.
+b8 getBytecodeCacheKey(Source* input, io::IO* instream, u64* out_key);
+
+// Attempts to load the entry under 'key' from 'dir'. On success the loaded
+// metacode is left on top of the lua stack and the metaprogram's parser
+// tokens and input line map are filled out as if the input had been
+// parsed.
+b8 loadCachedBytecode(Metaprogram* mp, String dir, u64 key);
+
+// Stores the metacode on top of the lua stack, which must have just been
+// loaded from the metaprogram's parsed input, under 'key' in 'dir'.
+// Failing to do so is not an error as the cache is only an optimization.
+void storeCachedBytecode(Metaprogram* mp, String dir, u64 key);
+
+}
+
+#endif // _lpp_BytecodeCache_h
@@ -6,6 +6,9 @@
 #include "iro/fs/File.h"
 #include "iro/fs/Path.h"
 
+#include "ctype.h"
+#include "stdlib.h"
+
 namespace lpp
 {
 
@@ -42,6 +45,9 @@ void Driver::deinit()
   passthrough_args.deinit();
   cpath_dirs.deinit();
   include_dirs.deinit();
+
+  if (profile)
+    profiler.deinit();
 }
 
 /* ----------------------------------------------------------------------------
@@ -63,13 +69,61 @@ Driver::ProcessArgsResult Driver::processArgs(Slice<String> args)
       if (arg == "version"_str)
       {
         // Print version and exit.
-        io::format(&fs::stdout, "0.1\n");
+        io::format(&fs::stdout, LPP_VERSION "\n");
         return ProcessArgsResult::EarlyOut;
       }
       else if (arg == "use-full-filepaths"_str)
       {
         use_full_filepaths = true;
       }
+      else if (arg == "serve"_str)
+      {
+        serve = true;
+      }
+      else if (arg.startsWith("batch="_str))
+      {
+        batch_path = arg.sub("batch="_str.len);
+      }
+      else if (arg.startsWith("threads="_str))
+      {
+        String count = arg.sub("threads="_str.len);
+        for (u64 i = 0; i < count.len; ++i)
+        {
+          if (!isdigit(count.ptr[i]))
+          {
+            ERROR("expected a number after '--threads=', got '", count, 
+                  "'\n");
+            return ProcessArgsResult::Error;
+          }
+        }
+        batch_threads = strtol((char*)count.ptr, nullptr, 10);
+      }
+      else if (arg.startsWith("import-cache="_str))
+      {
+        import_cache_dir = arg.sub("import-cache="_str.len);
+      }
+      else if (arg.startsWith("bytecode-cache="_str))
+      {
+        bytecode_cache_dir = arg.sub("bytecode-cache="_str.len);
+      }
+      else if (arg == "clang-deps"_str)
+      {
+        clang_deps = true;
+      }
+      else if (arg == "binary-deps"_str)
+      {
+        binary_deps = true;
+      }
+      else if (arg == "profile"_str)
+      {
+        profile = true;
+        profile_path = "lpp-profile.json"_str;
+      }
+      else if (arg.startsWith("profile="_str))
+      {
+        profile = true;
+        profile_path = arg.sub("profile="_str.len);
+      }
       else
       {
         passthrough_args.push(*iarg);
@@ -295,20 +349,24 @@ Driver::ProcessArgsResult Driver::processArgs(Slice<String> args)
     }
   }
 
-  if (nullptr == streams.in.stream)
+  // When serving or running a batch, input files are given per job.
+  if (nullptr == streams.in.stream && !serve && isnil(batch_path))
   {
     ERROR("no input file specified\n");
     return ProcessArgsResult::Error;
   }
 
+  if (profile && !profiler.init())
+    return ProcessArgsResult::Error;
+
   return ProcessArgsResult::Success;
 }
 
 /* ----------------------------------------------------------------------------
  */
-b8 Driver::construct(Lpp* lpp)
+void Driver::fillLppInitParams(Lpp::InitParams* out)
 {
-  Lpp::InitParams params = {};
+  Lpp::InitParams& params = *out;
 
   auto constructLppStream = [&](Lpp::Stream* lppstream, NamedStream* stream)
   {
@@ -331,10 +389,31 @@ b8 Driver::construct(Lpp* lpp)
   params.vfs = vfs;
 
   params.use_full_filepaths = use_full_filepaths;
+  params.import_cache_dir = import_cache_dir;
+  params.bytecode_cache_dir = bytecode_cache_dir;
+  params.profiler = profile? &profiler : nullptr;
+  params.clang_deps = clang_deps;
+  params.binary_deps = binary_deps;
+}
 
+/* ----------------------------------------------------------------------------
+ */
+b8 Driver::construct(Lpp* lpp)
+{
+  Lpp::InitParams params = {};
+  fillLppInitParams(&params);
   return lpp->init(params);
 }
 
+/* ----------------------------------------------------------------------------
+ */
+b8 Driver::reset(Lpp* lpp)
+{
+  Lpp::InitParams params = {};
+  fillLppInitParams(&params);
+  return lpp->reset(params);
+}
+
 /* ----------------------------------------------------------------------------
  */
 void Driver::cleanupAfterFailure()
@@ -352,4 +431,31 @@ void Driver::cleanupAfterFailure()
   }
 } 
 
+/* ----------------------------------------------------------------------------
+ */
+void Driver::writeProfile()
+{
+  if (!profile)
+    return;
+
+  profiler.writeSummary(&fs::stderr);
+
+  auto file = 
+    fs::File::from(
+      profile_path,
+        fs::OpenFlag::Create
+      | fs::OpenFlag::Write
+      | fs::OpenFlag::Truncate);
+  if (isnil(file))
+  {
+    ERROR("failed to open profile trace at path '", profile_path, "'\n");
+    return;
+  }
+  defer { file.close(); };
+
+  profiler.writeTrace(&file);
+
+  INFO("wrote profile trace to ", profile_path, "\n");
+}
+
 }
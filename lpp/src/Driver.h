@@ -8,6 +8,7 @@
 
 #include "Lpp.h"
 #include "Metaprogram.h"
+#include "Profiler.h"
 
 #include "iro/Common.h"
 #include "iro/Unicode.h"
@@ -84,6 +85,34 @@ struct Driver
 
   b8 use_full_filepaths = false;
 
+  // Set by '--import-cache=<dir>'.
+  String import_cache_dir = nil;
+
+  // Set by '--bytecode-cache=<dir>'.
+  String bytecode_cache_dir = nil;
+
+  // Set by '--clang-deps'. See Lpp::InitParams::clang_deps.
+  b8 clang_deps = false;
+
+  // Set by '--binary-deps'. See Lpp::InitParams::binary_deps.
+  b8 binary_deps = false;
+
+  // Set by '--profile' or '--profile=<file>'. Lpp instances constructed by
+  // this Driver record into 'profiler', which is written out by 
+  // writeProfile().
+  b8 profile = false;
+  String profile_path = nil;
+  Profiler profiler;
+
+  // Set by '--serve'. lpp is run as a JobServer rather than processing a
+  // single input file.
+  b8 serve = false;
+
+  // Set by '--batch=<file>' and '--threads=<n>'. lpp runs the jobs listed 
+  // in the file as a Batch rather than processing a single input file.
+  String batch_path = nil;
+  u32 batch_threads = 0;
+
   struct InitParams
   {
     // The streams and their names used to construct lpp. These are optional,
@@ -137,7 +166,19 @@ struct Driver
   // Constructs an lpp instance from this Driver.
   b8 construct(Lpp* lpp);
 
+  // Resets an lpp instance previously constructed by some Driver so that
+  // it may be run with this Driver's information.
+  b8 reset(Lpp* lpp);
+
   void cleanupAfterFailure();
+
+  // Writes a summary of the profile to stderr and its trace to 
+  // 'profile_path' when profiling.
+  void writeProfile();
+
+private:
+
+  void fillLppInitParams(Lpp::InitParams* params);
 };
 
 }
@@ -0,0 +1,177 @@
+--
+--
+-- Persistent cache of the results of importing lpp files.
+--
+-- Entries are content addressed: the key of an entry is formed from the
+-- path and contents of the imported file along with the args given to lpp,
+-- and each entry stores a hash of every file the import depended on
+-- (other imports, required lua modules, etc.) which must all still match
+-- for the entry to be used. This lets the same import be shared between
+-- every translation unit that uses it rather than reevaluating it each time.
+--
+-- Note that a hit skips running the imported file's metaprogram entirely,
+-- so any side effects it has on the lua state will not happen.
+--
+--
+
+local lpp = require "Lpp"
+local List = require "List"
+local buffer = require "string.buffer"
+
+local log = require "Logger" ("lpp.importcache", Verbosity.Notice)
+
+-- Bump whenever the format of entries or the way lpp expands files changes
+-- such that old entries can no longer be trusted.
+local version = "1"
+
+local ImportCache = {}
+
+-- * --------------------------------------------------------------------------
+
+--- If caching imports is enabled.
+---
+---@return boolean
+ImportCache.isEnabled = function()
+  return lpp.import_cache_dir ~= nil
+end
+
+-- * --------------------------------------------------------------------------
+
+local hashFile = function(path)
+  return lua__hashFile(lpp.handle, path)
+end
+
+local argv_hash
+local getArgvHash = function()
+  if not argv_hash then
+    argv_hash = lua__hashString(table.concat(lpp.argv, "\0"))
+  end
+  return argv_hash
+end
+
+local getEntryPath = function(key)
+  return lpp.import_cache_dir.."/"..key..".lic"
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Forms the key of the entry for the file at 'full_path'. Returns nil if
+--- the file could not be read.
+---
+---@param full_path string
+---@return string?
+ImportCache.getKey = function(full_path)
+  local content_hash = hashFile(full_path)
+  if not content_hash then
+    return
+  end
+
+  return lua__hashString(
+    table.concat({version, full_path, content_hash, getArgvHash()}, "\0"))
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Attempts to find a valid entry under 'key'.
+---
+--- 'isImported' is called with the full path of each import the entry
+--- was built with, and should return if that path has already been
+--- imported into the current translation unit. An entry is only valid if the
+--- imports it skipped because they were already imported are imported now,
+--- and the imports it expanded are not, as otherwise its result would differ
+--- from evaluating the file again.
+---
+--- Returns a table containing 'result', 'deps', 'embedded', and 'skipped'.
+---
+---@param key string
+---@param isImported function
+---@return table?
+ImportCache.lookup = function(key, isImported)
+  local file = io.open(getEntryPath(key), "rb")
+  if not file then
+    return
+  end
+
+  local data = file:read("*a")
+  file:close()
+
+  local success, entry = pcall(buffer.decode, data)
+  if not success or type(entry) ~= "table" then
+    log:warn("discarding corrupt import cache entry ", key, "\n")
+    return
+  end
+
+  for i=1,#entry.deps,2 do
+    if hashFile(entry.deps[i]) ~= entry.deps[i+1] then
+      return
+    end
+  end
+
+  for path in List(entry.skipped):each() do
+    if not isImported(path) then
+      return
+    end
+  end
+
+  for path in List(entry.embedded):each() do
+    if isImported(path) then
+      return
+    end
+  end
+
+  return entry
+end
+
+-- * --------------------------------------------------------------------------
+
+--- Stores the result of an import under 'key'.
+---
+---@param key string
+---@param result string
+--- List of paths the import depended on.
+---@param deps List
+--- Paths of imports expanded into the result.
+---@param embedded List
+--- Paths of imports skipped as they were already imported.
+---@param skipped List
+ImportCache.store = function(key, result, deps, embedded, skipped)
+  local entry =
+  {
+    result = result,
+    deps = {},
+    embedded = embedded,
+    skipped = skipped,
+  }
+
+  local seen = {}
+  for dep in deps:each() do
+    if not seen[dep] then
+      seen[dep] = true
+      local hash = hashFile(dep)
+      if not hash then
+        -- Can't validate this entry later, so don't bother writing it.
+        return
+      end
+      table.insert(entry.deps, dep)
+      table.insert(entry.deps, hash)
+    end
+  end
+
+  -- Write to a temp file and move it into place so that other lpp
+  -- processes never see a partially written entry.
+  local path = getEntryPath(key)
+  local tmp_path = 
+    path.."."..lua__hashString(tostring(entry)..os.time()..os.clock())
+  local file = io.open(tmp_path, "wb")
+  if not file then
+    log:warn("failed to open import cache entry ", tmp_path, "\n")
+    return
+  end
+
+  file:write(buffer.encode(entry))
+  file:close()
+
+  os.rename(tmp_path, path)
+end
+
+return ImportCache
@@ -0,0 +1,189 @@
+#include "IncludeScanner.h"
+
+#include "iro/Logger.h"
+#include "iro/fs/File.h"
+#include "iro/fs/Path.h"
+
+namespace lpp
+{
+
+static Logger logger =
+  Logger::create("lpp.incscan"_str, Logger::Verbosity::Notice);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 IncludeScanner::init(Slice<String> include_dirs)
+{
+  if (!header_pool.init())
+    return false;
+  if (!header_map.init())
+    return false;
+  headers = Array<Header*>::create();
+  this->include_dirs = include_dirs;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void IncludeScanner::deinit()
+{
+  for (Header* header : headers)
+    mem::stl_allocator.free(header->path.ptr);
+
+  headers.destroy();
+  header_map.deinit();
+  header_pool.deinit();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 isHorizontalSpace(u8 c)
+{
+  return c == ' ' || c == '\t';
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void IncludeScanner::scan(String content, String dir)
+{
+  scanContent(content, dir);
+
+  // Headers found while scanning are appended to the list, so this walks
+  // every header reachable from 'content'.
+  for (u64 i = 0; i < headers.len(); ++i)
+  {
+    Header* header = headers[i];
+    if (header->scanned)
+      continue;
+    header->scanned = true;
+
+    auto file = fs::File::from(header->path, fs::OpenFlag::Read);
+    if (isnil(file))
+    {
+      WARN("failed to open header ", header->path, "\n");
+      continue;
+    }
+    defer { file.close(); };
+
+    io::Memory buffer;
+    buffer.open();
+    defer { buffer.close(); };
+    buffer.consume(&file, 4096);
+
+    scanContent(buffer.asStr(), fs::Path::removeBasename(header->path));
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void IncludeScanner::scanContent(String content, String dir)
+{
+  u8* cursor = content.ptr;
+  u8* end = content.ptr + content.len;
+
+  while (cursor < end)
+  {
+    u8* line_end = cursor;
+    while (line_end < end && *line_end != '\n')
+      line_end += 1;
+
+    defer { cursor = line_end + 1; };
+
+    // Match '#' 'include' then either "name" or <name>, allowing horizontal
+    // space between each part like the preprocessor does.
+    u8* scan = cursor;
+    while (scan < line_end && isHorizontalSpace(*scan))
+      scan += 1;
+
+    if (scan == line_end || *scan != '#')
+      continue;
+    scan += 1;
+
+    while (scan < line_end && isHorizontalSpace(*scan))
+      scan += 1;
+
+    String directive = String::from(scan, line_end);
+    if (!directive.startsWith("include"_str))
+      continue;
+    scan += "include"_str.len;
+
+    while (scan < line_end && isHorizontalSpace(*scan))
+      scan += 1;
+
+    if (scan == line_end)
+      continue;
+
+    u8 closer;
+    if (*scan == '"')
+      closer = '"';
+    else if (*scan == '<')
+      closer = '>';
+    else
+      continue;
+    scan += 1;
+
+    u8* name_start = scan;
+    while (scan < line_end && *scan != closer)
+      scan += 1;
+
+    if (scan == line_end || scan == name_start)
+      continue;
+
+    resolve(String::from(name_start, scan), closer == '"', dir);
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+IncludeScanner::Header* IncludeScanner::resolve(
+    String name,
+    b8 quoted,
+    String dir)
+{
+  auto path = fs::Path::from();
+  defer { path.destroy(); };
+
+  auto tryDir = [&](String search_dir) -> Header*
+  {
+    path.clear();
+    if (!search_dir.isEmpty())
+      path.append(search_dir, '/');
+    path.append(name);
+
+    // Paths are made absolute so that a header reached through different
+    // relative paths is only reported once.
+    if (!path.makeAbsolute() || !path.isRegularFile())
+      return nullptr;
+
+    String full = path.asStr();
+    u64 hash = full.hash();
+    if (Header* header = header_map.find(hash))
+      return header;
+
+    Header* header = header_pool.add();
+    header->hash = hash;
+    header->path = full.allocateCopy();
+    header->scanned = false;
+
+    header_map.insert(header);
+    headers.push(header);
+    return header;
+  };
+
+  if (quoted)
+  {
+    if (Header* header = tryDir(dir))
+      return header;
+  }
+
+  for (String include_dir : include_dirs)
+  {
+    if (Header* header = tryDir(include_dir))
+      return header;
+  }
+
+  TRACE("could not resolve include of '", name, "'\n");
+  return nullptr;
+}
+
+}
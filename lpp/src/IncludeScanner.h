@@ -0,0 +1,70 @@
+/*
+ *  Finds the headers a C/C++ file depends on by following its #include
+ *  directives, so that lpp can write a dependency file without running the
+ *  file through a real preprocessor a second time.
+ *
+ *  Directives are matched textually. Conditional compilation and macros are
+ *  not evaluated, so a header included under an #if that is never taken is
+ *  still reported, and includes of a macro are ignored. Headers that cannot
+ *  be found relative to the including file or in the include dirs (eg.
+ *  system headers) are skipped, much like 'clang -MM' would. When exact
+ *  results are needed, lpp can be told to use clang instead with
+ *  --clang-deps.
+ */
+
+#ifndef _lpp_IncludeScanner_h
+#define _lpp_IncludeScanner_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/AVL.h"
+#include "iro/containers/Array.h"
+#include "iro/containers/Pool.h"
+#include "iro/containers/Slice.h"
+
+using namespace iro;
+
+namespace lpp
+{
+
+/* ============================================================================
+ */
+struct IncludeScanner
+{
+  struct Header
+  {
+    u64 hash;
+
+    // The absolute path of the header.
+    String path;
+
+    b8 scanned;
+  };
+
+  typedef AVL<Header, [](const Header* h) { return h->hash; }> HeaderMap;
+
+  Pool<Header> header_pool;
+  HeaderMap    header_map;
+
+  // Every header found, in the order they were found.
+  Array<Header*> headers;
+
+  Slice<String> include_dirs;
+
+  b8   init(Slice<String> include_dirs);
+  void deinit();
+
+  // Scans 'content' for #include directives, resolving quoted includes
+  // against 'dir' before the include dirs. Every header found is scanned
+  // as well.
+  void scan(String content, String dir);
+
+private:
+
+  void scanContent(String content, String dir);
+  Header* resolve(String name, b8 quoted, String dir);
+};
+
+}
+
+#endif // _lpp_IncludeScanner_h
@@ -0,0 +1,103 @@
+#include "JobRunner.h"
+#include "Driver.h"
+
+#include "iro/Logger.h"
+#include "iro/containers/SmallArray.h"
+
+namespace lpp
+{
+
+static Logger logger = 
+  Logger::create("lpp.jobrunner"_str, Logger::Verbosity::Info);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 JobRunner::init(Slice<String> base_args)
+{
+  this->base_args = base_args;
+  lpp_initialized = false;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void JobRunner::deinit()
+{
+  if (lpp_initialized)
+    lpp.deinit();
+  lpp_initialized = false;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 JobRunner::run(String line)
+{
+  SmallArray<String, 16> args;
+
+  for (String arg : base_args)
+    args.push(arg);
+
+  String scan = line;
+  while (!scan.isEmpty())
+  {
+    auto tab = scan.findFirst('\t');
+    if (!tab.found())
+    {
+      args.push(scan);
+      break;
+    }
+
+    if (tab != 0)
+      args.push(scan.sub(0, tab));
+    scan = scan.sub(tab + 1);
+  }
+
+  Driver driver;
+  Driver::InitParams driver_params = {};
+  if (!driver.init(driver_params))
+    return false;
+  defer { driver.deinit(); };
+
+  switch (driver.processArgs(args.asSlice()))
+  {
+  case Driver::ProcessArgsResult::Error:
+    return false;
+
+  case Driver::ProcessArgsResult::EarlyOut:
+    return true;
+  }
+
+  // Jobs don't get to write to stdout, as it may be used for reporting 
+  // their results.
+  if (driver.streams.out.stream == nullptr)
+    return ERROR("lpp jobs must specify an output file\n");
+
+  if (!lpp_initialized)
+  {
+    if (!driver.construct(&lpp))
+    {
+      lpp.deinit();
+      return false;
+    }
+    lpp_initialized = true;
+  }
+  else if (!driver.reset(&lpp))
+  {
+    lpp.deinit();
+    lpp_initialized = false;
+    return false;
+  }
+
+  if (!lpp.run())
+  {
+    driver.cleanupAfterFailure();
+
+    lpp.deinit();
+    lpp_initialized = false;
+    return false;
+  }
+
+  return true;
+}
+
+}
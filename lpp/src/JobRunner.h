@@ -0,0 +1,45 @@
+/*
+ *  Runs lpp 'jobs' on a single, reused lpp instance. A job is a line 
+ *  containing the arguments lpp would normally take on the command line 
+ *  separated by tabs.
+ *
+ *  The lpp instance is initialized by the first job and reset by every job
+ *  after, unless a job fails, in which case it is thrown away as its lua 
+ *  state can't be trusted anymore.
+ */
+
+#ifndef _lpp_JobRunner_h
+#define _lpp_JobRunner_h
+
+#include "Lpp.h"
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/containers/Slice.h"
+
+using namespace iro;
+
+namespace lpp
+{
+
+/* ============================================================================
+ */
+struct JobRunner
+{
+  Lpp lpp;
+
+  b8 lpp_initialized;
+
+  // Arguments prepended to the arguments of every job.
+  Slice<String> base_args;
+
+  b8   init(Slice<String> base_args);
+  void deinit();
+
+  // Runs the job described by 'line'. 
+  b8 run(String line);
+};
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "JobServer.h"
+
+#include "iro/Logger.h"
+#include "iro/memory/Memory.h"
+#include "iro/time/Time.h"
+
+namespace lpp
+{
+
+static Logger logger = 
+  Logger::create("lpp.server"_str, Logger::Verbosity::Info);
+
+/* ----------------------------------------------------------------------------
+ */
+b8 JobServer::init(Slice<String> base_args, io::IO* in, io::IO* out)
+{
+  this->in = in;
+  this->out = out;
+  return runner.init(base_args);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void JobServer::deinit()
+{
+  runner.deinit();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 JobServer::run()
+{
+  io::Memory buffer;
+  buffer.open(4096);
+  defer { buffer.close(); };
+
+  // Offset into 'buffer' of the line we are currently reading.
+  u32 line_start = 0;
+
+  for (;;)
+  {
+    String unread = buffer.asStr().sub(line_start);
+
+    auto newline = unread.findFirst('\n');
+    if (!newline.found())
+    {
+      // Move whatever we have of the next line to the front of the buffer
+      // and read more.
+      if (line_start != 0)
+      {
+        mem::move(buffer.ptr, buffer.ptr + line_start, unread.len);
+        buffer.len = unread.len;
+        line_start = 0;
+      }
+
+      Bytes reserved = buffer.reserve(4096);
+      s64 bytes_read = in->read(reserved);
+      if (bytes_read <= 0)
+        break;
+      buffer.commit(bytes_read);
+      continue;
+    }
+
+    String line = unread.sub(0, newline);
+    line_start += newline + 1;
+
+    if (line.isEmpty())
+      continue;
+
+    TimePoint start = TimePoint::monotonic();
+
+    b8 success = runner.run(line);
+
+    INFO(success? "finished" : "failed", " job in ", 
+         WithUnits(TimePoint::monotonic() - start), "\n");
+
+    io::format(out, success? "ok\n"_str : "error\n"_str);
+    out->flush();
+  }
+
+  return true;
+}
+
+}
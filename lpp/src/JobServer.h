@@ -0,0 +1,49 @@
+/*
+ *  Runs lpp as a long lived process which preprocesses files sent to it as 
+ *  jobs (see JobRunner.h), reusing the same lpp instance, and so the same 
+ *  lua state and any modules persisted in it, between them.
+ *
+ *  Jobs are read one per line. Once a job has finished, either 'ok' or 
+ *  'error' is written back on its own line. Diagnostics are
+ *  still reported through the log. The server exits once its input is 
+ *  closed.
+ *
+ *  Nothing but replies may be written to the output, so when serving over
+ *  stdout, main sends anything else written to it to stderr.
+ */
+
+#ifndef _lpp_JobServer_h
+#define _lpp_JobServer_h
+
+#include "JobRunner.h"
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/io/IO.h"
+#include "iro/containers/Slice.h"
+
+using namespace iro;
+
+namespace lpp
+{
+
+/* ============================================================================
+ */
+struct JobServer
+{
+  JobRunner runner;
+
+  io::IO* in;
+  io::IO* out;
+
+  // 'base_args' are prepended to the arguments of every job.
+  b8   init(Slice<String> base_args, io::IO* in, io::IO* out);
+  void deinit();
+
+  // Reads and runs jobs until 'in' is closed.
+  b8 run();
+};
+
+}
+
+#endif
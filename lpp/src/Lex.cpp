@@ -6,12 +6,69 @@
 #include "ctype.h"
 #include "assert.h"
 
+#if defined(__AVX2__)
+#include "immintrin.h"
+#elif defined(__SSE2__)
+#include "emmintrin.h"
+#endif
+
 namespace lpp
 {
 
 static Logger logger = 
   Logger::create("lpp.lexer"_str, Logger::Verbosity::Notice);
 
+/* ----------------------------------------------------------------------------
+ */
+b8 TokenRing::init(u64 initial_capacity)
+{
+  assert(initial_capacity && (initial_capacity & (initial_capacity - 1)) == 0);
+
+  arr = (Token*)mem::stl_allocator.allocate(sizeof(Token) * initial_capacity);
+  if (arr == nullptr)
+    return false;
+
+  capacity = initial_capacity;
+  head = tail = 0;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TokenRing::deinit()
+{
+  mem::stl_allocator.free(arr);
+  *this = {};
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TokenRing::push(const Token& token)
+{
+  if (tail - head == capacity)
+    grow();
+
+  arr[tail & (capacity - 1)] = token;
+  tail += 1;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void TokenRing::grow()
+{
+  u64 new_capacity = capacity * 2;
+  Token* new_arr = 
+    (Token*)mem::stl_allocator.allocate(sizeof(Token) * new_capacity);
+  assert(new_arr);
+
+  for (u64 i = head; i < tail; ++i)
+    new_arr[i & (new_capacity - 1)] = arr[i & (capacity - 1)];
+
+  mem::stl_allocator.free(arr);
+  arr = new_arr;
+  capacity = new_capacity;
+}
+
 /* ----------------------------------------------------------------------------
  */
 void Lexer::ScopedLexStage::onEnter(const char* funcname)
@@ -63,12 +120,17 @@ b8 Lexer::atWhitespace() { return 0 != isspace(current()); }
 b8 Lexer::readStreamIfNeeded(b8 peek)
 {
   if (current_offset + (peek? current_codepoint.advance : 0) 
-      >= source->cache.len)
+      >= source->content.len)
   {
+    if (source->complete)
+    {
+      at_end = true;
+      return false;
+    }
+
     TRACE("reading more bytes from stream... \n");
 
-    Bytes reserved = source->cache.reserve(4096);
-    s64 bytes_read = in->read(reserved);
+    s64 bytes_read = source->readStream(in, 4096);
     if (bytes_read == -1)
     {
       current_codepoint = nil;
@@ -81,9 +143,8 @@ b8 Lexer::readStreamIfNeeded(b8 peek)
       at_end = true;
       return false;
     }
-    source->cache.commit(bytes_read);
     TRACE(bytes_read, " bytes read... chunk is: \n", 
-      source->cache.asStr().sub(current_offset), "\n");
+      source->content.sub(current_offset), "\n");
   }
   return true;
 }
@@ -94,8 +155,8 @@ b8 Lexer::decodeCurrent()
 {
   current_codepoint = 
     utf8::decodeCharacter(
-      source->cache.ptr + current_offset, 
-      source->cache.len - current_offset);
+      source->content.ptr + current_offset, 
+      source->content.len - current_offset);
 
   return notnil(current_codepoint);
 }
@@ -107,8 +168,8 @@ u32 Lexer::peek()
   readStreamIfNeeded(true);
   u64 offset = current_offset + current_codepoint.advance;
   return utf8::decodeCharacter(
-      source->cache.ptr + offset,
-      source->cache.len - offset);
+      source->content.ptr + offset,
+      source->content.len - offset);
 }
 
 /* ----------------------------------------------------------------------------
@@ -199,14 +260,17 @@ b8 Lexer::init(
     Source* src, 
     LexerConsumer* consumer)
 {
-  assert(input_stream and src);
+  // Sources that are already complete have nothing to read.
+  assert(src and (input_stream or src->complete));
 
   TRACE("initializing with input stream '", src->name, "'\n");
 
-  tokens = TokenArray::create();
+  if (!tokens.init())
+    return false;
   in = input_stream;
   source = src;
   at_end = false;
+  finished = false;
   current_offset = 0;
   current_codepoint = nil;
   this->consumer = consumer;
@@ -222,26 +286,37 @@ b8 Lexer::init(
  */
 void Lexer::deinit()
 {
-  tokens.destroy();
+  tokens.deinit();
   *this = {};
 }
 
 /* ----------------------------------------------------------------------------
  */
-b8 Lexer::run()
+b8 Lexer::lexNext()
 {
   LEX_STAGE;
 
   using enum Token::Kind;
 
-  for (;;)
+  if (finished)
+    return false;
+
+  u64 start = tokens.tail;
+
+  // Skipping whitespace or lexing a Document may not produce a token, so 
+  // keep going until something is.
+  while (tokens.tail == start)
   {
     skipWhitespace();
 
+    if (tokens.tail != start)
+      break;
+
     if (eof())
     {
       initCurt();
       finishCurt(Eof, 1);
+      finished = true;
       return true;
     }
 
@@ -265,6 +340,127 @@ b8 Lexer::run()
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+b8 Lexer::run()
+{
+  while (!finished)
+  {
+    if (!lexNext())
+      return false;
+    tokens.release(tokens.tail);
+  }
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Bytes that lexDocument must stop at and look at more carefully. Bytes 
+ *  outside of ASCII are included so that only plain text is ever skipped.
+ */
+static b8 isSignificantDocumentByte(u8 c)
+{
+  return c == '$' || c == '@' || c == '\\' || c == 0 || c >= 0x80;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Returns the number of bytes at the start of 'ptr' before the first 
+ *  significant document byte, or 'len' if there is none.
+ */
+static u64 findSignificantDocumentByte(const u8* ptr, u64 len)
+{
+  u64 i = 0;
+
+#if defined(__AVX2__)
+  const __m256i dollar = _mm256_set1_epi8('$');
+  const __m256i at = _mm256_set1_epi8('@');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i zero = _mm256_setzero_si256();
+
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)(ptr + i));
+
+    __m256i matches = 
+      _mm256_or_si256(
+        _mm256_or_si256(
+          _mm256_cmpeq_epi8(chunk, dollar),
+          _mm256_cmpeq_epi8(chunk, at)),
+        _mm256_or_si256(
+          _mm256_cmpeq_epi8(chunk, backslash),
+          _mm256_cmpeq_epi8(chunk, zero)));
+
+    // Non-ASCII bytes have their sign bit set, which is what movemask 
+    // gathers, so or-ing in the chunk itself catches them.
+    u32 mask = (u32)_mm256_movemask_epi8(_mm256_or_si256(matches, chunk));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128i dollar16 = _mm_set1_epi8('$');
+  const __m128i at16 = _mm_set1_epi8('@');
+  const __m128i backslash16 = _mm_set1_epi8('\\');
+  const __m128i zero16 = _mm_setzero_si128();
+
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(ptr + i));
+
+    __m128i matches = 
+      _mm_or_si128(
+        _mm_or_si128(
+          _mm_cmpeq_epi8(chunk, dollar16),
+          _mm_cmpeq_epi8(chunk, at16)),
+        _mm_or_si128(
+          _mm_cmpeq_epi8(chunk, backslash16),
+          _mm_cmpeq_epi8(chunk, zero16)));
+
+    u32 mask = (u32)_mm_movemask_epi8(_mm_or_si128(matches, chunk));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+
+  for (; i < len; ++i)
+  {
+    if (isSignificantDocumentByte(ptr[i]))
+      return i;
+  }
+
+  return len;
+}
+
+/* ----------------------------------------------------------------------------
+ *  Skips over the run of plain ASCII text starting at the current 
+ *  codepoint, stopping on the last byte of it so that the caller handles 
+ *  that byte and reading whatever follows normally. Updates 
+ *  'last_non_whitespace' as if each byte skipped had been advanced over.
+ */
+void Lexer::skipPlainDocumentText(u64* last_non_whitespace)
+{
+  u8* start = source->content.ptr + current_offset;
+  u64 available = source->content.len - current_offset;
+
+  u64 run = findSignificantDocumentByte(start, available);
+  if (run < 2)
+    return;
+
+  // Find the last non-whitespace byte of those we are about to skip.
+  for (u64 i = run - 1; i > 0; --i)
+  {
+    if (!isspace(start[i - 1]))
+    {
+      *last_non_whitespace = current_offset + i - 1;
+      break;
+    }
+  }
+
+  current_offset += run - 1;
+  decodeCurrent();
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 Lexer::lexDocument()
@@ -278,6 +474,8 @@ b8 Lexer::lexDocument()
       not at('$') and
       not eof())
   {
+    skipPlainDocumentText(&last_non_whitespace);
+
     if (at('\\'))
     {
       switch (peek())
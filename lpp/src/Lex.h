@@ -86,20 +86,55 @@ struct LexerConsumer
 };
 
 /* ============================================================================
- *
- *  TODO(sushi) try reworking the lexer to give a token
- *              stream again instead of caching them into an array
- *              to save on memory. Making it a stream complicates the 
- *              internal logic too much at the moment so I'm just 
- *              going to avoid it for now.
- *              It's not a huge issue, though, because Tokens are quite small, 
- *              and with how lpp works we shouldn't be making too many tokens 
- *              to begin with.
+ *  Ring of the tokens most recently produced by the Lexer. Tokens are 
+ *  addressed by their index in the stream of all tokens lexed and stay 
+ *  available until released by whatever is consuming them. The ring grows
+ *  if the Lexer gets too far ahead of the consumer, which only happens when 
+ *  a single lpp construct (like a macro with many arguments) produces many 
+ *  tokens at once.
+ */
+struct TokenRing
+{
+  Token* arr = nullptr;
+
+  // Always a power of two.
+  u64 capacity = 0;
+
+  // Index of the oldest token still available.
+  u64 head = 0;
+
+  // Index one past the newest token, which is also the total number of 
+  // tokens that have been pushed.
+  u64 tail = 0;
+
+  b8   init(u64 initial_capacity = 64);
+  void deinit();
+
+  void push(const Token& token);
+
+  // Marks every token before 'idx' as no longer needed.
+  void release(u64 idx) { if (idx > head) head = idx < tail? idx : tail; }
+
+  b8 has(u64 idx) const { return idx >= head && idx < tail; }
+
+  // Note that references into the ring are invalidated by push().
+  Token& operator[](u64 idx) 
+  { 
+    assert(has(idx)); 
+    return arr[idx & (capacity - 1)]; 
+  }
+
+private:
+
+  void grow();
+};
+
+/* ============================================================================
+ *  Produces tokens on demand into a TokenRing, which the Parser pulls from.
  */
 struct Lexer
 {
   using enum Token::Kind;
-  typedef Array<Token> TokenArray;
 
   utf8::Codepoint current_codepoint;
   u64 current_offset;
@@ -107,10 +142,13 @@ struct Lexer
   Source* source;
   io::IO* in;
 
-  TokenArray tokens;
+  TokenRing tokens;
 
   b8 at_end;
 
+  // Set once the Eof token has been produced.
+  b8 finished;
+
   jmp_buf err_handler; // this is 200 bytes !!!
 
   LexerConsumer* consumer = nullptr;
@@ -121,7 +159,14 @@ struct Lexer
       LexerConsumer* consumer);
 
   void deinit();
+
+  // Lexes the next lpp construct in the input, producing at least one 
+  // token unless the Eof token has already been produced, in which case 
+  // this returns false. Errors longjmp to 'err_handler'.
+  b8 lexNext();
         
+  // Lexes the entire input, releasing tokens as they are produced. Mostly 
+  // useful for measuring the lexer on its own.
   b8 run();
 
 private:
@@ -129,6 +174,7 @@ private:
   Token curt;
 
   b8 lexDocument();
+  void skipPlainDocumentText(u64* last_non_whitespace);
 
   b8 lexLuaLine(); // '$'
   b8 lexLuaInline(); // '$'['<'...'>']'('...')'
@@ -159,8 +205,8 @@ private:
   // Don't forget that this could move!
   Token* lookback(u64 n)
   {
-    assert(n && n <= tokens.len());
-    return &tokens.end()[-n];
+    assert(n && n <= tokens.tail);
+    return &tokens[tokens.tail - n];
   }
 
   b8 lookbackIs(u64 n, Token::Kind k)
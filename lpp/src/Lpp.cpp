@@ -1,11 +1,14 @@
 #include "Lpp.h"
+#include "IncludeScanner.h"
 
 #include "Lex.h"
 #include "stdio.h"
 
 #include "iro/Logger.h"
 #include "iro/fs/FileSystem.h"
+#include "iro/fs/Path.h"
 #include "iro/ArgIter.h"
+#include "iro/DepFile.h"
 #include "iro/Platform.h"
 
 #include "assert.h"
@@ -23,6 +26,8 @@ int lua__debugBreak(lua_State* L);
 int lua__getCurrentInputSourceName(lua_State* L);
 int lua__getInputName(lua_State* L);
 int lua__getcwd(lua_State* L);
+int lua__hashFile(lua_State* L);
+int lua__hashString(lua_State* L);
 }
 
 namespace lpp
@@ -72,6 +77,8 @@ b8 Lpp::init(const InitParams& params)
   addGlobalCFunc(lua__getCurrentInputSourceName);
   addGlobalCFunc(lua__getInputName);
   addGlobalCFunc(lua__getcwd);
+  addGlobalCFunc(lua__hashFile);
+  addGlobalCFunc(lua__hashString);
 
 #undef addGlobalCFunc
 
@@ -85,16 +92,79 @@ b8 Lpp::init(const InitParams& params)
   lua.pushlightuserdata(this);
   lua.settable(lua.gettop()-2);
 
+  lua.pop();
+
+  if (!applyParams(params))
+    return false;
+
+  DEBUG("done initializing\n");
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lpp::reset(const InitParams& params)
+{
+  DEBUG("reset\n");
+
+  if (!lua.require("Lpp"_str))
+    return false;
+  const s32 I_lpp = lua.gettop();
+
+  lua.pushstring("reset"_str);
+  lua.gettable(I_lpp);
+  if (!lua.pcall())
+    return ERROR("failed to reset lpp: ", lua.tostring(), "\n");
+
+  lua.pop();
+
+  lua.newtable();
+  lua.setglobal(lpp_metaenv_stack);
+
+  return applyParams(params);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lpp::applyParams(const InitParams& params)
+{
+  if (!lua.require("Lpp"_str))
+    return false;
+  const s32 I_lpp = lua.gettop();
+
   streams = params.streams;
   consumers = params.consumers;
   use_full_filepaths = params.use_full_filepaths;
   vfs = params.vfs;
+  bytecode_cache_dir = params.bytecode_cache_dir;
+  profiler = params.profiler;
+  clang_deps = params.clang_deps;
+  binary_deps = params.binary_deps;
+  include_dirs = params.include_dirs;
+
+  if (profiler)
+    profiler->attach(lua);
 
   if (streams.dep.io)
   {
     lua.pushstring("generating_dep_file"_str);
     lua.pushboolean(true);
     lua.settable(I_lpp);
+
+    if (clang_deps)
+    {
+      lua.pushstring("clang_deps"_str);
+      lua.pushboolean(true);
+      lua.settable(I_lpp);
+    }
+  }
+
+  if (notnil(params.import_cache_dir))
+  {
+    lua.pushstring("import_cache_dir"_str);
+    lua.pushstring(params.import_cache_dir);
+    lua.settable(I_lpp);
   }
 
   if (!params.args.isEmpty())
@@ -164,26 +234,8 @@ b8 Lpp::init(const InitParams& params)
     lua.pop(2);
   }
 
-  if (!params.include_dirs.isEmpty())
-  {
-    lua.pushstring("addIncludeDir"_str);
-    lua.gettable(I_lpp);
-    const s32 I_addIncludeDir = lua.gettop();
-
-    for (String dir : params.include_dirs)
-    {
-      lua.pushvalue(I_addIncludeDir);
-      lua.pushstring(dir);
-      lua.pcall(1);
-    }
-
-    lua.pop();
-  }
-
   lua.pop();
 
-  DEBUG("done initializing\n");
-
   return true;
 }
 
@@ -212,61 +264,135 @@ b8 Lpp::run()
 
   using namespace fs;
 
-  if (!processStream(
-        streams.in.name, 
-        streams.in.io, 
-        streams.out.io))
+  return 
+    processStream(
+      streams.in.name, 
+      streams.in.io, 
+      streams.out.io,
+      streams.dep.io);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lpp::processStream(
+    String name, 
+    io::IO* instream, 
+    io::IO* outstream,
+    io::IO* depstream)
+{
+  DEBUG("creating metaprogram from input stream '", name, "'\n");
+
+  auto* source_node = sources.pushTail();
+  defer { sources.remove(source_node); };
+  Source* source = source_node->data;
+  if (!source->init(name))
     return false;
+  defer { source->deinit(); };
 
-  if (streams.dep.io)
+  auto* dest_node = sources.pushTail();
+  defer { sources.remove(dest_node); };
+  Source* dest = dest_node->data;
+  if (!dest->init("dest"_str)) // TODO(sushi) dont use 'dest' here.
+    return false;
+  defer { dest->deinit(); };
+
+  if (!processSource(source, instream, dest))
+    return false;
+
+  if (outstream)
+    outstream->write(dest->content);
+
+  if (depstream)
+    return writeDepFile(source, dest, depstream);
+  
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Lpp::writeDepFile(Source* input, Source* output, io::IO* depstream)
+{
+  if (!lua.require("Lpp"_str))
+    return false;
+  const s32 I_lpp = lua.gettop();
+  defer { lua.pop(); };
+
+  // Files imported, required, or included through lpp are tracked by the
+  // lpp module as they're used. Headers included by the output are found
+  // here, unless lppclang has been asked to find them (which the reflector
+  // does when it sees lpp.clang_deps).
+  if (!clang_deps)
   {
-    if (!lua.require("Lpp"_str))
+    IncludeScanner scanner;
+    if (!scanner.init(include_dirs))
       return false;
-    const s32 I_lpp = lua.gettop();
+    defer { scanner.deinit(); };
 
-    lua.pushstring("generateDepFile"_str);
+    scanner.scan(output->content, fs::Path::removeBasename(input->name));
+
+    lua.pushstring("addDependency"_str);
     lua.gettable(I_lpp);
+    const s32 I_addDependency = lua.gettop();
 
-    if (!lua.pcall(0, 1))
-      return false;
+    for (IncludeScanner::Header* header : scanner.headers)
+    {
+      lua.pushvalue(I_addDependency);
+      lua.pushstring(header->path);
+      if (!lua.pcall(1))
+        return ERROR(lua.tostring(), "\n");
+    }
+
+    lua.pop();
+  }
+
+  lua.pushstring("generateDepFile"_str);
+  lua.gettable(I_lpp);
 
-    String result = lua.tostring();
+  if (!lua.pcall(0, 1))
+    return ERROR("failed to generate dep file: ", lua.tostring(), "\n");
 
-    io::format(streams.dep.io, result);
+  String deps = lua.tostring();
+  defer { lua.pop(); };
+
+  if (!binary_deps)
+  {
+    io::format(depstream, deps);
+    return true;
   }
 
+  auto paths = Array<String>::create();
+  defer { paths.destroy(); };
+
+  // Paths may not contain newlines, so they can just be split back apart.
+  u64 start = 0;
+  for (u64 i = 0; i < deps.len; ++i)
+  {
+    if (deps.ptr[i] != '\n')
+      continue;
+    if (i != start)
+      paths.push({deps.ptr + start, i - start});
+    start = i + 1;
+  }
+  if (start != deps.len)
+    paths.push({deps.ptr + start, deps.len - start});
+
+  if (!depfile::writeBinary(depstream, paths.asSlice()))
+    return ERROR("failed to write binary dep file\n");
+
   return true;
 }
 
 /* ----------------------------------------------------------------------------
  */
-b8 Lpp::processStream(String name, io::IO* instream, io::IO* outstream)
+b8 Lpp::processSource(Source* input, io::IO* instream, Source* output)
 {
-  DEBUG("creating metaprogram from input stream '", name, "'\n");
-
-  Source* source = sources.pushTail()->data;
-  if (!source->init(name))
-    return false;
-  defer { source->deinit(); };
-
-  Source* dest = sources.pushTail()->data;
-  if (!dest->init("dest"_str)) // TODO(sushi) dont use 'dest' here.
-    return false;
-  defer { dest->deinit(); };
-
   Metaprogram* prev = (metaprograms.isEmpty()? nullptr : &metaprograms.tail());
   Metaprogram* metaprog = metaprograms.pushTail()->data;
-  if (!metaprog->init(this, instream, source, dest, prev))
+  if (!metaprog->init(this, instream, input, output, prev))
     return false;
   defer { metaprog->deinit(); metaprograms.popTail(); };
 
-  if (!metaprog->run())
-    return false;
-
-  if (outstream)
-    outstream->write(metaprog->output->cache.asStr());
-  
-  return true;
+  return metaprog->run();
 }
 
 /* ============================================================================
@@ -306,43 +432,55 @@ int lua__processFile(lua_State* L)
     return 0;
   }
 
-  // This is scuffed as hell, but I do NOT want to be working on the ls anymore
-  io::IO* stream = nullptr;
-  io::StringView virtual_content;
-  fs::File file;
-  if (lpp->vfs)
-  {
-    String content = lpp->vfs->open(path.asStr());
-    if (notnil(content))
-    {
-      virtual_content = io::StringView::from(content);
-      stream = &virtual_content;
-    }
-  }
-
-  if (stream == nullptr)
-  {
-    file = fs::File::from(path, fs::OpenFlag::Read);
-    if (isnil(file))
-      return {};
-    stream = &file;
-  }
-
-  defer { stream->close(); };
-
-  io::Memory mem;
-  mem.open();
-  defer { mem.close(); };
+  // Time spent processing the file is recorded as an import rather than
+  // being attributed to whatever lua block called us.
+  TimePoint import_start;
+  u64 import_bytes = 0;
+  if (lpp->profiler)
+    import_start = lpp->profiler->beginImport();
+  defer 
+  { 
+    if (lpp->profiler)
+      lpp->profiler->endImport(path.asStr(), import_start, import_bytes); 
+  };
 
   String name = 
     lpp->use_full_filepaths
     ? path.asStr() 
     : reqpath;
+
+  // Imported files are mapped, or borrowed from the vfs when lppls has 
+  // them open, rather than read through a stream so that their content is 
+  // never copied.
+  auto* source_node = lpp->sources.pushTail();
+  defer { lpp->sources.remove(source_node); };
+  Source* source = source_node->data;
+
+  String virtual_content = nil;
+  if (lpp->vfs)
+    virtual_content = lpp->vfs->open(path.asStr());
+
+  b8 initialized = 
+    notnil(virtual_content)
+    ? source->initView(name, virtual_content)
+    : source->initMapped(name, path.asStr());
+  if (!initialized)
+    return 0;
+  defer { source->deinit(); };
+
+  auto* dest_node = lpp->sources.pushTail();
+  defer { lpp->sources.remove(dest_node); };
+  Source* dest = dest_node->data;
+  if (!dest->init("dest"_str))
+    return 0;
+  defer { dest->deinit(); };
   
-  if (!lpp->processStream(name, stream, &mem))
+  if (!lpp->processSource(source, nullptr, dest))
     return 0;
 
-  lua.pushstring(mem.asStr());
+  import_bytes = dest->content.len;
+
+  lua.pushstring(dest->content);
   return 1;
 }
 
@@ -423,6 +561,61 @@ int lua__getcwd(lua_State* L)
   return 1;
 }
 
+/* ----------------------------------------------------------------------------
+ *  Pushes a hex string of the given hash. Hashes are handed to lua as strings
+ *  as lua numbers cannot represent all 64 bits.
+ */
+static void pushHash(LuaState& lua, u64 hash)
+{
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+  lua.pushstring(String::from((u8*)buf, 16));
+}
+
+/* ----------------------------------------------------------------------------
+ *  Hashes the contents of the file at the given path, preferring the vfs 
+ *  when one is set. Returns nothing if the file cannot be read.
+ */
+int lua__hashFile(lua_State* L)
+{
+  auto lua = LuaState::fromExistingState(L);
+  auto lpp = (Lpp*)lua.tolightuserdata(1);
+  String path = lua.tostring(2);
+
+  if (lpp->vfs)
+  {
+    String content = lpp->vfs->open(path);
+    if (notnil(content))
+    {
+      pushHash(lua, content.hash());
+      return 1;
+    }
+  }
+
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+    return 0;
+  defer { file.close(); };
+
+  io::Memory mem;
+  mem.open();
+  defer { mem.close(); };
+
+  mem.consume(&file, 4096);
+
+  pushHash(lua, mem.asStr().hash());
+  return 1;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+int lua__hashString(lua_State* L)
+{
+  auto lua = LuaState::fromExistingState(L);
+  pushHash(lua, lua.tostring(1).hash());
+  return 1;
+}
+
 }
 
 }
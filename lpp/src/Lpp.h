@@ -14,12 +14,17 @@
 
 #include "Source.h"
 #include "Parser.h"
+#include "Profiler.h"
 
 using namespace iro;
 
 // Use on functions that need to be exposed to luajit's ffi interface.
 #define LPP_LUAJIT_FFI_FUNC EXPORT_DYNAMIC
 
+// Printed by --version. Anything lpp caches on disk is invalidated when this
+// changes.
+#define LPP_VERSION "0.1"
+
 namespace lpp
 {
 
@@ -80,6 +85,18 @@ struct Lpp
 
   b8 use_full_filepaths;
 
+  String bytecode_cache_dir;
+
+  Profiler* profiler;
+
+  b8 clang_deps;
+
+  b8 binary_deps;
+
+  // Directories searched for headers included by the output when writing
+  // the dep file.
+  Slice<String> include_dirs;
+
   struct InitParams
   {
     Streams streams;
@@ -95,13 +112,58 @@ struct Lpp
     LppVFS* vfs;
 
     b8 use_full_filepaths;
+
+    // Directory in which the results of lpp.import are cached across runs.
+    // Caching is disabled when this is nil.
+    String import_cache_dir;
+
+    // Directory in which the bytecode of metaprograms is cached across runs.
+    // See BytecodeCache.h. Caching is disabled when this is nil.
+    String bytecode_cache_dir;
+
+    // When set, the time spent in each part of processing is recorded
+    // into this. See Profiler.h.
+    Profiler* profiler;
+
+    // Leave finding the headers included by the output to lppclang rather
+    // than scanning for them ourselves when writing the dep file. See 
+    // IncludeScanner.h.
+    b8 clang_deps;
+
+    // Write the dep file in the binary format described in iro/DepFile.h
+    // rather than one path per line.
+    b8 binary_deps;
   };
 
   b8   init(const InitParams& params);
   void deinit();
 
+  // Resets any state left over from a previous run and applies the given
+  // params so that this instance may process another file without needing
+  // to recreate its lua state. Modules loaded by the previous run that were
+  // not marked as persistent (see lpp.persistModule) are unloaded.
+  b8 reset(const InitParams& params);
+
   b8 run();
-  b8 processStream(String name, io::IO* instream, io::IO* outstream);
+
+  // Processes 'instream' into 'outstream'. When 'depstream' is given, the
+  // dependencies of the input are written to it afterwards.
+  b8 processStream(
+    String name, 
+    io::IO* instream, 
+    io::IO* outstream,
+    io::IO* depstream = nullptr);
+
+  // Processes 'input' into 'output', both of which are expected to have 
+  // been initialized by the caller. 'instream' may be null if 'input' is 
+  // already complete, eg. when it is a mapped file.
+  b8 processSource(Source* input, io::IO* instream, Source* output);
+
+private:
+
+  b8 applyParams(const InitParams& params);
+
+  b8 writeDepFile(Source* input, Source* output, io::IO* depstream);
 }; 
 
 }
@@ -123,6 +123,11 @@ local MacroExpansion,
 ---@field include_dirs List
 --- If lpp is generating a dep file or not.
 ---@field generating_dep_file boolean
+--- If headers included by the result should be found by lppclang when 
+--- generating a dep file, rather than by lpp itself.
+---@field clang_deps boolean
+--- Directory imported files are cached in, if enabled with --import-cache.
+---@field import_cache_dir string?
 --- List of arguments passed on the command line that weren't consumed by lpp.
 ---@field argv table
 local lpp = {}
@@ -132,6 +137,10 @@ lpp.include_dirs = List{}
 lpp.argv = List{}
 -- Set true in lpp.cpp if we are.
 lpp.generating_dep_file = false
+-- Set true in lpp.cpp if --clang-deps is passed.
+lpp.clang_deps = false
+-- Set in lpp.cpp if --import-cache is passed.
+lpp.import_cache_dir = nil
 lpp.stacktrace_func_filter = {}
 lpp.stacktrace_func_rename = {}
 
@@ -251,6 +260,59 @@ end
 
 -- * --------------------------------------------------------------------------
 
+-- Modules that stay loaded when lpp is reset between files. This starts with
+-- everything loaded before us along with lpp's internal modules.
+local persistent_modules = 
+{
+  Lpp = true,
+  Metaenv = true,
+  Errh = true,
+  StackCapture = true,
+}
+for name in pairs(package.loaded) do
+  persistent_modules[name] = true
+end
+
+local base_package_path = package.path
+local base_package_cpath = package.cpath
+
+--- Marks the module 'name' as one that should stay loaded between files 
+--- when lpp is processing many files, eg. when running with --serve. 
+--- Modules are otherwise unloaded after each file, so that any state they 
+--- keep is not carried into the next one. This should be used by modules
+--- that are expensive to load and do not keep per-file state, or that 
+--- cannot be loaded twice (such as those defining ffi types).
+---
+---@param name string
+lpp.persistModule = function(name)
+  persistent_modules[name] = true
+end
+
+--- Resets all per-file state so that another file may be processed by this
+--- same lua state. Used internally.
+lpp.reset = function()
+  lpp.dependencies = List{}
+  lpp.include_dirs = List{}
+  lpp.argv = List{}
+  lpp.generating_dep_file = false
+  lpp.clang_deps = false
+  lpp.import_cache_dir = nil
+  lpp.doc_callbacks = List{}
+  lpp.final_callbacks = List{}
+  lpp.source_final_callbacks = List{}
+
+  for name in pairs(package.loaded) do
+    if not persistent_modules[name] then
+      package.loaded[name] = nil
+    end
+  end
+
+  package.path = base_package_path
+  package.cpath = base_package_cpath
+end
+
+-- * --------------------------------------------------------------------------
+
 --- Immediately ends all preprocessing quietly and prevents lpp from 
 --- outputting the final output file.
 lpp.cancel = function()
@@ -289,7 +351,8 @@ end
 local lua_require = require
 require = function(path)
   local normpath = path:gsub('%.', '/')
-  if lpp.generating_dep_file then
+  -- The import cache also needs to know what modules a file relies on.
+  if lpp.generating_dep_file or lpp.import_cache_dir then
     for pattern in package.path:gmatch("[^;]+") do
       local fullpath = 
         lpp.getFileFullPathIfExists(
@@ -1,5 +1,7 @@
 #include "Metaprogram.h"
 #include "Lpp.h"
+#include "BytecodeCache.h"
+#include "Profiler.h"
 
 #include "iro/LineMap.h"
 #include "iro/fs/File.h"
@@ -19,17 +21,22 @@ b8 Section::initDocument(
     u64 token_idx,
     String raw, 
     SectionNode* node,
-    io::Memory* buffer)
+    io::Memory* buffer,
+    SectionPiecePool* piece_pool,
+    mem::Allocator* text_allocator)
 {
-  assert(buffer);
+  assert(buffer && piece_pool && text_allocator);
   this->buffer = buffer;
+  this->piece_pool = piece_pool;
+  this->text_allocator = text_allocator;
   this->node = node;
   this->token_idx = token_idx;
-  if (!buffer->open(raw.len))
-    return false;
-  buffer->write(raw);
+  pieces = nullptr;
+  piece_seed = 0x9e3779b97f4a7c15 ^ token_idx;
+  len = 0;
+  joined = false;
   kind = Kind::Document;
-  return true;
+  return insertString(0, raw);
 }
 
 /* ----------------------------------------------------------------------------
@@ -78,7 +85,15 @@ void Section::deinit()
     return;
 
   case Kind::Document:
+    // The text itself belongs to the metaprogram and the buffer to its 
+    // buffer pool, both of which are cleaned up along with it.
+    freePieces(pieces);
+    pieces = nullptr;
+    piece_pool = nullptr;
     buffer = nullptr;
+    text_allocator = nullptr;
+    len = 0;
+    joined = false;
     break;
   }
 
@@ -88,43 +103,255 @@ void Section::deinit()
 
 /* ----------------------------------------------------------------------------
  */
-b8 Section::insertString(u64 offset, String s)
+static u64 getSubtreeLen(const SectionPiece* piece)
 {
-  assert(offset <= buffer->len);
+  return piece == nullptr? 0 : piece->subtree_len;
+}
 
-  buffer->reserve(s.len);
+/* ----------------------------------------------------------------------------
+ */
+static void updateSubtreeLen(SectionPiece* piece)
+{
+  piece->subtree_len =
+    getSubtreeLen(piece->left) + piece->text.len + getSubtreeLen(piece->right);
+}
 
-  mem::move(
-    buffer->ptr + offset + s.len, 
-    buffer->ptr + offset, 
-    (buffer->len - offset) + 1);
-  mem::copy(buffer->ptr + offset, s.ptr, s.len);
+/* ----------------------------------------------------------------------------
+ *  Joins the trees 'before' and 'after' into one, keeping every piece in
+ *  'before' ahead of those in 'after'.
+ */
+static SectionPiece* mergePieces(SectionPiece* before, SectionPiece* after)
+{
+  if (before == nullptr)
+    return after;
+  if (after == nullptr)
+    return before;
 
-  buffer->commit(s.len);
+  if (before->priority > after->priority)
+  {
+    before->right = mergePieces(before->right, after);
+    updateSubtreeLen(before);
+    return before;
+  }
+  else
+  {
+    after->left = mergePieces(before, after->left);
+    updateSubtreeLen(after);
+    return after;
+  }
+}
 
-  return true;
+/* ----------------------------------------------------------------------------
+ *  Calls 'f' on the text of every piece under 'piece' in order, or in
+ *  reverse order if 'reverse' is set.
+ */
+template<typename F>
+static void forEachPiece(const SectionPiece* piece, b8 reverse, F&& f)
+{
+  if (piece == nullptr)
+    return;
+  forEachPiece(reverse? piece->right : piece->left, reverse, f);
+  f(piece->text);
+  forEachPiece(reverse? piece->left : piece->right, reverse, f);
 }
 
 /* ----------------------------------------------------------------------------
  */
-b8 Section::consumeFromBeginning(u64 len)
+SectionPiece* Section::newPiece(String text)
 {
-  if (len > buffer->len)
-    return false;
+  // xorshift, which is plenty random for balancing.
+  piece_seed ^= piece_seed << 13;
+  piece_seed ^= piece_seed >> 7;
+  piece_seed ^= piece_seed << 17;
+
+  SectionPiece* piece = piece_pool->add();
+  piece->text = text;
+  piece->subtree_len = text.len;
+  piece->priority = piece_seed;
+  piece->left = piece->right = nullptr;
+  return piece;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Section::freePieces(SectionPiece* piece)
+{
+  if (piece == nullptr)
+    return;
+  freePieces(piece->left);
+  freePieces(piece->right);
+  piece_pool->remove(piece);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Section::splitPieces(
+    SectionPiece*  piece,
+    u64            offset,
+    SectionPiece** out_before,
+    SectionPiece** out_after)
+{
+  if (piece == nullptr)
+  {
+    *out_before = *out_after = nullptr;
+    return;
+  }
 
-  if (len == buffer->len)
+  u64 left_len = getSubtreeLen(piece->left);
+  u64 text_end = left_len + piece->text.len;
+
+  if (offset <= left_len)
+  {
+    splitPieces(piece->left, offset, out_before, &piece->left);
+    updateSubtreeLen(piece);
+    *out_after = piece;
+  }
+  else if (offset >= text_end)
+  {
+    splitPieces(piece->right, offset - text_end, &piece->right, out_after);
+    updateSubtreeLen(piece);
+    *out_before = piece;
+  }
+  else
   {
-    buffer->clear();
+    // The tail of the text takes over the piece's right subtree, and so
+    // its priority as well.
+    u64 split = offset - left_len;
+    SectionPiece* tail = newPiece(piece->text.sub(split));
+    tail->priority = piece->priority;
+    tail->right = piece->right;
+    updateSubtreeLen(tail);
+
+    piece->text = piece->text.sub(0, split);
+    piece->right = nullptr;
+    updateSubtreeLen(piece);
+
+    *out_before = piece;
+    *out_after = tail;
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Section::insertString(u64 offset, String s)
+{
+  assert(offset <= len);
+
+  if (s.isEmpty())
     return true;
+
+  auto* copy = (u8*)text_allocator->allocate(s.len);
+  if (copy == nullptr)
+    return false;
+  mem::copy(copy, s.ptr, s.len);
+  SectionPiece* piece = newPiece(String::from(copy, s.len));
+
+  joined = false;
+
+  // Appending is by far the most common edit, so avoid splitting for it.
+  if (offset == len)
+  {
+    pieces = mergePieces(pieces, piece);
+  }
+  else
+  {
+    SectionPiece* before;
+    SectionPiece* after;
+    splitPieces(pieces, offset, &before, &after);
+    pieces = mergePieces(mergePieces(before, piece), after);
   }
 
-  // idk man find a way to not move shit around later maybe with just a String ? 
-  // idk we edit stuff too much and IDRC at the moment!!!
-  mem::move(buffer->ptr, buffer->ptr + len, buffer->len - len);
-  buffer->len -= len;
+  len += s.len;
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+b8 Section::consumeFromBeginning(u64 consume_len)
+{
+  if (consume_len > len)
+    return false;
+
+  joined = false;
+  len -= consume_len;
+
+  SectionPiece* consumed;
+  splitPieces(pieces, consume_len, &consumed, &pieces);
+  freePieces(consumed);
+
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+String Section::getString()
+{
+  if (joined)
+    return buffer->asStr();
+
+  if (!buffer->open(len))
+    return nil;
+
+  // The last join left a piece pointing into 'buffer', which edits since
+  // may have split, trimmed or dropped. Rather than joining into a copy,
+  // the text is rearranged in place: pieces from the buffer are moved to
+  // where they belong first, those moving left front to back and those
+  // moving right back to front, so that none overwrites text another has
+  // yet to move. The remaining pieces are then copied in around them.
+  u64 old_start = (u64)buffer->ptr;
+  u64 old_end = old_start + buffer->len;
+  auto isInBuffer = [old_start, old_end](String piece)
+  {
+    return (u64)piece.ptr >= old_start && (u64)piece.ptr < old_end;
+  };
+
+  if (len > buffer->len)
+    buffer->reserve(len - buffer->len);
+  u8* text = buffer->ptr;
+
+  u64 offset = 0;
+  forEachPiece(pieces, false, [&](String piece)
+  {
+    u64 from = (u64)piece.ptr - old_start;
+    if (isInBuffer(piece) && from > offset)
+      mem::move(text + offset, text + from, piece.len);
+    offset += piece.len;
+  });
+
+  forEachPiece(pieces, true, [&](String piece)
+  {
+    offset -= piece.len;
+    u64 from = (u64)piece.ptr - old_start;
+    if (isInBuffer(piece) && from < offset)
+      mem::move(text + offset, text + from, piece.len);
+  });
+
+  forEachPiece(pieces, false, [&](String piece)
+  {
+    if (!isInBuffer(piece))
+      mem::copy(text + offset, piece.ptr, piece.len);
+    offset += piece.len;
+  });
+
+  buffer->clear();
+  buffer->commit(len);
+
+  // Collapse the pieces into the joined text so that they don't need to be
+  // walked again.
+  freePieces(pieces);
+  pieces = len != 0? newPiece(buffer->asStr()) : nullptr;
+
+  joined = true;
+  return buffer->asStr();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Section::write(io::IO* io) const
+{
+  forEachPiece(pieces, false, [io](String piece) { io->write(piece); });
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 Metaprogram::init(
@@ -141,11 +368,15 @@ b8 Metaprogram::init(
   this->prev = prev;
   current_section = nullptr;
   if (!buffers.init()) return false;
+  if (!section_text.init()) return false;
+  if (!section_pieces.init()) return false;
   if (!sections.init()) return false;
   if (!scope_stack.init()) return false;
   if (!expansions.init()) return false;
   if (!captures.init()) return false;
   if (!meta.init("meta"_str)) return false;
+  if (!line_map.init()) return false;
+  line_map_generated = false;
   return true;
 }
 
@@ -163,8 +394,11 @@ void Metaprogram::deinit()
   for (auto& buffer : buffers)
     buffer.close();
   buffers.deinit();
+  section_text.deinit();
+  section_pieces.deinit();
   parser.deinit();
   captures.destroy();
+  line_map.destroy();
   meta.deinit();
   *this = {};
 }
@@ -238,7 +472,13 @@ void Metaprogram::addDocumentSection(u64 start, String raw)
 {
   auto node = getCurrentScope()->sections.pushTail();
   node->data = sections.pushTail()->data;
-  node->data->initDocument(start, raw, node, buffers.push()->data);
+  node->data->initDocument(
+    start, 
+    raw, 
+    node, 
+    buffers.push()->data, 
+    &section_pieces,
+    &section_text);
 }
 
 /* ----------------------------------------------------------------------------
@@ -434,7 +674,7 @@ void Metaprogram::emitError(s32 errinfo_idx, Scope* scope)
       lua.gettable(I.macro_names);
 
       u64 start_offset = 
-        parser.lexer.tokens[scope->macro_invocation->token_idx].loc;
+        parser.tokens[scope->macro_invocation->token_idx].loc;
 
       Source::Loc loc = input->getLoc(start_offset);
 
@@ -506,10 +746,14 @@ b8 Metaprogram::run()
   }
   I.errhandler = lua.gettop();
 
+  Profiler* profiler = lpp->profiler;
+
   // ~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~ Phase 1
   
   DEBUG("phase 1\n");
 
+  TimePoint phase_start = TimePoint::monotonic();
+
   // Parse into the lua 'metacode' that we run in Phase 2 to form the sections 
   // processed by Phase 3.
 
@@ -521,33 +765,68 @@ b8 Metaprogram::run()
     return false;
   defer { parser.deinit(); };
 
-  if (setjmp(parser.err_handler))
-    return false;
-
-  if (!parser.run())
-    return false;
+  // If the bytecode of this input's metacode is cached we skip parsing it 
+  // and loading the metacode into lua entirely. Anything that wants to see
+  // the metacode or the lexer's diagnostics needs the input parsed, 
+  // however.
+  b8 use_bytecode_cache = 
+       notnil(lpp->bytecode_cache_dir)
+    && lpp->streams.meta.io == nullptr
+    && lpp->consumers.meta == nullptr
+    && lpp->consumers.lex_diag_consumer == nullptr
+    && profiler == nullptr;
+
+  u64 bytecode_cache_key = 0;
+  b8 loaded_from_cache = false;
+  if (use_bytecode_cache)
+  {
+    if (!getBytecodeCacheKey(input, instream, &bytecode_cache_key))
+      return false;
 
-  meta.cacheLineOffsets();
+    loaded_from_cache = 
+      loadCachedBytecode(this, lpp->bytecode_cache_dir, bytecode_cache_key);
+  }
 
-  for (auto& exp : parser.locmap)
+  if (loaded_from_cache)
   {
-    DEBUG(exp.from, " -> ", exp.to, "\n");
+    DEBUG("loaded metaprogram from the bytecode cache\n");
   }
-
-  // NOTE(sushi) we only want to output the main lpp file's metafile
-  if (lpp->streams.meta.io)
+  else
   {
-    io::formatv(lpp->streams.meta.io, "\n\n-- * ", input->name, "\n\n\n");
-    io::format(lpp->streams.meta.io, meta.cache.asStr());
+    if (setjmp(parser.err_handler))
+      return false;
+
+    if (!parser.run())
+      return false;
+
+    meta.cacheWritten();
+    meta.cacheLineOffsets();
+
+    for (auto& exp : parser.locmap)
+    {
+      DEBUG(exp.from, " -> ", exp.to, "\n");
+    }
+
+    // NOTE(sushi) we only want to output the main lpp file's metafile
+    if (lpp->streams.meta.io)
+    {
+      io::formatv(lpp->streams.meta.io, "\n\n-- * ", input->name, "\n\n\n");
+      io::format(lpp->streams.meta.io, meta.content);
+    }
+
+    if (lpp->consumers.meta)
+      lpp->consumers.meta->consumeMetafile(*this, meta.content);
   }
 
-  if (lpp->consumers.meta)
-    lpp->consumers.meta->consumeMetafile(*this, meta.cache.asStr());
+  if (profiler)
+    profiler->recordPhase(input, "parse"_str, phase_start);
 
   // ~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~ Phase 2
   
   DEBUG("phase 2\n");
 
+  phase_start = TimePoint::monotonic();
+
   // Execute the lua metacode to form the sections we process in the following 
   // phase.
 
@@ -555,27 +834,35 @@ b8 Metaprogram::run()
   pushScope();
   defer { popScope(); };
 
-  TRACE("loading parsed program\n");
-  if (!lua.loadbuffer(meta.cache.asStr(), (char*)input->name.ptr))
+  // The metaprogram is already on the stack when loaded from the cache.
+  if (!loaded_from_cache)
   {
-    auto te = translateLuaError(*this, lua.tostring());
-    if (lpp->consumers.meta)
+    TRACE("loading parsed program\n");
+    if (!lua.loadbuffer(meta.content, (char*)input->name.ptr))
     {
-      MetaprogramDiagnostic diag;
-      diag.source = input;
-      diag.loc = te.line;
-      diag.message = te.error;
-      lpp->consumers.meta->consumeDiag(*this, diag);
-    }
-    else
-    {
-      ERROR(
-          "failed to load metaprogram into lua\n",
-          te.filename, ":", te.line, ": ", te.error, "\n");
+      auto te = translateLuaError(*this, lua.tostring());
+      if (lpp->consumers.meta)
+      {
+        MetaprogramDiagnostic diag;
+        diag.source = input;
+        diag.loc = te.line;
+        diag.message = te.error;
+        lpp->consumers.meta->consumeDiag(*this, diag);
+      }
+      else
+      {
+        ERROR(
+            "failed to load metaprogram into lua\n",
+            te.filename, ":", te.line, ": ", te.error, "\n");
+      }
+
+      return false;
     }
 
-    return false;
+    if (use_bytecode_cache)
+      storeCachedBytecode(this, lpp->bytecode_cache_dir, bytecode_cache_key);
   }
+
   I.metaprogram = lua.gettop();
 
   // Get the lpp module and set the proper metaprogram context. 
@@ -700,8 +987,17 @@ b8 Metaprogram::run()
   }
 
   TRACE("executing metaprogram\n");
+
+  if (profiler)
+    profiler->beginLuaBlocks(this);
+
   lua.pushvalue(I.metaprogram);
-  if (!lua.pcall(0,0,I.errhandler))
+  b8 executed = lua.pcall(0,0,I.errhandler);
+
+  if (profiler)
+    profiler->endLuaBlocks();
+
+  if (!executed)
   {
     const s32 I_errinfo = lua.gettop();
 
@@ -719,10 +1015,15 @@ b8 Metaprogram::run()
     return false;
   }
 
+  if (profiler)
+    profiler->recordPhase(input, "execute"_str, phase_start);
+
   // ~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~ Phase 3
   
   DEBUG("phase 3\n");
 
+  phase_start = TimePoint::monotonic();
+
   // Process each section generated by Phase 2, joining each Document section 
   // into a single buffer and performing macro expansions.
   
@@ -773,6 +1074,9 @@ b8 Metaprogram::run()
 
   output->cacheLineOffsets();
 
+  if (profiler)
+    profiler->recordPhase(input, "expand"_str, phase_start);
+
   for (auto& expansion : expansions)
   {
     printExpansion(input, output, expansion);
@@ -831,8 +1135,7 @@ b8 Metaprogram::processScopeSections(Scope* scope)
           captures.pop();
         }
 
-        if (section->kind == DocumentSpan || 
-            !section->buffer->asStr().isEmpty())
+        if (section->kind == DocumentSpan || section->len != 0)
         {
           lua.pushvalue(I.lpp_runDocumentSectionCallbacks);
 
@@ -841,11 +1144,11 @@ b8 Metaprogram::processScopeSections(Scope* scope)
 
           if (section->kind == Document)
           {
-            scope->writeBuffer(section->buffer->asStr());
+            section->write(scope->buffer);
           }
           else
           {
-            auto token = parser.lexer.tokens[section->token_idx];
+            auto token = parser.tokens[section->token_idx];
             TRACE(input->getStr(token.loc, token.len), "\n");
             scope->writeBuffer(input->getStr(token.loc, token.len));
           }
@@ -867,6 +1170,8 @@ b8 Metaprogram::processScopeSections(Scope* scope)
           return false;
         defer { popScope(); };
 
+        TimePoint invoke_start = TimePoint::monotonic();
+
         // Get the macro and execute it.
         TRACE("invoking macro\n");
         lua.pushinteger(section->macro_idx);
@@ -896,10 +1201,24 @@ b8 Metaprogram::processScopeSections(Scope* scope)
         // Append the result of the scope.
         scope->writeBuffer(macro_scope->buffer->asStr());
 
+        u64 result_len = 0;
         if (!lua.isnil())
-          scope->writeBuffer(lua.tostring());
+        {
+          String result = lua.tostring();
+          scope->writeBuffer(result);
+          result_len = result.len;
+        }
 
         lua.pop();
+
+        if (lpp->profiler)
+        {
+          lpp->profiler->recordMacro(
+            this,
+            section->token_idx,
+            invoke_start,
+            macro_scope->buffer->len + result_len);
+        }
       }
       break;
 
@@ -918,7 +1237,7 @@ b8 Metaprogram::processScopeSections(Scope* scope)
     if (emit_section)
     {
       pushExpansion(
-          parser.lexer.tokens[section->token_idx].loc,
+          parser.tokens[section->token_idx].loc,
           expansion_start);
 
       if (lpp->consumers.meta)
@@ -960,11 +1279,20 @@ String Metaprogram::consumeCurrentScope()
  */
 s32 Metaprogram::mapMetaprogramLineToInputLine(s32 line)
 {
-  auto line_map = InputLineMap::create();
-  defer { line_map.destroy(); };
-  generateInputLineMap(&line_map);
-    
-  for (auto& mapping : line_map)
+  // When loaded from the BytecodeCache the parser never ran, so the map it
+  // stored is all we have.
+  InputLineMap generated = nil;
+  defer { generated.destroy(); };
+
+  InputLineMap* map = &line_map;
+  if (!line_map_generated)
+  {
+    generated = InputLineMap::create();
+    generateInputLineMap(&generated);
+    map = &generated;
+  }
+
+  for (auto& mapping : *map)
   {
     if (line <= mapping.metaprogram)
       return mapping.input;
@@ -986,6 +1314,9 @@ void Metaprogram::generateInputLineMap(InputLineMap* out_map)
         .input = s32(from.line)
       });
   }
+  if (out_map->isEmpty())
+    return;
+
   // push a eof line
   out_map->push(
       { 
@@ -1010,7 +1341,7 @@ void Metaprogram::pushExpansion(u64 from, u64 to)
       if (scope->macro_invocation)
       {
         exp->invoking_macros.push(
-            parser.lexer.tokens[scope->macro_invocation->token_idx].loc);
+            parser.tokens[scope->macro_invocation->token_idx].loc);
       }
     }
   }
@@ -1088,7 +1419,7 @@ void metaprogramAddDocumentSpanSection(Metaprogram* mp, u64 start)
 LPP_LUAJIT_FFI_FUNC
 String metaprogramGetOutputSoFar(Metaprogram* mp)
 {
-  return mp->output->cache.asStr();
+  return mp->output->content;
 }
 
 /* ----------------------------------------------------------------------------
@@ -1121,7 +1452,7 @@ LineAndColumn metaprogramMapInputOffsetToLineAndColumn(
     u64 offset)
 {
   assert(mp);
-  assert(offset < mp->input->cache.len);
+  assert(offset < mp->input->content.len);
   LineAndColumn lac;
   Source::Loc loc = mp->input->getLoc(offset);
   lac.line = loc.line;
@@ -1214,7 +1545,7 @@ SectionNode* metaprogramGetCurrentSection(Metaprogram* mp)
 LPP_LUAJIT_FFI_FUNC
 String sectionGetString(SectionNode* section)
 {
-  return section->data->buffer->asStr();
+  return section->data->getString();
 }
 
 /* ----------------------------------------------------------------------------
@@ -1262,7 +1593,7 @@ LPP_LUAJIT_FFI_FUNC
 b8 sectionAppendString(SectionNode* section, String s)
 {
   assert(sectionIsDocument(section));
-  return section->data->insertString(section->data->buffer->len, s);
+  return section->data->insertString(section->data->len, s);
 }
 
 /* ----------------------------------------------------------------------------
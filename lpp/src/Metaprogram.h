@@ -11,6 +11,7 @@
 #include "iro/containers/LinkedPool.h"
 #include "iro/containers/List.h"
 #include "iro/fs/Path.h"
+#include "iro/memory/Bump.h"
 
 #include "Source.h"
 #include "Parser.h"
@@ -30,6 +31,29 @@ struct Metaprogram;
 
 typedef SLinkedPool<io::Memory> BufferPool;
 
+/* ============================================================================
+ *  A piece of immutable text in a Document section. A section's pieces form
+ *  a treap ordered by where they are in the section, with each piece
+ *  tracking the length of the text under it, so that finding the piece an
+ *  offset lands in, and so inserting there, takes O(log n) in the number of
+ *  pieces.
+ */
+struct SectionPiece
+{
+  String text;
+
+  // The length of this piece's text plus that of every piece under it.
+  u64 subtree_len;
+
+  // Pieces are kept above those with a lower priority, which are picked
+  // at random to keep the tree balanced.
+  u64 priority;
+
+  SectionPiece* left;
+  SectionPiece* right;
+};
+typedef Pool<SectionPiece> SectionPiecePool;
+
 /* ============================================================================
  */
 typedef DLinkedPool<Section> SectionPool;
@@ -53,7 +77,22 @@ struct Section
   // section came from is attainable from the kind of Token that started it.
   u64 token_idx = -1;
 
+  // The text of a Document section, kept as a tree of pieces of immutable
+  // text allocated from 'text_allocator', so that inserting into or 
+  // consuming from the section only ever splits or drops pieces rather 
+  // than moving the text already there. The pieces are only joined when 
+  // something needs the section as a single string.
+  SectionPiece*     pieces = nullptr;
+  SectionPiecePool* piece_pool = nullptr;
+  u64               piece_seed = 0;
+  u64               len = 0;
+  mem::Allocator*   text_allocator = nullptr;
+
+  // The pieces joined together by getString(), valid while 'joined' is set.
+  // The joined text then becomes the section's only piece, so later joins
+  // rearrange it in place rather than copying it again.
   io::Memory* buffer = nullptr;
+  b8          joined = false;
 
   SectionNode* node = nullptr;
 
@@ -63,7 +102,9 @@ struct Section
       u64 token_idx,
       String raw, 
       SectionNode* node,
-      io::Memory* buffer);
+      io::Memory* buffer,
+      SectionPiecePool* piece_pool,
+      mem::Allocator* text_allocator);
 
   b8 initDocumentSpan(
     u64 token_idx,
@@ -82,6 +123,26 @@ struct Section
 
   b8 insertString(u64 start, String s);
   b8 consumeFromBeginning(u64 len);
+
+  // Returns the text of a Document section as a single string, which is
+  // valid until the section is next modified.
+  String getString();
+
+  // Writes the text of a Document section to 'io'.
+  void write(io::IO* io) const;
+
+private:
+
+  SectionPiece* newPiece(String text);
+  void freePieces(SectionPiece* piece);
+
+  // Splits the tree under 'piece' into the pieces before 'offset' and those
+  // after, splitting the piece 'offset' lands in the middle of.
+  void splitPieces(
+      SectionPiece*  piece,
+      u64            offset,
+      SectionPiece** out_before,
+      SectionPiece** out_after);
 };
 
 }
@@ -201,6 +262,10 @@ struct Metaprogram
 
   BufferPool buffers;
 
+  // Backs the text of Document sections. See Section::pieces.
+  mem::LenientBump section_text;
+  SectionPiecePool section_pieces;
+
   SectionPool   sections;
   ExpansionList expansions;
 
@@ -228,10 +293,15 @@ struct Metaprogram
   // This lets us display the proper location of an error
   // in the input file when something goes wrong in lua.
   // 
-  // This is only generated when needed through generateInputLineMap.
+  // This is only generated when needed through generateInputLineMap, 
+  // unless the metaprogram was loaded from the BytecodeCache, which stores
+  // it.
   struct InputLineMapping { s32 metaprogram; s32 input; };
   typedef Array<InputLineMapping> InputLineMap;
 
+  InputLineMap line_map;
+  b8 line_map_generated;
+
   b8 init(
     Lpp*         lpp, 
     io::IO*      instream, 
@@ -20,7 +20,7 @@ b8 Parser::init(
     io::IO* outstream,
     LexerConsumer* lex_diag_consumer)
 {
-  assert(instream && outstream);
+  assert((instream || src->complete) && outstream);
 
   TRACE("initializing on stream '", src->name, "'\n");
 
@@ -32,19 +32,12 @@ b8 Parser::init(
   if (!lexer.init(in, src, lex_diag_consumer))
     return false;
 
-  if (setjmp(lexer.err_handler))
-  {
-    lexer.deinit();
-    locmap.destroy();
-    return false;
-  }
+  tokens = Array<Token>::create();
 
-  if (!lexer.run())
-    return false;
-
-  curt = lexer.tokens.arr-1;
+  curt = nullptr;
+  curt_idx = -1;
+  last_kept_idx = -1;
 
-  src->cacheLineOffsets();
   return true;
 }
 
@@ -53,6 +46,7 @@ b8 Parser::init(
 void Parser::deinit()
 {
   locmap.destroy();
+  tokens.destroy();
   lexer.deinit();
   *this = {};
 }
@@ -90,6 +84,10 @@ b8 Parser::run()
 {
   TRACE("begin\n");
 
+  // Tokens are lexed as we go, so lexer errors come back to us.
+  if (setjmp(lexer.err_handler))
+    return false;
+
   nextToken();
 
   writeOut(
@@ -115,11 +113,11 @@ b8 Parser::run()
         return false;
 
       case Whitespace:
-        TRACE("placing whitespace(", curtIdx(), "): ", 
+        TRACE("placing whitespace(", curt_idx, "): ", 
             io::SanitizeControlCharacters(getRaw()), "\n");
 
         writeOut(
-          "__metaenv_docspan("_str, curtIdx(), ")\n");
+          "__metaenv_docspan("_str, keepCurt(), ")\n");
         nextToken();
         break;
 
@@ -127,7 +125,7 @@ b8 Parser::run()
         TRACE("placing document text: '", 
               io::SanitizeControlCharacters(getRaw()), "'\n");
 
-        writeOut("__metaenv_docspan("_str, curtIdx(), ")\n");
+        writeOut("__metaenv_docspan("_str, keepCurt(), ")\n");
         nextToken();
         break;
 
@@ -158,7 +156,7 @@ b8 Parser::run()
       case LuaInline:
         TRACE("placing lua inline: '", 
               io::SanitizeControlCharacters(getRaw()), "'\n");
-        writeOut("__metaenv_val("_str, curtIdx(), ',');
+        writeOut("__metaenv_val("_str, keepCurt(), ',');
         pushLocMap();
         writeOut(getRaw(), ")\n"_str);
         nextToken();
@@ -173,19 +171,22 @@ b8 Parser::run()
 
           if (is_immediate)
           {
-            writeOut("__metaenv_doc("_str, curtIdx(),
-              ",__metaenv_macro_immediate("_str, curtIdx(), ",");
+            u64 idx = keepCurt();
+            writeOut("__metaenv_doc("_str, idx,
+              ",__metaenv_macro_immediate("_str, idx, ",");
 
             nextSignificantToken(); // identifier
+            keepCurt();
             writeOut('"', getRaw(), "\", ");
           }
           else
           {
             writeOut("__metaenv_macro("_str);
-            writeOut(curtIdx(), ',');
+            writeOut(keepCurt(), ',');
 
             TRACE("getting id\n");
             nextSignificantToken(); // identifier
+            keepCurt();
             TRACE("got id\n");
 
             writeOut('"', getRaw(), "\",");
@@ -210,7 +211,7 @@ b8 Parser::run()
 
           TRACE("wrote method\n");
 
-          auto* rollback = curt;
+          u64 rollback = curt_idx;
           nextSignificantToken();
           if (at(MacroTupleArg))
           {
@@ -256,11 +257,11 @@ b8 Parser::run()
               pushLocMap();
               writeTokenSanitized();
               writeOut('"', ')');
-              auto* rollback = curt;
+              u64 rollback = curt_idx;
               nextSignificantToken();
               if (not at(MacroTupleArg))
               {
-                curt = rollback;
+                rollbackTo(rollback);
                 nextToken();
                 break;
               }
@@ -288,7 +289,7 @@ b8 Parser::run()
             // space, causing whatever line is following the macro to be 
             // merged with whatever the macro outputs. This breaks when 
             // the macro outputs a line comment in C.
-            curt = rollback;
+            rollbackTo(rollback);
             nextToken();
           }
 
@@ -300,6 +301,8 @@ b8 Parser::run()
     }
   }
 
+  source->cacheLineOffsets();
+
   return true;
 }
 
@@ -321,11 +324,49 @@ void Parser::pushLocMap(s32 from_offset, s32 to_offset)
  */
 b8 Parser::nextToken()
 {
-  curt += 1;
+  // The most tokens we ever need to look back on is when rolling back over
+  // whitespace skipped while looking for macro arguments.
+  constexpr u64 keep_behind = 8;
+
+  curt_idx += 1;
+
+  while (curt_idx >= lexer.tokens.tail)
+  {
+    if (!lexer.lexNext())
+    {
+      assert(!"parser tried to read past eof");
+      return false;
+    }
+  }
+
+  if (curt_idx > keep_behind)
+    lexer.tokens.release(curt_idx - keep_behind);
+
+  curt = &lexer.tokens[curt_idx];
   TRACE("found ", *curt, "\n");
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+void Parser::rollbackTo(u64 idx)
+{
+  curt_idx = idx;
+  curt = &lexer.tokens[curt_idx];
+}
+
+/* ----------------------------------------------------------------------------
+ */
+u64 Parser::keepCurt()
+{
+  if (curt_idx != last_kept_idx)
+  {
+    tokens.push(*curt);
+    last_kept_idx = curt_idx;
+  }
+  return tokens.len() - 1;
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 Parser::nextSignificantToken()
@@ -20,7 +20,19 @@ struct Parser
 {
   Lexer lexer;
 
+  // The current token and its index in the lexer's token stream. 'curt' 
+  // points into the lexer's TokenRing and so is refreshed whenever we 
+  // move to another token.
   Token* curt;
+  u64 curt_idx;
+
+  // Tokens referenced by the generated metacode, eg. those passed to 
+  // __metaenv.docspan, which are what Sections refer to by index. Every 
+  // other token is dropped once the parser is done with it.
+  //
+  // When a macro symbol is kept, the token naming the macro is kept right
+  // after it.
+  Array<Token> tokens;
 
   Source* source;
 
@@ -39,6 +51,10 @@ struct Parser
   Array<LocMapping> locmap;
   s32 bytes_written = 0; // tracked solely for the locmap
 
+  // Index in the token stream of the last token kept, so that it is not 
+  // kept twice.
+  u64 last_kept_idx;
+
   jmp_buf err_handler;
 
   b8 init(
@@ -58,11 +74,16 @@ struct Parser
   b8 nextToken();
   b8 nextSignificantToken();
 
+  // Moves back to a token we've already seen. This must be within the last 
+  // few tokens, as those are the only ones we keep around.
+  void rollbackTo(u64 idx);
+
   b8 at(Token::Kind kind);
 
   String getRaw();
 
-  u64 curtIdx() const { return curt - lexer.tokens.arr; }
+  // Keeps the current token in 'tokens' and returns its index there.
+  u64 keepCurt();
 
   void writeTokenSanitized();
 
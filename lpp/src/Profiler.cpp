@@ -0,0 +1,480 @@
+#include "Profiler.h"
+#include "Metaprogram.h"
+#include "Source.h"
+
+#include "iro/Logger.h"
+#include "iro/containers/SmallArray.h"
+
+#include "luajit/lua.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+namespace lpp
+{
+
+static Logger logger =
+  Logger::create("lpp.profiler"_str, Logger::Verbosity::Notice);
+
+// The profiler whose line hook is installed in lua states on this thread.
+// Lua hooks only receive the lua_State, and each thread running lpp (see
+// Batch) has its own.
+static thread_local Profiler* hooked_profiler = nullptr;
+
+/* ----------------------------------------------------------------------------
+ */
+static String getKindName(Profiler::Kind kind)
+{
+  switch (kind)
+  {
+  case Profiler::Kind::Phase:    return "phase"_str;
+  case Profiler::Kind::Macro:    return "macro"_str;
+  case Profiler::Kind::LuaBlock: return "lua"_str;
+  case Profiler::Kind::Import:   return "import"_str;
+  }
+  return "unknown"_str;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static s64 nsSince(TimePoint from, TimePoint to)
+{
+  return (to - from).ns;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Profiler::init()
+{
+  if (!site_pool.init())
+    return false;
+  if (!site_map.init())
+    return false;
+  sites = Array<Site*>::create();
+  events = Array<Event>::create();
+  frames = Array<Frame>::create();
+  start = TimePoint::monotonic();
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::deinit()
+{
+  if (hooked_profiler == this)
+    hooked_profiler = nullptr;
+
+  for (Site* site : sites)
+  {
+    mem::stl_allocator.free(site->name.ptr);
+    mem::stl_allocator.free(site->location.ptr);
+  }
+
+  for (Frame& frame : frames)
+    frame.blocks.destroy();
+
+  frames.destroy();
+  events.destroy();
+  sites.destroy();
+  site_map.deinit();
+  site_pool.deinit();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void lineHook(lua_State* L, lua_Debug* ar)
+{
+  Profiler* profiler = hooked_profiler;
+  if (profiler == nullptr || profiler->frames.isEmpty())
+    return;
+
+  Profiler::Frame* frame = profiler->frames.last();
+
+  if (!lua_getinfo(L, "S", ar))
+    return;
+
+  // Lines run outside of the metacode, eg. in some module it called into,
+  // are attributed to whatever block called them.
+  String chunkname = frame->chunkname;
+  if (ar->source == nullptr ||
+      0 != strncmp(ar->source, (char*)chunkname.ptr, chunkname.len) ||
+      ar->source[chunkname.len] != 0)
+    return;
+
+  Profiler::Site* block = frame->findBlock(ar->currentline);
+  if (block != frame->current)
+    profiler->switchBlock(frame, block);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::attach(LuaState& lua)
+{
+  hooked_profiler = this;
+  lua_sethook(lua.L, lineHook, LUA_MASKLINE, 0);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+Profiler::Site* Profiler::getSite(Kind kind, String name, String location)
+{
+  u64 hash = name.hash();
+  hash = (hash ^ location.hash()) * 1099511628211;
+  hash = (hash ^ (u64)kind) * 1099511628211;
+
+  if (Site* site = site_map.find(hash))
+    return site;
+
+  Site* site = site_pool.add();
+  site->hash = hash;
+  site->kind = kind;
+  site->name = name.allocateCopy();
+  site->location = location.allocateCopy();
+  site->count = 0;
+  site->total_ns = 0;
+  site->bytes = 0;
+
+  site_map.insert(site);
+  sites.push(site);
+  return site;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::record(Site* site, TimePoint event_start, u64 bytes)
+{
+  TimePoint now = TimePoint::monotonic();
+
+  Event event;
+  event.site = site;
+  event.start_ns = nsSince(start, event_start);
+  event.duration_ns = nsSince(event_start, now);
+  events.push(event);
+
+  site->count += 1;
+  site->total_ns += event.duration_ns;
+  site->bytes += bytes;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::recordPhase(Source* input, String phase, TimePoint phase_start)
+{
+  record(getSite(Kind::Phase, phase, input->name), phase_start);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::recordMacro(
+    Metaprogram* mp,
+    u64 token_idx,
+    TimePoint invoke_start,
+    u64 bytes)
+{
+  // The macro's identifier is always kept right after its symbol.
+  Token& symbol = mp->parser.tokens[token_idx];
+  Token& identifier = mp->parser.tokens[token_idx + 1];
+
+  Source::Loc loc = mp->input->getLoc(symbol.loc);
+
+  io::SmallBuffer<256> location;
+  io::formatv(&location, mp->input->name, ':', loc.line, ':', loc.column);
+
+  Site* site =
+    getSite(
+      Kind::Macro,
+      identifier.getRaw(mp->input),
+      location.asStr());
+
+  record(site, invoke_start, bytes);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+Profiler::Site* Profiler::Frame::findBlock(s32 line)
+{
+  s32 l = 0;
+  s32 r = s32(blocks.len()) - 1;
+  while (l <= r)
+  {
+    s32 m = l + (r - l) / 2;
+    BlockRange& range = blocks[m];
+    if (line < range.first_line)
+      r = m - 1;
+    else if (line > range.last_line)
+      l = m + 1;
+    else
+      return range.site;
+  }
+  return nullptr;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::beginLuaBlocks(Metaprogram* mp)
+{
+  Frame* frame = frames.push();
+  frame->chunkname = mp->input->name;
+  frame->blocks = Array<BlockRange>::create();
+  frame->current = nullptr;
+  frame->segment_start = TimePoint::monotonic();
+
+  // Lua blocks are mapped line by line, each mapping using the same token,
+  // so the range of a block spans from its first mapping to its last. 
+  // Mappings are in the order they were written to the metacode, so the 
+  // ranges come out sorted.
+  for (Parser::LocMapping& mapping : mp->parser.locmap)
+  {
+    using enum Token::Kind;
+
+    Token& token = mapping.token;
+    if (token.kind != LuaBlock &&
+        token.kind != LuaLine &&
+        token.kind != LuaInline)
+      continue;
+
+    s32 line = mp->meta.getLoc(mapping.to).line;
+
+    if (!frame->blocks.isEmpty() && frame->blocks.last()->loc == token.loc)
+    {
+      frame->blocks.last()->last_line = line;
+      continue;
+    }
+
+    String name;
+    switch (token.kind)
+    {
+    case LuaBlock:  name = "$$$ block"_str; break;
+    case LuaLine:   name = "$ line"_str; break;
+    default:        name = "$() inline"_str; break;
+    }
+
+    Source::Loc loc = mp->input->getLoc(token.loc);
+
+    io::SmallBuffer<256> location;
+    io::formatv(&location, mp->input->name, ':', loc.line, ':', loc.column);
+
+    BlockRange* range = frame->blocks.push();
+    range->first_line = line;
+    range->last_line = line;
+    range->loc = token.loc;
+    range->site = getSite(Kind::LuaBlock, name, location.asStr());
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::endLuaBlocks()
+{
+  assert(!frames.isEmpty());
+
+  Frame* frame = frames.last();
+  switchBlock(frame, nullptr);
+  frame->blocks.destroy();
+  frames.pop();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::switchBlock(Frame* frame, Site* block)
+{
+  if (frame->current)
+    record(frame->current, frame->segment_start);
+
+  frame->current = block;
+  frame->segment_start = TimePoint::monotonic();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+TimePoint Profiler::beginImport()
+{
+  // Stop attributing time to the block that started the import. The next
+  // line the block runs after the import finishes starts a new segment.
+  if (!frames.isEmpty())
+    switchBlock(frames.last(), nullptr);
+
+  return TimePoint::monotonic();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::endImport(String path, TimePoint import_start, u64 bytes)
+{
+  record(getSite(Kind::Import, "processFile"_str, path), import_start, bytes);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static int compareSitesByTotal(const void* lhs, const void* rhs)
+{
+  auto* a = *(Profiler::Site**)lhs;
+  auto* b = *(Profiler::Site**)rhs;
+  if (a->total_ns > b->total_ns) return -1;
+  if (a->total_ns < b->total_ns) return 1;
+  return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void writeMilliseconds(io::IO* out, s64 ns)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%10.3fms", f64(ns) / 1000000.0);
+  io::format(out, (const char*)buf);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::writeSummary(io::IO* out)
+{
+  // Phases are summed over every file, as the interesting thing is how 
+  // much time went into each overall.
+  struct PhaseTotal { String name; s64 total_ns; u64 count; };
+  SmallArray<PhaseTotal, 4> phase_totals;
+
+  s64 import_ns = 0;
+  u64 import_count = 0;
+
+  for (Site* site : sites)
+  {
+    if (site->kind == Kind::Import)
+    {
+      import_ns += site->total_ns;
+      import_count += site->count;
+    }
+
+    if (site->kind != Kind::Phase)
+      continue;
+
+    PhaseTotal* total = nullptr;
+    for (PhaseTotal& phase : phase_totals)
+    {
+      if (phase.name == site->name)
+        total = &phase;
+    }
+
+    if (total == nullptr)
+    {
+      total = phase_totals.push();
+      total->name = site->name;
+      total->total_ns = 0;
+      total->count = 0;
+    }
+
+    total->total_ns += site->total_ns;
+    total->count += site->count;
+  }
+
+  io::format(out, 
+    "lpp profile (times include any nested imports)\n\n"
+    "phases:\n");
+  for (PhaseTotal& phase : phase_totals)
+  {
+    io::format(out, "  ");
+    writeMilliseconds(out, phase.total_ns);
+    io::formatv(out, "  ", phase.name, " (", phase.count, " files)\n");
+  }
+
+  io::format(out, "  ");
+  writeMilliseconds(out, import_ns);
+  io::formatv(out, "  imports (", import_count, " files)\n");
+
+  Array<Site*> sorted = Array<Site*>::create();
+  defer { sorted.destroy(); };
+
+  for (Site* site : sites)
+  {
+    if (site->kind != Kind::Phase)
+      sorted.push(site);
+  }
+
+  qsort(sorted.arr, sorted.len(), sizeof(Site*), compareSitesByTotal);
+
+  io::format(out, 
+    "\nsites by total time:\n"
+    "       total       average     count       bytes  kind    name\n");
+  for (Site* site : sorted)
+  {
+    char counts[64];
+    snprintf(counts, sizeof(counts), "  %8llu  %10llu  %-6s  ",
+      (unsigned long long)site->count,
+      (unsigned long long)site->bytes,
+      (char*)getKindName(site->kind).ptr);
+
+    io::format(out, "  ");
+    writeMilliseconds(out, site->total_ns);
+    io::format(out, "  ");
+    writeMilliseconds(out, site->total_ns / s64(site->count? site->count : 1));
+    io::format(out, (const char*)counts);
+    io::formatv(out, site->name, " at ", site->location, '\n');
+  }
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void writeJSONString(io::IO* out, String s)
+{
+  io::format(out, '"');
+  for (u64 i = 0; i < s.len; ++i)
+  {
+    u8 c = s.ptr[i];
+    if (c == '"' || c == '\\')
+    {
+      io::format(out, '\\');
+      io::format(out, (char)c);
+    }
+    else if (c < 0x20)
+    {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      io::format(out, (const char*)buf);
+    }
+    else
+    {
+      io::format(out, (char)c);
+    }
+  }
+  io::format(out, '"');
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static void writeMicroseconds(io::IO* out, s64 ns)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", f64(ns) / 1000.0);
+  io::format(out, (const char*)buf);
+}
+
+/* ----------------------------------------------------------------------------
+ */
+void Profiler::writeTrace(io::IO* out)
+{
+  io::format(out, "{\"traceEvents\":[\n");
+
+  b8 first = true;
+  for (Event& event : events)
+  {
+    if (!first)
+      io::format(out, ",\n");
+    first = false;
+
+    io::format(out, "{\"ph\":\"X\",\"pid\":1,\"tid\":1,\"name\":");
+    writeJSONString(out, event.site->name);
+    io::format(out, ",\"cat\":");
+    writeJSONString(out, getKindName(event.site->kind));
+    io::format(out, ",\"ts\":");
+    writeMicroseconds(out, event.start_ns);
+    io::format(out, ",\"dur\":");
+    writeMicroseconds(out, event.duration_ns);
+    io::format(out, ",\"args\":{\"location\":");
+    writeJSONString(out, event.site->location);
+    io::format(out, "}}");
+  }
+
+  io::format(out, "\n]}\n");
+}
+
+}
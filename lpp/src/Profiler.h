@@ -0,0 +1,165 @@
+/*
+ *  Records where lpp spends its time when given --profile.
+ *
+ *  Timed are the three phases of each Metaprogram, each macro invocation,
+ *  each lua block, line, and inline expression executed while running
+ *  metacode, and each file processed through lpp.processFile (eg. by
+ *  lpp.import). Events are grouped by the site they occurred at, eg. the
+ *  location of a macro invocation in its file, and written out as a text
+ *  summary sorted by total time along with a Chrome trace of every event
+ *  (viewable in chrome://tracing or perfetto).
+ *
+ *  Lua code is attributed to the block it appears in through a line hook,
+ *  so time spent in functions defined elsewhere is attributed to the block
+ *  that called them. Installing the hook prevents luajit from compiling
+ *  anything, so everything runs slower while profiling, though the time
+ *  spent in each place should remain proportional.
+ */
+
+#ifndef _lpp_Profiler_h
+#define _lpp_Profiler_h
+
+#include "iro/Common.h"
+#include "iro/Unicode.h"
+#include "iro/LuaState.h"
+#include "iro/io/IO.h"
+#include "iro/time/Time.h"
+#include "iro/containers/AVL.h"
+#include "iro/containers/Array.h"
+#include "iro/containers/Pool.h"
+
+using namespace iro;
+
+struct Source;
+
+namespace lpp
+{
+
+struct Metaprogram;
+
+/* ============================================================================
+ */
+struct Profiler
+{
+  enum class Kind
+  {
+    Phase,
+    Macro,
+    LuaBlock,
+    Import,
+  };
+
+  // The aggregate of every event recorded at some site.
+  struct Site
+  {
+    u64 hash;
+
+    Kind kind;
+
+    // What happened, eg. the name of a macro or phase.
+    String name;
+
+    // Where it happened, eg. 'file.lpp:12:4'.
+    String location;
+
+    u64 count;
+    s64 total_ns;
+
+    // Bytes of output produced, where that makes sense.
+    u64 bytes;
+  };
+
+  typedef AVL<Site, [](const Site* site) { return site->hash; }> SiteMap;
+
+  Pool<Site> site_pool;
+  SiteMap    site_map;
+
+  // Every site, in the order they were created.
+  Array<Site*> sites;
+
+  // A single occurrence of something at a site, kept for the trace.
+  struct Event
+  {
+    Site* site;
+
+    // Relative to 'start'.
+    s64 start_ns;
+    s64 duration_ns;
+  };
+
+  Array<Event> events;
+
+  TimePoint start;
+
+  // A metacode line range that belongs to some lua block.
+  struct BlockRange
+  {
+    s32 first_line;
+    s32 last_line;
+
+    // Offset of the block in the input.
+    s32 loc;
+
+    Site* site;
+  };
+
+  // The lua blocks of a metaprogram currently executing its metacode.
+  // Metaprograms started by lpp.processFile push their own on top.
+  struct Frame
+  {
+    String chunkname;
+    Array<BlockRange> blocks;
+
+    // The block whose code is currently running, if any.
+    Site* current;
+    TimePoint segment_start;
+
+    Site* findBlock(s32 line);
+  };
+
+  Array<Frame> frames;
+
+  b8   init();
+  void deinit();
+
+  // Installs the line hook used to time lua blocks in 'lua'.
+  void attach(LuaState& lua);
+
+  // Returns the site identified by the given kind, name, and location,
+  // creating it if it does not exist yet.
+  Site* getSite(Kind kind, String name, String location);
+
+  // Records an event at 'site' that started at 'event_start' and ends now.
+  void record(Site* site, TimePoint event_start, u64 bytes = 0);
+
+  // Records one of a metaprogram's phases.
+  void recordPhase(Source* input, String phase, TimePoint phase_start);
+
+  // Records an invocation of the macro at the given token of 'mp'.
+  void recordMacro(
+    Metaprogram* mp,
+    u64 token_idx,
+    TimePoint invoke_start,
+    u64 bytes);
+
+  // Begins and ends attributing the execution of 'mp's metacode to its
+  // lua blocks. 'mp' must have been parsed.
+  void beginLuaBlocks(Metaprogram* mp);
+  void endLuaBlocks();
+
+  // Called around processing a file through lpp.processFile so that its
+  // time is not attributed to the block that started it.
+  TimePoint beginImport();
+  void      endImport(String path, TimePoint import_start, u64 bytes);
+
+  void writeSummary(io::IO* out);
+  void writeTrace(io::IO* out);
+
+  // Ends the segment of 'frame' currently running and starts one in 'block'.
+  // Called by the line hook.
+  void switchBlock(Frame* frame, Site* block);
+};
+
+}
+
+#endif // _lpp_Profiler_h
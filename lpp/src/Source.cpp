@@ -3,6 +3,7 @@
 #include "Lpp.h"
 
 #include "iro/Unicode.h"
+#include "iro/Platform.h"
 
 /* ----------------------------------------------------------------------------
  */
@@ -10,16 +11,66 @@ b8 Source::init(String name)
 {
   if (!cache.open())
     return false;
+  content = cache.asStr();
+  mapped = false;
+  complete = false;
   line_offsets = Array<u64>::create();
   line_offsets_calculated = false;
   this->name = name;
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+b8 Source::initMapped(String name, String path)
+{
+  auto file = fs::File::from(path, fs::OpenFlag::Read);
+  if (isnil(file))
+    return false;
+  defer { file.close(); };
+
+  auto info = file.getInfo();
+  if (isnil(info))
+    return false;
+
+  if (!init(name))
+    return false;
+
+  // Empty files can't be mapped, but there's nothing to map anyways.
+  if (info.byte_size != 0)
+  {
+    void* ptr = platform::mapFile(file.handle, info.byte_size);
+    if (ptr == nullptr)
+    {
+      deinit();
+      return false;
+    }
+
+    content = {(u8*)ptr, info.byte_size};
+    mapped = true;
+  }
+
+  complete = true;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+b8 Source::initView(String name, String content)
+{
+  if (!init(name))
+    return false;
+  this->content = content;
+  complete = true;
+  return true;
+}
+
 /* ----------------------------------------------------------------------------
  */
 void Source::deinit()
 {
+  if (mapped)
+    platform::unmapFile(content.ptr, content.len);
   cache.close();
   line_offsets.destroy();
   *this = {};
@@ -29,11 +80,39 @@ void Source::deinit()
  */
 b8 Source::writeCache(Bytes slice)
 {
+  assert(!complete);
   line_offsets_calculated = false;
   cache.write(slice);
+  content = cache.asStr();
   return true;
 }
 
+/* ----------------------------------------------------------------------------
+ */
+void Source::cacheWritten()
+{
+  assert(!complete);
+  line_offsets_calculated = false;
+  content = cache.asStr();
+}
+
+/* ----------------------------------------------------------------------------
+ */
+s64 Source::readStream(io::IO* stream, u64 size)
+{
+  assert(!complete);
+
+  Bytes reserved = cache.reserve(size);
+  s64 bytes_read = stream->read(reserved);
+  if (bytes_read <= 0)
+    return bytes_read;
+
+  line_offsets_calculated = false;
+  cache.commit(bytes_read);
+  content = cache.asStr();
+  return bytes_read;
+}
+
 /* ----------------------------------------------------------------------------
  */
 b8 Source::cacheLineOffsets()
@@ -47,7 +126,7 @@ b8 Source::cacheLineOffsets()
 
   line_offsets.push(0);
 
-  String s = cache.asStr();
+  String s = content;
   for (s64 i = 0; i < s.len; i++)
   {
     if (s.ptr[i] == '\n')
@@ -62,7 +141,7 @@ b8 Source::cacheLineOffsets()
  */
 String Source::getStr(u64 loc, u64 len)
 {
-  return {cache.ptr + loc, len};
+  return {content.ptr + loc, len};
 }
 
 /* ----------------------------------------------------------------------------
@@ -76,7 +155,7 @@ String Source::getVirtualStr(u64 loc, u64 len)
  */
 Source::Loc Source::getLoc(u64 loc) const
 {
-  assert(loc < cache.len);
+  assert(loc < content.len);
 
   u64 l = 0, 
       m = 0, 
@@ -105,7 +184,12 @@ Source::Loc Source::getLoc(u64 loc) const
   {
     if (offset >= loc)
       break;
-    utf8::Codepoint c = utf8::decodeCharacter(cache.ptr + offset, 4);
+    // Don't read past the end of the content as it may be a mapping that 
+    // ends exactly on a page boundary.
+    utf8::Codepoint c = 
+      utf8::decodeCharacter(
+        content.ptr + offset, 
+        min<u64>(4, content.len - offset));
     if (isnil(c))
       break;
     offset += c.advance;
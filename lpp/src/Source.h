@@ -16,6 +16,7 @@
 #include "iro/Unicode.h"
 #include "iro/containers/Array.h"
 #include "iro/io/IO.h"
+#include "iro/fs/File.h"
 
 using namespace iro;
 
@@ -25,13 +26,22 @@ struct Source
 {
   String name;
 
-  // A cache of this source's content.
-  // TODO(sushi) figure out when we're given memory that we can just 
-  //             keep a view over.
-  //             or maybe later stuff should be designed to get 
-  //             content on demand so we dont store so much memory?
+  // This source's content. Depending on how the source was initialized 
+  // this is either a view of 'cache', a read-only mapping of a file, or 
+  // memory borrowed from whoever initialized us (eg. the content of a file
+  // in lppls' vfs), so that inputs we can get all at once are never copied.
+  String content;
+
+  // Backs 'content' when it is read from a stream or written to.
   io::Memory cache;
 
+  // Set when 'content' is a mapping of a file that we must unmap.
+  b8 mapped;
+
+  // Set when 'content' already holds all of this source, in which case 
+  // there is nothing to read from a stream.
+  b8 complete;
+
   // Text created by the lexer.
   io::Memory virtual_cache;
 
@@ -53,12 +63,28 @@ struct Source
 
 
   b8   init(String name);
+
+  // Initializes this source over the content of the file at 'path' by 
+  // mapping it into memory.
+  b8   initMapped(String name, String path);
+
+  // Initializes this source over 'content', which must outlive it.
+  b8   initView(String name, String content);
+
   void deinit();
 
   // Writes to the cache and handles some state such as if 
   // line offsets are calculated.
   b8 writeCache(Bytes slice);
 
+  // Updates 'content' after 'cache' was written to directly, eg. when it 
+  // was given to something as its output stream.
+  void cacheWritten();
+
+  // Reads up to 'size' more bytes of this source from 'stream' into the 
+  // cache. Returns the number of bytes read, or -1 on failure.
+  s64 readStream(io::IO* stream, u64 size);
+
   // Caches line offsets in the cached buffer.
   b8 cacheLineOffsets();
 
@@ -1,4 +1,6 @@
 #include "Driver.h"
+#include "JobServer.h"
+#include "Batch.h"
 
 #include "iro/Common.h"
 #include "iro/fs/FileSystem.h"
@@ -69,6 +71,70 @@ int main(int argc, const char** argv)
     return 0;
   }
 
+  SmallArray<String, 8> base_args;
+  if (driver.serve || notnil(driver.batch_path))
+  {
+    // Pass along everything but the args selecting how jobs are run to 
+    // each job.
+    for (String arg : args)
+    {
+      if (arg != "--serve"_str &&
+          !arg.startsWith("--batch="_str) &&
+          !arg.startsWith("--threads="_str) &&
+          arg != "--profile"_str &&
+          !arg.startsWith("--profile="_str))
+        base_args.push(arg);
+    }
+  }
+
+  if (notnil(driver.batch_path))
+  {
+    Batch batch;
+    if (!batch.init(
+          driver.batch_path, 
+          base_args.asSlice(), 
+          driver.batch_threads))
+      return 1;
+    defer { batch.deinit(); };
+
+    return batch.run()? 0 : 1;
+  }
+
+  if (driver.serve)
+  {
+    // Jobs may write to stdout themselves, eg. through lua's print or by
+    // printing help, which would desync the replies the client reads from
+    // it. So stdout is sent to stderr while serving and replies are written
+    // to what stdout was before.
+    io::IO* replies = &fs::stdout;
+    fs::File replies_file = nil;
+    fs::File::Handle replies_handle;
+    if (platform::redirectHandle(
+          fs::stdout.handle,
+          fs::stderr.handle,
+          &replies_handle))
+    {
+      replies_file = fs::File::fromFileDescriptor(
+        replies_handle,
+        "replies"_str,
+        fs::OpenFlag::Write);
+      replies = &replies_file;
+    }
+    else
+    {
+      WARN("failed to redirect stdout, output from jobs may be mixed into "
+           "replies\n");
+    }
+    defer { if (notnil(replies_file)) replies_file.close(); };
+
+    JobServer server;
+    if (!server.init(base_args.asSlice(), &fs::stdin, replies))
+      return 1;
+    defer { server.deinit(); };
+
+    return server.run()? 0 : 1;
+  }
+
   driver.streams.out.stream = 
     driver.streams.out.stream ?: &fs::stdout;
 
@@ -77,7 +143,11 @@ int main(int argc, const char** argv)
     return 1;
   defer { lpp.deinit(); };
 
-  if (!lpp.run())
+  b8 success = lpp.run();
+
+  driver.writeProfile();
+
+  if (!success)
   {
     driver.cleanupAfterFailure();
     return 1;
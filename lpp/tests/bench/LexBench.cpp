@@ -0,0 +1,143 @@
+/*
+ *  Microbenchmark of lpp's Lexer. 
+ *
+ *  Usage:
+ *    lpp-lexbench [glob] [iterations]
+ *
+ *  Every file matched by 'glob' (by default all lpp files in ecs, so this
+ *  should be run from the root of enosi) is read into memory up front and
+ *  then lexed 'iterations' times, so that only the time spent lexing is 
+ *  measured.
+ */
+
+#include "Lex.h"
+#include "Source.h"
+
+#include "iro/Common.h"
+#include "iro/Logger.h"
+#include "iro/fs/File.h"
+#include "iro/fs/Glob.h"
+#include "iro/io/IO.h"
+#include "iro/containers/Array.h"
+#include "iro/time/Time.h"
+
+#include "setjmp.h"
+#include "stdlib.h"
+
+using namespace iro;
+
+static Logger logger = 
+  Logger::create("lpp.lexbench"_str, Logger::Verbosity::Info);
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 lexFile(String name, String content, u64* out_token_count)
+{
+  Source source;
+  if (!source.initView(name, content))
+    return false;
+  defer { source.deinit(); };
+
+  lpp::Lexer lexer;
+  if (!lexer.init(nullptr, &source, nullptr))
+    return false;
+  defer { lexer.deinit(); };
+
+  if (setjmp(lexer.err_handler))
+    return false;
+
+  if (!lexer.run())
+    return false;
+
+  *out_token_count += lexer.tokens.tail;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+int main(int argc, const char** argv)
+{
+  iro::log.init();
+  defer { iro::log.deinit(); };
+
+  {
+    using enum Log::Dest::Flag;
+    Log::Dest::Flags flags = AllowColor | ShowVerbosity;
+    iro::log.newDestination("stdout"_str, &fs::stdout, flags);
+  }
+
+  String pattern = argc > 1? String::fromCStr(argv[1]) : "ecs/src/**/*.l*"_str;
+  s32 iterations = argc > 2? atoi(argv[2]) : 20;
+
+  io::Memory contents;
+  contents.open();
+  defer { contents.close(); };
+
+  struct Input { String name; u64 offset; u64 len; };
+  Array<Input> inputs = Array<Input>::create();
+  defer { inputs.destroy(); };
+
+  auto glob = fs::Globber::create(pattern);
+  glob.run([&](fs::Path& path)
+  {
+    if (!path.buffer.asStr().endsWith(".lpp"_str) &&
+        !path.buffer.asStr().endsWith(".lh"_str))
+      return true;
+
+    auto file = fs::File::from(path, fs::OpenFlag::Read);
+    if (isnil(file))
+      return true;
+    defer { file.close(); };
+
+    Input input;
+    input.name = path.buffer.asStr().allocateCopy();
+    input.offset = contents.len;
+    contents.consume(&file, 4096);
+    input.len = contents.len - input.offset;
+    inputs.push(input);
+    return true;
+  });
+  glob.destroy();
+
+  if (inputs.isEmpty())
+  {
+    ERROR("no lpp files matched '", pattern, "'\n");
+    return 1;
+  }
+
+  u64 token_count = 0;
+
+  TimePoint start = TimePoint::monotonic();
+
+  for (s32 i = 0; i < iterations; ++i)
+  {
+    for (Input& input : inputs)
+    {
+      String content = contents.asStr().sub(input.offset, 
+                                            input.offset + input.len);
+      if (!lexFile(input.name, content, &token_count))
+      {
+        ERROR("failed to lex ", input.name, "\n");
+        return 1;
+      }
+    }
+  }
+
+  TimeSpan elapsed = TimePoint::monotonic() - start;
+
+  u64 total_bytes = (u64)contents.len * iterations;
+  f64 seconds = elapsed.toSeconds();
+
+  INFO("lexed ", inputs.len(), " files (", contents.len, " bytes) ", 
+       iterations, " times\n");
+  INFO("  total:      ", WithUnits(elapsed), "\n");
+  INFO("  per pass:   ", WithUnits(TimeSpan::fromNanoseconds(elapsed.ns / iterations)), "\n");
+  INFO("  tokens:     ", token_count / iterations, " per pass\n");
+  INFO("  throughput: ", (total_bytes / seconds) / (1024.0 * 1024.0), 
+       " MiB/s\n");
+
+  for (Input& input : inputs)
+    mem::stl_allocator.free(input.name.ptr);
+
+  return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ *  Measures the time and peak memory use of lexing and parsing lpp files
+ *  into metacode.
+ *
+ *  Usage:
+ *    lpp-parsebench [glob]
+ *
+ *  Every file matched by 'glob' (by default all lpp files in ecs, so this
+ *  should be run from the root of enosi) is parsed one after the other.
+ *  Files are mapped the same way lpp maps imported files rather than read 
+ *  up front so that the peak RSS reported reflects what the Lexer and 
+ *  Parser hold onto.
+ *
+ *  The files in ecs are small enough that the peak RSS rarely rises above
+ *  what it is at startup, so to compare memory use pass a glob matching a
+ *  single large file (eg. every ecs file concatenated a few dozen times).
+ */
+
+#include "Parser.h"
+#include "Source.h"
+
+#include "iro/Common.h"
+#include "iro/Logger.h"
+#include "iro/fs/Glob.h"
+#include "iro/io/IO.h"
+#include "iro/time/Time.h"
+
+#include "setjmp.h"
+#include "sys/resource.h"
+
+using namespace iro;
+
+static Logger logger =
+  Logger::create("lpp.parsebench"_str, Logger::Verbosity::Info);
+
+/* ----------------------------------------------------------------------------
+ */
+static b8 parseFile(
+    fs::Path& path,
+    u64* out_tokens_lexed,
+    u64* out_tokens_kept,
+    u64* out_bytes)
+{
+  Source source;
+  if (!source.initMapped(path.buffer.asStr(), path.buffer.asStr()))
+    return false;
+  defer { source.deinit(); };
+
+  io::Memory metacode;
+  metacode.open();
+  defer { metacode.close(); };
+
+  lpp::Parser parser;
+  if (!parser.init(&source, nullptr, &metacode, nullptr))
+    return false;
+  defer { parser.deinit(); };
+
+  if (setjmp(parser.err_handler))
+    return false;
+
+  if (!parser.run())
+    return false;
+
+  *out_tokens_lexed += parser.lexer.tokens.tail;
+  *out_tokens_kept += parser.tokens.len();
+  *out_bytes += source.content.len;
+  return true;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+static u64 getPeakRSSKilobytes()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+    return 0;
+  return usage.ru_maxrss;
+}
+
+/* ----------------------------------------------------------------------------
+ */
+int main(int argc, const char** argv)
+{
+  iro::log.init();
+  defer { iro::log.deinit(); };
+
+  {
+    using enum Log::Dest::Flag;
+    Log::Dest::Flags flags = AllowColor | ShowVerbosity;
+    iro::log.newDestination("stdout"_str, &fs::stdout, flags);
+  }
+
+  String pattern = argc > 1? String::fromCStr(argv[1]) : "ecs/src/**/*.l*"_str;
+
+  u64 start_rss = getPeakRSSKilobytes();
+
+  u64 file_count = 0;
+  u64 tokens_lexed = 0;
+  u64 tokens_kept = 0;
+  u64 bytes = 0;
+  b8 failed = false;
+
+  TimePoint start = TimePoint::monotonic();
+
+  auto glob = fs::Globber::create(pattern);
+  glob.run([&](fs::Path& path)
+  {
+    if (!path.buffer.asStr().endsWith(".lpp"_str) &&
+        !path.buffer.asStr().endsWith(".lh"_str))
+      return true;
+
+    if (!parseFile(path, &tokens_lexed, &tokens_kept, &bytes))
+    {
+      ERROR("failed to parse ", path, "\n");
+      failed = true;
+      return false;
+    }
+
+    file_count += 1;
+    return true;
+  });
+  glob.destroy();
+
+  TimeSpan elapsed = TimePoint::monotonic() - start;
+
+  if (failed)
+    return 1;
+
+  if (file_count == 0)
+  {
+    ERROR("no lpp files matched '", pattern, "'\n");
+    return 1;
+  }
+
+  u64 peak_rss = getPeakRSSKilobytes();
+
+  INFO("parsed ", file_count, " files (", bytes, " bytes)\n");
+  INFO("  total:       ", WithUnits(elapsed), "\n");
+  INFO("  tokens:      ", tokens_lexed, " lexed, ", tokens_kept, " kept\n");
+  INFO("  peak rss:    ", peak_rss, " KiB (", start_rss, " KiB at start)\n");
+
+  return 0;
+}
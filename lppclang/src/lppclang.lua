@@ -198,6 +198,10 @@ typedef struct
 -- set to the lpp object when loaded
 local lpp = require "Lpp"
 
+-- We define ffi types and load clang, so stay loaded when lpp reuses its 
+-- lua state for many files.
+lpp.persistModule "lppclang"
+
 -- contains the shared library when loaded 
 local lppclang
 
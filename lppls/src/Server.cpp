@@ -430,13 +430,13 @@ b8 Server::processFile()
       const s32 I_source = 
         getOrCreateSourceTable(lua, I_result, *mp.input);
         
-      lpp::Token tok = mp.parser.lexer.tokens[section.token_idx];
+      lpp::Token tok = mp.parser.tokens[section.token_idx];
 
       switch (tok.kind)
       {
       case lpp::Token::Kind::MacroSymbol:
       case lpp::Token::Kind::MacroSymbolImmediate:
-        tok = mp.parser.lexer.tokens[section.token_idx + 1];
+        tok = mp.parser.tokens[section.token_idx + 1];
         break;
 
       default:
@@ -80,6 +80,43 @@ return
   -- Report files successfully built.
   report_success = true,
 
+  lpp =
+  {
+    -- Directory, relative to the root of enosi, that lpp caches the results
+    -- of lpp.import in so that they may be shared between translation units
+    -- and builds. Set to an empty string to disable the cache.
+    import_cache = "build/lpp-import-cache",
+
+    -- Directory, relative to the root of enosi, that lpp caches the 
+    -- compiled bytecode of metaprograms in so that unchanged files don't 
+    -- need to be parsed again. Set to an empty string to disable the cache.
+    bytecode_cache = "build/lpp-bytecode-cache",
+
+    -- Have lppclang find the headers included by lpp files when generating
+    -- their depfiles instead of lpp scanning for them itself. This is 
+    -- slower, as the whole translation unit gets preprocessed a second 
+    -- time, but exact.
+    clang_deps = false,
+
+    -- Have lpp write depfiles in a binary format that lake can load 
+    -- without parsing, rather than as a list of paths.
+    binary_deps = true,
+  },
+
+  -- Cache of the outputs of compiling C++ and lpp files, shared between 
+  -- builds so that objects aren't compiled again after switching branches
+  -- or cleaning the build directory.
+  obj_cache =
+  {
+    -- Directory, relative to the root of enosi, to keep the cache in. Set
+    -- to an empty string to disable the cache.
+    dir = "build/obj-cache",
+
+    -- Size in megabytes the cache may grow to before the least recently 
+    -- used entries are removed.
+    max_size_mb = 4096,
+  },
+
   -- Configuration intended to be applied to all projects.
   -- Note that any configuration specified in project specific
   -- tables will override any that appear here.